@@ -2,15 +2,35 @@
 
 layout (set = 0,binding = 0) uniform sampler2D inputTexture;
 
-
+layout (push_constant) uniform Composite {
+	// the scene only covers the top left of the texture when rendered at a lower resolution
+	vec2 uvScale;
+	float sharpness;
+} composite;
 
 layout (location = 0) in vec2 inUV;
 
 layout (location = 0) out vec4 outFragColor;
 
+vec4 sample_scene(vec2 uv, vec2 texel)
+{
+	// never filter in texels outside of what was rendered this frame
+	return texture(inputTexture, clamp(uv, 0.5 * texel, composite.uvScale - 0.5 * texel));
+}
 
 void main() 
 {
-	vec4 tex_color = texture(inputTexture, inUV);
+	vec2 texel = 1.0 / vec2(textureSize(inputTexture, 0));
+	vec2 uv = inUV * composite.uvScale;
+	vec4 tex_color = sample_scene(uv, texel);
+
+	if (composite.sharpness > 0.0) {
+		// unsharp mask one source texel wide, gives back some of the detail the upscale blurs
+		vec3 neighbours = sample_scene(uv + vec2(texel.x, 0.0), texel).rgb
+			+ sample_scene(uv - vec2(texel.x, 0.0), texel).rgb
+			+ sample_scene(uv + vec2(0.0, texel.y), texel).rgb
+			+ sample_scene(uv - vec2(0.0, texel.y), texel).rgb;
+		tex_color.rgb = max(tex_color.rgb + composite.sharpness * (tex_color.rgb * 4.0 - neighbours) * 0.25, vec3(0.0));
+	}
 	outFragColor = tex_color;
-}
\ No newline at end of file
+}
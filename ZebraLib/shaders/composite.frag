@@ -0,0 +1,14 @@
+#version 460
+
+// same as blit.frag, but reads the pixel straight out of the previous subpass
+layout (input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput inputColor;
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragColor;
+
+
+void main() 
+{
+	outFragColor = subpassLoad(inputColor);
+}
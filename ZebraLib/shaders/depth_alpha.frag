@@ -0,0 +1,13 @@
+#version 460
+//shader input
+layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec2 texCoord;
+
+layout(set = 2, binding = 0) uniform sampler2D tex1;
+
+// depth only, alpha tested. only this pass discards, so the shading pass keeps early-z
+void main()
+{
+	if (texture(tex1, texCoord).a < 0.5f)
+		discard;
+}
@@ -0,0 +1,48 @@
+#version 460
+layout (location = 0) in vec3 vPosition;
+
+layout(set = 0, binding = 0) uniform  SceneData{   
+    vec4 fogColor; // w is for exponent
+	vec4 fogDistances; //x for min, y for max, zw unused.
+	vec4 ambientColor;
+	vec4 sunlightDirection; //w for sun power
+	vec4 sunlightColor;
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+} sceneData;
+
+// GPUObjectData, the model matrix without its last row (always 0 0 0 1), one row per vec4
+struct ObjectData{
+	vec4 model_rows[3];
+	uint color;
+	uint material_index;
+	uint texture_index;
+	uint pad;
+};
+
+mat4 model_matrix(ObjectData object)
+{
+	return transpose(mat4(object.model_rows[0], object.model_rows[1], object.model_rows[2], vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+// every renderable, by handle
+layout(set = 1, binding = 0) readonly buffer ObjectBuffer{
+	ObjectData objects[];
+} objectBuffer;
+
+// the handles this batch draws, in draw order
+layout(set = 1, binding = 1) readonly buffer InstanceBuffer{
+	uint handles[];
+} instanceBuffer;
+
+// same math as tri_mesh.vert, the shading pass tests against this depth with EQUAL
+invariant gl_Position;
+
+void main()
+{
+	ObjectData object = objectBuffer.objects[instanceBuffer.handles[gl_InstanceIndex]];
+	mat4 modelMatrix = model_matrix(object);
+	mat4 transformMatrix = (sceneData.viewproj * modelMatrix);
+	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
+}
@@ -5,7 +5,7 @@ layout (location = 1) in vec2 texCoord;
 //output write
 layout (location = 0) out vec4 outFragColor;
 
-layout(set = 0, binding = 1) uniform  SceneData{
+layout(set = 0, binding = 0) uniform  SceneData{
     vec4 fogColor; // w is for exponent
 	vec4 fogDistances; //x for min, y for max, zw unused.
 	vec4 ambientColor;
@@ -15,11 +15,13 @@ layout(set = 0, binding = 1) uniform  SceneData{
 
 layout(set = 2, binding = 0) uniform sampler2D tex1;
 
+// off after the depth prepass, which already discarded the same texels
+layout(constant_id = 0) const bool ALPHA_TEST = true;
 
 void main()
 {
 	vec4 color = texture(tex1, texCoord);
-	if ( color.a < 0.5f ) 
+	if (ALPHA_TEST && color.a < 0.5f) 
 		discard;
 
 	outFragColor = vec4(color.xyz, 1.0f);
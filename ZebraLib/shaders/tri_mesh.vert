@@ -7,6 +7,9 @@ layout (location = 3) in vec2 vTexCoord;
 layout (location = 0) out vec3 outColor;
 layout (location = 1) out vec2 texCoord;
 
+// has to match depth_only.vert bit for bit for the EQUAL depth test after the prepass
+invariant gl_Position;
+
 layout(set = 0, binding = 0) uniform  SceneData{   
     vec4 fogColor; // w is for exponent
 	vec4 fogDistances; //x for min, y for max, zw unused.
@@ -18,16 +21,30 @@ layout(set = 0, binding = 0) uniform  SceneData{
 	mat4 viewproj;
 } sceneData;
 
+// GPUObjectData, the model matrix without its last row (always 0 0 0 1), one row per vec4
 struct ObjectData{
-	mat4 model;
-	vec4 color;
+	vec4 model_rows[3];
+	uint color;
+	uint material_index;
+	uint texture_index;
+	uint pad;
 };
 
-//all object matrices
+mat4 model_matrix(ObjectData object)
+{
+	return transpose(mat4(object.model_rows[0], object.model_rows[1], object.model_rows[2], vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+// every renderable, by handle
 layout(set = 1, binding = 0) readonly buffer ObjectBuffer{
 	ObjectData objects[];
 } objectBuffer;
 
+// the handles this batch draws, in draw order
+layout(set = 1, binding = 1) readonly buffer InstanceBuffer{
+	uint handles[];
+} instanceBuffer;
+
 //push constants block
 layout( push_constant ) uniform constants
 {
@@ -37,10 +54,11 @@ layout( push_constant ) uniform constants
 
 void main()
 {
-	mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
+	ObjectData object = objectBuffer.objects[instanceBuffer.handles[gl_InstanceIndex]];
+	mat4 modelMatrix = model_matrix(object);
 	mat4 transformMatrix = (sceneData.viewproj * modelMatrix);
 	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
-	outColor = mix(vColor, objectBuffer.objects[gl_InstanceIndex].color.rgb, 0.5);
+	outColor = mix(vColor, unpackUnorm4x8(object.color).rgb, 0.5);
 	
 	texCoord = vTexCoord;
 }
@@ -0,0 +1,382 @@
+#include "g_bvh.h"
+#include <algorithm>
+#include <numeric>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ZEBRA_BVH_SSE 1
+#endif
+
+namespace zebra {
+	constexpr u32 MAX_LEAF_ITEMS = 4;
+	constexpr u32 SAH_BINS = 12;
+	// deeper than this ranges are split at the median, which bounds the depth the traversal stacks see
+	constexpr u32 SAH_MAX_DEPTH = 24;
+	constexpr u32 NO_PARENT = ~0u;
+
+	static Aabb merge(const Aabb& a, const Aabb& b) {
+		return { glm::min(a.lo, b.lo), glm::max(a.hi, b.hi) };
+	}
+
+	// half the surface, only ever compared
+	static float area(const Aabb& box) {
+		glm::vec3 d = glm::max(box.hi - box.lo, glm::vec3(0.f));
+		return d.x * d.y + d.y * d.z + d.z * d.x;
+	}
+
+	static Aabb lane_bounds(const BvhNode& node, u32 lane) {
+		return { { node.lo_x[lane], node.lo_y[lane], node.lo_z[lane] }, { node.hi_x[lane], node.hi_y[lane], node.hi_z[lane] } };
+	}
+
+	static void set_lane_bounds(BvhNode& node, u32 lane, const Aabb& box) {
+		node.lo_x[lane] = box.lo.x;
+		node.lo_y[lane] = box.lo.y;
+		node.lo_z[lane] = box.lo.z;
+		node.hi_x[lane] = box.hi.x;
+		node.hi_y[lane] = box.hi.y;
+		node.hi_z[lane] = box.hi.z;
+	}
+
+	struct BuildRange {
+		u32 first;
+		u32 count;
+		Aabb box;
+		// sah found it cheaper as a leaf, or it cannot split
+		bool leaf = false;
+	};
+
+	struct BuildContext {
+		Bvh& bvh;
+		std::span<const Aabb> bounds;
+		// indices into bounds, partitioned in place
+		std::vector<u32> order;
+		std::vector<glm::vec3> centers;
+	};
+
+	static Aabb range_bounds(const BuildContext& ctx, u32 first, u32 count) {
+		Aabb box;
+		for (auto i = first; i < first + count; i++) {
+			box = merge(box, ctx.bounds[ctx.order[i]]);
+		}
+		return box;
+	}
+
+	/// @return how many items go left, count if the range is better off as a leaf
+	static u32 split_range(BuildContext& ctx, const BuildRange& range, u32 depth) {
+		if (range.count <= 1) return range.count;
+		auto begin = ctx.order.begin() + range.first;
+		auto end = begin + range.count;
+
+		Aabb centroid_box;
+		for (auto it = begin; it != end; it++) {
+			centroid_box.lo = glm::min(centroid_box.lo, ctx.centers[*it]);
+			centroid_box.hi = glm::max(centroid_box.hi, ctx.centers[*it]);
+		}
+		glm::vec3 extent = centroid_box.hi - centroid_box.lo;
+
+		if (depth < SAH_MAX_DEPTH) {
+			// binned sah on every axis, a split goes after a bin
+			float best_cost = std::numeric_limits<float>::max();
+			u32 best_axis = 0;
+			u32 best_bin = 0;
+			for (u32 axis = 0; axis < 3; axis++) {
+				if (extent[axis] <= 0.f) continue;
+				const float to_bin = SAH_BINS / extent[axis];
+				std::array<u32, SAH_BINS> counts{};
+				std::array<Aabb, SAH_BINS> boxes{};
+				for (auto it = begin; it != end; it++) {
+					u32 bin = std::min((u32)((ctx.centers[*it][axis] - centroid_box.lo[axis]) * to_bin), SAH_BINS - 1);
+					counts[bin]++;
+					boxes[bin] = merge(boxes[bin], ctx.bounds[*it]);
+				}
+				std::array<float, SAH_BINS> right_cost{};
+				Aabb right;
+				u32 right_count = 0;
+				for (u32 bin = SAH_BINS - 1; bin > 0; bin--) {
+					right = merge(right, boxes[bin]);
+					right_count += counts[bin];
+					right_cost[bin - 1] = area(right) * right_count;
+				}
+				Aabb left;
+				u32 left_count = 0;
+				for (u32 bin = 0; bin + 1 < SAH_BINS; bin++) {
+					left = merge(left, boxes[bin]);
+					left_count += counts[bin];
+					if (left_count == 0 || left_count == range.count) continue;
+					float cost = area(left) * left_count + right_cost[bin];
+					if (cost < best_cost) {
+						best_cost = cost;
+						best_axis = axis;
+						best_bin = bin;
+					}
+				}
+			}
+
+			if (best_cost < std::numeric_limits<float>::max()) {
+				// one traversal step costs about as much as one item test
+				float leaf_cost = area(range.box) * range.count;
+				if (range.count <= MAX_LEAF_ITEMS && leaf_cost <= area(range.box) + best_cost) return range.count;
+
+				const float to_bin = SAH_BINS / extent[best_axis];
+				auto middle = std::partition(begin, end, [&](u32 item) {
+					return std::min((u32)((ctx.centers[item][best_axis] - centroid_box.lo[best_axis]) * to_bin), SAH_BINS - 1) <= best_bin;
+					});
+				return (u32)(middle - begin);
+			}
+		}
+		if (range.count <= MAX_LEAF_ITEMS) return range.count;
+
+		// every center in one spot, or too deep already. halves along the longest axis
+		u32 axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+		auto middle = begin + range.count / 2;
+		std::nth_element(begin, middle, end, [&](u32 a, u32 b) { return ctx.centers[a][axis] < ctx.centers[b][axis]; });
+		return range.count / 2;
+	}
+
+	static u32 build_node(BuildContext& ctx, const BuildRange& range, u32 depth, u32 parent) {
+		auto& bvh = ctx.bvh;
+		const u32 index = (u32)bvh.nodes.size();
+		bvh.nodes.emplace_back();
+		bvh.parents.push_back(parent);
+
+		// collapsed binary splits, the lane with the most surface is split until there are four
+		std::array<BuildRange, BVH_WIDTH> lanes;
+		u32 lane_count = 1;
+		lanes[0] = range;
+		while (lane_count < BVH_WIDTH) {
+			u32 widest = BVH_WIDTH;
+			for (u32 lane = 0; lane < lane_count; lane++) {
+				if (lanes[lane].leaf) continue;
+				if (widest == BVH_WIDTH || area(lanes[lane].box) > area(lanes[widest].box)) widest = lane;
+			}
+			if (widest == BVH_WIDTH) break;
+
+			auto& split = lanes[widest];
+			u32 left = split_range(ctx, split, depth);
+			if (left == split.count) {
+				split.leaf = true;
+				continue;
+			}
+			BuildRange right = { split.first + left, split.count - left, range_bounds(ctx, split.first + left, split.count - left) };
+			split = { split.first, left, range_bounds(ctx, split.first, left) };
+			lanes[lane_count++] = right;
+		}
+
+		BvhNode node{};
+		for (u32 lane = 0; lane < BVH_WIDTH; lane++) {
+			set_lane_bounds(node, lane, Aabb{});
+			node.child[lane] = BVH_LEAF;
+		}
+		node.lanes = lane_count;
+		for (u32 lane = 0; lane < lane_count; lane++) {
+			auto& child = lanes[lane];
+			set_lane_bounds(node, lane, child.box);
+			node.first[lane] = child.first;
+			node.count[lane] = child.count;
+			if (child.leaf || child.count <= MAX_LEAF_ITEMS) {
+				for (auto i = child.first; i < child.first + child.count; i++) {
+					bvh.item_lanes[i] = index << 2 | lane;
+				}
+			} else {
+				node.child[lane] = build_node(ctx, child, depth + 1, index << 2 | lane);
+			}
+		}
+		// the recursion grew the vector
+		bvh.nodes[index] = node;
+		return index;
+	}
+
+	static float tree_cost(const Bvh& bvh) {
+		if (bvh.nodes.empty()) return 0.f;
+		auto& root = bvh.nodes[0];
+		Aabb root_box;
+		float cost = 0.f;
+		for (auto& node : bvh.nodes) {
+			for (u32 lane = 0; lane < node.lanes; lane++) {
+				float a = area(lane_bounds(node, lane));
+				cost += node.child[lane] == BVH_LEAF ? a * node.count[lane] : a;
+			}
+		}
+		for (u32 lane = 0; lane < root.lanes; lane++) {
+			root_box = merge(root_box, lane_bounds(root, lane));
+		}
+		return cost / std::max(area(root_box), 1e-12f);
+	}
+
+	void build_bvh(Bvh& bvh, std::span<const u32> ids, std::span<const Aabb> bounds) {
+		bvh.nodes.clear();
+		bvh.parents.clear();
+		bvh.items.assign(ids.begin(), ids.end());
+		bvh.item_bounds.assign(bounds.begin(), bounds.end());
+		bvh.item_lanes.assign(ids.size(), 0);
+		std::fill(bvh.positions.begin(), bvh.positions.end(), ~0u);
+		bvh.built_cost = bvh.cost = 0.f;
+		if (ids.empty()) return;
+
+		BuildContext ctx = { bvh, bounds };
+		ctx.order.resize(ids.size());
+		std::iota(ctx.order.begin(), ctx.order.end(), 0u);
+		ctx.centers.resize(ids.size());
+		for (auto i = 0ull; i < bounds.size(); i++) {
+			ctx.centers[i] = (bounds[i].lo + bounds[i].hi) * 0.5f;
+		}
+		bvh.nodes.reserve(ids.size() / 2 + 1);
+		build_node(ctx, { 0, (u32)ids.size(), range_bounds(ctx, 0, (u32)ids.size()) }, 0, NO_PARENT);
+
+		// leaf order
+		u32 max_id = 0;
+		for (auto i = 0ull; i < ids.size(); i++) {
+			bvh.items[i] = ids[ctx.order[i]];
+			bvh.item_bounds[i] = bounds[ctx.order[i]];
+			max_id = std::max(max_id, bvh.items[i]);
+		}
+		if (bvh.positions.size() <= max_id) {
+			bvh.positions.resize(max_id + 1, ~0u);
+		}
+		for (auto i = 0u; i < (u32)bvh.items.size(); i++) {
+			bvh.positions[bvh.items[i]] = i;
+		}
+		bvh.built_cost = bvh.cost = tree_cost(bvh);
+	}
+
+	void refit_bvh(Bvh& bvh, std::span<const u32> ids, std::span<const Aabb> bounds) {
+		if (ids.empty()) return;
+		for (auto k = 0ull; k < ids.size(); k++) {
+			u32 position = bvh.positions[ids[k]];
+			bvh.item_bounds[position] = bounds[k];
+
+			u32 node = bvh.item_lanes[position] >> 2;
+			u32 lane = bvh.item_lanes[position] & 3;
+			auto& leaf = bvh.nodes[node];
+			Aabb box;
+			for (auto i = leaf.first[lane]; i < leaf.first[lane] + leaf.count[lane]; i++) {
+				box = merge(box, bvh.item_bounds[i]);
+			}
+			set_lane_bounds(leaf, lane, box);
+
+			// every lane above covers exactly its node again
+			for (u32 up = bvh.parents[node]; up != NO_PARENT; up = bvh.parents[node]) {
+				auto& child = bvh.nodes[node];
+				Aabb covered;
+				for (u32 l = 0; l < child.lanes; l++) {
+					covered = merge(covered, lane_bounds(child, l));
+				}
+				set_lane_bounds(bvh.nodes[up >> 2], up & 3, covered);
+				node = up >> 2;
+			}
+		}
+		bvh.cost = tree_cost(bvh);
+	}
+
+	bool bvh_degraded(const Bvh& bvh) {
+		return bvh.cost > bvh.built_cost * 2.f;
+	}
+
+	bool contains(const Bvh& bvh, u32 id) {
+		return id < bvh.positions.size() && bvh.positions[id] != ~0u;
+	}
+
+	bool aabb_in_frustum(const Frustum& frustum, const Aabb& box) {
+		for (auto& plane : frustum.planes) {
+			// the corner furthest along the normal
+			glm::vec3 far = glm::mix(box.lo, box.hi, glm::greaterThan(glm::vec3(plane), glm::vec3(0.f)));
+			if (glm::dot(glm::vec3(plane), far) + plane.w < 0.f) return false;
+		}
+		return true;
+	}
+
+	float ray_aabb(const BvhRay& ray, const Aabb& box, float max_t) {
+		glm::vec3 t0 = (box.lo - ray.origin) * ray.inv_dir;
+		glm::vec3 t1 = (box.hi - ray.origin) * ray.inv_dir;
+		glm::vec3 near = glm::min(t0, t1);
+		glm::vec3 far = glm::max(t0, t1);
+		float enter = std::max({ near.x, near.y, near.z, 0.f });
+		float exit = std::min({ far.x, far.y, far.z, max_t });
+		return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+	}
+
+	bool sphere_touches_aabb(const glm::vec4& sphere, const Aabb& box) {
+		glm::vec3 center = sphere;
+		glm::vec3 d = glm::max(glm::max(box.lo - center, center - box.hi), glm::vec3(0.f));
+		return glm::dot(d, d) <= sphere.w * sphere.w;
+	}
+
+#ifdef ZEBRA_BVH_SSE
+	u32 frustum_lanes(const BvhNode& node, const Frustum& frustum, u32& inside) {
+		const __m128 lo_x = _mm_load_ps(node.lo_x), lo_y = _mm_load_ps(node.lo_y), lo_z = _mm_load_ps(node.lo_z);
+		const __m128 hi_x = _mm_load_ps(node.hi_x), hi_y = _mm_load_ps(node.hi_y), hi_z = _mm_load_ps(node.hi_z);
+		const __m128 zero = _mm_setzero_ps();
+		u32 pass = (1u << node.lanes) - 1;
+		inside = pass;
+		for (auto& plane : frustum.planes) {
+			const __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z), w = _mm_set1_ps(plane.w);
+			__m128 ax = _mm_mul_ps(nx, lo_x), bx = _mm_mul_ps(nx, hi_x);
+			__m128 ay = _mm_mul_ps(ny, lo_y), by = _mm_mul_ps(ny, hi_y);
+			__m128 az = _mm_mul_ps(nz, lo_z), bz = _mm_mul_ps(nz, hi_z);
+			// the corners furthest along and against the normal
+			__m128 far = _mm_add_ps(_mm_add_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_add_ps(_mm_max_ps(az, bz), w));
+			__m128 near = _mm_add_ps(_mm_add_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_add_ps(_mm_min_ps(az, bz), w));
+			pass &= ~(u32)_mm_movemask_ps(_mm_cmplt_ps(far, zero));
+			inside &= ~(u32)_mm_movemask_ps(_mm_cmplt_ps(near, zero));
+		}
+		inside &= pass;
+		return pass;
+	}
+
+	u32 ray_lanes(const BvhNode& node, const BvhRay& ray, float max_t, float t_near[BVH_WIDTH]) {
+		const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+		const __m128 ix = _mm_set1_ps(ray.inv_dir.x), iy = _mm_set1_ps(ray.inv_dir.y), iz = _mm_set1_ps(ray.inv_dir.z);
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.lo_x), ox), ix), t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.hi_x), ox), ix);
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.lo_y), oy), iy), t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.hi_y), oy), iy);
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.lo_z), oz), iz), t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.hi_z), oz), iz);
+		__m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+		__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(max_t)));
+		_mm_storeu_ps(t_near, enter);
+		return (u32)_mm_movemask_ps(_mm_cmple_ps(enter, exit)) & ((1u << node.lanes) - 1);
+	}
+
+	u32 sphere_lanes(const BvhNode& node, const glm::vec4& sphere) {
+		const __m128 cx = _mm_set1_ps(sphere.x), cy = _mm_set1_ps(sphere.y), cz = _mm_set1_ps(sphere.z);
+		const __m128 zero = _mm_setzero_ps();
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(node.lo_x), cx), _mm_sub_ps(cx, _mm_load_ps(node.hi_x))), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(node.lo_y), cy), _mm_sub_ps(cy, _mm_load_ps(node.hi_y))), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(node.lo_z), cz), _mm_sub_ps(cz, _mm_load_ps(node.hi_z))), zero);
+		__m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		return (u32)_mm_movemask_ps(_mm_cmple_ps(distance2, _mm_set1_ps(sphere.w * sphere.w))) & ((1u << node.lanes) - 1);
+	}
+#else
+	// one lane at a time, same answers
+	u32 frustum_lanes(const BvhNode& node, const Frustum& frustum, u32& inside) {
+		u32 pass = 0;
+		inside = 0;
+		for (u32 lane = 0; lane < node.lanes; lane++) {
+			auto box = lane_bounds(node, lane);
+			if (!aabb_in_frustum(frustum, box)) continue;
+			pass |= 1 << lane;
+			bool whole = true;
+			for (auto& plane : frustum.planes) {
+				glm::vec3 near = glm::mix(box.hi, box.lo, glm::greaterThan(glm::vec3(plane), glm::vec3(0.f)));
+				whole &= glm::dot(glm::vec3(plane), near) + plane.w >= 0.f;
+			}
+			inside |= whole ? 1 << lane : 0;
+		}
+		return pass;
+	}
+
+	u32 ray_lanes(const BvhNode& node, const BvhRay& ray, float max_t, float t_near[BVH_WIDTH]) {
+		u32 pass = 0;
+		for (u32 lane = 0; lane < node.lanes; lane++) {
+			t_near[lane] = ray_aabb(ray, lane_bounds(node, lane), max_t);
+			pass |= t_near[lane] <= max_t ? 1 << lane : 0;
+		}
+		return pass;
+	}
+
+	u32 sphere_lanes(const BvhNode& node, const glm::vec4& sphere) {
+		u32 pass = 0;
+		for (u32 lane = 0; lane < node.lanes; lane++) {
+			pass |= sphere_touches_aabb(sphere, lane_bounds(node, lane)) ? 1 << lane : 0;
+		}
+		return pass;
+	}
+#endif
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include <array>
+#include <span>
+#include <vector>
+#include <limits>
+#include <utility>
+#include <glm/glm.hpp>
+#include "zebratypes.h"
+#include "g_cull.h"
+
+namespace zebra {
+	struct Aabb {
+		glm::vec3 lo{ std::numeric_limits<float>::max() };
+		glm::vec3 hi{ std::numeric_limits<float>::lowest() };
+	};
+
+	inline Aabb sphere_aabb(const glm::vec4& sphere) {
+		return { glm::vec3(sphere) - sphere.w, glm::vec3(sphere) + sphere.w };
+	}
+
+	constexpr u32 BVH_WIDTH = 4;
+	// enough for any tree build_bvh makes, it goes balanced long before the depth would need more
+	constexpr u32 BVH_STACK = 128;
+	// a lane that is a leaf, its items are first..first+count
+	constexpr u32 BVH_LEAF = ~0u;
+
+	/* four children per node, their bounds stored by axis so one plane, ray or sphere is tested
+	* against all four in one go. every lane also knows the range of items under it, items are in leaf order */
+	struct alignas(16) BvhNode {
+		float lo_x[BVH_WIDTH];
+		float lo_y[BVH_WIDTH];
+		float lo_z[BVH_WIDTH];
+		float hi_x[BVH_WIDTH];
+		float hi_y[BVH_WIDTH];
+		float hi_z[BVH_WIDTH];
+		// node index, or BVH_LEAF
+		u32 child[BVH_WIDTH];
+		u32 first[BVH_WIDTH];
+		u32 count[BVH_WIDTH];
+		// filled lanes, always the first ones
+		u32 lanes;
+	};
+
+	/* sah built, flattened with the root at 0. ids are whatever the caller names items by, small enough to index a vector with.
+	* moving items are refit in place, the tree gets rebuilt once refits made it much worse than it was built */
+	struct Bvh {
+		std::vector<BvhNode> nodes;
+		// ids in leaf order, and their bounds
+		std::vector<u32> items;
+		std::vector<Aabb> item_bounds;
+		// -- for refits. by node, parent node << 2 | lane, ~0 for the root
+		std::vector<u32> parents;
+		// by item position, the leaf lane it is in, node << 2 | lane
+		std::vector<u32> item_lanes;
+		// by id, where it is in items. ~0 if it is not in the tree
+		std::vector<u32> positions;
+		// surface area heuristic of the tree relative to its root, at build and now
+		float built_cost = 0.f;
+		float cost = 0.f;
+	};
+
+	void build_bvh(Bvh& bvh, std::span<const u32> ids, std::span<const Aabb> bounds);
+	/// @brief new bounds for items already in the tree, the lanes above them grow or shrink to fit
+	void refit_bvh(Bvh& bvh, std::span<const u32> ids, std::span<const Aabb> bounds);
+	/// @return true once refits made the tree twice as expensive to walk as it was built
+	bool bvh_degraded(const Bvh& bvh);
+	bool contains(const Bvh& bvh, u32 id);
+
+	struct BvhRay {
+		glm::vec3 origin;
+		glm::vec3 inv_dir;
+	};
+
+	inline BvhRay make_ray(const glm::vec3& origin, const glm::vec3& dir) {
+		return { origin, 1.f / dir };
+	}
+
+	// -- four lanes at once, a bit per lane that passes. lanes past node.lanes never pass
+	/// @param inside lanes completely inside every plane
+	u32 frustum_lanes(const BvhNode& node, const Frustum& frustum, u32& inside);
+	/// @param t_near entry distance of each lane that passes
+	u32 ray_lanes(const BvhNode& node, const BvhRay& ray, float max_t, float t_near[BVH_WIDTH]);
+	u32 sphere_lanes(const BvhNode& node, const glm::vec4& sphere);
+
+	bool aabb_in_frustum(const Frustum& frustum, const Aabb& box);
+	/// @return entry distance, infinite on a miss
+	float ray_aabb(const BvhRay& ray, const Aabb& box, float max_t);
+	bool sphere_touches_aabb(const glm::vec4& sphere, const Aabb& box);
+
+	/* the queries hand out ids. fn(id) for everything whose bounds are in the frustum, whole subtrees
+	* inside it are handed out without testing further */
+	template<class F>
+	void query_frustum(const Bvh& bvh, const Frustum& frustum, F&& fn) {
+		if (bvh.nodes.empty()) return;
+		u32 stack[BVH_STACK];
+		u32 top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			auto& node = bvh.nodes[stack[--top]];
+			u32 inside;
+			u32 mask = frustum_lanes(node, frustum, inside);
+			for (u32 lane = 0; lane < BVH_WIDTH; lane++) {
+				if ((mask & (1 << lane)) == 0) continue;
+				if (inside & (1 << lane)) {
+					for (u32 i = node.first[lane]; i < node.first[lane] + node.count[lane]; i++) {
+						fn(bvh.items[i]);
+					}
+				} else if (node.child[lane] != BVH_LEAF) {
+					stack[top++] = node.child[lane];
+				} else {
+					for (u32 i = node.first[lane]; i < node.first[lane] + node.count[lane]; i++) {
+						if (aabb_in_frustum(frustum, bvh.item_bounds[i])) fn(bvh.items[i]);
+					}
+				}
+			}
+		}
+	}
+
+	/* nearest first. hit(id, max_t) returns where the item itself is hit, or anything past max_t for a miss.
+	* @return the id hit nearest, ~0 if nothing was hit before max_t. max_t is moved to the hit */
+	template<class F>
+	u32 query_ray(const Bvh& bvh, const glm::vec3& origin, const glm::vec3& dir, float& max_t, F&& hit) {
+		u32 best = ~0u;
+		if (bvh.nodes.empty()) return best;
+		auto ray = make_ray(origin, dir);
+		struct Entry {
+			u32 node;
+			float t;
+		};
+		Entry stack[BVH_STACK];
+		u32 top = 0;
+		stack[top++] = { 0, 0.f };
+		while (top > 0) {
+			auto entry = stack[--top];
+			// something nearer was hit since this was pushed
+			if (entry.t > max_t) continue;
+			auto& node = bvh.nodes[entry.node];
+			float t_near[BVH_WIDTH];
+			u32 mask = ray_lanes(node, ray, max_t, t_near);
+
+			// leaves right away, inner lanes pushed far to near so the nearest comes off first
+			u32 order[BVH_WIDTH];
+			u32 inner = 0;
+			for (u32 lane = 0; lane < BVH_WIDTH; lane++) {
+				if ((mask & (1 << lane)) == 0) continue;
+				if (node.child[lane] != BVH_LEAF) {
+					order[inner++] = lane;
+					continue;
+				}
+				for (u32 i = node.first[lane]; i < node.first[lane] + node.count[lane]; i++) {
+					if (ray_aabb(ray, bvh.item_bounds[i], max_t) > max_t) continue;
+					float t = hit(bvh.items[i], max_t);
+					if (t <= max_t) {
+						max_t = t;
+						best = bvh.items[i];
+					}
+				}
+			}
+			for (u32 a = 1; a < inner; a++) {
+				for (u32 b = a; b > 0 && t_near[order[b]] > t_near[order[b - 1]]; b--) {
+					std::swap(order[b], order[b - 1]);
+				}
+			}
+			for (u32 i = 0; i < inner; i++) {
+				stack[top++] = { node.child[order[i]], t_near[order[i]] };
+			}
+		}
+		return best;
+	}
+
+	/// @brief fn(id) for everything whose bounds touch the sphere
+	template<class F>
+	void query_sphere(const Bvh& bvh, const glm::vec4& sphere, F&& fn) {
+		if (bvh.nodes.empty()) return;
+		u32 stack[BVH_STACK];
+		u32 top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			auto& node = bvh.nodes[stack[--top]];
+			u32 mask = sphere_lanes(node, sphere);
+			for (u32 lane = 0; lane < BVH_WIDTH; lane++) {
+				if ((mask & (1 << lane)) == 0) continue;
+				if (node.child[lane] != BVH_LEAF) {
+					stack[top++] = node.child[lane];
+					continue;
+				}
+				for (u32 i = node.first[lane]; i < node.first[lane] + node.count[lane]; i++) {
+					if (sphere_touches_aabb(sphere, bvh.item_bounds[i])) fn(bvh.items[i]);
+				}
+			}
+		}
+	}
+}
@@ -53,6 +53,14 @@ namespace zebra {
 		apply_rotation(accx, accy);
 	}
 
+	FirstPersonPerspectiveCamera FirstPersonPerspectiveCamera::interpolate(const FirstPersonPerspectiveCamera& a, const FirstPersonPerspectiveCamera& b, float alpha) {
+		FirstPersonPerspectiveCamera result = b;
+		result._pos = glm::mix(a._pos, b._pos, alpha);
+		result._rx = glm::slerp(a._rx, b._rx, alpha);
+		result._ry = glm::slerp(a._ry, b._ry, alpha);
+		return result;
+	}
+
 	glm::mat4 FirstPersonPerspectiveCamera::view() {
 		return glm::toMat4(rotation()) * glm::translate(glm::mat4(1.f), _pos);
 	}
@@ -34,5 +34,8 @@ namespace zebra {
 		void apply_movement(glm::vec3 dv);
 		void apply_rotation(float phi, float theta);
 		void tick();
+
+		/// @brief blends position and rotation, everything else is taken from b
+		static FirstPersonPerspectiveCamera interpolate(const FirstPersonPerspectiveCamera& a, const FirstPersonPerspectiveCamera& b, float alpha);
 	};
 }
\ No newline at end of file
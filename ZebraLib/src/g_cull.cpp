@@ -0,0 +1,25 @@
+#include "g_cull.h"
+
+namespace zebra {
+	Frustum frustum_from_matrix(const glm::mat4& viewproj) {
+		// gribb/hartmann, glm is column major so build the rows first
+		glm::vec4 rows[4];
+		for (auto i = 0; i < 4; i++) {
+			rows[i] = glm::vec4(viewproj[0][i], viewproj[1][i], viewproj[2][i], viewproj[3][i]);
+		}
+
+		Frustum frustum = { {
+			rows[3] + rows[0],
+			rows[3] - rows[0],
+			rows[3] + rows[1],
+			rows[3] - rows[1],
+			rows[3] + rows[2],
+			rows[3] - rows[2],
+		} };
+
+		for (auto& plane : frustum.planes) {
+			plane /= glm::length(glm::vec3(plane));
+		}
+		return frustum;
+	}
+}
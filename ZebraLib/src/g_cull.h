@@ -0,0 +1,30 @@
+#pragma once
+#include <glm/glm.hpp>
+#include "zebratypes.h"
+
+namespace zebra {
+	struct Frustum {
+		// xyz is the inward facing normal, w the distance. left, right, bottom, top, near, far
+		glm::vec4 planes[6];
+	};
+
+	Frustum frustum_from_matrix(const glm::mat4& viewproj);
+
+	/// @param sphere xyz center, w radius
+	inline bool sphere_in_frustum(const Frustum& frustum, const glm::vec4& sphere) {
+		for (auto& plane : frustum.planes) {
+			if (glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w < -sphere.w) return false;
+		}
+		return true;
+	}
+
+	/// @brief moves a local bounding sphere into world space, radius grows with the largest axis scale
+	inline glm::vec4 transform_sphere(const glm::mat4& model, const glm::vec4& sphere) {
+		glm::vec3 center = model * glm::vec4(glm::vec3(sphere), 1.f);
+		float scale = glm::sqrt(glm::max(glm::max(
+			glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+			glm::dot(glm::vec3(model[1]), glm::vec3(model[1]))),
+			glm::dot(glm::vec3(model[2]), glm::vec3(model[2]))));
+		return glm::vec4(center, sphere.w * scale);
+	}
+}
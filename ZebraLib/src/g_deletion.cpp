@@ -0,0 +1,115 @@
+#include "g_deletion.h"
+#include "renderer.h"
+#include <limits>
+
+namespace zebra {
+	template<class T>
+	static void push(DeletionLane<T>& lane, u64 value, T item) {
+		lane.items.push_back(item);
+		lane.values.push_back(value);
+	}
+
+	template<class T>
+	static u64 waiting(const DeletionLane<T>& lane) {
+		return lane.items.size() - lane.head;
+	}
+
+	// entries are in tag order, so everything that is done sits at the front
+	template<class T, class F>
+	static void collect_lane(DeletionLane<T>& lane, u64 done_value, F&& destroy) {
+		while (lane.head < lane.items.size() && lane.values[lane.head] <= done_value) {
+			destroy(lane.items[lane.head]);
+			lane.head++;
+		}
+		if (lane.head == lane.items.size()) {
+			// drained, the usual case. keeps the capacity
+			lane.items.clear();
+			lane.values.clear();
+			lane.head = 0;
+		} else if (lane.head * 2 >= lane.items.size()) {
+			// every entry moves at most once per time the lane halves, amortized constant per entry
+			lane.items.erase(lane.items.begin(), lane.items.begin() + lane.head);
+			lane.values.erase(lane.values.begin(), lane.values.begin() + lane.head);
+			lane.head = 0;
+		}
+	}
+
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkFramebuffer framebuffer) {
+		push(queue.framebuffers, value, framebuffer);
+	}
+
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkPipeline pipeline) {
+		push(queue.pipelines, value, pipeline);
+	}
+
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkImageView view) {
+		push(queue.image_views, value, view);
+	}
+
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, Texture texture) {
+		push(queue.textures, value, texture);
+	}
+
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkImage image) {
+		push(queue.images, value, image);
+	}
+
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VmaAllocation allocation) {
+		push(queue.allocations, value, allocation);
+	}
+
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, AllocBuffer buffer) {
+		push(queue.buffers, value, buffer);
+	}
+
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkSwapchainKHR swapchain) {
+		push(queue.swapchains, value, swapchain);
+	}
+
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, GeometryRange range) {
+		push(queue.geometry, value, range);
+	}
+
+	void collect(FrameDeletionQueue& queue, u64 done_value) {
+		// users first: framebuffers before their views, views before their images and swapchains
+		collect_lane(queue.framebuffers, done_value, [&](VkFramebuffer framebuffer) {
+			vkDestroyFramebuffer(queue.device, framebuffer, nullptr);
+			});
+		collect_lane(queue.pipelines, done_value, [&](VkPipeline pipeline) {
+			vkDestroyPipeline(queue.device, pipeline, nullptr);
+			});
+		collect_lane(queue.image_views, done_value, [&](VkImageView view) {
+			if (queue.framebuffer_cache) queue.framebuffer_cache->evict(view);
+			vkDestroyImageView(queue.device, view, nullptr);
+			});
+		collect_lane(queue.textures, done_value, [&](Texture& texture) {
+			vkDestroyImageView(queue.device, texture.view, nullptr);
+			vmaDestroyImage(queue.allocator, texture.image, texture.allocation);
+			});
+		collect_lane(queue.images, done_value, [&](VkImage image) {
+			vkDestroyImage(queue.device, image, nullptr);
+			});
+		collect_lane(queue.allocations, done_value, [&](VmaAllocation allocation) {
+			vmaFreeMemory(queue.allocator, allocation);
+			});
+		collect_lane(queue.buffers, done_value, [&](AllocBuffer& buffer) {
+			vmaDestroyBuffer(queue.allocator, buffer.buffer, buffer.allocation);
+			});
+		collect_lane(queue.swapchains, done_value, [&](VkSwapchainKHR swapchain) {
+			vkDestroySwapchainKHR(queue.device, swapchain, nullptr);
+			});
+		collect_lane(queue.geometry, done_value, [&](GeometryRange& range) {
+			if (queue.geometry_pool) free_geometry(*queue.geometry_pool, range);
+			});
+	}
+
+	void collect_all(FrameDeletionQueue& queue) {
+		collect(queue, std::numeric_limits<u64>::max());
+	}
+
+	u64 pending(const FrameDeletionQueue& queue) {
+		return waiting(queue.framebuffers) + waiting(queue.pipelines) + waiting(queue.image_views)
+			+ waiting(queue.textures) + waiting(queue.images) + waiting(queue.allocations)
+			+ waiting(queue.buffers) + waiting(queue.swapchains) + waiting(queue.geometry);
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+#include "zebratypes.h"
+#include "g_buffer.h"
+#include "g_types.h"
+#include "g_geometry.h"
+
+namespace zebra {
+	namespace render {
+		struct FramebufferCache;
+	}
+
+	/* handles in the order they were deferred, each tagged with the timeline value after which nothing uses it.
+	* collected entries are only skipped by moving head, the live ones are moved down once they are the smaller half */
+	template<class T>
+	struct DeletionLane {
+		std::vector<T> items;
+		std::vector<u64> values;
+		// first entry that is still waiting
+		u64 head = 0;
+	};
+
+	/* typed deferred destruction for gpu objects. an entry waits until the gpu timeline reaches its value
+	* and goes in the next collect. one flat lane per type instead of closures, and lanes keep their
+	* capacity, so deferring in steady state does not allocate */
+	struct FrameDeletionQueue {
+		VkDevice device = VK_NULL_HANDLE;
+		VmaAllocator allocator = VK_NULL_HANDLE;
+		// views are evicted from here before they are destroyed
+		render::FramebufferCache* framebuffer_cache = nullptr;
+		// mesh ranges go back to their pool
+		GeometryPool* geometry_pool = nullptr;
+
+		DeletionLane<VkFramebuffer> framebuffers;
+		DeletionLane<VkPipeline> pipelines;
+		DeletionLane<VkImageView> image_views;
+		DeletionLane<Texture> textures;
+		DeletionLane<VkImage> images;
+		DeletionLane<VmaAllocation> allocations;
+		DeletionLane<AllocBuffer> buffers;
+		DeletionLane<VkSwapchainKHR> swapchains;
+		DeletionLane<GeometryRange> geometry;
+	};
+
+	// value is the timeline value of the last submission that may use the object, tags only ever go up
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkFramebuffer framebuffer);
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkPipeline pipeline);
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkImageView view);
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, Texture texture);
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkImage image);
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VmaAllocation allocation);
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, AllocBuffer buffer);
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, VkSwapchainKHR swapchain);
+	void defer_destroy(FrameDeletionQueue& queue, u64 value, GeometryRange range);
+
+	/// @brief destroys everything tagged with done_value or lower, pass the completed timeline value
+	void collect(FrameDeletionQueue& queue, u64 done_value);
+	/// @brief everything, the gpu has to be idle
+	void collect_all(FrameDeletionQueue& queue);
+	u64 pending(const FrameDeletionQueue& queue);
+}
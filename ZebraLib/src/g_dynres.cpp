@@ -0,0 +1,40 @@
+#include "g_dynres.h"
+#include <algorithm>
+#include <cmath>
+
+namespace zebra {
+	namespace render {
+		// measurements come back a few frames late, give a change time to show up before the next
+		constexpr u32 SETTLE_FRAMES = 8;
+
+		void update_resolution(ResolutionController& controller, float gpu_ms) {
+			controller.gpu_ms = controller.gpu_ms == 0.f ? gpu_ms : controller.gpu_ms + (gpu_ms - controller.gpu_ms) * 0.1f;
+			if (!controller.enabled) {
+				controller.scale = controller.max_scale;
+				return;
+			}
+			if (++controller.frames_since_change < SETTLE_FRAMES || controller.gpu_ms <= 0.f) return;
+
+			// drop quickly when over budget, only grow back with clear headroom
+			float ratio = controller.target_ms / controller.gpu_ms;
+			if (ratio > 0.95f && ratio < 1.1f) return;
+
+			float next = std::sqrt(controller.scale * controller.scale * ratio);
+			next = std::clamp(next, controller.scale - 0.1f, controller.scale + 0.05f);
+			next = std::clamp(next, controller.min_scale, controller.max_scale);
+			if (std::abs(next - controller.scale) > 0.005f) {
+				controller.scale = next;
+				controller.frames_since_change = 0;
+			}
+		}
+
+		VkExtent2D scaled_extent(const ResolutionController& controller, VkExtent2D full) {
+			if (controller.scale >= 1.f) return full;
+			auto scale_axis = [&](u32 size) {
+				u32 scaled = (u32)((float)size * controller.scale) & ~7u;
+				return std::clamp(scaled, std::min(size, 8u), size);
+			};
+			return { scale_axis(full.width), scale_axis(full.height) };
+		}
+	}
+}
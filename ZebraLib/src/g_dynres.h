@@ -0,0 +1,25 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "zebratypes.h"
+
+namespace zebra {
+	namespace render {
+		/* scales the 3d resolution to hold a gpu frame time. fed with measured gpu time,
+		* works on the area since that is what fragment cost roughly follows */
+		struct ResolutionController {
+			bool enabled = true;
+			float target_ms = 1000.f / 60.f;
+			float min_scale = 0.5f;
+			float max_scale = 1.f;
+			// per axis, fraction of the swapchain extent
+			float scale = 1.f;
+			// smoothed
+			float gpu_ms = 0.f;
+			u32 frames_since_change = 0;
+		};
+
+		void update_resolution(ResolutionController& controller, float gpu_ms);
+		/// @brief rounded down to 8 pixels, so small scale changes do not resize every frame
+		VkExtent2D scaled_extent(const ResolutionController& controller, VkExtent2D full);
+	}
+}
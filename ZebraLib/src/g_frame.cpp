@@ -0,0 +1,28 @@
+#include "g_frame.h"
+
+namespace zebra {
+	UiDrawSnapshot::~UiDrawSnapshot() {
+		clear_ui(*this);
+	}
+
+	bool capture_ui(UiDrawSnapshot& snapshot, const ImDrawData* source) {
+		clear_ui(snapshot);
+		if (source == nullptr || !source->Valid) return false;
+
+		snapshot.data = *source;
+		snapshot.lists.reserve(source->CmdListsCount);
+		for (auto i = 0; i < source->CmdListsCount; i++) {
+			snapshot.lists.push_back(source->CmdLists[i]->CloneOutput());
+		}
+		snapshot.data.CmdLists = snapshot.lists.data();
+		return true;
+	}
+
+	void clear_ui(UiDrawSnapshot& snapshot) {
+		for (auto list : snapshot.lists) {
+			IM_DELETE(list);
+		}
+		snapshot.lists.clear();
+		snapshot.data = ImDrawData();
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <imgui.h>
+#include <vulkan/vulkan.h>
+#include "zebratypes.h"
+#include "g_types.h"
+#include "renderer.h"
+#include "g_rendergraph.h"
+
+namespace zebra {
+
+	/// @brief imgui output that outlives the next NewFrame, so another thread can record it later
+	struct UiDrawSnapshot {
+		ImDrawData data{};
+		std::vector<ImDrawList*> lists;
+
+		UiDrawSnapshot() = default;
+		UiDrawSnapshot(const UiDrawSnapshot&) = delete;
+		UiDrawSnapshot& operator=(const UiDrawSnapshot&) = delete;
+		~UiDrawSnapshot();
+	};
+
+	/// @brief deep copies source, false when there is nothing to draw
+	bool capture_ui(UiDrawSnapshot& snapshot, const ImDrawData* source);
+	void clear_ui(UiDrawSnapshot& snapshot);
+
+	// what the debug ui can change, applied by the thread that records
+	struct RenderSettings {
+		bool depth_prepass = true;
+		bool dynamic_resolution = true;
+		float target_ms = 1000.f / 60.f;
+		float composite_sharpness = 0.25f;
+		// how far a lod may be off on screen before a finer one is picked
+		float lod_error_pixels = 1.f;
+		// only where the graph was built with the two forward passes
+		bool occlusion_culling = true;
+		// meshes with clusters draw only the clusters that survive culling
+		bool cluster_culling = true;
+		// occluders rasterized on the workers, for gpus where culling on them does not pay off
+		bool software_occlusion = false;
+	};
+
+	/* everything the main thread hands to the render thread for one frame.
+	* packets are reused, the vectors keep their capacity */
+	struct FramePacket {
+		// asks the render thread to finish, nothing else in the packet is valid
+		bool stop = false;
+		GPUSceneData scene_data;
+		glm::mat4 viewproj;
+		render::LodSelection lod;
+		// sim objects that moved since the last packet, everything else stays as the renderer has it
+		std::vector<render::RenderableUpdate> updates;
+		RenderSettings settings;
+		UiDrawSnapshot ui;
+	};
+
+	/// @brief render thread state for the debug ui, published once per recorded frame
+	struct RenderStats {
+		u64 frame = 0;
+		u64 objects = 0;
+		u64 visible = 0;
+		// of the visible ones, what each forward pass drew with occlusion culling. the counts are a few frames old
+		u32 drawn_early = 0;
+		u32 drawn_late = 0;
+		// of the visible clustered instances, counted with the occlusion numbers
+		u32 clusters = 0;
+		u32 clusters_drawn = 0;
+		// the static under the middle of the screen, NO_RENDERABLE for none
+		render::RenderableHandle picked = render::NO_RENDERABLE;
+		// statics the bvh was refit for this frame, and whether it got rebuilt instead
+		u32 statics_refit = 0;
+		bool statics_rebuilt = false;
+		// dropped by the software depth this frame, and the occluder triangles that made it to the screen
+		u32 software_occluded = 0;
+		u32 occluder_triangles = 0;
+		// instances copied into the instance buffer this frame, and in how many ranges
+		u32 uploaded = 0;
+		u32 upload_ranges = 0;
+		u64 renderpasses = 0;
+		u64 framebuffers = 0;
+		u64 pipelines = 0;
+		u64 pipeline_requests = 0;
+		// variants still compiling on the workers, drawn with the fallback meanwhile
+		u32 pipelines_compiling = 0;
+		u64 deferred = 0;
+		u64 timeline_completed = 0;
+		u64 timeline_submitted = 0;
+		u64 buffers_in_use = 0;
+		u64 available_buffers = 0;
+		render::RGStats graph;
+		float gpu_ms = 0.f;
+		float resolution_scale = 1.f;
+		VkExtent2D scene_extent{};
+	};
+}
@@ -0,0 +1,165 @@
+#include "g_geometry.h"
+#include <algorithm>
+#include "z_debug.h"
+
+namespace zebra {
+	static void insert_free(RangeAllocator& ranges, u64 offset, u64 size) {
+		ranges.free_offsets.emplace(offset, size);
+		ranges.free_sizes.emplace(size, offset);
+	}
+
+	static void erase_free(RangeAllocator& ranges, std::map<u64, u64>::iterator range) {
+		auto [first, last] = ranges.free_sizes.equal_range(range->second);
+		for (auto it = first; it != last; it++) {
+			if (it->second == range->first) {
+				ranges.free_sizes.erase(it);
+				break;
+			}
+		}
+		ranges.free_offsets.erase(range);
+	}
+
+	void init_ranges(RangeAllocator& ranges, u64 capacity) {
+		ranges = {};
+		ranges.capacity = capacity;
+		insert_free(ranges, 0, capacity);
+	}
+
+	bool allocate_range(RangeAllocator& ranges, u64 size, u64& offset) {
+		if (size == 0) {
+			offset = 0;
+			return true;
+		}
+		// smallest free range that fits, the rest of it stays free
+		auto best = ranges.free_sizes.lower_bound(size);
+		if (best == ranges.free_sizes.end()) return false;
+
+		offset = best->second;
+		auto remaining = best->first - size;
+		ranges.free_offsets.erase(offset);
+		ranges.free_sizes.erase(best);
+		if (remaining > 0) {
+			insert_free(ranges, offset + size, remaining);
+		}
+		ranges.used += size;
+		return true;
+	}
+
+	void free_range(RangeAllocator& ranges, u64 offset, u64 size) {
+		if (size == 0) return;
+		ranges.used -= size;
+
+		auto next = ranges.free_offsets.lower_bound(offset);
+		if (next != ranges.free_offsets.begin()) {
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset) {
+				offset = previous->first;
+				size += previous->second;
+				erase_free(ranges, previous);
+			}
+		}
+		if (next != ranges.free_offsets.end() && offset + size == next->first) {
+			size += next->second;
+			erase_free(ranges, next);
+		}
+		insert_free(ranges, offset, size);
+	}
+
+	void grow_ranges(RangeAllocator& ranges, u64 capacity) {
+		if (capacity <= ranges.capacity) return;
+		auto added = capacity - ranges.capacity;
+		// free_range takes it off used again
+		ranges.used += added;
+		free_range(ranges, ranges.capacity, added);
+		ranges.capacity = capacity;
+	}
+
+	u64 largest_range(const RangeAllocator& ranges) {
+		return ranges.free_sizes.empty() ? 0 : ranges.free_sizes.rbegin()->first;
+	}
+
+	void init_pool(GeometryPool& pool, VmaAllocator allocator, u32 vertex_stride) {
+		pool.allocator = allocator;
+		pool.vertex_stride = vertex_stride;
+	}
+
+	static GeometryBlock& add_block(GeometryPool& pool, u64 vertices, u64 indices) {
+		auto& block = pool.blocks.emplace_back();
+		block.vertices = create_buffer(pool.allocator, vertices * pool.vertex_stride,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		block.indices = create_buffer(pool.allocator, indices * sizeof(u32),
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		init_ranges(block.vertex_ranges, vertices);
+		init_ranges(block.index_ranges, indices);
+		DBG("geometry block " << pool.blocks.size() - 1 << ": " << vertices << " vertices, " << indices << " indices");
+		return block;
+	}
+
+	static bool place(GeometryBlock& block, u32 vertex_count, u32 index_count, GeometryRange& range) {
+		u64 first_vertex, first_index;
+		if (!allocate_range(block.vertex_ranges, vertex_count, first_vertex)) return false;
+		if (!allocate_range(block.index_ranges, index_count, first_index)) {
+			free_range(block.vertex_ranges, first_vertex, vertex_count);
+			return false;
+		}
+		range.first_vertex = (u32)first_vertex;
+		range.vertex_count = vertex_count;
+		range.first_index = (u32)first_index;
+		range.index_count = index_count;
+		return true;
+	}
+
+	GeometryRange allocate_geometry(GeometryPool& pool, u32 vertex_count, u32 index_count) {
+		std::lock_guard guard(pool.lock);
+		GeometryRange range;
+		for (auto i = 0u; i < pool.blocks.size(); i++) {
+			if (place(pool.blocks[i], vertex_count, index_count, range)) {
+				range.block = i;
+				return range;
+			}
+		}
+
+		// nothing fits, meshes larger than a block get a block of their own size
+		auto& block = add_block(pool, std::max<u64>(pool.block_vertices, vertex_count), std::max<u64>(pool.block_indices, index_count));
+		place(block, vertex_count, index_count, range);
+		range.block = (u32)pool.blocks.size() - 1;
+		return range;
+	}
+
+	void free_geometry(GeometryPool& pool, const GeometryRange& range) {
+		std::lock_guard guard(pool.lock);
+		auto& block = pool.blocks[range.block];
+		free_range(block.vertex_ranges, range.first_vertex, range.vertex_count);
+		free_range(block.index_ranges, range.first_index, range.index_count);
+	}
+
+	void destroy_pool(GeometryPool& pool) {
+		std::lock_guard guard(pool.lock);
+		for (auto& block : pool.blocks) {
+			vmaDestroyBuffer(pool.allocator, block.vertices.buffer, block.vertices.allocation);
+			vmaDestroyBuffer(pool.allocator, block.indices.buffer, block.indices.allocation);
+		}
+		pool.blocks.clear();
+	}
+
+	GeometryBinding geometry_binding(GeometryPool& pool, u32 block) {
+		std::lock_guard guard(pool.lock);
+		return { pool.blocks[block].vertices.buffer, pool.blocks[block].indices.buffer };
+	}
+
+	void geometry_bindings(GeometryPool& pool, std::vector<GeometryBinding>& out) {
+		std::lock_guard guard(pool.lock);
+		out.clear();
+		for (auto& block : pool.blocks) {
+			out.push_back({ block.vertices.buffer, block.indices.buffer });
+		}
+	}
+
+	VkDeviceSize vertex_offset(const GeometryPool& pool, const GeometryRange& range) {
+		return (VkDeviceSize)range.first_vertex * pool.vertex_stride;
+	}
+
+	VkDeviceSize index_offset(const GeometryRange& range) {
+		return (VkDeviceSize)range.first_index * sizeof(u32);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <vector>
+#include <vk_mem_alloc.h>
+#include "zebratypes.h"
+#include "g_buffer.h"
+
+namespace zebra {
+	/* best fit over a free list of [offset, offset + size) ranges. freed ranges merge with
+	* their free neighbours, so the pool does not fall apart into slivers as meshes come and go */
+	struct RangeAllocator {
+		u64 capacity = 0;
+		u64 used = 0;
+		// the same free ranges twice, by offset for merging and by size for the best fit
+		std::map<u64, u64> free_offsets;
+		std::multimap<u64, u64> free_sizes;
+	};
+
+	void init_ranges(RangeAllocator& ranges, u64 capacity);
+	/// @return false if no free range is large enough
+	bool allocate_range(RangeAllocator& ranges, u64 size, u64& offset);
+	void free_range(RangeAllocator& ranges, u64 offset, u64 size);
+	/// @brief [ranges.capacity, capacity) becomes free, merged with a free range at the old end
+	void grow_ranges(RangeAllocator& ranges, u64 capacity);
+	/// @brief the largest single allocation that would still succeed
+	u64 largest_range(const RangeAllocator& ranges);
+
+	/// @brief where a mesh lives in the pool. offsets and counts are in vertices and indices
+	struct GeometryRange {
+		u32 block = 0;
+		u32 first_vertex = 0;
+		u32 vertex_count = 0;
+		u32 first_index = 0;
+		u32 index_count = 0;
+	};
+
+	/// @brief one device local vertex buffer and one index buffer, shared by every mesh placed in them
+	struct GeometryBlock {
+		AllocBuffer vertices;
+		AllocBuffer indices;
+		RangeAllocator vertex_ranges;
+		RangeAllocator index_ranges;
+	};
+
+	/* all mesh geometry in a few large buffers. draws address their mesh through firstIndex and
+	* vertexOffset, so the buffers are bound once per pass instead of once per draw.
+	* a new block is only added when a mesh does not fit into any existing one */
+	struct GeometryPool {
+		VmaAllocator allocator = VK_NULL_HANDLE;
+		u32 vertex_stride = 0;
+		u64 block_vertices = 1 << 20;
+		u64 block_indices = 1 << 22;
+
+		// meshes are placed on the loading thread and freed on the recording thread
+		std::mutex lock;
+		std::vector<GeometryBlock> blocks;
+	};
+
+	struct GeometryBinding {
+		VkBuffer vertices;
+		VkBuffer indices;
+	};
+
+	void init_pool(GeometryPool& pool, VmaAllocator allocator, u32 vertex_stride);
+	/// @brief reserves room for a mesh, its data still has to be copied into the returned range
+	GeometryRange allocate_geometry(GeometryPool& pool, u32 vertex_count, u32 index_count);
+	/// @brief the gpu must be done with the range
+	void free_geometry(GeometryPool& pool, const GeometryRange& range);
+	void destroy_pool(GeometryPool& pool);
+	GeometryBinding geometry_binding(GeometryPool& pool, u32 block);
+	/// @brief the buffers of every block by index, so recording does not have to hold the lock
+	void geometry_bindings(GeometryPool& pool, std::vector<GeometryBinding>& out);
+
+	VkDeviceSize vertex_offset(const GeometryPool& pool, const GeometryRange& range);
+	VkDeviceSize index_offset(const GeometryRange& range);
+}
@@ -0,0 +1,132 @@
+#include "g_hiz.h"
+#include <algorithm>
+#include <bit>
+#include "vki.h"
+#include "z_debug.h"
+
+namespace zebra {
+	namespace render {
+		constexpr VkFormat HIZ_FORMAT = VK_FORMAT_R32_SFLOAT;
+
+		// hiz_reduce.comp
+		struct HiZReduceConstants {
+			i32 source_size[2];
+			i32 destination_size[2];
+			u32 from_depth;
+		};
+
+		HiZPyramid create_pyramid(VkDevice device, VmaAllocator allocator, VkExtent2D depth_extent) {
+			HiZPyramid pyramid;
+			pyramid.extent = {
+				std::bit_floor(std::max(depth_extent.width, 1u)),
+				std::bit_floor(std::max(depth_extent.height, 1u)),
+			};
+			pyramid.levels = std::min((u32)std::bit_width(std::max(pyramid.extent.width, pyramid.extent.height)), MAX_HIZ_LEVELS);
+
+			auto image_info = vki::image_create_info(HIZ_FORMAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, { pyramid.extent.width, pyramid.extent.height, 1 });
+			image_info.mipLevels = pyramid.levels;
+			VmaAllocationCreateInfo alloc_info = {
+				.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+			};
+			VK_CHECK(vmaCreateImage(allocator, &image_info, &alloc_info, &pyramid.image, &pyramid.allocation, nullptr));
+
+			auto view_info = vki::imageview_create_info(HIZ_FORMAT, pyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+			view_info.subresourceRange.levelCount = pyramid.levels;
+			VK_CHECK(vkCreateImageView(device, &view_info, nullptr, &pyramid.view));
+			view_info.subresourceRange.levelCount = 1;
+			for (auto level = 0u; level < pyramid.levels; level++) {
+				view_info.subresourceRange.baseMipLevel = level;
+				VK_CHECK(vkCreateImageView(device, &view_info, nullptr, &pyramid.level_views[level]));
+			}
+			DBG("hiz pyramid " << pyramid.extent.width << "x" << pyramid.extent.height << ", " << pyramid.levels << " levels");
+			return pyramid;
+		}
+
+		void destroy_pyramid(HiZPyramid& pyramid, FrameDeletionQueue& deferred, u64 value) {
+			if (pyramid.image == VK_NULL_HANDLE) return;
+			defer_destroy(deferred, value, pyramid.view);
+			for (auto level = 0u; level < pyramid.levels; level++) {
+				defer_destroy(deferred, value, pyramid.level_views[level]);
+			}
+			defer_destroy(deferred, value, pyramid.image);
+			defer_destroy(deferred, value, pyramid.allocation);
+			pyramid = {};
+		}
+
+		static VkImageMemoryBarrier pyramid_barrier(const HiZPyramid& pyramid, VkAccessFlags src, VkAccessFlags dst, VkImageLayout from, VkImageLayout to) {
+			return {
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				.srcAccessMask = src,
+				.dstAccessMask = dst,
+				.oldLayout = from,
+				.newLayout = to,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = pyramid.image,
+				.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramid.levels, 0, 1 },
+			};
+		}
+
+		void prepare_pyramid(HiZPyramid& pyramid, VkCommandBuffer cmd) {
+			if (!pyramid.fresh) return;
+			auto barrier = pyramid_barrier(pyramid, 0, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			pyramid.fresh = false;
+		}
+
+		void build_pyramid(HiZPyramid& pyramid, VkCommandBuffer cmd, const ComputeProgram& reduce, VkImageView depth_view, VkSampler sampler, VkExtent2D area,
+			VkDevice device, VkDescriptorPool pool, DescriptorLayoutCache& dcache) {
+			// every texel of every level is written, so the old contents go. the readers of the last frame still have to be done
+			auto to_general = pyramid_barrier(pyramid, 0, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &to_general);
+			pyramid.fresh = false;
+
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.pipeline);
+			VkExtent2D source = area;
+			for (auto level = 0u; level < pyramid.levels; level++) {
+				VkExtent2D destination = { std::max(pyramid.extent.width >> level, 1u), std::max(pyramid.extent.height >> level, 1u) };
+
+				VkDescriptorImageInfo depth_info = {
+					.sampler = sampler,
+					.imageView = depth_view,
+					.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				};
+				VkDescriptorImageInfo source_info = {
+					.imageView = pyramid.level_views[level > 0 ? level - 1 : 0],
+					.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+				};
+				VkDescriptorImageInfo destination_info = {
+					.imageView = pyramid.level_views[level],
+					.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+				};
+				VkDescriptorSet set;
+				DescriptorBuilder::begin(device, pool, dcache)
+					.bind_image(0, depth_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_image(1, source_info, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_image(2, destination_info, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT)
+					.build(set);
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, reduce.layout, 0, 1, &set, 0, nullptr);
+
+				HiZReduceConstants constants = {
+					.source_size = { (i32)source.width, (i32)source.height },
+					.destination_size = { (i32)destination.width, (i32)destination.height },
+					.from_depth = level == 0,
+				};
+				vkCmdPushConstants(cmd, reduce.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+				vkCmdDispatch(cmd, (destination.width + 7) / 8, (destination.height + 7) / 8, 1);
+
+				// the next level reads this one
+				VkMemoryBarrier written = {
+					.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+					.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+					.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+				};
+				vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &written, 0, nullptr, 0, nullptr);
+				source = destination;
+			}
+
+			auto to_read = pyramid_barrier(pyramid, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &to_read);
+		}
+	}
+}
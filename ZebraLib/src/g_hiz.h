@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+#include "zebratypes.h"
+#include "g_descriptorset.h"
+#include "g_deletion.h"
+#include "g_pipeline.h"
+
+namespace zebra {
+	namespace render {
+		constexpr u32 MAX_HIZ_LEVELS = 16;
+
+		/* farthest depth pyramid of the scene, rebuilt every frame from scene_depth. level 0 is the power
+		* of two below the depth target, so every level below it halves exactly. it only covers the part of
+		* the depth target that was rendered, uv 0..1 is the render area.
+		* between builds it rests in SHADER_READ_ONLY_OPTIMAL */
+		struct HiZPyramid {
+			VkImage image = VK_NULL_HANDLE;
+			VmaAllocation allocation = VK_NULL_HANDLE;
+			// every level, sampled
+			VkImageView view = VK_NULL_HANDLE;
+			// one per level, written by the reduction
+			std::array<VkImageView, MAX_HIZ_LEVELS> level_views{};
+			VkExtent2D extent{};
+			u32 levels = 0;
+			// never transitioned, still UNDEFINED
+			bool fresh = true;
+		};
+
+		HiZPyramid create_pyramid(VkDevice device, VmaAllocator allocator, VkExtent2D depth_extent);
+		void destroy_pyramid(HiZPyramid& pyramid, FrameDeletionQueue& deferred, u64 value);
+		/// @brief moves a fresh pyramid into its resting layout, for readers that come before the first build
+		void prepare_pyramid(HiZPyramid& pyramid, VkCommandBuffer cmd);
+		/// @param depth_view sampled in SHADER_READ_ONLY_OPTIMAL, area is the part of it rendered this frame
+		void build_pyramid(HiZPyramid& pyramid, VkCommandBuffer cmd, const ComputeProgram& reduce, VkImageView depth_view, VkSampler sampler, VkExtent2D area,
+			VkDevice device, VkDescriptorPool pool, DescriptorLayoutCache& dcache);
+	}
+}
@@ -1,7 +1,11 @@
 #include "g_mesh.h"
+#include "g_simplify.h"
+#include "z_debug.h"
 #include <tiny_obj_loader.h>
 #include <iostream>
 #include <filesystem>
+#include <unordered_map>
+#include <numeric>
 
 namespace zebra {
 	bool LocalMesh::load_from_obj(const char* file) {
@@ -23,6 +27,19 @@ namespace zebra {
 			return false;
 		}
 
+		// obj indexes position, normal and uv separately, a vertex is one combination of the three
+		struct ObjIndexHash {
+			size_t operator()(const tinyobj::index_t& idx) const {
+				return std::hash<u64>()((u64)(u32)idx.vertex_index << 32 ^ (u64)(u32)idx.normal_index << 16 ^ (u32)idx.texcoord_index);
+			}
+		};
+		struct ObjIndexEqual {
+			bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const {
+				return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+			}
+		};
+		std::unordered_map<tinyobj::index_t, u32, ObjIndexHash, ObjIndexEqual> unique_vertices;
+
 		for (size_t s = 0; s < shapes.size(); s++) {
 			size_t index_offset = 0;
 			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
@@ -33,6 +50,9 @@ namespace zebra {
 				for (size_t v = 0; v < fv; v++) {
 					// access to vertex
 					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+					auto [known, inserted] = unique_vertices.try_emplace(idx, (u32)_vertices.size());
+					_indices.push_back(known->second);
+					if (!inserted) continue;
 
 					//vertex position
 					tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
@@ -69,4 +89,72 @@ namespace zebra {
 		}
 		return true;
 	}
+
+	glm::vec4 LocalMesh::bounding_sphere() const {
+		if (_vertices.empty()) return glm::vec4(0.f);
+
+		glm::vec3 lo = _vertices[0].pos;
+		glm::vec3 hi = _vertices[0].pos;
+		for (auto& v : _vertices) {
+			lo = glm::min(lo, v.pos);
+			hi = glm::max(hi, v.pos);
+		}
+
+		glm::vec3 center = (lo + hi) * 0.5f;
+		float radius2 = 0.f;
+		for (auto& v : _vertices) {
+			glm::vec3 d = v.pos - center;
+			radius2 = glm::max(radius2, glm::dot(d, d));
+		}
+		return glm::vec4(center, glm::sqrt(radius2));
+	}
+
+	void LocalMesh::generate_lods() {
+		if (_indices.empty()) {
+			_indices.resize(_vertices.size());
+			std::iota(_indices.begin(), _indices.end(), 0u);
+		}
+		_lods = { { 0, (u32)_indices.size(), 0.f } };
+
+		std::vector<glm::vec3> positions(_vertices.size());
+		for (auto i = 0ull; i < _vertices.size(); i++) {
+			positions[i] = _vertices[i].pos;
+		}
+		// no single collapse may move the surface by more than a tenth of the mesh
+		float max_error = bounding_sphere().w * 0.1f;
+
+		std::vector<u32> level(_indices.begin(), _indices.end());
+		float error = 0.f;
+		while (_lods.size() < MAX_LODS) {
+			float level_error;
+			auto coarser = simplify_mesh(level, positions, level.size() / 6 * 3, max_error, level_error);
+			// not worth a level of its own
+			if (coarser.size() > level.size() * 0.85) break;
+
+			// every level is simplified from the one before, so their errors add up
+			error += level_error;
+			_lods.push_back({ (u32)_indices.size(), (u32)coarser.size(), error });
+			_indices.insert(_indices.end(), coarser.begin(), coarser.end());
+			level = std::move(coarser);
+		}
+		DBG(_lods.size() << " lods, " << _lods.back().index_count / 3 << " triangles at error " << _lods.back().error);
+	}
+
+	void LocalMesh::generate_meshlets() {
+		if (_indices.empty()) {
+			_indices.resize(_vertices.size());
+			std::iota(_indices.begin(), _indices.end(), 0u);
+		}
+		// coarser levels are only picked far away, they are drawn whole
+		u64 count = _lods.empty() ? _indices.size() : _lods[0].index_count;
+
+		std::vector<glm::vec3> positions(_vertices.size());
+		std::vector<glm::vec3> normals(_vertices.size());
+		for (auto i = 0ull; i < _vertices.size(); i++) {
+			positions[i] = _vertices[i].pos;
+			normals[i] = _vertices[i].normal;
+		}
+		_meshlets = build_meshlets(std::span<u32>(_indices).first(count), positions, normals);
+		DBG(_meshlets.size() << " meshlets for " << count / 3 << " triangles");
+	}
 }
\ No newline at end of file
@@ -1,14 +1,37 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 #include "g_types.h"
 #include "g_buffer.h"
+#include "g_pipeline.h"
+#include "g_geometry.h"
+#include "g_meshlet.h"
 #include <filesystem>
+#include <array>
 
 namespace zebra {
+	constexpr u32 NO_TEXTURE = ~0u;
+
 	struct Material {
 		VkDescriptorSet texture_set{ VK_NULL_HANDLE };
 		VkPipeline pipeline;
 		VkPipelineLayout pipeline_layout;
+		// -- depth prepass variants, both on the same layout. null if the material does not take part
+		VkPipeline depth_pipeline{ VK_NULL_HANDLE };
+		// shades after the prepass: depth EQUAL without writes, alpha test already happened
+		VkPipeline equal_pipeline{ VK_NULL_HANDLE };
+		// set before drawing with the matching pipeline. with extended dynamic state the variants
+		// often share one pipeline and only these differ
+		RasterState state;
+		RasterState depth_state;
+		RasterState equal_state;
+		// variants still compiling or that failed to, the material draws as the fallback material until this is 0
+		u8 pending_pipelines = 0;
+		// slots in the material and texture tables, what instances refer to on the gpu
+		u32 table_index = 0;
+		u32 texture_index = NO_TEXTURE;
+		// stages of the layout's push constant range, every push has to name all of them
+		VkShaderStageFlags push_stages = 0;
 	};
 
 	struct MeshPushConstants {
@@ -16,20 +39,80 @@ namespace zebra {
 		glm::mat4 render_matrix;
 	};
 
+	struct CompositePushConstants {
+		// part of the scene texture that was rendered to
+		glm::vec2 uv_scale;
+		float sharpness;
+		float pad;
+	};
+
+	constexpr u32 MAX_LODS = 4;
+
+	/// @brief one level of detail, a range of the mesh's indices over the same vertices
+	struct MeshLod {
+		u32 first_index;
+		u32 index_count;
+		// local space, how far this level may be from the full mesh
+		float error;
+	};
+
 	struct LocalMesh {
 		std::vector<P3N3C3U2> _vertices;
+		// empty for plain triangle lists
+		std::vector<u32> _indices;
+		// filled by generate_lods, coarser levels are appended to _indices
+		std::vector<MeshLod> _lods;
+		// filled by generate_meshlets, over the finest level only
+		std::vector<Meshlet> _meshlets;
 		bool load_from_obj(const char* file);
+		/// @return xyz center, w radius
+		glm::vec4 bounding_sphere() const;
+		/// @brief simplifies into up to MAX_LODS levels, each about half of the one before
+		void generate_lods();
+		/// @brief reorders the finest level into clusters that are culled one by one, for large static meshes
+		void generate_meshlets();
 	};
 
 	struct Mesh {
-		size_t size;
-		AllocBuffer vertices;
+		// vertices and indices in the geometry pool, every lod
+		GeometryRange geometry;
+		// local space, xyz center, w radius
+		glm::vec4 bounds;
+		// finest first, first_index is relative to geometry
+		std::array<MeshLod, MAX_LODS> lods{};
+		u32 lod_count = 1;
+		// Meshlet array on the gpu, empty unless the mesh was clustered. clusters replace lod 0
+		AllocBuffer clusters{};
+		u32 cluster_count = 0;
 	};
 
-	struct GPUObjectData {
+	// what gameplay and the sim write, packed into GPUObjectData when batches are built
+	struct ObjectData {
 		glm::mat4 model_matrix;
 		glm::vec4 color;
 	};
-	
-	static_assert(sizeof(GPUObjectData) == 80);
+
+	/* per instance, read by the vertex shaders. the model matrix is affine, so only its
+	* first three rows go up (transposed, one vec4 each). color is rgba8 */
+	struct GPUObjectData {
+		glm::vec4 model_rows[3];
+		u32 color;
+		// slots in the material and texture tables
+		u32 material_index;
+		u32 texture_index;
+		u32 pad;
+	};
+
+	static_assert(sizeof(GPUObjectData) == 64);
+
+	inline GPUObjectData pack_object(const ObjectData& obj, u32 material_index, u32 texture_index) {
+		auto rows = glm::transpose(obj.model_matrix);
+		return {
+			.model_rows = { rows[0], rows[1], rows[2] },
+			.color = glm::packUnorm4x8(obj.color),
+			.material_index = material_index,
+			.texture_index = texture_index,
+			.pad = 0,
+		};
+	}
 }
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include "g_meshlet.h"
+#include <algorithm>
+#include <numeric>
+#include <limits>
+
+namespace zebra {
+	// 10 bits spread out to every third of 30
+	static u32 spread_bits(u32 v) {
+		v = (v | (v << 16)) & 0x030000FF;
+		v = (v | (v << 8)) & 0x0300F00F;
+		v = (v | (v << 4)) & 0x030C30C3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+
+	static Meshlet meshlet_bounds(std::span<const u32> cluster, std::span<const glm::vec3> positions, std::span<const glm::vec3> normals) {
+		glm::vec3 lo(std::numeric_limits<float>::max());
+		glm::vec3 hi(std::numeric_limits<float>::lowest());
+		for (auto index : cluster) {
+			lo = glm::min(lo, positions[index]);
+			hi = glm::max(hi, positions[index]);
+		}
+		glm::vec3 center = (lo + hi) * 0.5f;
+		float radius2 = 0.f;
+		for (auto index : cluster) {
+			glm::vec3 d = positions[index] - center;
+			radius2 = glm::max(radius2, glm::dot(d, d));
+		}
+
+		// face normals, turned to the side the vertex normals are on. degenerate triangles have none
+		std::vector<glm::vec3> faces;
+		glm::vec3 sum(0.f);
+		for (auto t = 0ull; t + 2 < cluster.size(); t += 3) {
+			auto& a = positions[cluster[t]];
+			glm::vec3 n = glm::cross(positions[cluster[t + 1]] - a, positions[cluster[t + 2]] - a);
+			float length = glm::length(n);
+			if (length <= 1e-12f) continue;
+			n /= length;
+			if (!normals.empty() && glm::dot(n, normals[cluster[t]] + normals[cluster[t + 1]] + normals[cluster[t + 2]]) < 0.f) {
+				n = -n;
+			}
+			faces.push_back(n);
+			sum += n;
+		}
+
+		glm::vec4 cone(0.f, 0.f, 1.f, 1.f);
+		if (glm::length(sum) > 1e-6f) {
+			glm::vec3 axis = glm::normalize(sum);
+			float spread = 1.f;
+			for (auto& n : faces) {
+				spread = glm::min(spread, glm::dot(axis, n));
+			}
+			// past 90 degrees some triangle always faces the camera
+			if (spread > 0.f) {
+				cone = glm::vec4(axis, glm::sqrt(1.f - spread * spread));
+			}
+		}
+		return { glm::vec4(center, glm::sqrt(radius2)), cone, 0, (u32)cluster.size(), { 0, 0 } };
+	}
+
+	std::vector<Meshlet> build_meshlets(std::span<u32> indices, std::span<const glm::vec3> positions, std::span<const glm::vec3> normals) {
+		std::vector<Meshlet> meshlets;
+		const u32 triangle_count = (u32)(indices.size() / 3);
+		if (triangle_count == 0) return meshlets;
+
+		// -- morton order of the triangle centers inside the bounds
+		glm::vec3 lo(std::numeric_limits<float>::max());
+		glm::vec3 hi(std::numeric_limits<float>::lowest());
+		for (auto index : indices) {
+			lo = glm::min(lo, positions[index]);
+			hi = glm::max(hi, positions[index]);
+		}
+		glm::vec3 to_grid = 1023.f / glm::max(hi - lo, glm::vec3(1e-6f));
+		std::vector<u32> codes(triangle_count);
+		for (auto t = 0u; t < triangle_count; t++) {
+			glm::vec3 center = (positions[indices[t * 3]] + positions[indices[t * 3 + 1]] + positions[indices[t * 3 + 2]]) / 3.f;
+			glm::uvec3 cell = glm::clamp((center - lo) * to_grid, 0.f, 1023.f);
+			codes[t] = spread_bits(cell.x) | spread_bits(cell.y) << 1 | spread_bits(cell.z) << 2;
+		}
+		std::vector<u32> order(triangle_count);
+		std::iota(order.begin(), order.end(), 0u);
+		std::stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) { return codes[a] < codes[b]; });
+
+		// -- triangles around each vertex
+		std::vector<u32> adjacency_offsets(positions.size() + 1, 0);
+		for (auto index : indices) {
+			adjacency_offsets[index + 1]++;
+		}
+		std::partial_sum(adjacency_offsets.begin(), adjacency_offsets.end(), adjacency_offsets.begin());
+		std::vector<u32> adjacency(indices.size());
+		{
+			auto fill = adjacency_offsets;
+			for (auto i = 0ull; i < indices.size(); i++) {
+				adjacency[fill[indices[i]]++] = (u32)(i / 3);
+			}
+		}
+
+		// -- grow clusters
+		std::vector<u8> emitted(triangle_count, 0);
+		// cluster a vertex or candidate triangle was last seen in
+		std::vector<u32> vertex_cluster(positions.size(), ~0u);
+		std::vector<u32> candidate_cluster(triangle_count, ~0u);
+		std::vector<u32> candidates;
+		std::vector<u32> reordered;
+		reordered.reserve(indices.size());
+		u32 cursor = 0;
+
+		while (true) {
+			while (cursor < triangle_count && emitted[order[cursor]]) {
+				cursor++;
+			}
+			if (cursor == triangle_count) break;
+
+			const u32 id = (u32)meshlets.size();
+			const u64 first = reordered.size();
+			u32 vertices = 0;
+			u32 triangles = 0;
+			candidates.clear();
+
+			auto new_vertices = [&](u32 t) {
+				u32 a = indices[t * 3], b = indices[t * 3 + 1], c = indices[t * 3 + 2];
+				return (u32)(vertex_cluster[a] != id) + (u32)(vertex_cluster[b] != id && b != a) + (u32)(vertex_cluster[c] != id && c != a && c != b);
+			};
+			auto add = [&](u32 t) {
+				emitted[t] = 1;
+				triangles++;
+				for (auto corner = 0u; corner < 3; corner++) {
+					u32 v = indices[t * 3 + corner];
+					reordered.push_back(v);
+					if (vertex_cluster[v] == id) continue;
+					vertex_cluster[v] = id;
+					vertices++;
+					for (auto a = adjacency_offsets[v]; a < adjacency_offsets[v + 1]; a++) {
+						u32 neighbour = adjacency[a];
+						if (emitted[neighbour] || candidate_cluster[neighbour] == id) continue;
+						candidate_cluster[neighbour] = id;
+						candidates.push_back(neighbour);
+					}
+				}
+			};
+
+			add(order[cursor]);
+			while (triangles < MESHLET_MAX_TRIANGLES) {
+				// the connected triangle that brings the fewest new vertices, the oldest one on ties
+				u32 best = ~0u;
+				u32 best_cost = 4;
+				u64 kept = 0;
+				for (auto i = 0ull; i < candidates.size(); i++) {
+					u32 t = candidates[i];
+					if (emitted[t]) continue;
+					candidates[kept++] = t;
+					u32 cost = new_vertices(t);
+					if (cost < best_cost && vertices + cost <= MESHLET_MAX_VERTICES) {
+						best = t;
+						best_cost = cost;
+					}
+				}
+				candidates.resize(kept);
+
+				if (best == ~0u) {
+					// nothing connected fits, the next one in morton order is still close by
+					while (cursor < triangle_count && emitted[order[cursor]]) {
+						cursor++;
+					}
+					if (cursor == triangle_count || vertices + new_vertices(order[cursor]) > MESHLET_MAX_VERTICES) break;
+					best = order[cursor];
+				}
+				add(best);
+			}
+
+			auto meshlet = meshlet_bounds(std::span<const u32>(reordered).subspan(first), positions, normals);
+			meshlet.first_index = (u32)first;
+			meshlets.push_back(meshlet);
+		}
+
+		std::copy(reordered.begin(), reordered.end(), indices.begin());
+		return meshlets;
+	}
+}
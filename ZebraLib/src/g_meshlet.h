@@ -0,0 +1,33 @@
+#pragma once
+#include <span>
+#include <vector>
+#include <glm/glm.hpp>
+#include "zebratypes.h"
+
+namespace zebra {
+	constexpr u32 MESHLET_MAX_VERTICES = 64;
+	constexpr u32 MESHLET_MAX_TRIANGLES = 124;
+
+	/* a small patch of triangles that is culled on its own, its indices are one range of the mesh's.
+	* the layout is what cluster_cull.comp reads */
+	struct Meshlet {
+		// object space, xyz center, w radius
+		glm::vec4 sphere;
+		// xyz the axis every triangle normal is close to, w the sine of how far they spread.
+		// w is 1 when they spread too far for the cluster to ever face away as a whole
+		glm::vec4 cone;
+		// relative to the mesh's indices
+		u32 first_index;
+		u32 index_count;
+		u32 pad[2];
+	};
+
+	static_assert(sizeof(Meshlet) == 48);
+
+	/* greedy clustering. triangles are visited in morton order of their centers, a cluster grows over
+	* shared vertices first and takes the next unvisited triangle in that order when nothing connected fits,
+	* so meshes made of disconnected quads still get compact clusters.
+	* the indices are reordered in place, cluster after cluster */
+	/// @param normals per vertex, only decide which side of a triangle is its front
+	std::vector<Meshlet> build_meshlets(std::span<u32> indices, std::span<const glm::vec3> positions, std::span<const glm::vec3> normals);
+}
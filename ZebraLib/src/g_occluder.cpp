@@ -0,0 +1,333 @@
+#include "g_occluder.h"
+#include "g_bvh.h"
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ZEBRA_SOFT_SSE 1
+#endif
+
+namespace zebra {
+	// either side, infinite on a miss
+	static float ray_triangle(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) {
+		glm::vec3 e1 = p1 - p0;
+		glm::vec3 e2 = p2 - p0;
+		glm::vec3 p = glm::cross(dir, e2);
+		float det = glm::dot(e1, p);
+		if (std::abs(det) < 1e-12f) return std::numeric_limits<float>::infinity();
+		glm::vec3 s = origin - p0;
+		float u = glm::dot(s, p) / det;
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(dir, q) / det;
+		if (u < 0.f || v < 0.f || u + v > 1.f) return std::numeric_limits<float>::infinity();
+		float t = glm::dot(e2, q) / det;
+		return t >= 0.f ? t : std::numeric_limits<float>::infinity();
+	}
+
+	/* a lod spans dips of the mesh and sits in front of them, where it would hide parts of the mesh that are in view.
+	* points spread over each triangle look into the mesh along the triangle's normal. if the first surface they
+	* meet is one they enter, they are outside and the triangle goes. what is left lies inside the mesh or on it,
+	* so it can only hide what the mesh hides too, and the holes only hide less */
+	static void drop_outside(OccluderMesh& occluder, std::span<const u32> source, const LocalMesh& mesh, float error) {
+		std::span<const u32> finest = mesh._indices;
+		if (!mesh._lods.empty()) finest = finest.subspan(mesh._lods[0].first_index, mesh._lods[0].index_count);
+		const auto count = (u32)finest.size() / 3;
+		if (count == 0) return;
+
+		std::vector<u32> ids(count);
+		std::vector<Aabb> bounds(count);
+		std::vector<glm::vec3> outward(count);
+		float edges = 0.f;
+		for (auto t = 0u; t < count; t++) {
+			ids[t] = t;
+			auto* index = &finest[t * 3];
+			glm::vec3 normal(0.f);
+			for (auto c = 0; c < 3; c++) {
+				auto& vertex = mesh._vertices[index[c]];
+				bounds[t].lo = glm::min(bounds[t].lo, vertex.pos);
+				bounds[t].hi = glm::max(bounds[t].hi, vertex.pos);
+				normal += vertex.normal;
+				edges += glm::length(mesh._vertices[index[(c + 1) % 3]].pos - vertex.pos);
+			}
+			outward[t] = normal;
+		}
+		Bvh bvh;
+		build_bvh(bvh, ids, bounds);
+		const float spacing = edges / (count * 3);
+		// vertices the lod kept sit right on the mesh
+		const float slack = 0.01f * error;
+
+		auto outside = [&](const glm::vec3& point, const glm::vec3& into) {
+			float reach = 4.f * error;
+			auto hit = query_ray(bvh, point, into, reach, [&](u32 t, float) {
+				auto* index = &finest[t * 3];
+				return ray_triangle(point, into, mesh._vertices[index[0]].pos, mesh._vertices[index[1]].pos, mesh._vertices[index[2]].pos);
+				});
+			// nothing within a few times the error, deep inside
+			if (hit == ~0u) return false;
+			return reach > slack && glm::dot(outward[hit], into) < 0.f;
+		};
+
+		u32 kept = 0;
+		for (u32 t = 0; t < (u32)occluder.indices.size() / 3; t++) {
+			auto* index = &occluder.indices[t * 3];
+			const glm::vec3 corners[3] = { occluder.positions[index[0]], occluder.positions[index[1]], occluder.positions[index[2]] };
+			auto face = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			if (glm::dot(face, face) == 0.f) continue;
+			glm::vec3 normal(0.f);
+			for (auto c = 0; c < 3; c++) normal += mesh._vertices[source[index[c]]].normal;
+			face = glm::normalize(face);
+			auto into = glm::dot(face, normal) > 0.f ? -face : face;
+
+			// about one point per triangle of the mesh it stands for
+			float longest = std::max({ glm::length(corners[1] - corners[0]), glm::length(corners[2] - corners[1]), glm::length(corners[0] - corners[2]) });
+			u32 steps = std::clamp((u32)std::ceil(longest / spacing), 1u, 16u);
+			bool out = false;
+			for (u32 i = 0; i <= steps && !out; i++) {
+				for (u32 j = 0; i + j <= steps && !out; j++) {
+					float u = (float)i / steps;
+					float v = (float)j / steps;
+					out = outside(corners[0] + u * (corners[1] - corners[0]) + v * (corners[2] - corners[0]), into);
+				}
+			}
+			if (out) continue;
+			for (auto c = 0; c < 3; c++) {
+				occluder.indices[kept * 3 + c] = index[c];
+			}
+			kept++;
+		}
+		occluder.indices.resize(kept * 3);
+	}
+
+	OccluderMesh make_occluder(const LocalMesh& mesh, u32 max_triangles) {
+		OccluderMesh occluder;
+		std::span<const u32> indices = mesh._indices;
+		float error = 0.f;
+		if (!mesh._lods.empty()) {
+			// finest to coarsest, the coarsest is taken when none fits
+			auto lod = mesh._lods.back();
+			for (auto& level : mesh._lods) {
+				if (level.index_count / 3 <= max_triangles) {
+					lod = level;
+					break;
+				}
+			}
+			indices = indices.subspan(lod.first_index, lod.index_count);
+			error = lod.error;
+		}
+
+		std::vector<u32> remap(mesh._vertices.size(), ~0u);
+		// by occluder vertex, the mesh vertex
+		std::vector<u32> source;
+		auto add = [&](u32 index) {
+			if (remap[index] == ~0u) {
+				remap[index] = (u32)occluder.positions.size();
+				occluder.positions.push_back(mesh._vertices[index].pos);
+				source.push_back(index);
+			}
+			occluder.indices.push_back(remap[index]);
+		};
+		if (indices.empty()) {
+			// plain triangle list
+			for (auto i = 0u; i < (u32)mesh._vertices.size(); i++) {
+				add(i);
+			}
+		} else {
+			for (auto index : indices) {
+				add(index);
+			}
+		}
+		if (error > 0.f) {
+			drop_outside(occluder, source, mesh, error);
+		}
+		return occluder;
+	}
+
+	/* edge functions and depth as planes over pixel coordinates, a*x + b*y + c.
+	* a pixel is covered when its center is on the positive side of all three edges */
+	struct ScreenTriangle {
+		float edge_a[3];
+		float edge_b[3];
+		float edge_c[3];
+		float z_a;
+		float z_b;
+		float z_c;
+		// pixels whose centers can be covered, empty for dropped triangles
+		i32 min_x;
+		i32 max_x;
+		i32 min_y;
+		i32 max_y;
+	};
+
+	static ScreenTriangle setup_triangle(const glm::mat4& mvp, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2) {
+		ScreenTriangle tri{};
+		tri.min_y = 1;
+		tri.max_y = 0;
+
+		glm::vec3 v[3];
+		const glm::vec3* corners[3] = { &p0, &p1, &p2 };
+		for (u32 i = 0; i < 3; i++) {
+			glm::vec4 clip = mvp * glm::vec4(*corners[i], 1.f);
+			if (clip.w <= 1e-5f || clip.z < 0.f) return tri;
+			glm::vec3 ndc = glm::vec3(clip) / clip.w;
+			v[i] = { (ndc.x * 0.5f + 0.5f) * SOFT_DEPTH_WIDTH, (ndc.y * 0.5f + 0.5f) * SOFT_DEPTH_HEIGHT, std::min(ndc.z, 1.f) };
+		}
+
+		// counter clockwise on screen, both sides of an occluder hide things
+		float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+		if (std::abs(area) < 1e-8f) return tri;
+		if (area < 0.f) {
+			std::swap(v[1], v[2]);
+			area = -area;
+		}
+
+		glm::vec3 lo = glm::min(glm::min(v[0], v[1]), v[2]);
+		glm::vec3 hi = glm::max(glm::max(v[0], v[1]), v[2]);
+		if (lo.z > 1.f) return tri;
+		i32 min_x = std::max((i32)std::ceil(lo.x - 0.5f), 0);
+		i32 max_x = std::min((i32)std::floor(hi.x - 0.5f), (i32)SOFT_DEPTH_WIDTH - 1);
+		i32 min_y = std::max((i32)std::ceil(lo.y - 0.5f), 0);
+		i32 max_y = std::min((i32)std::floor(hi.y - 0.5f), (i32)SOFT_DEPTH_HEIGHT - 1);
+		if (min_x > max_x || min_y > max_y) return tri;
+
+		// edge i is opposite vertex i, so it weighs that vertex's depth
+		for (u32 i = 0; i < 3; i++) {
+			auto& a = v[(i + 1) % 3];
+			auto& b = v[(i + 2) % 3];
+			tri.edge_a[i] = a.y - b.y;
+			tri.edge_b[i] = b.x - a.x;
+			tri.edge_c[i] = -(tri.edge_a[i] * a.x + tri.edge_b[i] * a.y);
+			tri.z_a += tri.edge_a[i] * v[i].z / area;
+			tri.z_b += tri.edge_b[i] * v[i].z / area;
+			tri.z_c += tri.edge_c[i] * v[i].z / area;
+		}
+		tri.min_x = min_x;
+		tri.max_x = max_x;
+		tri.min_y = min_y;
+		tri.max_y = max_y;
+		return tri;
+	}
+
+	static void rasterize_row(float* row, const ScreenTriangle& tri, i32 y) {
+		const float py = (float)y + 0.5f;
+		float row_c[3];
+		for (u32 i = 0; i < 3; i++) {
+			row_c[i] = tri.edge_b[i] * py + tri.edge_c[i];
+		}
+		const float z_c = tri.z_b * py + tri.z_c;
+		// from the first four pixels the triangle is in, the width is a multiple of four so the last group still fits
+		const i32 first = tri.min_x & ~3;
+#ifdef ZEBRA_SOFT_SSE
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 step = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		for (i32 x = first; x <= tri.max_x; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), step);
+			__m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edge_a[0]), px), _mm_set1_ps(row_c[0]));
+			__m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edge_a[1]), px), _mm_set1_ps(row_c[1]));
+			__m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edge_a[2]), px), _mm_set1_ps(row_c[2]));
+			__m128 covered = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+			if (_mm_movemask_ps(covered) == 0) continue;
+			__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.z_a), px), _mm_set1_ps(z_c));
+			__m128 depth = _mm_loadu_ps(row + x);
+			depth = _mm_or_ps(_mm_and_ps(covered, _mm_min_ps(depth, z)), _mm_andnot_ps(covered, depth));
+			_mm_storeu_ps(row + x, depth);
+		}
+#else
+		for (i32 x = first; x <= tri.max_x; x++) {
+			float px = (float)x + 0.5f;
+			if (tri.edge_a[0] * px + row_c[0] < 0.f || tri.edge_a[1] * px + row_c[1] < 0.f || tri.edge_a[2] * px + row_c[2] < 0.f) continue;
+			row[x] = std::min(row[x], tri.z_a * px + z_c);
+		}
+#endif
+	}
+
+	void rasterize_occluders(SoftDepth& target, std::span<const OccluderDraw> draws, const glm::mat4& viewproj, JobSystem& jobs) {
+		target.depth.assign(SOFT_DEPTH_WIDTH * SOFT_DEPTH_HEIGHT, 1.f);
+		target.tile_far.assign(SOFT_TILES_X * SOFT_TILES_Y, 1.f);
+		target.triangles = 0;
+
+		// -- setup, every triangle of every draw in one range
+		std::vector<u64> offsets(draws.size() + 1, 0);
+		std::vector<glm::mat4> mvps(draws.size());
+		for (auto d = 0ull; d < draws.size(); d++) {
+			offsets[d + 1] = offsets[d] + draws[d].mesh->indices.size() / 3;
+			mvps[d] = viewproj * draws[d].model;
+		}
+		std::vector<ScreenTriangle> triangles(offsets.back());
+		jobs.parallel_for(0, triangles.size(), jobs.grain_for(triangles.size(), 1024), [&](u64 lo, u64 hi) {
+			u64 d = std::upper_bound(offsets.begin(), offsets.end(), lo) - offsets.begin() - 1;
+			for (auto t = lo; t < hi; t++) {
+				while (t >= offsets[d + 1]) {
+					d++;
+				}
+				auto& mesh = *draws[d].mesh;
+				auto* index = &mesh.indices[(t - offsets[d]) * 3];
+				triangles[t] = setup_triangle(mvps[d], mesh.positions[index[0]], mesh.positions[index[1]], mesh.positions[index[2]]);
+			}
+			});
+		std::erase_if(triangles, [](const ScreenTriangle& tri) { return tri.min_y > tri.max_y; });
+		target.triangles = (u32)triangles.size();
+
+		// -- a band of tile rows per job, no two jobs write the same pixels
+		jobs.parallel_for(0, SOFT_TILES_Y, 1, [&](u64 lo, u64 hi) {
+			for (auto band = lo; band < hi; band++) {
+				const i32 top = (i32)(band * SOFT_TILE);
+				const i32 bottom = top + (i32)SOFT_TILE - 1;
+				for (auto& tri : triangles) {
+					if (tri.max_y < top || tri.min_y > bottom) continue;
+					for (i32 y = std::max(tri.min_y, top); y <= std::min(tri.max_y, bottom); y++) {
+						rasterize_row(&target.depth[y * SOFT_DEPTH_WIDTH], tri, y);
+					}
+				}
+
+				for (u32 tx = 0; tx < SOFT_TILES_X; tx++) {
+					float far = 0.f;
+					for (u32 y = 0; y < SOFT_TILE; y++) {
+						auto* row = &target.depth[(top + y) * SOFT_DEPTH_WIDTH + tx * SOFT_TILE];
+						far = std::max(far, *std::max_element(row, row + SOFT_TILE));
+					}
+					target.tile_far[band * SOFT_TILES_X + tx] = far;
+				}
+			}
+			});
+	}
+
+	bool sphere_occluded(const SoftDepth& target, const glm::mat4& viewproj, const glm::vec4& sphere) {
+		if (target.triangles == 0) return false;
+
+		// the screen rectangle of the sphere's box and its nearest depth, as the gpu tests it
+		glm::vec2 lo(std::numeric_limits<float>::max());
+		glm::vec2 hi(std::numeric_limits<float>::lowest());
+		float nearest = 1.f;
+		for (u32 i = 0; i < 8; i++) {
+			glm::vec3 corner = glm::vec3(sphere) + sphere.w * glm::vec3(i & 1 ? 1.f : -1.f, i & 2 ? 1.f : -1.f, i & 4 ? 1.f : -1.f);
+			glm::vec4 clip = viewproj * glm::vec4(corner, 1.f);
+			// reaches past the near plane, nothing can be in front of it
+			if (clip.w <= 0.f || clip.z < 0.f) return false;
+			glm::vec3 ndc = glm::vec3(clip) / clip.w;
+			lo = glm::min(lo, glm::vec2(ndc));
+			hi = glm::max(hi, glm::vec2(ndc));
+			nearest = std::min(nearest, ndc.z);
+		}
+
+		// every pixel the rectangle touches
+		i32 x0 = std::clamp((i32)std::floor((lo.x * 0.5f + 0.5f) * SOFT_DEPTH_WIDTH), 0, (i32)SOFT_DEPTH_WIDTH - 1);
+		i32 x1 = std::clamp((i32)std::ceil((hi.x * 0.5f + 0.5f) * SOFT_DEPTH_WIDTH) - 1, 0, (i32)SOFT_DEPTH_WIDTH - 1);
+		i32 y0 = std::clamp((i32)std::floor((lo.y * 0.5f + 0.5f) * SOFT_DEPTH_HEIGHT), 0, (i32)SOFT_DEPTH_HEIGHT - 1);
+		i32 y1 = std::clamp((i32)std::ceil((hi.y * 0.5f + 0.5f) * SOFT_DEPTH_HEIGHT) - 1, 0, (i32)SOFT_DEPTH_HEIGHT - 1);
+
+		for (i32 ty = y0 / (i32)SOFT_TILE; ty <= y1 / (i32)SOFT_TILE; ty++) {
+			for (i32 tx = x0 / (i32)SOFT_TILE; tx <= x1 / (i32)SOFT_TILE; tx++) {
+				// hidden under the whole tile
+				if (nearest > target.tile_far[ty * SOFT_TILES_X + tx]) continue;
+				for (i32 y = std::max(y0, ty * (i32)SOFT_TILE); y <= std::min(y1, ty * (i32)SOFT_TILE + (i32)SOFT_TILE - 1); y++) {
+					for (i32 x = std::max(x0, tx * (i32)SOFT_TILE); x <= std::min(x1, tx * (i32)SOFT_TILE + (i32)SOFT_TILE - 1); x++) {
+						if (target.depth[y * SOFT_DEPTH_WIDTH + x] >= nearest) return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <span>
+#include <vector>
+#include <glm/glm.hpp>
+#include "zebratypes.h"
+#include "z_jobs.h"
+#include "g_mesh.h"
+
+namespace zebra {
+	/// @brief cpu side triangles of a mesh that hides things, local space
+	struct OccluderMesh {
+		std::vector<glm::vec3> positions;
+		std::vector<u32> indices;
+	};
+
+	/* the finest lod of the mesh with at most max_triangles, only the vertices it uses.
+	* triangles of the lod that stick out of the mesh are dropped, it never hides what the mesh leaves in view */
+	OccluderMesh make_occluder(const LocalMesh& mesh, u32 max_triangles);
+
+	/// @brief an occluder as placed this frame
+	struct OccluderDraw {
+		const OccluderMesh* mesh;
+		glm::mat4 model;
+	};
+
+	// small enough to fill on the cpu every frame. the width is a multiple of four pixels, rows are rasterized four at a time
+	constexpr u32 SOFT_DEPTH_WIDTH = 256;
+	constexpr u32 SOFT_DEPTH_HEIGHT = 144;
+	constexpr u32 SOFT_TILE = 8;
+	constexpr u32 SOFT_TILES_X = SOFT_DEPTH_WIDTH / SOFT_TILE;
+	constexpr u32 SOFT_TILES_Y = SOFT_DEPTH_HEIGHT / SOFT_TILE;
+
+	/* nearest occluder depth per pixel over the whole screen, 0..1 like the depth buffer, 1 where nothing was drawn.
+	* every 8x8 tile also keeps the farthest of its pixels, most tests are answered by the tiles alone */
+	struct SoftDepth {
+		std::vector<float> depth;
+		std::vector<float> tile_far;
+		// what the last rasterize_occluders drew, after culling
+		u32 triangles = 0;
+	};
+
+	/* clears the buffer and draws the occluders. triangles are set up in parallel, then horizontal bands of tiles
+	* are rasterized on the workers. triangles that cross the near plane are dropped, leaving a hole is always safe */
+	void rasterize_occluders(SoftDepth& target, std::span<const OccluderDraw> draws, const glm::mat4& viewproj, JobSystem& jobs);
+	/// @return true if the screen rectangle of the sphere's box is behind occluders everywhere
+	bool sphere_occluded(const SoftDepth& target, const glm::mat4& viewproj, const glm::vec4& sphere);
+}
@@ -1,9 +1,117 @@
 #include "g_pipeline.h"
 #include "zebratypes.h"
 #include "vki.h"
+#include "z_debug.h"
 
 namespace zebra {
-	VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass) {
+	template<class T>
+	static void key_append(std::string& key, const T& value) {
+		key.append((const char*)&value, sizeof(T));
+	}
+
+	/* everything baked into the pipeline, field by field so padding stays out of it.
+	* state that is dynamic is left out, that is what lets variants collapse.
+	* empty if a module was never added to the cache */
+	static std::string pipeline_key(const PipelineBuilder& builder, PipelineCache& cache, const DynamicStateSupport& dynamic, const PipelineTarget& target) {
+		std::string key;
+		key.reserve(256);
+		for (auto& stage : builder._shader_stages) {
+			u64 code = cache.module_hash(stage.module);
+			if (code == 0) return {};
+			key_append(key, stage.stage);
+			key_append(key, code);
+			key.append(stage.pName);
+			key_append(key, (u8)0);
+			if (auto spec = stage.pSpecializationInfo) {
+				for (auto i = 0u; i < spec->mapEntryCount; i++) {
+					key_append(key, spec->pMapEntries[i].constantID);
+					key_append(key, spec->pMapEntries[i].offset);
+					key_append(key, (u64)spec->pMapEntries[i].size);
+				}
+				key.append((const char*)spec->pData, spec->dataSize);
+			}
+		}
+		auto& input = builder._vertex_input_info;
+		for (auto i = 0u; i < input.vertexBindingDescriptionCount; i++) {
+			auto& binding = input.pVertexBindingDescriptions[i];
+			key_append(key, binding.binding);
+			key_append(key, binding.stride);
+			key_append(key, binding.inputRate);
+		}
+		for (auto i = 0u; i < input.vertexAttributeDescriptionCount; i++) {
+			auto& attribute = input.pVertexAttributeDescriptions[i];
+			key_append(key, attribute.location);
+			key_append(key, attribute.binding);
+			key_append(key, attribute.format);
+			key_append(key, attribute.offset);
+		}
+
+		if (!dynamic.extended) {
+			key_append(key, builder._input_assembly.topology);
+			key_append(key, builder._rasterizer.cullMode);
+			key_append(key, builder._rasterizer.frontFace);
+			key_append(key, builder._depth_stencil.depthTestEnable);
+			key_append(key, builder._depth_stencil.depthWriteEnable);
+			key_append(key, builder._depth_stencil.depthCompareOp);
+		}
+		if (!dynamic.extended2) {
+			key_append(key, builder._rasterizer.depthBiasEnable);
+		}
+		if (!dynamic.extended3_polygon) {
+			key_append(key, builder._rasterizer.polygonMode);
+		}
+		if (!dynamic.extended3_blend) {
+			auto& blend = builder._color_blend_attachment;
+			key_append(key, blend.blendEnable);
+			key_append(key, blend.srcColorBlendFactor);
+			key_append(key, blend.dstColorBlendFactor);
+			key_append(key, blend.colorBlendOp);
+			key_append(key, blend.srcAlphaBlendFactor);
+			key_append(key, blend.dstAlphaBlendFactor);
+			key_append(key, blend.alphaBlendOp);
+			key_append(key, blend.colorWriteMask);
+		}
+		key_append(key, builder._input_assembly.primitiveRestartEnable);
+		key_append(key, builder._rasterizer.depthClampEnable);
+		key_append(key, builder._rasterizer.rasterizerDiscardEnable);
+		key_append(key, builder._rasterizer.lineWidth);
+		key_append(key, builder._rasterizer.depthBiasConstantFactor);
+		key_append(key, builder._rasterizer.depthBiasClamp);
+		key_append(key, builder._rasterizer.depthBiasSlopeFactor);
+		key_append(key, builder._multisampling.rasterizationSamples);
+		key_append(key, builder._multisampling.sampleShadingEnable);
+		key_append(key, builder._multisampling.alphaToCoverageEnable);
+		key_append(key, builder._depth_stencil.depthBoundsTestEnable);
+		key_append(key, builder._depth_stencil.stencilTestEnable);
+
+		key_append(key, builder._pipelineLayout);
+		key_append(key, target.pass);
+		key_append(key, target.subpass);
+		key_append(key, target.color_count);
+		for (auto i = 0u; i < target.color_count; i++) {
+			key_append(key, target.color_formats[i]);
+		}
+		key_append(key, target.depth_format);
+		return key;
+	}
+
+	VkPipeline PipelineBuilder::build_pipeline(VkDevice device, const PipelineTarget& target) {
+		const DynamicStateSupport no_dynamic_state;
+		auto& dynamic = _dynamic_state ? *_dynamic_state : no_dynamic_state;
+
+		std::string key;
+		if (_cache) {
+			key = pipeline_key(*this, *_cache, dynamic, target);
+		}
+		if (!key.empty()) {
+			std::lock_guard guard(_cache->lock);
+			_cache->requests++;
+			auto cached = _cache->cache.find(key);
+			if (cached != _cache->cache.end()) {
+				return cached->second;
+			}
+		}
+
 		//make viewport state from our stored viewport and scissor.
 		//at the moment we won't support multiple viewports or scissors
 		VkPipelineViewportStateCreateInfo viewport_state = {
@@ -22,22 +130,55 @@ namespace zebra {
 			.pNext = nullptr,
 			.logicOpEnable = VK_FALSE,
 			.logicOp = VK_LOGIC_OP_COPY,
-			.attachmentCount = 1,
+			.attachmentCount = target.pass != VK_NULL_HANDLE ? 1 : target.color_count,
 			.pAttachments = &_color_blend_attachment,
 		};
 
-		auto dynamic_states = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+		std::array<VkDynamicState, 16> dynamic_states;
+		u32 dynamic_count = 0;
+		dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_VIEWPORT;
+		dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_SCISSOR;
+		if (dynamic.extended) {
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT;
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_CULL_MODE_EXT;
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_FRONT_FACE_EXT;
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT;
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT;
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT;
+		}
+		if (dynamic.extended2) {
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_DEPTH_BIAS_ENABLE_EXT;
+		}
+#ifdef VK_EXT_extended_dynamic_state3
+		if (dynamic.extended3_polygon) {
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_POLYGON_MODE_EXT;
+		}
+		if (dynamic.extended3_blend) {
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT;
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT;
+			dynamic_states[dynamic_count++] = VK_DYNAMIC_STATE_COLOR_WRITE_MASK_EXT;
+		}
+#endif
 
 		VkPipelineDynamicStateCreateInfo dynamic_info = {
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
 			.pNext = nullptr,
-			.dynamicStateCount = (u32) dynamic_states.size(),
-			.pDynamicStates = dynamic_states.begin(),
+			.dynamicStateCount = dynamic_count,
+			.pDynamicStates = dynamic_states.data(),
+		};
+
+		// without a render pass the formats are all the pipeline needs to know
+		VkPipelineRenderingCreateInfoKHR rendering_info = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+			.colorAttachmentCount = target.color_count,
+			.pColorAttachmentFormats = target.color_formats.data(),
+			.depthAttachmentFormat = target.depth_format,
+			.stencilAttachmentFormat = VK_FORMAT_UNDEFINED,
 		};
 
 		VkGraphicsPipelineCreateInfo pipeline_info = {
 			.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-			.pNext = nullptr,
+			.pNext = target.pass != VK_NULL_HANDLE ? nullptr : &rendering_info,
 			.stageCount = (u32)_shader_stages.size(),
 			.pStages = _shader_stages.data(),
 			.pVertexInputState = &_vertex_input_info,
@@ -49,21 +190,189 @@ namespace zebra {
 			.pColorBlendState = &color_blending,
 			.pDynamicState = &dynamic_info,
 			.layout = _pipelineLayout,
-			.renderPass = pass,
-			.subpass = 0,
+			.renderPass = target.pass,
+			.subpass = target.subpass,
 			.basePipelineHandle = VK_NULL_HANDLE,
 		};
 
 
 
 		VkPipeline new_pipeline;
-		auto result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &new_pipeline);
+		auto result = vkCreateGraphicsPipelines(device, _cache ? _cache->driver_cache : VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &new_pipeline);
 
 		if (result != VK_SUCCESS) {
 			return VK_NULL_HANDLE;
-		} else {
-			return new_pipeline;
 		}
+		if (!key.empty()) {
+			std::lock_guard guard(_cache->lock);
+			auto [slot, inserted] = _cache->cache.emplace(std::move(key), new_pipeline);
+			// someone else built the same variant while we did, keep theirs
+			if (!inserted) {
+				vkDestroyPipeline(device, new_pipeline, nullptr);
+				return slot->second;
+			}
+		}
+		return new_pipeline;
+	}
+
+	VkPipeline build_compute_pipeline(VkDevice device, PipelineCache& cache, VkPipelineLayout layout, VkShaderModule shader) {
+		std::string key;
+		u64 code = cache.module_hash(shader);
+		if (code != 0) {
+			key_append(key, VK_SHADER_STAGE_COMPUTE_BIT);
+			key_append(key, code);
+			key.append("main");
+			key_append(key, layout);
+			std::lock_guard guard(cache.lock);
+			cache.requests++;
+			auto cached = cache.cache.find(key);
+			if (cached != cache.cache.end()) {
+				return cached->second;
+			}
+		}
+
+		VkComputePipelineCreateInfo pipeline_info = {
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.stage = {
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.module = shader,
+				.pName = "main",
+			},
+			.layout = layout,
+		};
+		VkPipeline new_pipeline;
+		if (vkCreateComputePipelines(device, cache.driver_cache, 1, &pipeline_info, nullptr, &new_pipeline) != VK_SUCCESS) {
+			return VK_NULL_HANDLE;
+		}
+
+		if (code == 0) return new_pipeline;
+		std::lock_guard guard(cache.lock);
+		auto [slot, inserted] = cache.cache.emplace(std::move(key), new_pipeline);
+		if (!inserted) {
+			vkDestroyPipeline(device, new_pipeline, nullptr);
+			return slot->second;
+		}
+		return new_pipeline;
+	}
+
+	RasterState PipelineBuilder::raster_state() const {
+		return {
+			.topology = _input_assembly.topology,
+			.polygon_mode = _rasterizer.polygonMode,
+			.cull_mode = _rasterizer.cullMode,
+			.front_face = _rasterizer.frontFace,
+			.depth_test = _depth_stencil.depthTestEnable == VK_TRUE,
+			.depth_write = _depth_stencil.depthWriteEnable == VK_TRUE,
+			.depth_compare = _depth_stencil.depthCompareOp,
+			.depth_bias = _rasterizer.depthBiasEnable == VK_TRUE,
+			.blend = _color_blend_attachment,
+		};
+	}
+
+	void PipelineCache::init(VkDevice device) {
+		this->device = device;
+		VkPipelineCacheCreateInfo info = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+			.pNext = nullptr,
+		};
+		VK_CHECK(vkCreatePipelineCache(device, &info, nullptr, &driver_cache));
+	}
+
+	void PipelineCache::add_module(VkShaderModule module, std::span<const u32> code) {
+		// fnv-1a over the words, then the length. never 0, that means unknown
+		u64 hash = 14695981039346656037ull;
+		for (auto word : code) {
+			hash = (hash ^ word) * 1099511628211ull;
+		}
+		hash = (hash ^ code.size()) * 1099511628211ull;
+		std::lock_guard guard(lock);
+		module_hashes[module] = hash != 0 ? hash : 1;
+	}
+
+	u64 PipelineCache::module_hash(VkShaderModule module) {
+		std::lock_guard guard(lock);
+		auto found = module_hashes.find(module);
+		return found != module_hashes.end() ? found->second : 0;
+	}
+
+	void PipelineCache::clear() {
+		std::lock_guard guard(lock);
+		for (auto& pipeline : cache) {
+			vkDestroyPipeline(device, pipeline.second, nullptr);
+		}
+		cache.clear();
+	}
+
+	void PipelineCache::destroy() {
+		clear();
+		if (driver_cache != VK_NULL_HANDLE) {
+			vkDestroyPipelineCache(device, driver_cache, nullptr);
+			driver_cache = VK_NULL_HANDLE;
+		}
+	}
+
+	void load_dynamic_state(DynamicStateSupport& support, VkDevice device) {
+		if (support.extended) {
+			support.set_topology = (PFN_vkCmdSetPrimitiveTopologyEXT)vkGetDeviceProcAddr(device, "vkCmdSetPrimitiveTopologyEXT");
+			support.set_cull_mode = (PFN_vkCmdSetCullModeEXT)vkGetDeviceProcAddr(device, "vkCmdSetCullModeEXT");
+			support.set_front_face = (PFN_vkCmdSetFrontFaceEXT)vkGetDeviceProcAddr(device, "vkCmdSetFrontFaceEXT");
+			support.set_depth_test = (PFN_vkCmdSetDepthTestEnableEXT)vkGetDeviceProcAddr(device, "vkCmdSetDepthTestEnableEXT");
+			support.set_depth_write = (PFN_vkCmdSetDepthWriteEnableEXT)vkGetDeviceProcAddr(device, "vkCmdSetDepthWriteEnableEXT");
+			support.set_depth_compare = (PFN_vkCmdSetDepthCompareOpEXT)vkGetDeviceProcAddr(device, "vkCmdSetDepthCompareOpEXT");
+		}
+		if (support.extended2) {
+			support.set_depth_bias = (PFN_vkCmdSetDepthBiasEnableEXT)vkGetDeviceProcAddr(device, "vkCmdSetDepthBiasEnableEXT");
+		}
+#ifdef VK_EXT_extended_dynamic_state3
+		if (support.extended3_polygon) {
+			support.set_polygon_mode = (PFN_vkCmdSetPolygonModeEXT)vkGetDeviceProcAddr(device, "vkCmdSetPolygonModeEXT");
+		}
+		if (support.extended3_blend) {
+			support.set_blend_enable = (PFN_vkCmdSetColorBlendEnableEXT)vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEnableEXT");
+			support.set_blend_equation = (PFN_vkCmdSetColorBlendEquationEXT)vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEquationEXT");
+			support.set_write_mask = (PFN_vkCmdSetColorWriteMaskEXT)vkGetDeviceProcAddr(device, "vkCmdSetColorWriteMaskEXT");
+		}
+#else
+		support.extended3_polygon = false;
+		support.extended3_blend = false;
+#endif
+	}
+
+	void set_raster_state(VkCommandBuffer cmd, const DynamicStateSupport& support, const RasterState& state, const RasterState* bound) {
+		if (support.extended) {
+			if (!bound || bound->topology != state.topology) support.set_topology(cmd, state.topology);
+			if (!bound || bound->cull_mode != state.cull_mode) support.set_cull_mode(cmd, state.cull_mode);
+			if (!bound || bound->front_face != state.front_face) support.set_front_face(cmd, state.front_face);
+			if (!bound || bound->depth_test != state.depth_test) support.set_depth_test(cmd, state.depth_test);
+			if (!bound || bound->depth_write != state.depth_write) support.set_depth_write(cmd, state.depth_write);
+			if (!bound || bound->depth_compare != state.depth_compare) support.set_depth_compare(cmd, state.depth_compare);
+		}
+		if (support.extended2) {
+			if (!bound || bound->depth_bias != state.depth_bias) support.set_depth_bias(cmd, state.depth_bias);
+		}
+#ifdef VK_EXT_extended_dynamic_state3
+		if (support.extended3_polygon) {
+			if (!bound || bound->polygon_mode != state.polygon_mode) support.set_polygon_mode(cmd, state.polygon_mode);
+		}
+		if (support.extended3_blend) {
+			auto& blend = state.blend;
+			if (!bound || bound->blend.blendEnable != blend.blendEnable) support.set_blend_enable(cmd, 0, 1, &blend.blendEnable);
+			if (!bound || bound->blend.colorWriteMask != blend.colorWriteMask) support.set_write_mask(cmd, 0, 1, &blend.colorWriteMask);
+			// only matters while blending
+			if (blend.blendEnable) {
+				VkColorBlendEquationEXT equation = {
+					.srcColorBlendFactor = blend.srcColorBlendFactor,
+					.dstColorBlendFactor = blend.dstColorBlendFactor,
+					.colorBlendOp = blend.colorBlendOp,
+					.srcAlphaBlendFactor = blend.srcAlphaBlendFactor,
+					.dstAlphaBlendFactor = blend.dstAlphaBlendFactor,
+					.alphaBlendOp = blend.alphaBlendOp,
+				};
+				support.set_blend_equation(cmd, 0, 1, &equation);
+			}
+		}
+#endif
 	}
 	/// @brief Sets up for filled polygons in a triangle list
 	/// @return this
@@ -96,9 +405,10 @@ namespace zebra {
 		return pipeline_builder;
 	}
 
-	PipelineBuilder& PipelineBuilder::add_shader(VkShaderStageFlagBits stage, VkShaderModule shader) {
+	PipelineBuilder& PipelineBuilder::add_shader(VkShaderStageFlagBits stage, VkShaderModule shader, const VkSpecializationInfo* specialization) {
 		auto& pipeline_builder = *this;
 		pipeline_builder._shader_stages.push_back(vki::pipeline_shader_stage_create_info(stage, shader));
+		pipeline_builder._shader_stages.back().pSpecializationInfo = specialization;
 		return pipeline_builder;
 	}
 }
\ No newline at end of file
@@ -1,11 +1,103 @@
 #pragma once
+#include <span>
 #include <vector>
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
 
 #include <vulkan/vulkan.h>
 #include "g_types.h"
 #include "vki.h"
 
 namespace zebra {
+	constexpr u32 MAX_COLOR_TARGETS = 8;
+
+	/* what a pipeline renders into. either a render pass and subpass,
+	* or with dynamic rendering (pass left null) only the attachment formats */
+	struct PipelineTarget {
+		VkRenderPass pass = VK_NULL_HANDLE;
+		u32 subpass = 0;
+		std::array<VkFormat, MAX_COLOR_TARGETS> color_formats{};
+		u32 color_count = 0;
+		VkFormat depth_format = VK_FORMAT_UNDEFINED;
+	};
+
+	/* fixed function state that can move from the pipeline onto the command buffer.
+	* filled at device creation, each level only where the device has it */
+	struct DynamicStateSupport {
+		// VK_EXT_extended_dynamic_state: topology, cull mode, front face, depth test, write and compare
+		bool extended = false;
+		// VK_EXT_extended_dynamic_state2: depth bias enable
+		bool extended2 = false;
+		// VK_EXT_extended_dynamic_state3, only the parts we set: polygon mode, and blend enable, equation and write mask
+		bool extended3_polygon = false;
+		bool extended3_blend = false;
+
+		PFN_vkCmdSetPrimitiveTopologyEXT set_topology = nullptr;
+		PFN_vkCmdSetCullModeEXT set_cull_mode = nullptr;
+		PFN_vkCmdSetFrontFaceEXT set_front_face = nullptr;
+		PFN_vkCmdSetDepthTestEnableEXT set_depth_test = nullptr;
+		PFN_vkCmdSetDepthWriteEnableEXT set_depth_write = nullptr;
+		PFN_vkCmdSetDepthCompareOpEXT set_depth_compare = nullptr;
+		PFN_vkCmdSetDepthBiasEnableEXT set_depth_bias = nullptr;
+#ifdef VK_EXT_extended_dynamic_state3
+		PFN_vkCmdSetPolygonModeEXT set_polygon_mode = nullptr;
+		PFN_vkCmdSetColorBlendEnableEXT set_blend_enable = nullptr;
+		PFN_vkCmdSetColorBlendEquationEXT set_blend_equation = nullptr;
+		PFN_vkCmdSetColorWriteMaskEXT set_write_mask = nullptr;
+#endif
+	};
+
+	/// @brief loads the entry points for whatever support has turned on
+	void load_dynamic_state(DynamicStateSupport& support, VkDevice device);
+
+	/// @brief what a pipeline was built with. the dynamic parts of it are set per draw
+	struct RasterState {
+		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
+		VkCullModeFlags cull_mode = VK_CULL_MODE_NONE;
+		VkFrontFace front_face = VK_FRONT_FACE_CLOCKWISE;
+		bool depth_test = false;
+		bool depth_write = false;
+		VkCompareOp depth_compare = VK_COMPARE_OP_ALWAYS;
+		bool depth_bias = false;
+		// applied to the first color target, the only one anything renders to so far
+		VkPipelineColorBlendAttachmentState blend = vki::color_blend_attachment_state();
+	};
+
+	/// @brief sets what differs from bound, everything when bound is null. state that is baked is skipped
+	void set_raster_state(VkCommandBuffer cmd, const DynamicStateSupport& support, const RasterState& state, const RasterState* bound = nullptr);
+
+	/* pipelines by everything that is baked into them. with extended dynamic state,
+	* variants that only differ in dynamic state come back as the same pipeline.
+	* owns all of them, materials only point in here. safe to build from several threads */
+	struct PipelineCache {
+		VkDevice device = VK_NULL_HANDLE;
+		// handed to every create so the driver can reuse compiled shader code between variants
+		VkPipelineCache driver_cache = VK_NULL_HANDLE;
+		std::mutex lock;
+		std::unordered_map<std::string, VkPipeline> cache;
+		// by module, a hash of the spir-v it was made from. keys use this and not the handle,
+		// a destroyed module's handle can come back for different code
+		std::unordered_map<VkShaderModule, u64> module_hashes;
+		std::atomic<u32> requests{ 0 };
+
+		void init(VkDevice device);
+		/// @brief every module that goes into a cached pipeline is added when it is created
+		void add_module(VkShaderModule module, std::span<const u32> code);
+		/// @return 0 for modules that were never added, their pipelines are not cached
+		u64 module_hash(VkShaderModule module);
+		/// @brief destroys the pipelines, the driver cache is kept
+		void clear();
+		void destroy();
+		u32 size() {
+			std::lock_guard guard(lock);
+			return (u32)cache.size();
+		}
+	};
+
 	class PipelineBuilder {
 	public:
 		std::vector<VkPipelineShaderStageCreateInfo> _shader_stages;
@@ -18,11 +110,15 @@ namespace zebra {
 		VkPipelineDepthStencilStateCreateInfo _depth_stencil;
 		VkPipelineMultisampleStateCreateInfo _multisampling;
 		VkPipelineLayout _pipelineLayout;
+		// both optional. without dynamic state everything is baked, without a cache nothing is shared
+		const DynamicStateSupport* _dynamic_state = nullptr;
+		PipelineCache* _cache = nullptr;
 
 		PipelineBuilder& set_defaults();
 		PipelineBuilder& set_vertex_format(VertexInputDescription& description);
 		PipelineBuilder& no_vertex_format();
-		PipelineBuilder& add_shader(VkShaderStageFlagBits stage, VkShaderModule shader);
+		/// @param specialization has to outlive build_pipeline
+		PipelineBuilder& add_shader(VkShaderStageFlagBits stage, VkShaderModule shader, const VkSpecializationInfo* specialization = nullptr);
 		PipelineBuilder& clear_shaders() {
 			this->_shader_stages.clear();
 			return *this;
@@ -35,7 +131,28 @@ namespace zebra {
 			this->_depth_stencil = vki::depth_stencil_create_info(depth_test, depth_write, compare_op);
 			return *this;
 		}
+		PipelineBuilder& use_dynamic_state(const DynamicStateSupport& support) {
+			this->_dynamic_state = &support;
+			return *this;
+		}
+		PipelineBuilder& use_cache(PipelineCache& cache) {
+			this->_cache = &cache;
+			return *this;
+		}
+		/// @brief the current settings, for setting them at draw time
+		RasterState raster_state() const;
 
-		VkPipeline build_pipeline(VkDevice device, VkRenderPass pass);
+		VkPipeline build_pipeline(VkDevice device, const PipelineTarget& target);
+		VkPipeline build_pipeline(VkDevice device, VkRenderPass pass, u32 subpass = 0) {
+			return build_pipeline(device, PipelineTarget{ .pass = pass, .subpass = subpass });
+		}
 	};
+
+	struct ComputeProgram {
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VkPipelineLayout layout = VK_NULL_HANDLE;
+	};
+
+	/// @brief nothing to vary, shares the cache with the graphics pipelines keyed by shader code and layout
+	VkPipeline build_compute_pipeline(VkDevice device, PipelineCache& cache, VkPipelineLayout layout, VkShaderModule shader);
 }
\ No newline at end of file
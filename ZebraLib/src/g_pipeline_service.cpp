@@ -0,0 +1,137 @@
+#include "g_pipeline_service.h"
+#include "z_debug.h"
+
+namespace zebra {
+	ShaderModuleSet::~ShaderModuleSet() {
+		for (auto module : modules) {
+			vkDestroyShaderModule(device, module, nullptr);
+		}
+	}
+
+	// owns everything the builder points to, so the copy can go to another thread
+	struct PipelineRequest {
+		struct Specialization {
+			std::vector<VkSpecializationMapEntry> entries;
+			std::vector<u8> data;
+			VkSpecializationInfo info;
+		};
+
+		PipelineBuilder builder;
+		PipelineTarget target;
+		std::vector<VkVertexInputBindingDescription> bindings;
+		std::vector<VkVertexInputAttributeDescription> attributes;
+		std::vector<Specialization> specializations;
+		std::shared_ptr<ShaderModuleSet> modules;
+		u64 material_fk;
+		MaterialVariant variant;
+	};
+
+	static std::shared_ptr<PipelineRequest> capture(const PipelineBuilder& builder, const PipelineTarget& target) {
+		auto request = std::make_shared<PipelineRequest>();
+		request->builder = builder;
+		request->target = target;
+
+		auto& input = request->builder._vertex_input_info;
+		request->bindings.assign(input.pVertexBindingDescriptions, input.pVertexBindingDescriptions + input.vertexBindingDescriptionCount);
+		request->attributes.assign(input.pVertexAttributeDescriptions, input.pVertexAttributeDescriptions + input.vertexAttributeDescriptionCount);
+		input.pVertexBindingDescriptions = request->bindings.data();
+		input.pVertexAttributeDescriptions = request->attributes.data();
+
+		// reserved up front, the stages point into it
+		request->specializations.reserve(request->builder._shader_stages.size());
+		for (auto& stage : request->builder._shader_stages) {
+			if (stage.pSpecializationInfo == nullptr) continue;
+			auto source = stage.pSpecializationInfo;
+			auto& copy = request->specializations.emplace_back();
+			copy.entries.assign(source->pMapEntries, source->pMapEntries + source->mapEntryCount);
+			copy.data.assign((const u8*)source->pData, (const u8*)source->pData + source->dataSize);
+			copy.info = {
+				.mapEntryCount = (u32)copy.entries.size(),
+				.pMapEntries = copy.entries.data(),
+				.dataSize = copy.data.size(),
+				.pData = copy.data.data(),
+			};
+			stage.pSpecializationInfo = &copy.info;
+		}
+		return request;
+	}
+
+	void compile_async(PipelineService& service, const PipelineBuilder& builder, const PipelineTarget& target, std::shared_ptr<ShaderModuleSet> modules, u64 material_fk, MaterialVariant variant) {
+		auto request = capture(builder, target);
+		request->modules = std::move(modules);
+		request->material_fk = material_fk;
+		request->variant = variant;
+
+		service.in_flight.fetch_add(1, std::memory_order_relaxed);
+		{
+			std::lock_guard guard(service.lock);
+			service.queue.push_back([&service, request = std::move(request)]() mutable {
+				auto pipeline = request->builder.build_pipeline(service.device, request->target);
+				{
+					std::lock_guard guard(service.lock);
+					service.finished.push_back({ request->material_fk, request->variant, pipeline });
+				}
+				// the last request lets go of the shader modules here
+				request.reset();
+				service.in_flight.fetch_sub(1, std::memory_order_release);
+				});
+		}
+		service.wake.notify_one();
+	}
+
+	void start_service(PipelineService& service, VkDevice device) {
+		service.device = device;
+		service.thread = std::thread([&service]() {
+			while (true) {
+				std::function<void()> compile;
+				{
+					std::unique_lock guard(service.lock);
+					service.wake.wait(guard, [&service]() { return service.stopping || !service.queue.empty(); });
+					if (service.queue.empty()) return;
+					compile = std::move(service.queue.front());
+					service.queue.pop_front();
+				}
+				compile();
+			}
+			});
+	}
+
+	void stop_service(PipelineService& service) {
+		{
+			std::lock_guard guard(service.lock);
+			service.stopping = true;
+		}
+		service.wake.notify_one();
+		if (service.thread.joinable()) {
+			service.thread.join();
+		}
+	}
+
+	u32 apply_compiled(PipelineService& service, render::Assets& assets) {
+		std::vector<CompiledPipeline> arrived;
+		{
+			std::lock_guard guard(service.lock);
+			if (service.finished.empty()) return 0;
+			arrived.swap(service.finished);
+		}
+
+		for (auto& compiled : arrived) {
+			auto material = assets.t_materials.find(compiled.material_fk);
+			// unloaded while compiling, the pipeline stays in the pipeline cache
+			if (material == assets.t_materials.end()) continue;
+			auto& mat = material->second;
+			// pending_pipelines stays up, so bind_draw keeps using the fallback material instead of drawing nothing
+			if (compiled.pipeline == VK_NULL_HANDLE) {
+				DBG("pipeline compile failed for material " << compiled.material_fk << " variant " << (u32)compiled.variant << ", it stays on the fallback");
+				continue;
+			}
+			switch (compiled.variant) {
+			case MaterialVariant::Shade: mat.pipeline = compiled.pipeline; break;
+			case MaterialVariant::Depth: mat.depth_pipeline = compiled.pipeline; break;
+			case MaterialVariant::Equal: mat.equal_pipeline = compiled.pipeline; break;
+			}
+			if (mat.pending_pipelines > 0) mat.pending_pipelines--;
+		}
+		return (u32)arrived.size();
+	}
+}
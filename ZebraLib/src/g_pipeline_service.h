@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "zebratypes.h"
+#include "g_pipeline.h"
+#include "renderer.h"
+
+namespace zebra {
+	enum class MaterialVariant : u8 {
+		Shade,
+		Depth,
+		Equal,
+	};
+
+	/// @brief shader modules shared by the requests that use them, destroyed with the last one
+	struct ShaderModuleSet {
+		VkDevice device = VK_NULL_HANDLE;
+		std::vector<VkShaderModule> modules;
+
+		ShaderModuleSet(VkDevice device) : device(device) {}
+		ShaderModuleSet(const ShaderModuleSet&) = delete;
+		ShaderModuleSet& operator=(const ShaderModuleSet&) = delete;
+		~ShaderModuleSet();
+	};
+
+	struct CompiledPipeline {
+		u64 material_fk;
+		MaterialVariant variant;
+		VkPipeline pipeline;
+	};
+
+	/* compiles pipelines on a thread of its own, one after the other. not on the job system: JobSystem::wait
+	* runs whatever it can steal, and a compile picked up inside a frame's wait is the hitch this is meant to avoid.
+	* the builder is deep copied at request time, so nothing it points to has to outlive the call.
+	* finished pipelines are patched into their materials by apply_compiled, on the thread that records */
+	struct PipelineService {
+		VkDevice device = VK_NULL_HANDLE;
+		std::thread thread;
+
+		std::mutex lock;
+		std::condition_variable wake;
+		std::deque<std::function<void()>> queue;
+		bool stopping = false;
+		std::vector<CompiledPipeline> finished;
+		std::atomic<u32> in_flight{ 0 };
+	};
+
+	void start_service(PipelineService& service, VkDevice device);
+	/// @brief compiles what is still queued and joins the thread, for shutdown
+	void stop_service(PipelineService& service);
+
+	/// @brief queues the pipeline builder would build for target, the material gets it once it is done
+	void compile_async(PipelineService& service, const PipelineBuilder& builder, const PipelineTarget& target, std::shared_ptr<ShaderModuleSet> modules, u64 material_fk, MaterialVariant variant);
+	/* moves finished pipelines into their materials, returns how many arrived.
+	* a variant that failed is never installed, its material keeps drawing as the fallback */
+	u32 apply_compiled(PipelineService& service, render::Assets& assets);
+}
@@ -0,0 +1,336 @@
+#include "g_reflect.h"
+#include <algorithm>
+#include "z_debug.h"
+
+namespace zebra {
+	namespace spv {
+		constexpr u32 MAGIC = 0x07230203;
+
+		// -- the few opcodes, decorations and enums layouts depend on
+		enum Op : u32 {
+			OpEntryPoint = 15,
+			OpTypeBool = 20,
+			OpTypeInt = 21,
+			OpTypeFloat = 22,
+			OpTypeVector = 23,
+			OpTypeMatrix = 24,
+			OpTypeImage = 25,
+			OpTypeSampler = 26,
+			OpTypeSampledImage = 27,
+			OpTypeArray = 28,
+			OpTypeRuntimeArray = 29,
+			OpTypeStruct = 30,
+			OpTypePointer = 32,
+			OpConstant = 43,
+			OpVariable = 59,
+			OpDecorate = 71,
+			OpMemberDecorate = 72,
+			OpTypeAccelerationStructureKHR = 5341,
+		};
+
+		enum Decoration : u32 {
+			Block = 2,
+			BufferBlock = 3,
+			ArrayStride = 6,
+			MatrixStride = 7,
+			Binding = 33,
+			DescriptorSet = 34,
+			Offset = 35,
+		};
+
+		enum StorageClass : u32 {
+			UniformConstant = 0,
+			Uniform = 2,
+			PushConstant = 9,
+			StorageBuffer = 12,
+		};
+
+		constexpr u32 DIM_BUFFER = 5;
+		constexpr u32 DIM_SUBPASS_DATA = 6;
+		constexpr u32 UNSET = ~0u;
+
+		struct Id {
+			u32 opcode = 0;
+			// variables: pointer type. pointers: pointee
+			u32 type = 0;
+			u32 storage = 0;
+			// constants: the low word, all array lengths need
+			u32 value = 0;
+			u32 set = UNSET;
+			u32 binding = UNSET;
+			u32 array_stride = 0;
+			bool block = false;
+			bool buffer_block = false;
+			// types: everything after the result id
+			std::vector<u32> operands;
+			std::vector<u32> member_offsets;
+			std::vector<u32> member_matrix_strides;
+		};
+
+		static VkShaderStageFlagBits stage(u32 execution_model) {
+			switch (execution_model) {
+			case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+			case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+			case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+			case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+			case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+			case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+			default: return VK_SHADER_STAGE_ALL;
+			}
+		}
+
+		static void grow(std::vector<u32>& values, u32 index) {
+			if (values.size() <= index) values.resize(index + 1, 0);
+		}
+
+		// std430 sizes, only what push constant blocks need
+		static u32 type_size(const std::vector<Id>& ids, u32 type, u32 matrix_stride = 0) {
+			auto& id = ids[type];
+			switch (id.opcode) {
+			case OpTypeBool: return 4;
+			case OpTypeInt:
+			case OpTypeFloat: return id.operands[0] / 8;
+			case OpTypeVector: return type_size(ids, id.operands[0]) * id.operands[1];
+			case OpTypeMatrix: {
+				auto column = matrix_stride ? matrix_stride : type_size(ids, id.operands[0]);
+				return column * id.operands[1];
+			}
+			case OpTypeArray: {
+				auto length = ids[id.operands[1]].value;
+				auto stride = id.array_stride ? id.array_stride : type_size(ids, id.operands[0], matrix_stride);
+				return stride * length;
+			}
+			case OpTypeStruct: {
+				u32 end = 0;
+				for (auto member = 0u; member < id.operands.size(); member++) {
+					auto offset = member < id.member_offsets.size() ? id.member_offsets[member] : 0;
+					auto stride = member < id.member_matrix_strides.size() ? id.member_matrix_strides[member] : 0;
+					end = std::max(end, offset + type_size(ids, id.operands[member], stride));
+				}
+				return end;
+			}
+			default: return 0;
+			}
+		}
+	}
+
+	bool reflect_spirv(std::span<const u32> code, ShaderReflection& out) {
+		using namespace spv;
+		if (code.size() < 5 || code[0] != MAGIC) {
+			DBG("not spir-v");
+			return false;
+		}
+
+		std::vector<Id> ids(code[3]);
+		auto valid = [&ids](u32 id) { return id < ids.size(); };
+
+		for (auto word = 5ull; word < code.size();) {
+			auto count = code[word] >> 16;
+			auto opcode = code[word] & 0xffff;
+			if (count == 0 || word + count > code.size()) {
+				DBG("truncated spir-v instruction at word " << word);
+				return false;
+			}
+			auto ops = code.subspan(word + 1, count - 1);
+
+			switch (opcode) {
+			case OpEntryPoint:
+				out.stage = stage(ops[0]);
+				break;
+			case OpDecorate:
+				if (!valid(ops[0])) break;
+				switch (ops[1]) {
+				case DescriptorSet: ids[ops[0]].set = ops[2]; break;
+				case Binding: ids[ops[0]].binding = ops[2]; break;
+				case ArrayStride: ids[ops[0]].array_stride = ops[2]; break;
+				case Block: ids[ops[0]].block = true; break;
+				case BufferBlock: ids[ops[0]].buffer_block = true; break;
+				}
+				break;
+			case OpMemberDecorate:
+				if (!valid(ops[0])) break;
+				if (ops[2] == Offset) {
+					grow(ids[ops[0]].member_offsets, ops[1]);
+					ids[ops[0]].member_offsets[ops[1]] = ops[3];
+				} else if (ops[2] == MatrixStride) {
+					grow(ids[ops[0]].member_matrix_strides, ops[1]);
+					ids[ops[0]].member_matrix_strides[ops[1]] = ops[3];
+				}
+				break;
+			case OpTypeBool: case OpTypeInt: case OpTypeFloat: case OpTypeVector: case OpTypeMatrix:
+			case OpTypeImage: case OpTypeSampler: case OpTypeSampledImage: case OpTypeArray:
+			case OpTypeRuntimeArray: case OpTypeStruct: case OpTypeAccelerationStructureKHR:
+				if (!valid(ops[0])) break;
+				ids[ops[0]].opcode = opcode;
+				ids[ops[0]].operands.assign(ops.begin() + 1, ops.end());
+				break;
+			case OpTypePointer:
+				if (!valid(ops[0])) break;
+				ids[ops[0]].opcode = opcode;
+				ids[ops[0]].storage = ops[1];
+				ids[ops[0]].type = ops[2];
+				break;
+			case OpConstant:
+				if (!valid(ops[1])) break;
+				ids[ops[1]].opcode = opcode;
+				ids[ops[1]].type = ops[0];
+				ids[ops[1]].value = ops[2];
+				break;
+			case OpVariable:
+				if (!valid(ops[1])) break;
+				ids[ops[1]].opcode = opcode;
+				ids[ops[1]].type = ops[0];
+				ids[ops[1]].storage = ops[2];
+				break;
+			}
+			word += count;
+		}
+
+		for (auto& variable : ids) {
+			if (variable.opcode != OpVariable) continue;
+			auto type = ids[variable.type].type;
+
+			if (variable.storage == PushConstant) {
+				out.push_constant_size = std::max(out.push_constant_size, type_size(ids, type));
+				continue;
+			}
+			if (variable.storage != UniformConstant && variable.storage != Uniform && variable.storage != StorageBuffer) continue;
+			if (variable.set == UNSET || variable.binding == UNSET) continue;
+
+			// arrays of descriptors, runtime sized ones are left at 1
+			u32 descriptor_count = 1;
+			while (ids[type].opcode == OpTypeArray || ids[type].opcode == OpTypeRuntimeArray) {
+				if (ids[type].opcode == OpTypeArray) {
+					descriptor_count *= ids[ids[type].operands[1]].value;
+				}
+				type = ids[type].operands[0];
+			}
+
+			auto& pointee = ids[type];
+			VkDescriptorType descriptor_type;
+			switch (pointee.opcode) {
+			case OpTypeStruct:
+				descriptor_type = variable.storage == StorageBuffer || pointee.buffer_block ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				break;
+			case OpTypeSampledImage:
+				descriptor_type = ids[pointee.operands[0]].operands[1] == DIM_BUFFER ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				break;
+			case OpTypeSampler:
+				descriptor_type = VK_DESCRIPTOR_TYPE_SAMPLER;
+				break;
+			case OpTypeImage: {
+				// operands: sampled type, dim, depth, arrayed, ms, sampled (1 with a sampler, 2 storage)
+				auto dim = pointee.operands[1];
+				auto sampled = pointee.operands[5];
+				if (dim == DIM_SUBPASS_DATA) {
+					descriptor_type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+				} else if (dim == DIM_BUFFER) {
+					descriptor_type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+				} else {
+					descriptor_type = sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+				}
+				break;
+			}
+			default:
+				DBG("cannot reflect descriptor at set " << variable.set << " binding " << variable.binding);
+				return false;
+			}
+
+			out.bindings.push_back({
+				.set = variable.set,
+				.binding = variable.binding,
+				.type = descriptor_type,
+				.count = descriptor_count,
+			});
+		}
+		return true;
+	}
+
+	bool merge_reflection(ReflectedLayout& layout, const ShaderReflection& shader) {
+		for (auto& reflected : shader.bindings) {
+			if (reflected.count != 1) {
+				DBG("descriptor arrays are not supported by FatSetLayout, set " << reflected.set << " binding " << reflected.binding);
+				return false;
+			}
+			if (layout.sets.size() <= reflected.set) {
+				layout.sets.resize(reflected.set + 1);
+			}
+			auto& set = layout.sets[reflected.set];
+			auto begin = set.bindings.begin();
+			auto end = begin + set.binding_count;
+			auto slot = std::lower_bound(begin, end, reflected.binding, [](const SmallLayoutBinding& binding, u32 value) {
+				return binding.binding < value;
+			});
+
+			if (slot != end && slot->binding == reflected.binding) {
+				if (slot->descriptorType != reflected.type) {
+					DBG("set " << reflected.set << " binding " << reflected.binding << " is declared as two different descriptor types");
+					return false;
+				}
+				slot->stageFlags |= shader.stage;
+				continue;
+			}
+
+			if (set.binding_count == DefaultFatSize) {
+				DBG("set " << reflected.set << " has more bindings than a FatSetLayout holds");
+				return false;
+			}
+			// kept sorted, FatSetLayout compares binding by binding
+			std::move_backward(slot, end, end + 1);
+			*slot = {
+				.binding = reflected.binding,
+				.descriptorType = reflected.type,
+				.stageFlags = (VkShaderStageFlags)shader.stage,
+			};
+			set.binding_count++;
+		}
+
+		if (shader.push_constant_size > 0) {
+			// every block starts at 0, so they all overlap. one range for all of them, a push has to name
+			// every stage whose range it touches, which are then all the stages in it
+			if (layout.push_constants.empty()) {
+				layout.push_constants.push_back({ (VkShaderStageFlags)shader.stage, 0, shader.push_constant_size });
+			} else {
+				auto& range = layout.push_constants.front();
+				range.stageFlags |= shader.stage;
+				range.size = std::max(range.size, shader.push_constant_size);
+			}
+		}
+		return true;
+	}
+
+	VkPipelineLayout PipelineLayoutCache::create(DescriptorLayoutCache& set_cache, ReflectedLayout& layout) {
+		std::vector<VkDescriptorSetLayout> set_layouts;
+		std::vector<u64> key;
+		for (auto& set : layout.sets) {
+			set_layouts.push_back(set_cache.create(device, set));
+			key.push_back((u64)set_layouts.back());
+		}
+		for (auto& range : layout.push_constants) {
+			key.push_back((u64)range.stageFlags << 48 | (u64)range.offset << 24 | range.size);
+		}
+
+		auto cached = layouts.find(key);
+		if (cached != layouts.end()) {
+			return cached->second;
+		}
+
+		auto info = vki::pipeline_layout_create_info();
+		info.setLayoutCount = (u32)set_layouts.size();
+		info.pSetLayouts = set_layouts.data();
+		info.pushConstantRangeCount = (u32)layout.push_constants.size();
+		info.pPushConstantRanges = layout.push_constants.data();
+
+		VkPipelineLayout pipeline_layout;
+		VK_CHECK(vkCreatePipelineLayout(device, &info, nullptr, &pipeline_layout));
+		layouts.emplace(std::move(key), pipeline_layout);
+		return pipeline_layout;
+	}
+
+	void PipelineLayoutCache::destroy() {
+		for (auto& layout : layouts) {
+			vkDestroyPipelineLayout(device, layout.second, nullptr);
+		}
+		layouts.clear();
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <span>
+#include <vulkan/vulkan.h>
+#include "zebratypes.h"
+#include "g_descriptorset.h"
+
+namespace zebra {
+	/* descriptor sets are arranged by how often they change, so a pipeline switch
+	* between compatible layouts keeps everything below the set that differs bound */
+	enum SetFrequency : u32 {
+		SET_FRAME = 0,
+		SET_BATCH = 1,
+		SET_MATERIAL = 2,
+		SET_COUNT,
+	};
+
+	struct ReflectedBinding {
+		u32 set;
+		u32 binding;
+		VkDescriptorType type;
+		u32 count;
+	};
+
+	/// @brief what one shader stage declares, read straight from its spir-v
+	struct ShaderReflection {
+		VkShaderStageFlagBits stage = VK_SHADER_STAGE_ALL;
+		std::vector<ReflectedBinding> bindings;
+		// end of the push constant block, 0 without one
+		u32 push_constant_size = 0;
+	};
+
+	/// @brief the union of every stage that shares one pipeline layout
+	struct ReflectedLayout {
+		std::vector<FatSetLayout<DefaultFatSize>> sets;
+		// at most one range, over every stage with a push constant block. pushes use its stageFlags
+		std::vector<VkPushConstantRange> push_constants;
+	};
+
+	/// @return false if code is not spir-v or uses something we cannot describe
+	bool reflect_spirv(std::span<const u32> code, ShaderReflection& out);
+	/// @brief adds the stage to layout, stage flags of bindings both declare are merged
+	/// @return false if the stage disagrees with what is already there
+	bool merge_reflection(ReflectedLayout& layout, const ShaderReflection& shader);
+
+	/* pipeline layouts by their set layouts and push constants. pipelines built from
+	* the same merged layout get the same handle, so recording can tell when sets stay bound */
+	struct PipelineLayoutCache {
+		VkDevice device = VK_NULL_HANDLE;
+		std::map<std::vector<u64>, VkPipelineLayout> layouts;
+
+		VkPipelineLayout create(DescriptorLayoutCache& set_cache, ReflectedLayout& layout);
+		void destroy();
+	};
+}
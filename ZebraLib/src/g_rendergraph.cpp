@@ -0,0 +1,693 @@
+#include "g_rendergraph.h"
+#include <algorithm>
+#include <numeric>
+#include <cassert>
+#include <array>
+#include "vki.h"
+#include "z_debug.h"
+
+namespace zebra {
+	namespace render {
+		struct RGState {
+			VkImageLayout layout;
+			VkPipelineStageFlags stage;
+			VkAccessFlags access;
+		};
+
+		constexpr VkAccessFlags WRITE_ACCESS = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		// whatever the previous frame may still be doing with a transient
+		constexpr RGState FRAME_START = {
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			WRITE_ACCESS,
+		};
+
+		constexpr VkImageUsageFlags ATTACHMENT_USAGE = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+		static bool is_write(RGAccess access) {
+			return access != RGAccess::Sampled && access != RGAccess::InputAttachment;
+		}
+
+		static bool is_attachment(RGAccess access) {
+			return access == RGAccess::ColorAttachment || access == RGAccess::DepthAttachment || access == RGAccess::InputAttachment;
+		}
+
+		static RGState access_state(RGAccess access, bool raster) {
+			VkPipelineStageFlags shader_stages = raster
+				? VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+				: VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+			switch (access) {
+			case RGAccess::ColorAttachment:
+				return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT };
+			case RGAccess::DepthAttachment:
+				return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT };
+			case RGAccess::Sampled:
+				return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, shader_stages, VK_ACCESS_SHADER_READ_BIT };
+			case RGAccess::Storage:
+				return { VK_IMAGE_LAYOUT_GENERAL, shader_stages, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT };
+			case RGAccess::InputAttachment:
+				return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT };
+			}
+			return {};
+		}
+
+		static VkImageUsageFlags access_usage(RGAccess access) {
+			switch (access) {
+			case RGAccess::ColorAttachment: return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+			case RGAccess::DepthAttachment: return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+			case RGAccess::Sampled: return VK_IMAGE_USAGE_SAMPLED_BIT;
+			case RGAccess::Storage: return VK_IMAGE_USAGE_STORAGE_BIT;
+			case RGAccess::InputAttachment: return VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+			}
+			return 0;
+		}
+
+		static bool is_raster(const RGPassNode& pass) {
+			return std::any_of(pass.uses.begin(), pass.uses.end(), [](const RGUse& use) { return is_attachment(use.access); });
+		}
+
+		static bool uses_dynamic_rendering(const RenderGraph& graph, const RGPassNode& pass) {
+			return graph.dynamic_rendering && !pass.needs_render_pass;
+		}
+
+		RGResource create_texture(RenderGraph& graph, std::string name, RGTextureDesc desc) {
+			graph.resources.push_back({ .name = std::move(name), .desc = desc });
+			return (RGResource)graph.resources.size() - 1;
+		}
+
+		RGResource import_texture(RenderGraph& graph, std::string name, RGTextureDesc desc, VkImageLayout final_layout) {
+			graph.resources.push_back({ .name = std::move(name), .desc = desc, .imported = true, .final_layout = final_layout });
+			return (RGResource)graph.resources.size() - 1;
+		}
+
+		void bind_imported(RenderGraph& graph, RGResource resource, VkImage image, VkImageView view) {
+			auto& node = graph.resources[resource];
+			assert(node.imported);
+			node.image = image;
+			node.view = view;
+		}
+
+		RGPassBuilder add_pass(RenderGraph& graph, std::string name) {
+			graph.passes.push_back({ .name = std::move(name) });
+			return RGPassBuilder{ &graph, (RGPass)graph.passes.size() - 1 };
+		}
+
+		RGPassBuilder& RGPassBuilder::write_color(RGResource target) {
+			graph->passes[pass].uses.push_back({ target, RGAccess::ColorAttachment });
+			return *this;
+		}
+
+		RGPassBuilder& RGPassBuilder::write_color(RGResource target, VkClearValue clear) {
+			graph->passes[pass].uses.push_back({ target, RGAccess::ColorAttachment, true, clear });
+			return *this;
+		}
+
+		RGPassBuilder& RGPassBuilder::write_depth(RGResource target, VkClearValue clear) {
+			graph->passes[pass].uses.push_back({ target, RGAccess::DepthAttachment, true, clear });
+			return *this;
+		}
+
+		RGPassBuilder& RGPassBuilder::read(RGResource source) {
+			graph->passes[pass].uses.push_back({ source, RGAccess::Sampled });
+			return *this;
+		}
+
+		RGPassBuilder& RGPassBuilder::read_attachment(RGResource source) {
+			graph->passes[pass].uses.push_back({ source, RGAccess::InputAttachment });
+			return *this;
+		}
+
+		RGPassBuilder& RGPassBuilder::storage(RGResource target) {
+			graph->passes[pass].uses.push_back({ target, RGAccess::Storage });
+			return *this;
+		}
+
+		RGPassBuilder& RGPassBuilder::side_effect() {
+			graph->passes[pass].side_effect = true;
+			return *this;
+		}
+
+		RGPassBuilder& RGPassBuilder::needs_render_pass() {
+			graph->passes[pass].needs_render_pass = true;
+			return *this;
+		}
+
+		RGPass RGPassBuilder::execute(std::function<void(RGPassContext&)>&& fn) {
+			graph->passes[pass].execute = std::move(fn);
+			return pass;
+		}
+
+		// -- compile
+
+		static void find_producers(RenderGraph& graph) {
+			// passes run in the order they were added, so the last writer of a resource
+			// before a pass is the one it depends on
+			std::vector<RGPass> last_writer(graph.resources.size(), RG_NONE);
+			for (auto p = 0u; p < graph.passes.size(); p++) {
+				auto& pass = graph.passes[p];
+				pass.producers.clear();
+				for (auto& use : pass.uses) {
+					auto writer = last_writer[use.resource];
+					if (writer != RG_NONE && writer != p) {
+						pass.producers.push_back(writer);
+					}
+				}
+				for (auto& use : pass.uses) {
+					if (is_write(use.access)) last_writer[use.resource] = p;
+				}
+			}
+		}
+
+		static void cull(RenderGraph& graph) {
+			for (auto& pass : graph.passes) {
+				pass.culled = !pass.side_effect && std::none_of(pass.uses.begin(), pass.uses.end(), [&](const RGUse& use) {
+					return is_write(use.access) && graph.resources[use.resource].imported;
+					});
+			}
+			// producers always come first, so one backwards sweep reaches everything
+			for (auto p = (i64)graph.passes.size() - 1; p >= 0; p--) {
+				if (graph.passes[p].culled) continue;
+				for (auto producer : graph.passes[p].producers) {
+					graph.passes[producer].culled = false;
+				}
+			}
+
+			graph.order.clear();
+			for (auto p = 0u; p < graph.passes.size(); p++) {
+				if (!graph.passes[p].culled) graph.order.push_back(p);
+			}
+		}
+
+		static void compute_lifetimes(RenderGraph& graph) {
+			for (auto& resource : graph.resources) {
+				resource.used = false;
+				resource.first_use = RG_NONE;
+				resource.last_use = 0;
+				resource.usage = 0;
+				resource.lazy = false;
+			}
+			for (auto position = 0u; position < graph.order.size(); position++) {
+				for (auto& use : graph.passes[graph.order[position]].uses) {
+					auto& resource = graph.resources[use.resource];
+					resource.used = true;
+					resource.first_use = std::min(resource.first_use, position);
+					resource.last_use = std::max(resource.last_use, position);
+					resource.usage |= access_usage(use.access);
+				}
+			}
+		}
+
+		static bool lifetimes_overlap(const RGResourceNode& a, const RGResourceNode& b) {
+			return !(a.last_use < b.first_use || b.last_use < a.first_use);
+		}
+
+		static void allocate_transients(RenderGraph& graph) {
+			std::vector<RGResource> transients;
+			std::vector<VkMemoryRequirements> requirements(graph.resources.size());
+
+			for (auto r = 0u; r < graph.resources.size(); r++) {
+				auto& resource = graph.resources[r];
+				if (resource.imported || !resource.used) continue;
+
+				VkExtent3D extent = { resource.desc.extent.width, resource.desc.extent.height, 1 };
+				auto usage = resource.usage | (resource.lazy ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+				auto image_info = vki::image_create_info(resource.desc.format, usage, extent);
+				VK_CHECK(vkCreateImage(graph.device, &image_info, nullptr, &resource.image));
+				vkGetImageMemoryRequirements(graph.device, resource.image, &requirements[r]);
+				graph.stats.requested_bytes += requirements[r].size;
+				transients.push_back(r);
+			}
+
+			// biggest first, so the smaller ones fill in behind them
+			std::sort(transients.begin(), transients.end(), [&](RGResource a, RGResource b) {
+				return requirements[a].size > requirements[b].size;
+				});
+
+			VmaAllocationCreateInfo lazy_info = {
+				.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED,
+			};
+			for (auto r : transients) {
+				auto& resource = graph.resources[r];
+				auto& req = requirements[r];
+
+				u32 lazy_type;
+				if (resource.lazy && vmaFindMemoryTypeIndex(graph.allocator, req.memoryTypeBits, &lazy_info, &lazy_type) == VK_SUCCESS) {
+					// lazy memory is free until touched, nothing to gain from aliasing it
+					resource.alias_block = (u32)graph.blocks.size();
+					graph.blocks.push_back({ .requirements = req, .members = { r }, .lazy = true });
+					continue;
+				}
+				// no lazy memory on this device (desktop gpus), alias it like any other transient
+
+				auto block = std::find_if(graph.blocks.begin(), graph.blocks.end(), [&](const RGAliasBlock& candidate) {
+					if (candidate.lazy || (candidate.requirements.memoryTypeBits & req.memoryTypeBits) == 0) return false;
+					return std::none_of(candidate.members.begin(), candidate.members.end(), [&](RGResource member) {
+						return lifetimes_overlap(graph.resources[member], resource);
+						});
+					});
+
+				if (block == graph.blocks.end()) {
+					graph.blocks.push_back({ .requirements = req });
+					block = graph.blocks.end() - 1;
+				} else {
+					block->requirements.size = std::max(block->requirements.size, req.size);
+					block->requirements.alignment = std::max(block->requirements.alignment, req.alignment);
+					block->requirements.memoryTypeBits &= req.memoryTypeBits;
+				}
+				block->members.push_back(r);
+				resource.alias_block = (u32)(block - graph.blocks.begin());
+			}
+
+			VmaAllocationCreateInfo alloc_info = {
+				.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+				.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			};
+			for (auto& block : graph.blocks) {
+				VK_CHECK(vmaAllocateMemory(graph.allocator, &block.requirements, block.lazy ? &lazy_info : &alloc_info, &block.allocation, nullptr));
+				(block.lazy ? graph.stats.lazy_bytes : graph.stats.allocated_bytes) += block.requirements.size;
+				for (auto member : block.members) {
+					auto& resource = graph.resources[member];
+					VK_CHECK(vmaBindImageMemory(graph.allocator, block.allocation, resource.image));
+					auto view_info = vki::imageview_create_info(resource.desc.format, resource.image, resource.desc.aspect);
+					VK_CHECK(vkCreateImageView(graph.device, &view_info, nullptr, &resource.view));
+				}
+			}
+		}
+
+		static bool can_join(const RenderGraph& graph, const RGPassNode& group, const RGPassNode& pass) {
+			// dynamic rendering has no subpasses to fuse into
+			if (uses_dynamic_rendering(graph, group) || uses_dynamic_rendering(graph, pass)) return false;
+			if (group.subpasses.size() >= MAX_SUBPASSES) return false;
+
+			// joins if it reads the group through an input attachment, or only draws on top of what the group has bound
+			bool reads_input = false;
+			bool only_group_attachments = true;
+			u32 added = 0;
+			for (auto& use : pass.uses) {
+				bool in_group = std::find(group.attachment_resources.begin(), group.attachment_resources.end(), use.resource) != group.attachment_resources.end();
+				reads_input |= use.access == RGAccess::InputAttachment;
+				only_group_attachments &= in_group && is_attachment(use.access);
+				if (is_attachment(use.access)) {
+					auto& extent = graph.resources[use.resource].desc.extent;
+					if (extent.width != group.extent.width || extent.height != group.extent.height) return false;
+					added += in_group ? 0 : 1;
+				} else if (in_group) {
+					// sampling something the group renders to would need it to leave the tile
+					return false;
+				}
+			}
+			if (!reads_input && !only_group_attachments) return false;
+			return group.attachment_resources.size() + added <= MAX_ATTACHMENTS;
+		}
+
+		/* fuses each pass that reads an input attachment into the render pass before it,
+		* then derives attachment ops. transients that live and die inside one group go lazy */
+		static void build_groups(RenderGraph& graph) {
+			std::vector<bool> written(graph.resources.size(), false);
+			RGPass group = RG_NONE;
+			u32 group_start = 0;
+
+			auto close_group = [&](u32 group_end) {
+				if (group == RG_NONE) return;
+				auto& node = graph.passes[group];
+				for (auto i = 0u; i < node.attachment_resources.size(); i++) {
+					auto& resource = graph.resources[node.attachment_resources[i]];
+					// anything not read later (and not handed out) is never written back
+					bool read_later = resource.imported || resource.last_use > group_end;
+					node.attachments[i].on_store = read_later ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+					resource.lazy = !read_later && resource.first_use >= group_start && node.attachments[i].on_load != VK_ATTACHMENT_LOAD_OP_LOAD
+						&& (resource.usage & ~ATTACHMENT_USAGE) == 0;
+				}
+				group = RG_NONE;
+			};
+
+			for (auto position = 0u; position < graph.order.size(); position++) {
+				auto p = graph.order[position];
+				auto& pass = graph.passes[p];
+				pass.group = p;
+				pass.subpass = 0;
+				pass.group_size = 1;
+				pass.subpasses.clear();
+				pass.attachments.clear();
+				pass.attachment_resources.clear();
+				pass.clear_values.clear();
+				pass.pass = VK_NULL_HANDLE;
+				pass.framebuffer = VK_NULL_HANDLE;
+				pass.dynamic = false;
+
+				if (!is_raster(pass)) {
+					close_group(position - 1);
+				} else if (group != RG_NONE && can_join(graph, graph.passes[group], pass)) {
+					auto& node = graph.passes[group];
+					pass.group = group;
+					pass.subpass = (u32)node.subpasses.size();
+					node.group_size++;
+				} else {
+					close_group(position - 1);
+					group = p;
+					group_start = position;
+					pass.dynamic = uses_dynamic_rendering(graph, pass);
+					assert(!pass.dynamic || std::none_of(pass.uses.begin(), pass.uses.end(), [](const RGUse& use) { return use.access == RGAccess::InputAttachment; }));
+					auto first = std::find_if(pass.uses.begin(), pass.uses.end(), [](const RGUse& use) { return is_attachment(use.access); });
+					pass.extent = graph.resources[first->resource].desc.extent;
+					pass.area = pass.extent;
+				}
+
+				if (pass.group == p && !is_raster(pass)) {
+					continue;
+				}
+
+				auto& node = graph.passes[pass.group];
+				SubpassInfo subpass{};
+				for (auto& use : pass.uses) {
+					if (!is_attachment(use.access)) continue;
+					auto& resource = graph.resources[use.resource];
+					auto layout = access_state(use.access, true).layout;
+
+					auto found = std::find(node.attachment_resources.begin(), node.attachment_resources.end(), use.resource);
+					auto index = (u32)(found - node.attachment_resources.begin());
+					if (found == node.attachment_resources.end()) {
+						// earlier content is kept, otherwise there is nothing worth loading.
+						// the graph transitions into the first layout itself, the render pass handles the rest
+						auto on_load = written[use.resource] ? VK_ATTACHMENT_LOAD_OP_LOAD
+							: use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR
+							: VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+						node.attachments.push_back({
+							.format = resource.desc.format,
+							.initial_layout = layout,
+							.final_layout = layout,
+							.on_load = on_load,
+							.on_store = VK_ATTACHMENT_STORE_OP_STORE,
+							.attachment_layout = layout,
+							});
+						node.attachment_resources.push_back(use.resource);
+						node.clear_values.push_back(use.clear_value);
+					}
+					node.attachments[index].final_layout = layout;
+
+					switch (use.access) {
+					case RGAccess::ColorAttachment: subpass.color |= 1 << index; break;
+					case RGAccess::DepthAttachment: subpass.depth |= 1 << index; break;
+					case RGAccess::InputAttachment: subpass.input |= 1 << index; break;
+					default: break;
+					}
+				}
+				node.subpasses.push_back(subpass);
+
+				for (auto& use : pass.uses) {
+					if (is_write(use.access)) written[use.resource] = true;
+				}
+			}
+			close_group((u32)graph.order.size() - 1);
+		}
+
+		static VkFramebuffer get_framebuffer(RenderGraph& graph, const RGPassNode& pass);
+
+		static void resolve_render_passes(RenderGraph& graph) {
+			for (auto p : graph.order) {
+				auto& pass = graph.passes[p];
+				if (pass.group != p || pass.attachments.empty() || pass.dynamic) continue;
+
+				pass.pass = graph.pass_cache->get_or_create(pass.attachments, pass.subpasses);
+				bool imported = std::any_of(pass.attachment_resources.begin(), pass.attachment_resources.end(), [&](RGResource r) {
+					return graph.resources[r].imported;
+					});
+				pass.framebuffer = imported ? VK_NULL_HANDLE : get_framebuffer(graph, pass);
+			}
+		}
+
+		void compile(RenderGraph& graph) {
+			graph.stats = {};
+			find_producers(graph);
+			cull(graph);
+			compute_lifetimes(graph);
+			build_groups(graph);
+			allocate_transients(graph);
+			resolve_render_passes(graph);
+
+			graph.stats.passes = (u32)graph.passes.size();
+			graph.stats.culled_passes = (u32)(graph.passes.size() - graph.order.size());
+			graph.stats.textures = (u32)graph.resources.size();
+			graph.stats.culled_textures = (u32)std::count_if(graph.resources.begin(), graph.resources.end(), [](const RGResourceNode& r) { return !r.used; });
+
+			for (auto& pass : graph.passes) {
+				if (pass.culled) DBG("culled pass " << pass.name);
+			}
+			for (auto& resource : graph.resources) {
+				if (!resource.used) DBG("culled texture " << resource.name);
+			}
+			for (auto p : graph.order) {
+				auto& pass = graph.passes[p];
+				if (pass.group != p) DBG("fused pass " << pass.name << " into " << graph.passes[pass.group].name << " as subpass " << pass.subpass);
+			}
+			DBG("transients: " << graph.stats.requested_bytes / 1024 << "kb requested, " << graph.stats.allocated_bytes / 1024 << "kb allocated in " << graph.blocks.size() << " blocks, " << graph.stats.lazy_bytes / 1024 << "kb lazy");
+		}
+
+		// -- execute
+
+		static VkFramebuffer get_framebuffer(RenderGraph& graph, const RGPassNode& pass) {
+			std::array<VkImageView, MAX_ATTACHMENTS> views;
+			for (auto i = 0u; i < pass.attachment_resources.size(); i++) {
+				views[i] = graph.resources[pass.attachment_resources[i]].view;
+			}
+			return graph.framebuffer_cache->get_or_create(pass.pass, pass.extent, std::span(views.data(), pass.attachment_resources.size()));
+		}
+
+		void execute(RenderGraph& graph, VkCommandBuffer cmd) {
+			std::vector<RGState> states(graph.resources.size(), RGState{ VK_IMAGE_LAYOUT_UNDEFINED, 0, 0 });
+			std::vector<bool> touched(graph.resources.size(), false);
+			// aliased transients wait on whoever used their memory last
+			std::vector<RGState> block_states(graph.blocks.size(), FRAME_START);
+			std::vector<VkImageMemoryBarrier> barriers;
+
+			std::vector<bool> in_group(graph.resources.size(), false);
+
+			for (auto position = 0u; position < graph.order.size();) {
+				auto& group = graph.passes[graph.order[position]];
+				bool raster = group.pass != VK_NULL_HANDLE || group.dynamic;
+				VkPipelineStageFlags src_stage = 0;
+				VkPipelineStageFlags dst_stage = 0;
+				barriers.clear();
+				std::fill(in_group.begin(), in_group.end(), false);
+
+				for (auto k = 0u; k < group.group_size; k++) {
+					for (auto& use : graph.passes[graph.order[position + k]].uses) {
+						auto& resource = graph.resources[use.resource];
+						auto next = access_state(use.access, raster);
+						auto previous = states[use.resource];
+
+						// later uses inside the render pass are transitioned by its subpasses
+						bool needs_barrier = false;
+						if (!in_group[use.resource] || !is_attachment(use.access)) {
+							if (!touched[use.resource]) {
+								// imported images come out of the acquire semaphore wait, which already covers next.stage
+								previous = resource.imported ? RGState{ VK_IMAGE_LAYOUT_UNDEFINED, next.stage, 0 } : block_states[resource.alias_block];
+								previous.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+							}
+							needs_barrier = !touched[use.resource]
+								|| previous.layout != next.layout
+								|| (previous.access & WRITE_ACCESS)
+								|| (next.access & WRITE_ACCESS);
+						}
+
+						if (needs_barrier) {
+							barriers.push_back(VkImageMemoryBarrier{
+								.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+								.srcAccessMask = previous.access & WRITE_ACCESS,
+								.dstAccessMask = next.access,
+								.oldLayout = previous.layout,
+								.newLayout = next.layout,
+								.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+								.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+								.image = resource.image,
+								.subresourceRange = { resource.desc.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS },
+								});
+							src_stage |= previous.stage;
+							dst_stage |= next.stage;
+						}
+
+						states[use.resource] = next;
+						touched[use.resource] = true;
+						in_group[use.resource] = true;
+						if (!resource.imported) block_states[resource.alias_block] = next;
+					}
+				}
+
+				if (!barriers.empty()) {
+					vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, (u32)barriers.size(), barriers.data());
+				}
+
+				RGPassContext context = {
+					.cmd = cmd,
+					.pass = group.pass,
+					.framebuffer = VK_NULL_HANDLE,
+					.extent = group.area,
+					.subpass = 0,
+					.graph = &graph,
+				};
+
+				if (group.dynamic) {
+					// same ops the render pass would have had, the barriers above already did the layouts
+					std::array<VkRenderingAttachmentInfoKHR, MAX_ATTACHMENTS> colors;
+					VkRenderingAttachmentInfoKHR depth;
+					u32 color_count = 0;
+					bool has_depth = false;
+					auto& subpass = group.subpasses[0];
+					for (auto i = 0u; i < group.attachment_resources.size(); i++) {
+						auto& attachment = group.attachments[i];
+						VkRenderingAttachmentInfoKHR info = {
+							.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+							.imageView = graph.resources[group.attachment_resources[i]].view,
+							.imageLayout = attachment.attachment_layout,
+							.resolveMode = VK_RESOLVE_MODE_NONE,
+							.loadOp = attachment.on_load,
+							.storeOp = attachment.on_store,
+							.clearValue = group.clear_values[i],
+						};
+						if (subpass.depth & (1 << i)) {
+							depth = info;
+							has_depth = true;
+						} else if (subpass.color & (1 << i)) {
+							colors[color_count++] = info;
+						}
+					}
+
+					VkRenderingInfoKHR rendering_info = {
+						.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+						.renderArea = { { 0, 0 }, group.area },
+						.layerCount = 1,
+						.colorAttachmentCount = color_count,
+						.pColorAttachments = colors.data(),
+						.pDepthAttachment = has_depth ? &depth : nullptr,
+					};
+					graph.begin_rendering(cmd, &rendering_info);
+					group.execute(context);
+					graph.end_rendering(cmd);
+				} else if (raster) {
+					context.framebuffer = group.framebuffer != VK_NULL_HANDLE ? group.framebuffer : get_framebuffer(graph, group);
+					auto begin_info = vki::renderpass_begin_info(group.pass, context.framebuffer, group.area);
+					begin_info.clearValueCount = (u32)group.clear_values.size();
+					begin_info.pClearValues = group.clear_values.data();
+					vkCmdBeginRenderPass(cmd, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+					for (auto k = 0u; k < group.group_size; k++) {
+						if (k > 0) vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+						context.subpass = k;
+						graph.passes[graph.order[position + k]].execute(context);
+					}
+					vkCmdEndRenderPass(cmd);
+				} else {
+					group.execute(context);
+				}
+				position += group.group_size;
+			}
+
+			// hand imported images back in the layout their owner expects
+			barriers.clear();
+			VkPipelineStageFlags src_stage = 0;
+			for (auto r = 0u; r < graph.resources.size(); r++) {
+				auto& resource = graph.resources[r];
+				if (!resource.imported || !touched[r] || states[r].layout == resource.final_layout) continue;
+				barriers.push_back(VkImageMemoryBarrier{
+					.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+					.srcAccessMask = states[r].access & WRITE_ACCESS,
+					.dstAccessMask = 0,
+					.oldLayout = states[r].layout,
+					.newLayout = resource.final_layout,
+					.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.image = resource.image,
+					.subresourceRange = { resource.desc.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS },
+					});
+				src_stage |= states[r].stage;
+			}
+			if (!barriers.empty()) {
+				vkCmdPipelineBarrier(cmd, src_stage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, (u32)barriers.size(), barriers.data());
+			}
+		}
+
+		void destroy(RenderGraph& graph) {
+			for (auto& resource : graph.resources) {
+				if (resource.imported) continue;
+				if (resource.view != VK_NULL_HANDLE) {
+					graph.framebuffer_cache->evict(resource.view);
+					vkDestroyImageView(graph.device, resource.view, nullptr);
+				}
+				if (resource.image != VK_NULL_HANDLE) vkDestroyImage(graph.device, resource.image, nullptr);
+			}
+			for (auto& block : graph.blocks) {
+				vmaFreeMemory(graph.allocator, block.allocation);
+			}
+			reset(graph);
+		}
+
+		void destroy(RenderGraph& graph, FrameDeletionQueue& deferred, u64 value) {
+			for (auto& resource : graph.resources) {
+				if (resource.imported) continue;
+				if (resource.view != VK_NULL_HANDLE) defer_destroy(deferred, value, resource.view);
+				if (resource.image != VK_NULL_HANDLE) defer_destroy(deferred, value, resource.image);
+			}
+			for (auto& block : graph.blocks) {
+				defer_destroy(deferred, value, block.allocation);
+			}
+			reset(graph);
+		}
+
+		void reset(RenderGraph& graph) {
+			graph.resources.clear();
+			graph.passes.clear();
+			graph.order.clear();
+			graph.blocks.clear();
+			graph.stats = {};
+		}
+
+		VkRenderPass render_pass(const RenderGraph& graph, RGPass pass) {
+			auto group = graph.passes[pass].group;
+			return group == RG_NONE ? VK_NULL_HANDLE : graph.passes[group].pass;
+		}
+
+		u32 render_subpass(const RenderGraph& graph, RGPass pass) {
+			return graph.passes[pass].subpass;
+		}
+
+		void set_render_area(RenderGraph& graph, RGPass pass, VkExtent2D area) {
+			auto group = graph.passes[pass].group;
+			if (group == RG_NONE) return;
+			auto& node = graph.passes[group];
+			node.area = { std::min(area.width, node.extent.width), std::min(area.height, node.extent.height) };
+		}
+
+		VkExtent2D render_area(const RenderGraph& graph, RGPass pass) {
+			auto group = graph.passes[pass].group;
+			return group == RG_NONE ? VkExtent2D{} : graph.passes[group].area;
+		}
+
+		PipelineTarget pipeline_target(const RenderGraph& graph, RGPass pass) {
+			PipelineTarget target{};
+			auto group = graph.passes[pass].group;
+			if (group == RG_NONE) return target;
+
+			auto& node = graph.passes[group];
+			if (!node.dynamic) {
+				target.pass = node.pass;
+				target.subpass = graph.passes[pass].subpass;
+				return target;
+			}
+			// colors go in attachment order, same as they are bound in execute
+			auto& subpass = node.subpasses[0];
+			for (auto i = 0u; i < node.attachments.size(); i++) {
+				if (subpass.depth & (1 << i)) {
+					target.depth_format = node.attachments[i].format;
+				} else if (subpass.color & (1 << i)) {
+					target.color_formats[target.color_count++] = node.attachments[i].format;
+				}
+			}
+			return target;
+		}
+
+		VkImageView texture_view(const RenderGraph& graph, RGResource resource) {
+			return graph.resources[resource].view;
+		}
+	}
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include <vk_mem_alloc.h>
+#include <vector>
+#include <string>
+#include <functional>
+#include "zebratypes.h"
+#include "renderer.h"
+#include "g_pipeline.h"
+#include "g_deletion.h"
+
+namespace zebra {
+	namespace render {
+		using RGResource = u32;
+		using RGPass = u32;
+		constexpr u32 RG_NONE = ~0u;
+
+		enum class RGAccess : u8 {
+			ColorAttachment,
+			DepthAttachment,
+			Sampled,
+			Storage,
+			// read in place from the tile, fuses the pass into the render pass of its producer.
+			// only works with render passes, not with dynamic rendering
+			InputAttachment,
+		};
+
+		struct RGTextureDesc {
+			VkFormat format;
+			VkExtent2D extent;
+			VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+		};
+
+		struct RGUse {
+			RGResource resource;
+			RGAccess access;
+			// only applied when nothing earlier in the frame wrote the attachment
+			bool clear = false;
+			VkClearValue clear_value{};
+		};
+
+		struct RenderGraph;
+
+		struct RGPassContext {
+			VkCommandBuffer cmd;
+			// null for passes without attachments, and for passes recorded with dynamic rendering
+			VkRenderPass pass;
+			VkFramebuffer framebuffer;
+			// the render area, smaller than the attachments when scaled
+			VkExtent2D extent;
+			u32 subpass;
+			RenderGraph* graph;
+		};
+
+		struct RGResourceNode {
+			std::string name;
+			RGTextureDesc desc;
+			// imported images (the swapchain) are owned elsewhere, start every frame undefined
+			// and are left in final_layout
+			bool imported = false;
+			VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkImageUsageFlags usage = 0;
+
+			// -- filled by compile, positions are in execution order
+			bool used = false;
+			u32 first_use = RG_NONE;
+			u32 last_use = 0;
+			u32 alias_block = RG_NONE;
+			// never leaves the render pass it is used in, so it may not need memory at all
+			bool lazy = false;
+			VkImage image = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+		};
+
+		struct RGPassNode {
+			std::string name;
+			std::vector<RGUse> uses;
+			std::function<void(RGPassContext&)> execute;
+			bool side_effect = false;
+			// recorded in a render pass even when the graph uses dynamic rendering,
+			// for code that can only build its pipelines against one (imgui)
+			bool needs_render_pass = false;
+
+			// -- filled by compile
+			bool culled = true;
+			// begun with vkCmdBeginRendering, no render pass or framebuffer behind it
+			bool dynamic = false;
+			std::vector<RGPass> producers;
+			// passes fused into one render pass run as subpasses, the first one (the group) owns everything below
+			RGPass group = RG_NONE;
+			u32 subpass = 0;
+			u32 group_size = 1;
+			std::vector<SubpassInfo> subpasses;
+			std::vector<DependencyInfo> attachments;
+			std::vector<RGResource> attachment_resources;
+			std::vector<VkClearValue> clear_values;
+			VkRenderPass pass = VK_NULL_HANDLE;
+			VkExtent2D extent{};
+			// what is actually rendered, top left of extent. changes per frame with set_render_area
+			VkExtent2D area{};
+			// resolved once, unless an attachment is imported and changes every frame
+			VkFramebuffer framebuffer = VK_NULL_HANDLE;
+		};
+
+		/// @brief one allocation shared by transients whose lifetimes do not overlap
+		struct RGAliasBlock {
+			VmaAllocation allocation = VK_NULL_HANDLE;
+			VkMemoryRequirements requirements{};
+			std::vector<RGResource> members;
+			bool lazy = false;
+		};
+
+		struct RGStats {
+			u32 passes = 0;
+			u32 culled_passes = 0;
+			u32 textures = 0;
+			u32 culled_textures = 0;
+			VkDeviceSize requested_bytes = 0;
+			VkDeviceSize allocated_bytes = 0;
+			// lazily allocated, only backed if the driver has to spill the tile
+			VkDeviceSize lazy_bytes = 0;
+		};
+
+		struct RenderGraph {
+			VkDevice device = VK_NULL_HANDLE;
+			VmaAllocator allocator = VK_NULL_HANDLE;
+			RenderPassCache* pass_cache = nullptr;
+			FramebufferCache* framebuffer_cache = nullptr;
+			// record raster passes with VK_KHR_dynamic_rendering instead of render passes.
+			// set before compile, together with the two entry points
+			bool dynamic_rendering = false;
+			PFN_vkCmdBeginRenderingKHR begin_rendering = nullptr;
+			PFN_vkCmdEndRenderingKHR end_rendering = nullptr;
+
+			std::vector<RGResourceNode> resources;
+			std::vector<RGPassNode> passes;
+			// passes that survived culling, in the order they are recorded
+			std::vector<RGPass> order;
+			std::vector<RGAliasBlock> blocks;
+			RGStats stats;
+		};
+
+		struct RGPassBuilder {
+			RenderGraph* graph;
+			RGPass pass;
+
+			RGPassBuilder& write_color(RGResource target);
+			RGPassBuilder& write_color(RGResource target, VkClearValue clear);
+			RGPassBuilder& write_depth(RGResource target, VkClearValue clear);
+			RGPassBuilder& read(RGResource source);
+			/// @brief subpassLoad from source, the pass becomes a subpass of the render pass that wrote it
+			RGPassBuilder& read_attachment(RGResource source);
+			RGPassBuilder& storage(RGResource target);
+			/// @brief the pass is never culled, even if nothing reads its output
+			RGPassBuilder& side_effect();
+			/// @brief keeps the pass in a real render pass when the graph uses dynamic rendering
+			RGPassBuilder& needs_render_pass();
+			RGPass execute(std::function<void(RGPassContext&)>&& fn);
+		};
+
+		RGResource create_texture(RenderGraph& graph, std::string name, RGTextureDesc desc);
+		RGResource import_texture(RenderGraph& graph, std::string name, RGTextureDesc desc, VkImageLayout final_layout);
+		/// @brief points an imported texture at this frame's image
+		void bind_imported(RenderGraph& graph, RGResource resource, VkImage image, VkImageView view);
+		RGPassBuilder add_pass(RenderGraph& graph, std::string name);
+
+		/* culls passes that nothing observable depends on, fuses input attachment readers
+		* (and passes that only draw over the same attachments) into subpasses,
+		* derives load/store ops and render passes, and creates the transient images,
+		* aliasing memory between them where lifetimes allow */
+		void compile(RenderGraph& graph);
+		/// @brief records all passes with the barriers and layout transitions between them
+		void execute(RenderGraph& graph, VkCommandBuffer cmd);
+		void destroy(RenderGraph& graph);
+		/// @brief hands the transients to deferred, for a graph that submissions up to value may still be using
+		void destroy(RenderGraph& graph, FrameDeletionQueue& deferred, u64 value);
+		/// @brief forgets all passes and resources without destroying them, for when a copy of the graph owns them now
+		void reset(RenderGraph& graph);
+
+		/// @brief the render pass pipelines for pass have to be built against, shared by fused passes
+		VkRenderPass render_pass(const RenderGraph& graph, RGPass pass);
+		u32 render_subpass(const RenderGraph& graph, RGPass pass);
+		/// @brief renders only the top left area of the attachments from now on, for resolution scaling without reallocating
+		void set_render_area(RenderGraph& graph, RGPass pass, VkExtent2D area);
+		VkExtent2D render_area(const RenderGraph& graph, RGPass pass);
+		/// @brief what pipelines for pass are built against, the render pass or just the attachment formats
+		PipelineTarget pipeline_target(const RenderGraph& graph, RGPass pass);
+		VkImageView texture_view(const RenderGraph& graph, RGResource resource);
+	}
+}
@@ -0,0 +1,281 @@
+#include "g_simplify.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace zebra {
+	// symmetric 4x4 of summed plane equations, each weighted by the area of its triangle
+	struct Quadric {
+		float a00, a01, a02, a11, a12, a22;
+		float b0, b1, b2;
+		float c;
+		float weight;
+	};
+
+	static void add_plane(Quadric& q, glm::vec3 n, float d, float w) {
+		q.a00 += w * n.x * n.x;
+		q.a01 += w * n.x * n.y;
+		q.a02 += w * n.x * n.z;
+		q.a11 += w * n.y * n.y;
+		q.a12 += w * n.y * n.z;
+		q.a22 += w * n.z * n.z;
+		q.b0 += w * n.x * d;
+		q.b1 += w * n.y * d;
+		q.b2 += w * n.z * d;
+		q.c += w * d * d;
+		q.weight += w;
+	}
+
+	static Quadric sum(const Quadric& a, const Quadric& b) {
+		return {
+			a.a00 + b.a00, a.a01 + b.a01, a.a02 + b.a02, a.a11 + b.a11, a.a12 + b.a12, a.a22 + b.a22,
+			a.b0 + b.b0, a.b1 + b.b1, a.b2 + b.b2,
+			a.c + b.c,
+			a.weight + b.weight,
+		};
+	}
+
+	// squared distance of p to the planes, averaged by area
+	static float evaluate(const Quadric& q, glm::vec3 p) {
+		float r = q.a00 * p.x * p.x + q.a11 * p.y * p.y + q.a22 * p.z * p.z
+			+ 2.f * (q.a01 * p.x * p.y + q.a02 * p.x * p.z + q.a12 * p.y * p.z)
+			+ 2.f * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z)
+			+ q.c;
+		return q.weight > 0.f ? std::abs(r) / q.weight : 0.f;
+	}
+
+	static u64 edge_key(u32 a, u32 b) {
+		return a < b ? (u64)a << 32 | b : (u64)b << 32 | a;
+	}
+
+	struct Collapse {
+		u32 from;
+		u32 to;
+		float cost;
+	};
+
+	std::vector<u32> simplify_mesh(std::span<const u32> indices, std::span<const glm::vec3> positions, u64 target_index_count, float max_error, float& out_error) {
+		const u32 vertex_count = (u32)positions.size();
+		std::vector<u32> result(indices.begin(), indices.end());
+		out_error = 0.f;
+		if (result.size() <= target_index_count) return result;
+
+		// -- vertices at the same position share a class, found by sorting instead of hashing floats
+		std::vector<u32> order(vertex_count);
+		std::iota(order.begin(), order.end(), 0u);
+		std::sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+			auto& pa = positions[a];
+			auto& pb = positions[b];
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			if (pa.z != pb.z) return pa.z < pb.z;
+			return a < b;
+			});
+		// by class, its members are order[class_start, class_start + class_size)
+		std::vector<u32> position_class(vertex_count);
+		std::vector<u32> class_start(vertex_count, 0);
+		std::vector<u32> class_size(vertex_count, 0);
+		for (auto i = 0u; i < vertex_count; i++) {
+			bool same = i > 0 && positions[order[i]] == positions[order[i - 1]];
+			position_class[order[i]] = same ? position_class[order[i - 1]] : order[i];
+			if (!same) class_start[order[i]] = i;
+			class_size[position_class[order[i]]]++;
+		}
+
+		// -- everything on an edge without exactly two triangles is locked, the edges between classes see across seams
+		std::vector<u64> class_edges;
+		class_edges.reserve(result.size());
+		for (u64 t = 0; t < result.size(); t += 3) {
+			for (auto e = 0; e < 3; e++) {
+				auto a = position_class[result[t + e]];
+				auto b = position_class[result[t + (e + 1) % 3]];
+				if (a != b) class_edges.push_back(edge_key(a, b));
+			}
+		}
+		std::sort(class_edges.begin(), class_edges.end());
+		std::vector<u8> locked_class(vertex_count, 0);
+		for (u64 first = 0; first < class_edges.size();) {
+			auto last = first;
+			while (last < class_edges.size() && class_edges[last] == class_edges[first]) last++;
+			if (last - first != 2) {
+				locked_class[class_edges[first] >> 32] = 1;
+				locked_class[class_edges[first] & 0xFFFFFFFF] = 1;
+			}
+			first = last;
+		}
+		std::vector<u8> locked(vertex_count);
+		for (auto v = 0u; v < vertex_count; v++) {
+			locked[v] = locked_class[position_class[v]];
+		}
+
+		// -- quadrics of the input, merged along with the collapses so errors add up over passes
+		std::vector<Quadric> quadrics(vertex_count, Quadric{});
+		for (u64 t = 0; t < result.size(); t += 3) {
+			auto& p0 = positions[result[t]];
+			auto n = glm::cross(positions[result[t + 1]] - p0, positions[result[t + 2]] - p0);
+			float length = glm::length(n);
+			if (length == 0.f) continue;
+			n /= length;
+			for (auto c = 0; c < 3; c++) {
+				add_plane(quadrics[result[t + c]], n, -glm::dot(n, p0), length * 0.5f);
+			}
+		}
+
+		const float max_cost = max_error * max_error;
+		float worst = 0.f;
+		std::vector<u32> remap(vertex_count);
+		std::vector<u8> touched(vertex_count);
+		std::vector<u32> adjacency_offsets(vertex_count + 1);
+		std::vector<u32> adjacency;
+		std::vector<u64> edges;
+		std::vector<Collapse> collapses;
+		// what moves with a collapse, from and to
+		std::vector<std::pair<u32, u32>> moves;
+
+		/* a seam vertex only goes together with the rest of its class. each of them needs a neighbour at the
+		* target's position to go to, which keeps every triangle inside its own uv island. across a seam there
+		* is none, so seams only ever shorten along themselves */
+		auto seam_moves = [&](u32 from, u32 to) {
+			moves.clear();
+			if (class_size[position_class[from]] == 1) {
+				moves.push_back({ from, to });
+				return true;
+			}
+			const u32 target = position_class[to];
+			const u32 start = class_start[position_class[from]];
+			for (auto m = start; m < start + class_size[position_class[from]]; m++) {
+				u32 member = order[m];
+				u32 partner = ~0u;
+				for (auto i = adjacency_offsets[member]; i < adjacency_offsets[member + 1] && partner == ~0u; i++) {
+					auto t = (u64)adjacency[i] * 3;
+					for (auto c = 0; c < 3; c++) {
+						if (position_class[result[t + c]] == target) partner = result[t + c];
+					}
+				}
+				// no triangles left, nothing to move
+				if (adjacency_offsets[member] == adjacency_offsets[member + 1]) continue;
+				if (partner == ~0u) return false;
+				moves.push_back({ member, partner });
+			}
+			return true;
+		};
+		auto collapse_cost = [&](u32 from, u32 to) {
+			if (locked[from] || !seam_moves(from, to)) return std::numeric_limits<float>::infinity();
+			Quadric merged{};
+			for (auto [a, b] : moves) {
+				merged = sum(merged, sum(quadrics[a], quadrics[b]));
+			}
+			return evaluate(merged, positions[to]);
+		};
+
+		auto normal = [&](u32 i0, u32 i1, u32 i2, u32 moved, glm::vec3 to) {
+			glm::vec3 p[3] = { positions[i0], positions[i1], positions[i2] };
+			u32 ids[3] = { i0, i1, i2 };
+			for (auto c = 0; c < 3; c++) {
+				if (ids[c] == moved) p[c] = to;
+			}
+			return glm::cross(p[1] - p[0], p[2] - p[0]);
+		};
+
+		while (result.size() > target_index_count) {
+			// -- triangles around every vertex
+			std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0u);
+			for (auto index : result) {
+				adjacency_offsets[index + 1]++;
+			}
+			for (auto v = 0u; v < vertex_count; v++) {
+				adjacency_offsets[v + 1] += adjacency_offsets[v];
+			}
+			adjacency.resize(result.size());
+			{
+				std::vector<u32> cursor(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+				for (u64 i = 0; i < result.size(); i++) {
+					adjacency[cursor[result[i]]++] = (u32)(i / 3);
+				}
+			}
+
+			// -- every edge once, in the cheaper of the directions that are allowed
+			edges.clear();
+			for (u64 t = 0; t < result.size(); t += 3) {
+				for (auto e = 0; e < 3; e++) {
+					edges.push_back(edge_key(result[t + e], result[t + (e + 1) % 3]));
+				}
+			}
+			std::sort(edges.begin(), edges.end());
+			edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+			collapses.clear();
+			for (auto key : edges) {
+				u32 a = (u32)(key >> 32);
+				u32 b = (u32)(key & 0xFFFFFFFF);
+				float to_b = collapse_cost(a, b);
+				float to_a = collapse_cost(b, a);
+				Collapse collapse = to_b <= to_a ? Collapse{ a, b, to_b } : Collapse{ b, a, to_a };
+				if (collapse.cost <= max_cost) {
+					collapses.push_back(collapse);
+				}
+			}
+			if (collapses.empty()) break;
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+			// -- cheapest first, a vertex takes part in one collapse per pass so adjacency stays valid
+			std::iota(remap.begin(), remap.end(), 0u);
+			std::fill(touched.begin(), touched.end(), 0);
+			const u64 wanted = (result.size() - target_index_count + 2) / 3;
+			u64 removed = 0;
+			for (auto& collapse : collapses) {
+				if (removed >= wanted) break;
+				if (touched[collapse.from] || touched[collapse.to]) continue;
+				// the neighbourhood is as it was when the cost was taken, so this holds again
+				seam_moves(collapse.from, collapse.to);
+
+				bool blocked = false;
+				u32 shared = 0;
+				for (auto [from, to] : moves) {
+					blocked = blocked || touched[from] || touched[to];
+					for (auto i = adjacency_offsets[from]; i < adjacency_offsets[from + 1] && !blocked; i++) {
+						auto t = (u64)adjacency[i] * 3;
+						u32 i0 = result[t], i1 = result[t + 1], i2 = result[t + 2];
+						if (i0 == to || i1 == to || i2 == to) {
+							shared++;
+							continue;
+						}
+						auto before = normal(i0, i1, i2, ~0u, {});
+						auto after = normal(i0, i1, i2, from, positions[to]);
+						blocked = glm::dot(before, after) <= 0.f;
+					}
+				}
+				if (blocked) continue;
+
+				for (auto [from, to] : moves) {
+					remap[from] = to;
+					quadrics[to] = sum(quadrics[to], quadrics[from]);
+				}
+				worst = std::max(worst, collapse.cost);
+				removed += shared;
+				for (auto [from, to] : moves) {
+					for (auto i = adjacency_offsets[from]; i < adjacency_offsets[from + 1]; i++) {
+						auto t = (u64)adjacency[i] * 3;
+						touched[result[t]] = touched[result[t + 1]] = touched[result[t + 2]] = 1;
+					}
+				}
+			}
+			if (removed == 0) break;
+
+			// -- triangles that lost an edge are degenerate now and drop out
+			u64 kept = 0;
+			for (u64 t = 0; t < result.size(); t += 3) {
+				u32 i0 = remap[result[t]], i1 = remap[result[t + 1]], i2 = remap[result[t + 2]];
+				if (i0 == i1 || i1 == i2 || i0 == i2) continue;
+				result[kept++] = i0;
+				result[kept++] = i1;
+				result[kept++] = i2;
+			}
+			result.resize(kept);
+		}
+
+		out_error = std::sqrt(worst);
+		return result;
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <span>
+#include <vector>
+#include <glm/glm.hpp>
+#include "zebratypes.h"
+
+namespace zebra {
+	/* quadric error edge collapse (garland & heckbert), only positions are looked at.
+	* vertices on open borders are locked, so outlines survive. vertices on attribute seams (several vertices
+	* at one position) move together and only along the seam, so uv layouts survive.
+	* a collapse that would flip a triangle is skipped.
+	* the result indexes the same vertices as the input, nothing is added or moved */
+	/// @param target_index_count stops once the mesh is at or below this
+	/// @param max_error no collapse moves the surface further than this, object space
+	/// @param out_error how far the result is from the input surface at most
+	std::vector<u32> simplify_mesh(std::span<const u32> indices, std::span<const glm::vec3> positions, u64 target_index_count, float max_error, float& out_error);
+}
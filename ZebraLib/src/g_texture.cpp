@@ -10,7 +10,7 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-bool zebra::load_image_from_file(zebra::UploadContext& up, const char* file, VkImage& out_image, VmaAllocation& out_allocation) {
+bool zebra::load_image_pixels(const char* file, zebra::LocalImage& out_image) {
 	int tw, th, tc;
 
 	stbi_uc* pixels = stbi_load(file, &tw, &th, &tc, STBI_rgb_alpha);
@@ -18,7 +18,27 @@ bool zebra::load_image_from_file(zebra::UploadContext& up, const char* file, VkI
 		DBG("Failed to load texture file. " << file);
 		return false;
 	}
-	
+
+	out_image.pixels = pixels;
+	out_image.width = tw;
+	out_image.height = th;
+	return true;
+}
+
+bool zebra::load_image_from_file(zebra::UploadContext& up, const char* file, VkImage& out_image, VmaAllocation& out_allocation) {
+	LocalImage image;
+	if (!load_image_pixels(file, image)) return false;
+	if (!upload_image(up, image, out_image, out_allocation)) return false;
+	DBG("Texture loaded sucessfully: " << file);
+	return true;
+}
+
+bool zebra::upload_image(zebra::UploadContext& up, zebra::LocalImage& image, VkImage& out_image, VmaAllocation& out_allocation) {
+	int tw = image.width;
+	int th = image.height;
+	stbi_uc* pixels = image.pixels;
+	if (!pixels) return false;
+
 	VkDeviceSize image_size = (u64)tw * (u64)th * 4u;
 
 	VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
@@ -30,6 +50,7 @@ bool zebra::load_image_from_file(zebra::UploadContext& up, const char* file, VkI
 	vmaUnmapMemory(up.allocator, staging_buffer.allocation);
 
 	stbi_image_free(pixels);
+	image.pixels = nullptr;
 	// stuffs is now in staging buffer
 
 	VkExtent3D image_extent = {
@@ -98,7 +119,6 @@ bool zebra::load_image_from_file(zebra::UploadContext& up, const char* file, VkI
 
 	vmaDestroyBuffer(up.allocator, staging_buffer.buffer, staging_buffer.allocation);
 
-	DBG("Texture loaded sucessfully: " << file);
 	out_image = gpu_image;
 	out_allocation = gpu_image_alloc;
 	return true;
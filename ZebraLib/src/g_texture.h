@@ -1,8 +1,20 @@
 #pragma once
 
 #include "g_types.h"
+#include "zebratypes.h"
 
 namespace zebra {
+	// decoded rgba8 pixels, not yet on the gpu
+	struct LocalImage {
+		u8* pixels = nullptr;
+		i32 width = 0;
+		i32 height = 0;
+	};
+
+	/// @brief decodes only, safe to call from worker threads
+	bool load_image_pixels(const char* file, LocalImage& out_image);
+	/// @brief uploads and frees the pixels of image
+	bool upload_image(UploadContext& up, LocalImage& image, VkImage& out_image, VmaAllocation& out_allocation);
 	bool load_image_from_file(UploadContext& up, const char* file, VkImage& out_image, VmaAllocation& out_allocation);
 	bool create_gpu_texture(zebra::UploadContext& up, VkImageCreateInfo& iinfo, VkImageAspectFlags aspects, zebra::Texture& tex);
 	void destroy_texture(UploadContext& up, Texture tex);
@@ -0,0 +1,55 @@
+#include "g_timeline.h"
+#include "z_debug.h"
+
+namespace zebra {
+	bool init_timeline(GpuTimeline& timeline, VkDevice device) {
+		VkSemaphoreTypeCreateInfo type_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+			.pNext = nullptr,
+			.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+			.initialValue = 0,
+		};
+		VkSemaphoreCreateInfo semaphore_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+			.pNext = &type_info,
+			.flags = 0,
+		};
+		timeline.device = device;
+		timeline.submitted = 0;
+		if (vkCreateSemaphore(device, &semaphore_info, nullptr, &timeline.semaphore) != VK_SUCCESS) {
+			DBG("could not create timeline semaphore");
+			return false;
+		}
+		return true;
+	}
+
+	void destroy_timeline(GpuTimeline& timeline) {
+		if (timeline.semaphore == VK_NULL_HANDLE) return;
+		vkDestroySemaphore(timeline.device, timeline.semaphore, nullptr);
+		timeline.semaphore = VK_NULL_HANDLE;
+	}
+
+	u64 next_value(GpuTimeline& timeline) {
+		return ++timeline.submitted;
+	}
+
+	u64 completed_value(const GpuTimeline& timeline) {
+		uint64_t value = 0;
+		vkGetSemaphoreCounterValue(timeline.device, timeline.semaphore, &value);
+		return value;
+	}
+
+	bool wait(const GpuTimeline& timeline, u64 value, u64 timeout) {
+		if (value == 0) return true;
+		uint64_t wait_value = value;
+		VkSemaphoreWaitInfo wait_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+			.pNext = nullptr,
+			.flags = 0,
+			.semaphoreCount = 1,
+			.pSemaphores = &timeline.semaphore,
+			.pValues = &wait_value,
+		};
+		return vkWaitSemaphores(timeline.device, &wait_info, timeout) == VK_SUCCESS;
+	}
+}
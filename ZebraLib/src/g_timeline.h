@@ -0,0 +1,35 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "zebratypes.h"
+
+namespace zebra {
+	/* one timeline semaphore per queue. every submission signals the next value, so frames,
+	* uploads and deferred deletions all just remember a value and wait for the counter to reach it */
+	struct GpuTimeline {
+		VkDevice device = VK_NULL_HANDLE;
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		// last value handed to a submission
+		u64 submitted = 0;
+	};
+
+	bool init_timeline(GpuTimeline& timeline, VkDevice device);
+	void destroy_timeline(GpuTimeline& timeline);
+
+	/// @brief the value for the submission about to be made, use it once per vkQueueSubmit
+	u64 next_value(GpuTimeline& timeline);
+	/// @brief what whatever is being recorded right now will be signalled with, for tagging before the submit
+	inline u64 pending_value(const GpuTimeline& timeline) {
+		return timeline.submitted + 1;
+	}
+	/// @brief the value the gpu has reached
+	u64 completed_value(const GpuTimeline& timeline);
+	inline bool reached(const GpuTimeline& timeline, u64 value) {
+		return value == 0 || completed_value(timeline) >= value;
+	}
+	/// @brief blocks until the gpu reaches value, false on timeout
+	bool wait(const GpuTimeline& timeline, u64 value, u64 timeout = 999'999'999'999);
+	/// @brief everything submitted so far
+	inline bool wait_idle(const GpuTimeline& timeline) {
+		return wait(timeline, timeline.submitted);
+	}
+}
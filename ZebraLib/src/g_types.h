@@ -3,6 +3,7 @@
 #include <vector>
 #include <glm/glm.hpp>
 #include "g_buffer.h"
+#include "g_timeline.h"
 
 namespace zebra {
 
@@ -11,12 +12,15 @@ namespace zebra {
 		VkImage image;
 		VkImageView view;
 		VkFormat format;
+		// slot in the texture table, set by insert_texture
+		u32 table_index = 0;
 	};
 
 	struct PerFrameData {
 		// depends on swapchain
 		VkSemaphore presentS, renderS;
-		VkFence renderF;
+		// timeline value signalled by the last submission from this slot, 0 before the first
+		u64 timeline_value = 0;
 
 		VkCommandPool pool;
 		VkCommandBuffer buf;
@@ -28,12 +32,17 @@ namespace zebra {
 		AllocBuffer indirect_buffer;
 
 		VkDescriptorPool descriptor_pool;
+
+		// start and end of the frame on the gpu, null if the queue cannot time
+		VkQueryPool timestamps = VK_NULL_HANDLE;
+		bool timestamps_written = false;
 	};
 
 	struct UploadContext {
 		VmaAllocator allocator;
 		VkDevice device;
-		VkFence uploadF;
+		// shared with rendering, both submit to graphics_queue
+		GpuTimeline timeline;
 		VkCommandPool pool;
 		VkQueue graphics_queue;
 	};
@@ -142,6 +151,23 @@ namespace zebra {
 			description.attributes.push_back(uvAttribute);
 			return description;
 		}
+
+		/// @brief only the position out of the full vertex, for depth only pipelines
+		static VertexInputDescription get_position_description() {
+			VertexInputDescription description;
+			description.bindings.push_back({
+				.binding = 0,
+				.stride = sizeof(P3N3C3U2),
+				.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+				});
+			description.attributes.push_back({
+				.location = 0,
+				.binding = 0,
+				.format = VK_FORMAT_R32G32B32_SFLOAT,
+				.offset = offsetof(P3N3C3U2, pos),
+				});
+			return description;
+		}
 	};
 
 	struct GPUCameraData {
@@ -12,21 +12,29 @@ void vku::vk_immediate(zebra::UploadContext& up, std::function<void(VkCommandBuf
 	vkBeginCommandBuffer(cmd, &begin_info);
 	function(cmd);
 	vkEndCommandBuffer(cmd);
+	uint64_t signal_value = zebra::next_value(up.timeline);
+	VkTimelineSemaphoreSubmitInfo timeline_info = {
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+		.pNext = nullptr,
+		.waitSemaphoreValueCount = 0,
+		.pWaitSemaphoreValues = nullptr,
+		.signalSemaphoreValueCount = 1,
+		.pSignalSemaphoreValues = &signal_value,
+	};
 	VkSubmitInfo submit = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.pNext = nullptr,
+		.pNext = &timeline_info,
 		.waitSemaphoreCount = 0,
 		.pWaitSemaphores = nullptr,
 		.pWaitDstStageMask = 0,
 		.commandBufferCount = 1,
 		.pCommandBuffers = &cmd,
-		.signalSemaphoreCount = 0,
-		.pSignalSemaphores = nullptr,
+		.signalSemaphoreCount = 1,
+		.pSignalSemaphores = &up.timeline.semaphore,
 	};
 
-	vkQueueSubmit(up.graphics_queue, 1, &submit, up.uploadF);
-	vkWaitForFences(up.device, 1, &up.uploadF, true, 999'999'999'999);
-	vkResetFences(up.device, 1, &up.uploadF);
+	vkQueueSubmit(up.graphics_queue, 1, &submit, VK_NULL_HANDLE);
+	zebra::wait(up.timeline, signal_value);
 
 	vkResetCommandPool(up.device, up.pool, 0);
 }
\ No newline at end of file
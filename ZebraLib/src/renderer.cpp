@@ -3,11 +3,16 @@
 #include "d_rel.h"
 #include "vki.h"
 #include "g_descriptorset.h"
+#include "g_reflect.h"
 #include "z_debug.h"
 #include <vulkan/vulkan.h>
 #include <vk_mem_alloc.h>
 #include <algorithm>
 #include <functional>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <bit>
 
 namespace zebra {
 	namespace render {
@@ -18,29 +23,79 @@ namespace zebra {
 		}
 		u64 insert_material(Assets& assets, Material material) {
 			auto k = genkey();
+			material.table_index = assets.material_slots++;
 			assets.t_materials[k] = material;
 			return k;
 		}
 
 		u64 insert_texture(Assets& assets, Texture texture) {
 			auto k = genkey();
+			texture.table_index = assets.texture_slots++;
 			assets.t_textures[k] = texture;
 			return k;
 		}
 
+		void insert_occluder(Assets& assets, u64 mesh_fk, OccluderMesh occluder) {
+			assets.t_occluders[mesh_fk] = std::move(occluder);
+		}
+
 		void name_handle(Assets& assets, std::string name, u64 handle) {
 			assets.t_names[name] = handle;
 		}
+
+		void unload_mesh(Assets& assets, u64 mesh_fk, FrameDeletionQueue& deferred, u64 value) {
+			auto mesh = assets.t_meshes.find(mesh_fk);
+			if (mesh == assets.t_meshes.end()) return;
+			defer_destroy(deferred, value, mesh->second.geometry);
+			if (mesh->second.clusters.buffer != VK_NULL_HANDLE) {
+				defer_destroy(deferred, value, mesh->second.clusters);
+			}
+			assets.t_occluders.erase(mesh_fk);
+			assets.t_meshes.erase(mesh);
+		}
+
+		void unload_texture(Assets& assets, u64 texture_fk, FrameDeletionQueue& deferred, u64 value) {
+			auto texture = assets.t_textures.find(texture_fk);
+			if (texture == assets.t_textures.end()) return;
+			defer_destroy(deferred, value, texture->second);
+			assets.t_textures.erase(texture);
+		}
 		
-		VkRenderPass RenderPassCache::get_or_create(std::span<DependencyInfo> info) {
-			if (cache.find(info) == cache.end()) [[unlikely]] {
+		RenderPassKey::RenderPassKey(std::span<const DependencyInfo> info, std::span<const SubpassInfo> subpass_info) {
+			assert(info.size() <= MAX_ATTACHMENTS && subpass_info.size() <= MAX_SUBPASSES);
+			count = (u32)std::min<size_t>(info.size(), MAX_ATTACHMENTS);
+			std::copy_n(info.begin(), count, attachments.begin());
+
+			if (!subpass_info.empty()) {
+				subpass_count = (u32)std::min<size_t>(subpass_info.size(), MAX_SUBPASSES);
+				std::copy_n(subpass_info.begin(), subpass_count, subpasses.begin());
+				return;
+			}
+
+			subpass_count = 1;
+			for (auto i = 0u; i < count; i++) {
+				switch (attachments[i].attachment_layout) {
+					case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+						subpasses[0].color |= 1 << i;
+						break;
+					case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+						subpasses[0].depth |= 1 << i;
+						break;
+					[[unlikely]] default:
+						DBG("invalid attachment layout passed. you probably didnt want this! layout: " << attachments[i].attachment_layout << " idx: " << i);
+						while(true);
+				}
+			}
+		}
+
+		VkRenderPass RenderPassCache::get_or_create(std::span<const DependencyInfo> info, std::span<const SubpassInfo> subpasses) {
+			RenderPassKey key{ info, subpasses };
+			auto found = cache.find(key);
+			if (found == cache.end()) [[unlikely]] {
 				// fill cache
 				std::vector<VkAttachmentDescription> attachment_descs;
-				std::vector<VkAttachmentReference> attachment_references;
-				std::vector<VkAttachmentReference> color_attachment_refs;
-				std::vector<VkAttachmentReference> depth_attachment_refs;
-				
-				for (DependencyInfo& di : info) {
+				for (auto i = 0u; i < key.count; i++) {
+					auto& di = key.attachments[i];
 					attachment_descs.emplace_back(
 						vki::attachment_description(
 							di.format,
@@ -50,56 +105,74 @@ namespace zebra {
 							di.on_store
 						)
 					);
-					
-					auto attachment_ref = VkAttachmentReference {
-							.attachment = (u32)attachment_references.size(),
-							.layout = di.attachment_layout
-						};
-					
-					attachment_references.emplace_back(
-						attachment_ref
-					);
-					
-					switch(di.attachment_layout) {
-						case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-							color_attachment_refs.emplace_back(attachment_ref);
-							break;
-						case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-							depth_attachment_refs.emplace_back(attachment_ref);
-							if (depth_attachment_refs.size() > 1) [[unlikely]] {
+				}
+
+				// refs have to outlive the create call, so size them up front
+				std::array<std::vector<VkAttachmentReference>, MAX_SUBPASSES> color_refs;
+				std::array<std::vector<VkAttachmentReference>, MAX_SUBPASSES> input_refs;
+				std::array<VkAttachmentReference, MAX_SUBPASSES> depth_refs;
+				std::vector<VkSubpassDescription> subpass_descs;
+				std::vector<VkSubpassDependency> dependencies;
+
+				for (auto s = 0u; s < key.subpass_count; s++) {
+					auto& sp = key.subpasses[s];
+					VkAttachmentReference* depth_ref = nullptr;
+					for (auto i = 0u; i < key.count; i++) {
+						if (sp.color & (1 << i)) {
+							color_refs[s].push_back({ i, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+						}
+						if (sp.input & (1 << i)) {
+							input_refs[s].push_back({ i, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+						}
+						if (sp.depth & (1 << i)) {
+							if (depth_ref != nullptr) [[unlikely]] {
 								DBG("more than one depth attachment. this is not supported, but we will let it slide.. however, you should change this.");
 							}
-							
-							break;
-						[[unlikely]] default:
-							DBG("invalid attachment layout passed. you probably didnt want this! layout: " << attachment_ref.layout << " idx: " << attachment_ref.attachment);
-							while(true);
-							
+							depth_refs[s] = { i, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+							depth_ref = &depth_refs[s];
+						}
+					}
+
+					subpass_descs.push_back({
+						.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+						.inputAttachmentCount = (u32)input_refs[s].size(),
+						.pInputAttachments = input_refs[s].data(),
+						.colorAttachmentCount = (u32)color_refs[s].size(),
+						.pColorAttachments = color_refs[s].data(),
+						.pDepthStencilAttachment = depth_ref,
+						});
+
+					// each subpass waits on the attachment writes of the one before, per pixel
+					if (s > 0) {
+						dependencies.push_back({
+							.srcSubpass = s - 1,
+							.dstSubpass = s,
+							.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+							.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+							.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+							.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+							.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+							});
 					}
 				}
 				
-				VkSubpassDescription subpass = {
-					.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-					.colorAttachmentCount = (u32)color_attachment_refs.size(),
-					.pColorAttachments = color_attachment_refs.data(),
-					.pDepthStencilAttachment = depth_attachment_refs.data(),
-				};
-				
 				VkRenderPassCreateInfo render_pass_info = {
 					.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
 					.attachmentCount = (u32)attachment_descs.size(),
 					.pAttachments = attachment_descs.data(),
-					.subpassCount = 1,
-					.pSubpasses = &subpass
+					.subpassCount = (u32)subpass_descs.size(),
+					.pSubpasses = subpass_descs.data(),
+					.dependencyCount = (u32)dependencies.size(),
+					.pDependencies = dependencies.data(),
 				};
 				VkRenderPass uwu_finally;
 				VK_CHECK(vkCreateRenderPass(this->device, &render_pass_info, nullptr, &uwu_finally));
 				
-				cache[info] = uwu_finally;
+				cache.emplace(key, uwu_finally);
 				return uwu_finally;
 				
 			} else [[likely]] {
-				return cache[info];
+				return found->second;
 			}
 		}
 		
@@ -115,18 +188,103 @@ namespace zebra {
 			cache.clear();
 		}
 
+		VkFramebuffer FramebufferCache::get_or_create(VkRenderPass pass, VkExtent2D extent, std::span<const VkImageView> views) {
+			assert(views.size() <= MAX_ATTACHMENTS);
+			FramebufferKey key = { .pass = pass, .extent = extent, .count = (u32)views.size() };
+			std::copy(views.begin(), views.end(), key.views.begin());
+
+			auto found = cache.find(key);
+			if (found != cache.end()) [[likely]] {
+				return found->second;
+			}
+
+			auto framebuffer_info = vki::framebuffer_info(pass, extent);
+			framebuffer_info.attachmentCount = key.count;
+			framebuffer_info.pAttachments = key.views.data();
+			VkFramebuffer framebuffer;
+			VK_CHECK(vkCreateFramebuffer(device, &framebuffer_info, nullptr, &framebuffer));
+			cache.emplace(key, framebuffer);
+			return framebuffer;
+		}
+
+		void FramebufferCache::evict(VkImageView view) {
+			for (auto it = cache.begin(); it != cache.end();) {
+				auto& key = it->first;
+				if (std::find(key.views.begin(), key.views.begin() + key.count, view) != key.views.begin() + key.count) {
+					vkDestroyFramebuffer(device, it->second, nullptr);
+					it = cache.erase(it);
+				} else {
+					it++;
+				}
+			}
+		}
+
+		void FramebufferCache::clear() {
+			if (device == VK_NULL_HANDLE) return;
+			for (auto& framebuffer_kv : cache) {
+				vkDestroyFramebuffer(device, framebuffer_kv.second, nullptr);
+			}
+			cache.clear();
+		}
+
 		
-		void add_renderable(Renderer& renderer, RenderObject object, bool bStatic) {
-			if (bStatic) {
-				renderer.t_statics.push_back(object);
-				renderer.b_statics_sorted = false;
+		static void mark_dirty(RenderableRegistry& registry, u32 handle) {
+			if (registry.dirty[handle]) return;
+			registry.dirty[handle] = 1;
+			registry.dirty_handles.push_back(handle);
+		}
+
+		RenderableHandle add_renderable(Renderer& renderer, RenderObject object) {
+			auto& registry = renderer.registry;
+			// the cull sphere is filled in with the first sync
+			Entity entity;
+			if (object.is_static) {
+				entity = create_entity(registry.world, object.obj, CullSphere{}, LodBounds{}, DrawKey{ object.material_fk, object.mesh_fk }, StaticRenderable{});
+				registry.statics_changed = true;
 			} else {
-				renderer.t_objects.push_back(object);
+				entity = create_entity(registry.world, object.obj, CullSphere{}, LodBounds{}, DrawKey{ object.material_fk, object.mesh_fk });
+			}
+			if (object.is_occluder) {
+				registry.occluders.push_back(entity.index);
+			}
+			if (registry.dirty.size() <= entity.index) {
+				registry.dirty.resize(entity.index + 1, 0);
+			}
+			mark_dirty(registry, entity.index);
+			return entity;
+		}
+
+		void update_renderable(Renderer& renderer, RenderableHandle handle, const ObjectData& obj) {
+			auto& registry = renderer.registry;
+			auto* data = get<ObjectData>(registry.world, handle);
+			if (data == nullptr) return;
+			*data = obj;
+			mark_dirty(registry, handle.index);
+		}
+
+		void apply_updates(Renderer& renderer, std::span<const RenderableUpdate> updates) {
+			for (auto& update : updates) {
+				update_renderable(renderer, update.handle, update.obj);
 			}
 		}
 
+		void remove_renderable(Renderer& renderer, RenderableHandle handle) {
+			// the slot keeps its stale data on the gpu, nothing draws it anymore
+			auto& registry = renderer.registry;
+			if (!alive(registry.world, handle)) return;
+			if (get<StaticRenderable>(registry.world, handle) != nullptr) {
+				registry.statics_changed = true;
+			}
+			std::erase(registry.occluders, handle.index);
+			auto& clusters = renderer.clusters;
+			if (auto slots = clusters.slots.find(handle.index); slots != clusters.slots.end()) {
+				free_range(clusters.ranges, slots->second.first, slots->second.count);
+				clusters.slots.erase(slots);
+			}
+			destroy_entity(registry.world, handle);
+		}
+
 		void begin_collect(Renderer& renderer, UploadContext& up) {
-			renderer.t_objects.resize(0);
 			renderer.up = &up;
 
 			// wait for unused?
@@ -137,8 +295,9 @@ namespace zebra {
 			renderer.used_buffers.clear();
 
 			// dangerous buffers that are used per frame
+			auto completed = completed_value(up.timeline);
 			for (auto i = renderer.danger_buffers.begin(); i != renderer.danger_buffers.end();) {
-				if (vkGetFenceStatus(up.device, (*i).fence_usage) == VK_SUCCESS) {
+				if ((*i).timeline_value <= completed) {
 					renderer.available_buffers.push_back((*i).buffer);
 					i = renderer.danger_buffers.erase(i);
 				} else {
@@ -151,7 +310,7 @@ namespace zebra {
 		AllocBuffer pop_buffer(Renderer& renderer, bool bJustTake) {
 			AllocBuffer buffer;
 			if (renderer.available_buffers.empty()) {
-				buffer = create_buffer(renderer.up->allocator, SINGLE_BUFFER_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+				buffer = create_buffer(renderer.up->allocator, SINGLE_BUFFER_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 			} else {
 				buffer = renderer.available_buffers.front();
 				renderer.available_buffers.pop_front();
@@ -162,28 +321,369 @@ namespace zebra {
 			return buffer;
 		}
 
-		AllocBuffer pop_hot_buffer(Renderer& renderer, VkFence render_fence) {
+		AllocBuffer pop_hot_buffer(Renderer& renderer, u64 timeline_value) {
 			AllocBuffer buffer;
 			buffer = pop_buffer(renderer, true);
 			DangerBuffer danger;
-			danger.fence_usage = render_fence;
+			danger.timeline_value = timeline_value;
 			danger.buffer = buffer;
 			renderer.danger_buffers.push_back(danger);
 			return buffer;
 		}
 
-		void finish_collect(Renderer& renderer) {
-			// frustrum culling
-			std::sort(renderer.t_objects.begin(), renderer.t_objects.end(), [](const RenderObject& a, const RenderObject& b) {
-				return (a.material_fk > b.material_fk) || (a.material_fk == b.material_fk && a.mesh_fk > b.mesh_fk);
+		/* material first so pipelines still change rarely, then front to back inside it.
+		* depth is bucketed at 8 steps per doubling of distance, so instances of one mesh
+		* at similar depths still end up next to each other and batch */
+		static u64 sort_key(const CullSphere& cull, const DrawKey& key, u32 lod, const glm::mat4& viewproj) {
+			// clip w is the view depth
+			float depth = (viewproj * glm::vec4(glm::vec3(cull.sphere), 1.f)).w - cull.radius;
+			u64 bucket = (u64)glm::clamp(std::log2(1.f + std::max(depth, 0.f)) * 8.f, 0.f, 65535.f);
+			return ((key.material_fk & 0xFFFFFF) << 40) | (bucket << 24) | ((key.mesh_fk & 0x3FFFFF) << 2) | lod;
+		}
+
+		static_assert(MAX_LODS <= 4, "the lod gets two bits of the sort key");
+
+		static u32 select_lod(const LodBounds& bounds, const CullSphere& cull, const LodSelection& selection) {
+			// nearest point of the bounds, never closer than something that still divides
+			float distance = std::max(glm::length(glm::vec3(cull.sphere) - selection.eye) - cull.radius, 1e-3f);
+			float limit = selection.error_pixels * distance / selection.pixel_scale;
+			u32 lod = 0;
+			while (lod + 1 < MAX_LODS && bounds.error[lod + 1] <= limit) {
+				lod++;
+			}
+			return lod;
+		}
+
+		static bool sort_key_order(const DrawItem& a, const DrawItem& b) {
+			return a.sort_key < b.sort_key;
+		}
+
+		// world space cull spheres from the local mesh bounds, only for what changed since the last sync
+		static void update_cull_spheres(RenderableRegistry& registry, Assets& assets, JobSystem& jobs) {
+			auto& handles = registry.dirty_handles;
+			jobs.parallel_for(0, handles.size(), jobs.grain_for(handles.size(), 1024), [&](u64 lo, u64 hi) {
+				for (auto i = lo; i < hi; i++) {
+					auto entity = entity_at(registry.world, handles[i]);
+					// removed after it got dirty
+					if (entity == NO_ENTITY) continue;
+					auto* key = get<DrawKey>(registry.world, entity);
+					auto& model = get<ObjectData>(registry.world, entity)->model_matrix;
+					auto mesh = assets.t_meshes.find(key->mesh_fk);
+					glm::vec4 bounds = mesh != assets.t_meshes.end() ? mesh->second.bounds : glm::vec4(0.f);
+					get<CullSphere>(registry.world, entity)->sphere = transform_sphere(model, bounds);
+
+					// errors scale with the largest axis, same as the sphere
+					float scale = std::max({ glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2])) });
+					auto& lods = *get<LodBounds>(registry.world, entity);
+					for (auto l = 0u; l < MAX_LODS; l++) {
+						bool has = mesh != assets.t_meshes.end() && l < mesh->second.lod_count;
+						lods.error[l] = has ? mesh->second.lods[l].error * scale : std::numeric_limits<float>::infinity();
+					}
+				}
+				});
+		}
+
+		/* a query over the cull spheres, lod bounds and draw keys, object data is never touched.
+		* parallel compaction by chunk, keeps the chunk order. lods and sort keys are picked on the way
+		* out, only what survived culling is worth ordering by depth */
+		static void cull_objects(RenderableRegistry& registry, std::vector<DrawItem>& visible, const Frustum& frustum, const glm::mat4& viewproj, const LodSelection& selection, JobSystem& jobs) {
+			std::vector<ChunkView> views;
+			query_chunks(registry.world, component_mask<const CullSphere, const LodBounds, const DrawKey>(), views);
+			// statics come out of the bvh
+			std::erase_if(views, [](const ChunkView& view) { return (view.archetype->mask & component_mask<StaticRenderable>()) != 0; });
+			std::vector<u64> row_offsets(views.size() + 1, 0);
+			for (auto c = 0ull; c < views.size(); c++) {
+				row_offsets[c + 1] = row_offsets[c] + views[c].rows;
+			}
+			std::vector<u8> inside(row_offsets.back());
+			std::vector<u64> visible_offsets(views.size() + 1, 0);
+
+			const u64 grain = jobs.grain_for(views.size(), 4);
+			jobs.parallel_for(0, views.size(), grain, [&](u64 lo, u64 hi) {
+				for (auto c = lo; c < hi; c++) {
+					auto* spheres = column<const CullSphere>(views[c]);
+					u64 count = 0;
+					for (u32 row = 0; row < views[c].rows; row++) {
+						inside[row_offsets[c] + row] = sphere_in_frustum(frustum, spheres[row].sphere);
+						count += inside[row_offsets[c] + row];
+					}
+					visible_offsets[c + 1] = count;
+				}
+				});
+
+			for (auto c = 0ull; c < views.size(); c++) {
+				visible_offsets[c + 1] += visible_offsets[c];
+			}
+			visible.resize(visible_offsets.back());
+
+			jobs.parallel_for(0, views.size(), grain, [&](u64 lo, u64 hi) {
+				for (auto c = lo; c < hi; c++) {
+					auto* spheres = column<const CullSphere>(views[c]);
+					auto* lods = column<const LodBounds>(views[c]);
+					auto* keys = column<const DrawKey>(views[c]);
+					auto* ids = entities(views[c]);
+					auto out = visible_offsets[c];
+					for (u32 row = 0; row < views[c].rows; row++) {
+						if (inside[row_offsets[c] + row]) {
+							auto lod = select_lod(lods[row], spheres[row], selection);
+							visible[out++] = { sort_key(spheres[row], keys[row], lod, viewproj), keys[row].material_fk, keys[row].mesh_fk, ids[row].index, lod };
+						}
+					}
+				}
+				});
+		}
+
+		// after update_cull_spheres, the bvh follows the statics' new spheres
+		static void update_statics(RenderableRegistry& registry) {
+			std::vector<u32> ids;
+			std::vector<Aabb> bounds;
+			registry.statics_refit = 0;
+			registry.statics_rebuilt = false;
+			if (!registry.statics_changed) {
+				// every static that moved is still in the tree, nothing came or went
+				for (auto handle : registry.dirty_handles) {
+					if (!contains(registry.statics, handle)) continue;
+					ids.push_back(handle);
+					bounds.push_back(sphere_aabb(get<CullSphere>(registry.world, entity_at(registry.world, handle))->sphere));
+				}
+				refit_bvh(registry.statics, ids, bounds);
+				registry.statics_refit = (u32)ids.size();
+				if (!bvh_degraded(registry.statics)) return;
+				ids.clear();
+				bounds.clear();
+			}
+
+			std::vector<ChunkView> views;
+			query_chunks(registry.world, component_mask<const CullSphere, const StaticRenderable>(), views);
+			for (auto& view : views) {
+				auto* spheres = column<const CullSphere>(view);
+				auto* handles = entities(view);
+				for (u32 row = 0; row < view.rows; row++) {
+					ids.push_back(handles[row].index);
+					bounds.push_back(sphere_aabb(spheres[row].sphere));
+				}
+			}
+			build_bvh(registry.statics, ids, bounds);
+			registry.statics_changed = false;
+			registry.statics_rebuilt = true;
+		}
+
+		// whole subtrees off screen are gone after one test, lods and sort keys as in cull_objects
+		static void cull_statics(RenderableRegistry& registry, std::vector<DrawItem>& visible, const Frustum& frustum, const glm::mat4& viewproj, const LodSelection& selection, JobSystem& jobs) {
+			std::vector<u32> handles;
+			query_frustum(registry.statics, frustum, [&](u32 handle) { handles.push_back(handle); });
+			const u64 first = visible.size();
+			visible.resize(first + handles.size());
+			jobs.parallel_for(0, handles.size(), jobs.grain_for(handles.size(), 1024), [&](u64 lo, u64 hi) {
+				for (auto i = lo; i < hi; i++) {
+					auto entity = entity_at(registry.world, handles[i]);
+					auto& sphere = *get<CullSphere>(registry.world, entity);
+					auto& key = *get<DrawKey>(registry.world, entity);
+					auto lod = select_lod(*get<LodBounds>(registry.world, entity), sphere, selection);
+					visible[first + i] = { sort_key(sphere, key, lod, viewproj), key.material_fk, key.mesh_fk, handles[i], lod };
+				}
 				});
+		}
+
+		// draws the occluders, then keeps what is not behind them. the order of the rest stays as it was
+		static void cull_software(Renderer& renderer, Assets& assets, JobSystem& jobs, const glm::mat4& viewproj) {
+			auto& registry = renderer.registry;
+			auto& software = renderer.software;
+			software.draws.clear();
+			for (auto handle : registry.occluders) {
+				auto entity = entity_at(registry.world, handle);
+				auto occluder = assets.t_occluders.find(get<DrawKey>(registry.world, entity)->mesh_fk);
+				if (occluder == assets.t_occluders.end()) continue;
+				software.draws.push_back({ &occluder->second, get<ObjectData>(registry.world, entity)->model_matrix });
+			}
+			if (software.draws.empty()) return;
+			rasterize_occluders(software.depth, software.draws, viewproj, jobs);
 
-			if (!renderer.b_statics_sorted) {
-				std::sort(renderer.t_statics.begin(), renderer.t_statics.end(), [](const RenderObject& a, const RenderObject& b) {
-					return (a.material_fk > b.material_fk) || (a.material_fk == b.material_fk && a.mesh_fk > b.mesh_fk);
-					}); 
-				renderer.b_statics_sorted = true;
+			auto& visible = renderer.visible_objects;
+			std::vector<u8> keep(visible.size());
+			jobs.parallel_for(0, visible.size(), jobs.grain_for(visible.size(), 1024), [&](u64 lo, u64 hi) {
+				for (auto i = lo; i < hi; i++) {
+					auto& sphere = get<CullSphere>(registry.world, entity_at(registry.world, visible[i].handle))->sphere;
+					keep[i] = !sphere_occluded(software.depth, viewproj, sphere);
+				}
+				});
+			u64 kept = 0;
+			for (auto i = 0ull; i < visible.size(); i++) {
+				if (keep[i]) visible[kept++] = visible[i];
 			}
+			software.occluded = (u32)(visible.size() - kept);
+			visible.resize(kept);
+		}
+
+		void finish_collect(Renderer& renderer, Assets& assets, JobSystem& jobs, const glm::mat4& viewproj, const LodSelection& lod, bool software_occlusion) {
+			update_cull_spheres(renderer.registry, assets, jobs);
+			update_statics(renderer.registry);
+
+			// frustum culling
+			auto frustum = frustum_from_matrix(viewproj);
+			cull_objects(renderer.registry, renderer.visible_objects, frustum, viewproj, lod, jobs);
+			cull_statics(renderer.registry, renderer.visible_objects, frustum, viewproj, lod, jobs);
+			renderer.software.occluded = 0;
+			if (software_occlusion) {
+				cull_software(renderer, assets, jobs, viewproj);
+			}
+			parallel_sort(jobs, renderer.visible_objects.begin(), renderer.visible_objects.end(), sort_key_order);
+		}
+
+		RenderableHandle pick_renderable(Renderer& renderer, const glm::vec3& origin, const glm::vec3& dir, float& max_t) {
+			auto& registry = renderer.registry;
+			glm::vec3 unit = glm::normalize(dir);
+			float scale = glm::length(dir);
+			float limit = max_t * scale;
+			auto picked = query_ray(registry.statics, origin, unit, limit, [&](u32 handle, float) {
+				auto& sphere = get<CullSphere>(registry.world, entity_at(registry.world, handle))->sphere;
+				// entry point of the sphere, or the origin when it starts inside
+				glm::vec3 to_center = glm::vec3(sphere) - origin;
+				float along = glm::dot(to_center, unit);
+				float off2 = glm::dot(to_center, to_center) - along * along;
+				float r2 = sphere.w * sphere.w;
+				if (off2 > r2) return std::numeric_limits<float>::infinity();
+				float t = along - std::sqrt(r2 - off2);
+				if (t < 0.f) return along + std::sqrt(r2 - off2) >= 0.f ? 0.f : std::numeric_limits<float>::infinity();
+				return t;
+				});
+			if (picked != ~0u) {
+				max_t = limit / scale;
+			}
+			return picked == ~0u ? NO_RENDERABLE : entity_at(registry.world, picked);
+		}
+
+		void renderables_near(Renderer& renderer, const glm::vec4& sphere, std::vector<RenderableHandle>& out) {
+			auto& registry = renderer.registry;
+			query_sphere(registry.statics, sphere, [&](u32 handle) {
+				auto& other = get<CullSphere>(registry.world, entity_at(registry.world, handle))->sphere;
+				if (glm::length(glm::vec3(other) - glm::vec3(sphere)) <= other.w + sphere.w) out.push_back(entity_at(registry.world, handle));
+				});
+		}
+
+		constexpr u32 INSTANCE_STRIDE = sizeof(GPUObjectData);
+		constexpr u32 BOUNDS_STRIDE = sizeof(CullSphere);
+		constexpr u32 VISIBILITY_STRIDE = sizeof(u32);
+		// a staging buffer holds the object data first, then the bounds of the same handles
+		constexpr u32 STAGING_INSTANCES = SINGLE_BUFFER_SIZE / (INSTANCE_STRIDE + BOUNDS_STRIDE);
+		constexpr VkDeviceSize STAGING_BOUNDS = (VkDeviceSize)STAGING_INSTANCES * INSTANCE_STRIDE;
+
+		// doubles, old contents are copied over on the gpu. the old buffers go once this frame is done with them
+		static void grow_instances(RenderableRegistry& registry, UploadContext& up, VkCommandBuffer cmd, FrameDeletionQueue& deferred) {
+			u32 capacity = std::max(registry.capacity, 1024u);
+			while (capacity < registry.world.records.size()) {
+				capacity *= 2;
+			}
+
+			auto grow = [&](AllocBuffer& buffer, u32 stride) {
+				auto grown = create_buffer(up.allocator, (u64)capacity * stride,
+					VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+				if (registry.capacity > 0) {
+					VkBufferCopy copy = { .srcOffset = 0, .dstOffset = 0, .size = (u64)registry.capacity * stride };
+					vkCmdCopyBuffer(cmd, buffer.buffer, grown.buffer, 1, &copy);
+					defer_destroy(deferred, pending_value(up.timeline), buffer);
+				}
+				buffer = grown;
+			};
+			grow(registry.instances, INSTANCE_STRIDE);
+			grow(registry.bounds, BOUNDS_STRIDE);
+			grow(registry.visibility, VISIBILITY_STRIDE);
+			// new slots were never seen, the late pass finds out
+			vkCmdFillBuffer(cmd, registry.visibility.buffer, (u64)registry.capacity * VISIBILITY_STRIDE, VK_WHOLE_SIZE, 0);
+
+			// the dirty copies land on top of these
+			VkMemoryBarrier barrier = {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			};
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			DBG("instance buffer " << registry.capacity << " -> " << capacity);
+			registry.capacity = capacity;
+		}
+
+		void sync_renderables(Renderer& renderer, Assets& assets, UploadContext& up, VkCommandBuffer cmd, FrameDeletionQueue& deferred) {
+			auto& registry = renderer.registry;
+			auto& handles = registry.dirty_handles;
+			registry.uploaded = 0;
+			registry.upload_ranges = 0;
+			if (handles.empty()) return;
+
+			// frames still in flight read the slots about to be overwritten, and the last late cull wrote visibility
+			VkMemoryBarrier before = {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+			};
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &before, 0, nullptr, 0, nullptr);
+
+			if (registry.capacity < registry.world.records.size()) {
+				grow_instances(registry, up, cmd, deferred);
+			}
+
+			// runs of neighbouring handles become one copy each
+			std::sort(handles.begin(), handles.end());
+			std::vector<VkBufferCopy> ranges;
+			u64 packed_fk = ~0ull;
+			const Material* packed_material = nullptr;
+			for (u64 first = 0; first < handles.size();) {
+				auto staging = pop_hot_buffer(renderer, pending_value(up.timeline));
+				GPUObjectData* staged;
+				vmaMapMemory(up.allocator, staging.allocation, (void**)&staged);
+				auto* staged_bounds = (CullSphere*)((u8*)staged + STAGING_BOUNDS);
+
+				ranges.clear();
+				u32 count = 0;
+				u64 i = first;
+				for (; i < handles.size() && count < STAGING_INSTANCES; i++) {
+					auto handle = handles[i];
+					registry.dirty[handle] = 0;
+					auto entity = entity_at(registry.world, handle);
+					// removed after it got dirty
+					if (entity == NO_ENTITY) continue;
+
+					auto* key = get<DrawKey>(registry.world, entity);
+					if (key->material_fk != packed_fk) {
+						packed_fk = key->material_fk;
+						packed_material = &assets.t_materials.find(packed_fk)->second;
+					}
+					staged[count] = pack_object(*get<ObjectData>(registry.world, entity), packed_material->table_index, packed_material->texture_index);
+					staged_bounds[count] = *get<CullSphere>(registry.world, entity);
+
+					VkDeviceSize dst = (VkDeviceSize)handle * INSTANCE_STRIDE;
+					if (!ranges.empty() && ranges.back().dstOffset + ranges.back().size == dst) {
+						ranges.back().size += INSTANCE_STRIDE;
+					} else {
+						ranges.push_back({ .srcOffset = (VkDeviceSize)count * INSTANCE_STRIDE, .dstOffset = dst, .size = INSTANCE_STRIDE });
+					}
+					count++;
+				}
+				vmaUnmapMemory(up.allocator, staging.allocation);
+				first = i;
+
+				if (!ranges.empty()) {
+					vkCmdCopyBuffer(cmd, staging.buffer, registry.instances.buffer, (u32)ranges.size(), ranges.data());
+					// same runs for the bounds, every offset scaled down to their stride
+					for (auto& range : ranges) {
+						range = {
+							.srcOffset = STAGING_BOUNDS + range.srcOffset / INSTANCE_STRIDE * BOUNDS_STRIDE,
+							.dstOffset = range.dstOffset / INSTANCE_STRIDE * BOUNDS_STRIDE,
+							.size = range.size / INSTANCE_STRIDE * BOUNDS_STRIDE,
+						};
+					}
+					vkCmdCopyBuffer(cmd, staging.buffer, registry.bounds.buffer, (u32)ranges.size(), ranges.data());
+				}
+				registry.uploaded += count;
+				registry.upload_ranges += (u32)ranges.size();
+			}
+			handles.clear();
+
+			VkMemoryBarrier after = {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+			};
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &after, 0, nullptr, 0, nullptr);
 		}
 
 		constexpr VkClearValue clear_color = { .color = {0.2f, 0.2f, 1.f, 1.f} };
@@ -202,7 +702,7 @@ namespace zebra {
 			vkCmdSetScissor(frame.buf, 0, 1, &scissor);
 
 			// -- setup scene
-			auto scene_param_buffer = pop_hot_buffer(renderer, frame.renderF);
+			auto scene_param_buffer = pop_hot_buffer(renderer, pending_value(up.timeline));
 
 			VkDescriptorBufferInfo sinfo = {
 				.buffer = scene_param_buffer.buffer,
@@ -220,18 +720,53 @@ namespace zebra {
 				*scene_map.data = params;
 			}
 
-			//
-			draw_batches(renderer, up, frame, dcache, renderer.t_statics, assets, scene_set);
-			draw_batches(renderer, up, frame, dcache, renderer.t_objects, assets, scene_set);
+			// built once before the graph runs, the prepass and the shading pass draw from the same batches
+			auto& object_batches = renderer.batches;
+
+			// blocks are only ever added, a snapshot is good for the whole frame
+			std::vector<GeometryBinding> geometry;
+			geometry_bindings(*rdata.geometry, geometry);
+
+			// same subpass, the depth pipelines just do not write color
+			auto& clustered = renderer.clusters.batch;
+			if (rdata.depth_prepass) {
+				record_batches(frame.buf, assets, object_batches, scene_set, DrawPass::Depth, rdata, geometry);
+				record_clusters(frame.buf, assets, clustered, scene_set, DrawPass::Depth, rdata, geometry);
+			}
+			auto shade = rdata.depth_prepass ? DrawPass::ShadeEqual : DrawPass::Shade;
+			record_batches(frame.buf, assets, object_batches, scene_set, shade, rdata, geometry);
+			record_clusters(frame.buf, assets, clustered, scene_set, shade, rdata, geometry);
 			// POSTPROCESS PASS
 		}
 
 		void clear_buffers(zebra::render::Renderer& renderer, zebra::UploadContext& up) {
-			for (auto& buf : renderer.static_buffers) {
-				vmaDestroyBuffer(up.allocator, buf.buffer, buf.allocation);
-
+			auto& registry = renderer.registry;
+			if (registry.capacity > 0) {
+				for (auto* buffer : { &registry.instances, &registry.bounds, &registry.visibility }) {
+					vmaDestroyBuffer(up.allocator, buffer->buffer, buffer->allocation);
+					*buffer = {};
+				}
+				registry.capacity = 0;
+			}
+			auto& clusters = renderer.clusters;
+			if (clusters.capacity > 0) {
+				vmaDestroyBuffer(up.allocator, clusters.visibility.buffer, clusters.visibility.allocation);
+				clusters.visibility = {};
+				clusters.capacity = 0;
+			}
+			clusters.ranges = {};
+			clusters.slots.clear();
+			clusters.fresh.clear();
+			for (auto& slot : clusters.frames) {
+				if (slot.buffer.buffer == VK_NULL_HANDLE) continue;
+				vmaDestroyBuffer(up.allocator, slot.buffer.buffer, slot.buffer.allocation);
+			}
+			clusters.frames.clear();
+			auto& counters = renderer.occlusion.counters;
+			if (counters.buffer != VK_NULL_HANDLE) {
+				vmaDestroyBuffer(up.allocator, counters.buffer, counters.allocation);
+				counters = {};
 			}
-			renderer.static_buffers.clear();
 			for (auto& buf : renderer.danger_buffers) {
 				vmaDestroyBuffer(up.allocator, buf.buffer.buffer, buf.buffer.allocation);
 			}
@@ -246,81 +781,583 @@ namespace zebra {
 
 		}
 
-		void draw_batches(zebra::render::Renderer& renderer, zebra::UploadContext& up, zebra::PerFrameData& frame, zebra::DescriptorLayoutCache& dcache, std::vector<zebra::render::RenderObject>& object_vector, zebra::render::Assets& assets, VkDescriptorSet& scene_set) {
-			const u64 BATCH_SIZE = (SINGLE_BUFFER_SIZE / (sizeof(GPUObjectData) + sizeof(VkDrawIndirectCommand)));
-			const u64 DRAW_OFFSET = BATCH_SIZE * sizeof(GPUObjectData);
+		/* instance data already sits in the registry, a batch only says which handles it draws.
+		* without occlusion culling the cpu writes the handles and the draws. with it the cpu writes candidates
+		* (handle and draw) and draws without instances, and each pass gets its own handles and draws for the
+		* cull shader to fill in. handle lists start on 256 bytes, the most a storage buffer offset has to align to */
+		struct BatchLayout {
+			u64 capacity;
+			VkDeviceSize handles;
+			VkDeviceSize late_handles;
+			VkDeviceSize candidates;
+			VkDeviceSize draws;
+			VkDeviceSize late_draws;
+		};
+
+		constexpr u32 DRAW_STRIDE = sizeof(VkDrawIndexedIndirectCommand);
+		constexpr u32 CANDIDATE_STRIDE = 2 * sizeof(u32);
+
+		static constexpr BatchLayout batch_layout(bool occlusion) {
+			if (!occlusion) {
+				constexpr u64 capacity = SINGLE_BUFFER_SIZE / (sizeof(u32) + DRAW_STRIDE);
+				return { capacity, 0, 0, 0, capacity * sizeof(u32), 0 };
+			}
+			constexpr u64 capacity = (SINGLE_BUFFER_SIZE / (2 * sizeof(u32) + CANDIDATE_STRIDE + 2 * DRAW_STRIDE)) & ~63ull;
+			constexpr u64 handles = capacity * sizeof(u32);
+			return { capacity, 0, handles, 2 * handles, 2 * handles + capacity * CANDIDATE_STRIDE, 2 * handles + capacity * (CANDIDATE_STRIDE + DRAW_STRIDE) };
+		}
+		static_assert(batch_layout(true).late_draws + batch_layout(true).capacity * DRAW_STRIDE <= SINGLE_BUFFER_SIZE);
+
+		std::vector<DrawBatch> build_batches(zebra::render::Renderer& renderer, zebra::UploadContext& up, zebra::PerFrameData& frame, zebra::DescriptorLayoutCache& dcache, std::vector<DrawItem>& object_vector, zebra::render::Assets& assets, zebra::JobSystem& jobs, bool occlusion) {
+			std::vector<DrawBatch> batches;
+			if (object_vector.empty()) return batches;
+			const auto layout = batch_layout(occlusion);
+			const u64 BATCH_SIZE = layout.capacity;
+			const u64 batch_count = (object_vector.size() + BATCH_SIZE - 1) / BATCH_SIZE;
+
+			// -- buffers are taken up front, the renderer itself is not thread safe
+			std::vector<AllocBuffer> batch_buffers(batch_count);
+			std::vector<u8*> batch_maps(batch_count);
+			for (auto b = 0ull; b < batch_count; b++) {
+				batch_buffers[b] = pop_hot_buffer(renderer, pending_value(up.timeline));
+				vmaMapMemory(up.allocator, batch_buffers[b].allocation, (void**)&batch_maps[b]);
+			}
+
+			// -- start object buffer and draw command generator, one job per batch
+			batches.resize(batch_count);
+			jobs.parallel_for(0, batch_count, 1, [&](u64 lo, u64 hi) {
+				for (auto b = lo; b < hi; b++) {
+					const auto ridx = b * BATCH_SIZE;
+					const auto left = std::min(BATCH_SIZE, static_cast<u64>(object_vector.size() - ridx));
+
+					batches[b].instances = (u32)left;
+					if (!occlusion) {
+						u32* instance_ids = (u32*)(batch_maps[b] + layout.handles);
+						for (auto i = 0ull; i < left; i++) {
+							instance_ids[i] = object_vector[ridx + i].handle;
+						}
+					}
+
+					auto& draws = batches[b].draws;
+					VkDrawIndexedIndirectCommand* draw_ptr = (VkDrawIndexedIndirectCommand*)(batch_maps[b] + layout.draws);
+					u32* candidates = (u32*)(batch_maps[b] + layout.candidates);
+					for (auto batch_id = 0u; batch_id < left;) {
+						auto& prototype = object_vector[ridx + batch_id];
+						auto& mesh = assets.t_meshes.find(prototype.mesh_fk)->second;
+						auto& geometry = mesh.geometry;
+						auto& lod = mesh.lods[std::min(prototype.lod, mesh.lod_count - 1)];
+
+						// the mesh is addressed inside the shared buffers, nothing is bound per mesh.
+						// every lod shares the vertices, only the index range differs
+						VkDrawIndexedIndirectCommand draw_command = {
+							.indexCount = lod.index_count,
+							.instanceCount = 0,
+							.firstIndex = geometry.first_index + lod.first_index,
+							.vertexOffset = (i32)geometry.first_vertex,
+							.firstInstance = batch_id,
+						};
 
-			std::vector<StaticDrawInfo> scratch_draws;
-			scratch_draws.reserve(16);
+						do {
+							if (occlusion) {
+								candidates[batch_id * 2] = object_vector[ridx + batch_id].handle;
+								candidates[batch_id * 2 + 1] = (u32)draws.size();
+							} else {
+								draw_command.instanceCount += 1;
+							}
+							batch_id += 1;
+						} while (
+							batch_id < left &&
+							object_vector[ridx + batch_id].mesh_fk == prototype.mesh_fk &&
+							object_vector[ridx + batch_id].lod == prototype.lod &&
+							object_vector[ridx + batch_id].material_fk == prototype.material_fk);
 
-			for (auto ridx = 0ull;; ridx += BATCH_SIZE) {
-				// -- start object buffer
-				auto left = std::min(BATCH_SIZE, static_cast<u64>(object_vector.size() - ridx));
-				auto object_buffer = pop_hot_buffer(renderer, frame.renderF);
-				MappedBuffer<GPUObjectData> object_map{ up.allocator, object_buffer };
-				for (auto i = 0ull; i < left; i++) {
-					object_map[i] = object_vector[ridx + i].obj;
+						draw_ptr[draws.size()] = draw_command;
+						if (occlusion) {
+							// the late pass starts from no instances too
+							((VkDrawIndexedIndirectCommand*)(batch_maps[b] + layout.late_draws))[draws.size()] = draw_command;
+						}
+						draws.push_back({ prototype.material_fk, prototype.mesh_fk, geometry.block });
+					}
 				}
-				// -- end object buffer
-				
-				// -- start descriptor
+				});
+			// -- end object buffer and draw command generator
+
+			for (auto b = 0ull; b < batch_count; b++) {
+				vmaUnmapMemory(up.allocator, batch_buffers[b].allocation);
+				batches[b].buffer = batch_buffers[b];
+
 				VkDescriptorBufferInfo oinfo = {
-					.buffer = object_buffer.buffer,
+					.buffer = renderer.registry.instances.buffer,
 					.offset = 0,
-					.range = DRAW_OFFSET,
+					.range = VK_WHOLE_SIZE,
+				};
+				VkDescriptorBufferInfo iinfo = {
+					.buffer = batch_buffers[b].buffer,
+					.offset = layout.handles,
+					.range = layout.capacity * sizeof(u32),
 				};
 
-				VkDescriptorSet object_set;
 				DescriptorBuilder::begin(up.device, frame.descriptor_pool, dcache)
 					.bind_buffer(0, oinfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
-					.build(object_set);
-				// -- end descriptor
-
-				// -- start draw command generator
-				auto batch_id = 0u;
-				VkDrawIndirectCommand* draw_ptr = (VkDrawIndirectCommand*)(((u8*)object_map.data) + DRAW_OFFSET);
-				for (auto draw_i = 0ull; batch_id < left; draw_i += 1) {
-					auto& prototype = object_vector[ridx + batch_id];
-					auto& material = assets.t_materials[prototype.material_fk];
-					auto& mesh = assets.t_meshes[prototype.mesh_fk];
-
-					VkDrawIndirectCommand draw_command = {
-						.vertexCount = (u32)assets.t_meshes[object_vector[ridx + batch_id].mesh_fk].size,
-						.instanceCount = 0,
-						.firstVertex = 0,
-						.firstInstance = batch_id,
-					};
+					.bind_buffer(1, iinfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+					.build(batches[b].object_set);
+				if (occlusion) {
+					iinfo.offset = layout.late_handles;
+					DescriptorBuilder::begin(up.device, frame.descriptor_pool, dcache)
+						.bind_buffer(0, oinfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+						.bind_buffer(1, iinfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+						.build(batches[b].late_set);
+				}
+			}
+			return batches;
+		}
+
+		// occlusion_cull.comp
+		struct OcclusionCullConstants {
+			glm::mat4 viewproj;
+			glm::vec2 pyramid_size;
+			u32 levels;
+			u32 count;
+			u32 late;
+			u32 counter;
+		};
 
-					do {
-						draw_command.instanceCount += 1;
-						batch_id += 1;
-					} while (
-						batch_id < left &&
-						object_vector[ridx + batch_id].mesh_fk == prototype.mesh_fk &&
-						object_vector[ridx + batch_id].material_fk == prototype.material_fk);
-
-					draw_ptr[draw_i] = draw_command;
-					vkCmdBindPipeline(frame.buf, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline);
-					vkCmdBindDescriptorSets(frame.buf, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline_layout, 0, 1, &scene_set, 0, nullptr);
-					vkCmdBindDescriptorSets(frame.buf, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline_layout, 1, 1, &object_set, 0, nullptr);
-					if (material.texture_set != VK_NULL_HANDLE) {
-						vkCmdBindDescriptorSets(frame.buf, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline_layout, 2, 1, &material.texture_set, 0, nullptr);
+		void cull_occlusion(Renderer& renderer, VkCommandBuffer cmd, DrawPhase phase, const glm::mat4& viewproj, u32 frame_slot, UploadContext& up, PerFrameData& frame, DescriptorLayoutCache& dcache, VkSampler sampler) {
+			auto& occlusion = renderer.occlusion;
+			auto& registry = renderer.registry;
+			if (renderer.batches.empty()) return;
+			const auto layout = batch_layout(true);
+			const bool late = phase == DrawPhase::Late;
+			// the early phase binds the pyramid too, it only never reads it
+			prepare_pyramid(occlusion.pyramid, cmd);
+
+			// visibility was written by the late phase before this one
+			VkMemoryBarrier before = {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+			};
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &before, 0, nullptr, 0, nullptr);
+
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, occlusion.cull.pipeline);
+			OcclusionCullConstants constants = {
+				.viewproj = viewproj,
+				.pyramid_size = { (float)occlusion.pyramid.extent.width, (float)occlusion.pyramid.extent.height },
+				.levels = occlusion.pyramid.levels,
+				.late = late,
+				.counter = frame_slot * 2 + (late ? 1 : 0),
+			};
+
+			VkDescriptorBufferInfo bounds_info = { .buffer = registry.bounds.buffer, .offset = 0, .range = VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo visibility_info = { .buffer = registry.visibility.buffer, .offset = 0, .range = VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo counter_info = { .buffer = occlusion.counters.buffer, .offset = 0, .range = VK_WHOLE_SIZE };
+			VkDescriptorImageInfo pyramid_info = {
+				.sampler = sampler,
+				.imageView = occlusion.pyramid.view,
+				.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			};
+			for (auto& batch : renderer.batches) {
+				VkDescriptorBufferInfo candidate_info = { .buffer = batch.buffer.buffer, .offset = layout.candidates, .range = layout.capacity * CANDIDATE_STRIDE };
+				VkDescriptorBufferInfo draw_info = { .buffer = batch.buffer.buffer, .offset = late ? layout.late_draws : layout.draws, .range = layout.capacity * DRAW_STRIDE };
+				VkDescriptorBufferInfo handle_info = { .buffer = batch.buffer.buffer, .offset = late ? layout.late_handles : layout.handles, .range = layout.capacity * sizeof(u32) };
+
+				VkDescriptorSet set;
+				DescriptorBuilder::begin(up.device, frame.descriptor_pool, dcache)
+					.bind_buffer(0, bounds_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(1, visibility_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(2, candidate_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(3, draw_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(4, handle_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(5, counter_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_image(6, pyramid_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.build(set);
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, occlusion.cull.layout, 0, 1, &set, 0, nullptr);
+
+				constants.count = batch.instances;
+				vkCmdPushConstants(cmd, occlusion.cull.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+				vkCmdDispatch(cmd, (batch.instances + 63) / 64, 1, 1);
+			}
+
+			// draws and handles are read by the pass after, the counters once the frame is done
+			VkMemoryBarrier after = {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT,
+			};
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+				0, 1, &after, 0, nullptr, 0, nullptr);
+		}
+
+		void read_occlusion_counters(Renderer& renderer, UploadContext& up, u32 frame_slot) {
+			auto& occlusion = renderer.occlusion;
+			if (occlusion.counters.buffer == VK_NULL_HANDLE) return;
+			u32* counts;
+			vmaMapMemory(up.allocator, occlusion.counters.allocation, (void**)&counts);
+			occlusion.drawn_early = counts[frame_slot * 2];
+			occlusion.drawn_late = counts[frame_slot * 2 + 1];
+			counts[frame_slot * 2] = 0;
+			counts[frame_slot * 2 + 1] = 0;
+			vmaUnmapMemory(up.allocator, occlusion.counters.allocation);
+		}
+
+		// what the last draws left bound, so only what changes goes out
+		struct BoundState {
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			RasterState raster;
+			bool raster_set = false;
+			// sets stay bound across pipelines with the same layout, only what changed is rebound
+			VkPipelineLayout layout = VK_NULL_HANDLE;
+			std::array<VkDescriptorSet, SET_COUNT> sets{};
+			u32 block = ~0u;
+		};
+
+		/// @return false if the material has nothing to draw in draw_pass
+		static bool bind_draw(VkCommandBuffer cmd, BoundState& bound, Assets& assets, u64 material_fk, u32 block, VkDescriptorSet scene_set, VkDescriptorSet object_set,
+			DrawPass draw_pass, const RenderData& rdata, std::span<const GeometryBinding> geometry) {
+			auto* material_ptr = &assets.t_materials[material_fk];
+			// still compiling, draw with the fallback until every variant is there
+			if (material_ptr->pending_pipelines > 0) {
+				material_ptr = &assets.t_materials[assets.fallback_material];
+			}
+			auto& material = *material_ptr;
+
+			// materials without prepass variants are not in the depth buffer, so they shade normally
+			VkPipeline pipeline = material.pipeline;
+			const RasterState* state = &material.state;
+			if (draw_pass == DrawPass::Depth) {
+				pipeline = material.depth_pipeline;
+				state = &material.depth_state;
+			} else if (draw_pass == DrawPass::ShadeEqual && material.depth_pipeline != VK_NULL_HANDLE) {
+				pipeline = material.equal_pipeline;
+				state = &material.equal_state;
+			}
+			if (pipeline == VK_NULL_HANDLE) return false;
+
+			if (pipeline != bound.pipeline) {
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				bound.pipeline = pipeline;
+			}
+			// dynamic state outlives pipeline binds, only what changed goes out
+			set_raster_state(cmd, *rdata.dynamic_state, *state, bound.raster_set ? &bound.raster : nullptr);
+			bound.raster = *state;
+			bound.raster_set = true;
+			if (material.pipeline_layout != bound.layout) {
+				bound.layout = material.pipeline_layout;
+				bound.sets = {};
+			}
+			const std::array<VkDescriptorSet, SET_COUNT> sets = { scene_set, object_set, material.texture_set };
+			for (u32 set = SET_FRAME; set < SET_COUNT; set++) {
+				if (sets[set] == VK_NULL_HANDLE || sets[set] == bound.sets[set]) continue;
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline_layout, set, 1, &sets[set], 0, nullptr);
+				bound.sets[set] = sets[set];
+			}
+
+			if (block != bound.block) {
+				VkDeviceSize buffer_offset = 0;
+				vkCmdBindVertexBuffers(cmd, 0, 1, &geometry[block].vertices, &buffer_offset);
+				vkCmdBindIndexBuffer(cmd, geometry[block].indices, 0, VK_INDEX_TYPE_UINT32);
+				bound.block = block;
+			}
+			return true;
+		}
+
+		void record_batches(VkCommandBuffer cmd, zebra::render::Assets& assets, std::span<const DrawBatch> batches, VkDescriptorSet scene_set, DrawPass draw_pass, const RenderData& rdata, std::span<const GeometryBinding> geometry) {
+			constexpr u32 stride = sizeof(VkDrawIndexedIndirectCommand);
+			BoundState bound;
+			const bool late = rdata.phase == DrawPhase::Late;
+			const auto layout = batch_layout(rdata.phase != DrawPhase::All);
+			const VkDeviceSize draw_offset = late ? layout.late_draws : layout.draws;
+			for (auto& batch : batches) {
+				for (u64 first = 0; first < batch.draws.size();) {
+					auto& draw = batch.draws[first];
+					// everything after it with the same material in the same block goes out in the same call
+					u64 count = 1;
+					while (first + count < batch.draws.size()
+						&& batch.draws[first + count].material_fk == draw.material_fk
+						&& batch.draws[first + count].block == draw.block) {
+						count++;
+					}
+
+					if (!bind_draw(cmd, bound, assets, draw.material_fk, draw.block, scene_set, late ? batch.late_set : batch.object_set, draw_pass, rdata, geometry)) {
+						first += count;
+						continue;
+					}
+
+					VkDeviceSize indirect_offset = draw_offset + first * stride;
+					if (rdata.multi_draw_indirect) {
+						vkCmdDrawIndexedIndirect(cmd, batch.buffer.buffer, indirect_offset, (u32)count, stride);
+					} else {
+						for (auto i = 0ull; i < count; i++) {
+							vkCmdDrawIndexedIndirect(cmd, batch.buffer.buffer, indirect_offset + i * stride, 1, stride);
+						}
 					}
+					first += count;
+				}
+			}
+		}
+
+		/* -- clusters */
+
+		static_assert(sizeof(VkDrawIndexedIndirectCommand) == sizeof(u32) * 5);
+
+		void build_clusters(Renderer& renderer, Assets& assets, UploadContext& up, VkCommandBuffer cmd, u32 frame_slot, PerFrameData& frame, DescriptorLayoutCache& dcache, FrameDeletionQueue& deferred, bool enabled) {
+			auto& clusters = renderer.clusters;
+			auto& batch = clusters.batch;
+			batch.draws.clear();
+			batch.clusters = 0;
+			if (clusters.frames.size() <= frame_slot) {
+				clusters.frames.resize(frame_slot + 1);
+			}
+			auto& slot = clusters.frames[frame_slot];
+
+			// the slot's last frame is done, its counts are what it drew
+			clusters.drawn = 0;
+			clusters.total = slot.clusters;
+			if (slot.instances > 0) {
+				u32* counts;
+				vmaMapMemory(up.allocator, slot.buffer.allocation, (void**)&counts);
+				for (auto i = 0u; i < slot.instances * 2; i++) {
+					clusters.drawn += counts[i];
+				}
+				vmaUnmapMemory(up.allocator, slot.buffer.allocation);
+			}
+			slot.instances = 0;
+			slot.clusters = 0;
+			if (!enabled) return;
+
+			// -- the clustered instances leave the visible list, the rest keeps its order
+			auto& visible = renderer.visible_objects;
+			u64 kept = 0;
+			for (auto& item : visible) {
+				auto& mesh = assets.t_meshes.find(item.mesh_fk)->second;
+				if (mesh.cluster_count == 0 || item.lod != 0) {
+					visible[kept++] = item;
+					continue;
+				}
+				auto [slots, fresh] = clusters.slots.try_emplace(item.handle, ClusterSlots{ item.mesh_fk, 0, 0 });
+				if (fresh || slots->second.mesh_fk != item.mesh_fk) {
+					free_range(clusters.ranges, slots->second.first, slots->second.count);
+					u64 first;
+					while (!allocate_range(clusters.ranges, mesh.cluster_count, first)) {
+						grow_ranges(clusters.ranges, std::max<u64>(clusters.ranges.capacity * 2, 4096));
+					}
+					slots->second = { item.mesh_fk, (u32)first, mesh.cluster_count };
+					clusters.fresh.push_back(slots->second);
+				}
+				batch.draws.push_back({ item.material_fk, item.mesh_fk, item.handle, mesh.geometry.block, batch.clusters, mesh.cluster_count, slots->second.first });
+				batch.clusters += mesh.cluster_count;
+			}
+			visible.resize(kept);
+			if (batch.draws.empty()) return;
+
+			// -- visibility grows like the instance buffer, new ranges start out hidden
+			if (clusters.capacity < clusters.ranges.capacity || !clusters.fresh.empty()) {
+				VkMemoryBarrier before = {
+					.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+					.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+					.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+				};
+				vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &before, 0, nullptr, 0, nullptr);
+
+				if (clusters.capacity < clusters.ranges.capacity) {
+					u32 capacity = (u32)clusters.ranges.capacity;
+					auto grown = create_buffer(up.allocator, (u64)capacity * sizeof(u32),
+						VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+					if (clusters.capacity > 0) {
+						VkBufferCopy copy = { .srcOffset = 0, .dstOffset = 0, .size = (u64)clusters.capacity * sizeof(u32) };
+						vkCmdCopyBuffer(cmd, clusters.visibility.buffer, grown.buffer, 1, &copy);
+						defer_destroy(deferred, pending_value(up.timeline), clusters.visibility);
+					}
+					vkCmdFillBuffer(cmd, grown.buffer, (u64)clusters.capacity * sizeof(u32), VK_WHOLE_SIZE, 0);
+					clusters.visibility = grown;
+					clusters.capacity = capacity;
+					DBG("cluster visibility -> " << capacity);
+
+					// the fills below may land in what was just copied
+					VkMemoryBarrier copied = {
+						.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+						.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+						.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+					};
+					vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &copied, 0, nullptr, 0, nullptr);
+				}
+				// a reused range still holds what its last renderable saw
+				for (auto& range : clusters.fresh) {
+					vkCmdFillBuffer(cmd, clusters.visibility.buffer, (u64)range.first * sizeof(u32), (u64)range.count * sizeof(u32), 0);
+				}
+				clusters.fresh.clear();
+
+				VkMemoryBarrier after = {
+					.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+					.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+					.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+				};
+				vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &after, 0, nullptr, 0, nullptr);
+			}
 
-					
-					VkDeviceSize vertex_offset = 0;
-					VkDeviceSize indirect_offset = DRAW_OFFSET + draw_i * sizeof(VkDrawIndirectCommand);
-					vkCmdBindVertexBuffers(frame.buf, 0, 1, &mesh.vertices.buffer, &vertex_offset);
+			// -- counts, then handles and draws for each pass. storage offsets align to 256 at most
+			constexpr u32 stride = sizeof(VkDrawIndexedIndirectCommand);
+			auto align = [](VkDeviceSize offset) { return (offset + 255) & ~(VkDeviceSize)255; };
+			const u32 instances = (u32)batch.draws.size();
+			batch.handles = align((VkDeviceSize)instances * 2 * sizeof(u32));
+			batch.late_handles = align(batch.handles + (VkDeviceSize)batch.clusters * sizeof(u32));
+			batch.commands = align(batch.late_handles + (VkDeviceSize)batch.clusters * sizeof(u32));
+			batch.late_commands = align(batch.commands + (VkDeviceSize)batch.clusters * stride);
+			const VkDeviceSize size = batch.late_commands + (VkDeviceSize)batch.clusters * stride;
 
-					vkCmdDrawIndirect(frame.buf, object_buffer.buffer, indirect_offset, 1, sizeof(VkDrawIndirectCommand));
+			// nothing of the slot is in flight anymore, so it is replaced right away
+			if (slot.size < size) {
+				if (slot.buffer.buffer != VK_NULL_HANDLE) {
+					vmaDestroyBuffer(up.allocator, slot.buffer.buffer, slot.buffer.allocation);
 				}
-				// -- end draw command generator
+				slot.size = std::max<VkDeviceSize>(std::bit_ceil(size), SINGLE_BUFFER_SIZE);
+				slot.buffer = create_buffer(up.allocator, slot.size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			}
+			batch.buffer = slot.buffer;
+			slot.instances = instances;
+			slot.clusters = batch.clusters;
+
+			// counts start at 0, and draws past them stay empty for the path without indirect count
+			u8* mapped;
+			vmaMapMemory(up.allocator, slot.buffer.allocation, (void**)&mapped);
+			memset(mapped, 0, instances * 2 * sizeof(u32));
+			memset(mapped + batch.commands, 0, (size_t)(size - batch.commands));
+			vmaUnmapMemory(up.allocator, slot.buffer.allocation);
+
+			VkDescriptorBufferInfo oinfo = {
+				.buffer = renderer.registry.instances.buffer,
+				.offset = 0,
+				.range = VK_WHOLE_SIZE,
+			};
+			VkDescriptorBufferInfo iinfo = {
+				.buffer = slot.buffer.buffer,
+				.offset = batch.handles,
+				.range = (VkDeviceSize)batch.clusters * sizeof(u32),
+			};
+			DescriptorBuilder::begin(up.device, frame.descriptor_pool, dcache)
+				.bind_buffer(0, oinfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+				.bind_buffer(1, iinfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+				.build(batch.object_set);
+			iinfo.offset = batch.late_handles;
+			DescriptorBuilder::begin(up.device, frame.descriptor_pool, dcache)
+				.bind_buffer(0, oinfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+				.bind_buffer(1, iinfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+				.build(batch.late_set);
+		}
+
+		// cluster_cull.comp
+		struct ClusterCullConstants {
+			glm::mat4 viewproj;
+			glm::vec4 eye;
+			glm::vec2 pyramid_size;
+			u32 levels;
+			u32 phase;
+			u32 handle;
+			u32 cluster_count;
+			u32 first_draw;
+			u32 first_index;
+			i32 vertex_offset;
+			u32 visibility;
+			u32 counter;
+		};
 
+		static_assert(sizeof(ClusterCullConstants) <= 128, "the smallest push constant range there is");
 
-				if (left < BATCH_SIZE) {
-					break;
+		void cull_clusters(Renderer& renderer, VkCommandBuffer cmd, DrawPhase phase, const glm::mat4& viewproj, const glm::vec3& eye, Assets& assets, UploadContext& up, PerFrameData& frame, DescriptorLayoutCache& dcache, VkSampler sampler) {
+			auto& clusters = renderer.clusters;
+			auto& batch = clusters.batch;
+			if (batch.draws.empty()) return;
+			auto& pyramid = renderer.occlusion.pyramid;
+			const bool late = phase == DrawPhase::Late;
+			const u32 instances = (u32)batch.draws.size();
+			// only the late phase samples it, every phase binds it
+			prepare_pyramid(pyramid, cmd);
+
+			VkMemoryBarrier before = {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+			};
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &before, 0, nullptr, 0, nullptr);
+
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, clusters.cull.pipeline);
+			ClusterCullConstants constants = {
+				.viewproj = viewproj,
+				.eye = glm::vec4(eye, 1.f),
+				.pyramid_size = { (float)pyramid.extent.width, (float)pyramid.extent.height },
+				.levels = pyramid.levels,
+				.phase = (u32)phase,
+			};
+
+			constexpr u32 stride = sizeof(VkDrawIndexedIndirectCommand);
+			VkDescriptorBufferInfo object_info = { .buffer = renderer.registry.instances.buffer, .offset = 0, .range = VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo visibility_info = { .buffer = clusters.visibility.buffer, .offset = 0, .range = VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo draw_info = { .buffer = batch.buffer.buffer, .offset = late ? batch.late_commands : batch.commands, .range = (VkDeviceSize)batch.clusters * stride };
+			VkDescriptorBufferInfo handle_info = { .buffer = batch.buffer.buffer, .offset = late ? batch.late_handles : batch.handles, .range = (VkDeviceSize)batch.clusters * sizeof(u32) };
+			VkDescriptorBufferInfo count_info = { .buffer = batch.buffer.buffer, .offset = 0, .range = (VkDeviceSize)instances * 2 * sizeof(u32) };
+			VkDescriptorImageInfo pyramid_info = {
+				.sampler = sampler,
+				.imageView = pyramid.view,
+				.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			};
+			for (auto i = 0u; i < instances; i++) {
+				auto& draw = batch.draws[i];
+				auto& mesh = assets.t_meshes.find(draw.mesh_fk)->second;
+				VkDescriptorBufferInfo cluster_info = { .buffer = mesh.clusters.buffer, .offset = 0, .range = VK_WHOLE_SIZE };
+
+				VkDescriptorSet set;
+				DescriptorBuilder::begin(up.device, frame.descriptor_pool, dcache)
+					.bind_buffer(0, object_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(1, cluster_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(2, visibility_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(3, draw_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(4, handle_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_buffer(5, count_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.bind_image(6, pyramid_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+					.build(set);
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, clusters.cull.layout, 0, 1, &set, 0, nullptr);
+
+				constants.handle = draw.handle;
+				constants.cluster_count = draw.clusters;
+				constants.first_draw = draw.first_draw;
+				constants.first_index = mesh.geometry.first_index;
+				constants.vertex_offset = (i32)mesh.geometry.first_vertex;
+				constants.visibility = draw.visibility;
+				constants.counter = late ? instances + i : i;
+				vkCmdPushConstants(cmd, clusters.cull.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+				vkCmdDispatch(cmd, (draw.clusters + 63) / 64, 1, 1);
+			}
+
+			VkMemoryBarrier after = {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT,
+			};
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+				0, 1, &after, 0, nullptr, 0, nullptr);
+		}
+
+		void record_clusters(VkCommandBuffer cmd, zebra::render::Assets& assets, const ClusterBatch& batch, VkDescriptorSet scene_set, DrawPass draw_pass, const RenderData& rdata, std::span<const GeometryBinding> geometry) {
+			constexpr u32 stride = sizeof(VkDrawIndexedIndirectCommand);
+			BoundState bound;
+			const bool late = rdata.phase == DrawPhase::Late;
+			const u32 instances = (u32)batch.draws.size();
+			for (auto i = 0u; i < instances; i++) {
+				auto& draw = batch.draws[i];
+				if (!bind_draw(cmd, bound, assets, draw.material_fk, draw.block, scene_set, late ? batch.late_set : batch.object_set, draw_pass, rdata, geometry)) continue;
+
+				VkDeviceSize indirect_offset = (late ? batch.late_commands : batch.commands) + (VkDeviceSize)draw.first_draw * stride;
+				if (rdata.draw_indexed_indirect_count != nullptr) {
+					VkDeviceSize count_offset = (VkDeviceSize)(late ? instances + i : i) * sizeof(u32);
+					rdata.draw_indexed_indirect_count(cmd, batch.buffer.buffer, indirect_offset, batch.buffer.buffer, count_offset, draw.clusters, stride);
+				} else if (rdata.multi_draw_indirect) {
+					vkCmdDrawIndexedIndirect(cmd, batch.buffer.buffer, indirect_offset, draw.clusters, stride);
+				} else {
+					for (auto c = 0u; c < draw.clusters; c++) {
+						vkCmdDrawIndexedIndirect(cmd, batch.buffer.buffer, indirect_offset + (VkDeviceSize)c * stride, 1, stride);
+					}
 				}
 			}
 		}
 	}
-}
\ No newline at end of file
+}
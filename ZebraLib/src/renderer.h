@@ -6,8 +6,18 @@
 #include "g_mesh.h"
 #include "g_descriptorset.h"
 #include "zebratypes.h"
+#include "z_jobs.h"
+#include "g_cull.h"
+#include "g_deletion.h"
+#include "z_ecs.h"
+#include "g_hiz.h"
+#include "g_bvh.h"
+#include "g_occluder.h"
+#include "g_pipeline.h"
 #include <deque>
 #include <span>
+#include <array>
+#include <cstring>
 #include "boost/container_hash/hash.hpp"
 
 namespace zebra {
@@ -20,52 +30,256 @@ namespace zebra {
 			};
 		};
 
+		/* the renderable's entity in the registry world. the index is its slot, the generation tells
+		* a removed renderable apart from whatever got the slot after it */
+		using RenderableHandle = Entity;
+		constexpr RenderableHandle NO_RENDERABLE = NO_ENTITY;
+
+		/// @brief what a renderable is made of when it is added
 		struct RenderObject {
-			GPUObjectData obj;
-			CullSphere cull;
+			ObjectData obj;
+			u64 material_fk;
+			u64 mesh_fk;
+			// rarely or never moves, culled through the static bvh instead of the per frame walk
+			bool is_static = false;
+			// drawn into the software depth buffer with the mesh's occluder, see insert_occluder
+			bool is_occluder = false;
+		};
+
+		// renderable components next to ObjectData and CullSphere
+		struct DrawKey {
 			u64 material_fk;
 			u64 mesh_fk;
 		};
 
+		/// @brief world space error of every lod of the mesh at this instance's scale, levels it does not have are infinite
+		struct LodBounds {
+			float error[MAX_LODS];
+		};
+
+		/// @brief tag, keeps statics in archetypes of their own so the walk over everything else can skip them
+		struct StaticRenderable {
+			u8 unused;
+		};
+
+		/// @brief a visible renderable, all that sorting and batching need
+		struct DrawItem {
+			// material, coarse view depth, mesh and lod
+			u64 sort_key;
+			u64 material_fk;
+			u64 mesh_fk;
+			// slot
+			u32 handle;
+			u32 lod;
+		};
+
+		/* the coarsest lod whose error covers at most error_pixels on screen is drawn.
+		* a world space error e at distance d covers e * pixel_scale / d pixels */
+		struct LodSelection {
+			glm::vec3 eye{ 0.f };
+			float pixel_scale = 0.f;
+			float error_pixels = 1.f;
+		};
+
+		/// @brief new object data for a renderable that is already registered
+		struct RenderableUpdate {
+			RenderableHandle handle;
+			ObjectData obj;
+		};
+
+		/* retained renderables, entities of their own world. a handle is the entity, its index is
+		* the slot in a persistent device local instance buffer that only gets written when
+		* something about that slot changed. dirty slots are sorted and merged into ranges before
+		* they go up, so the upload follows how much moved, not how much exists */
+		struct RenderableRegistry {
+			World world;
+			// -- by handle
+			std::vector<u8> dirty;
+			// every dirty handle once, in the order they got dirty
+			std::vector<u32> dirty_handles;
+
+			// GPUObjectData by handle
+			AllocBuffer instances{};
+			// CullSphere by handle, for culling on the gpu
+			AllocBuffer bounds{};
+			// u32 by handle, 1 if occlusion culling found it visible last frame. only the gpu writes it
+			AllocBuffer visibility{};
+			u32 capacity = 0;
+			// what the last sync copied
+			u32 uploaded = 0;
+			u32 upload_ranges = 0;
+
+			// statics by handle, over their cull spheres. rebuilt when a static comes or goes, refit when one moves
+			Bvh statics;
+			bool statics_changed = false;
+			// what finish_collect did to it this frame, for the stats
+			u32 statics_refit = 0;
+			bool statics_rebuilt = false;
+
+			// renderables marked is_occluder, a handful
+			std::vector<u32> occluders;
+		};
+
+		/* two phase occlusion culling. what was visible last frame is drawn first and its depth becomes the
+		* hi-z pyramid, then everything in the frustum is tested against that and what turned visible is drawn on top */
+		enum class DrawPhase : u8 {
+			// no occlusion culling, the cpu wrote the draws
+			All,
+			Early,
+			Late,
+		};
+
 		struct RenderData {
 			VkRenderPass forward_pass;
 			VkFramebuffer forward_framebuffer;
 			VkExtent2D forward_extent;
 			DescriptorLayoutCache* dcache;
+			JobSystem* jobs;
+			// lay down depth for everything first, then shade with depth EQUAL
+			bool depth_prepass;
+			const DynamicStateSupport* dynamic_state;
+			GeometryPool* geometry;
+			// neighbouring draws with the same material go out as one indirect call
+			bool multi_draw_indirect;
+			DrawPhase phase = DrawPhase::All;
+			// VK_KHR_draw_indirect_count, cluster draws stop at what the cull shader filled in. without it the rest are empty draws
+			PFN_vkCmdDrawIndexedIndirectCountKHR draw_indexed_indirect_count = nullptr;
 		};
 
-		struct CullInfo {
+		enum class DrawPass : u8 {
+			Depth,
+			Shade,
+			// shade on top of the prepass depth
+			ShadeEqual,
+		};
 
+		struct BatchDraw {
+			u64 material_fk;
+			u64 mesh_fk;
+			// geometry block of the mesh, draws only have to rebind buffers when it changes
+			u32 block;
 		};
 
-		struct UsedBuffer {
+		/// @brief one buffer worth of instance handles and the indirect draws into it
+		struct DrawBatch {
 			AllocBuffer buffer;
+			VkDescriptorSet object_set;
+			// occlusion culled batches only, the handles the late pass draws
+			VkDescriptorSet late_set = VK_NULL_HANDLE;
+			std::vector<BatchDraw> draws;
+			u32 instances = 0;
 		};
 
-		struct DangerBuffer {
-			VkFence fence_usage;
+		struct OcclusionCulling {
+			// occlusion_cull.comp and hiz_reduce.comp, culling is off without them
+			ComputeProgram cull;
+			ComputeProgram reduce;
+			HiZPyramid pyramid;
+			// instances drawn by the early and the late pass, a pair per frame slot
+			AllocBuffer counters{};
+			// read back once the slot came around
+			u32 drawn_early = 0;
+			u32 drawn_late = 0;
+		};
+
+		/// @brief a visible instance of a clustered mesh, each of its clusters owns a draw and a handle slot
+		struct ClusterDraw {
+			u64 material_fk;
+			u64 mesh_fk;
+			// slot
+			u32 handle;
+			u32 block;
+			u32 first_draw;
+			u32 clusters;
+			// its first slot in ClusterCulling::visibility
+			u32 visibility;
+		};
+
+		/* this frame's clustered instances. counts, handles and draws of both passes share a buffer per frame slot.
+		* the cull shader packs each instance's visible clusters to the front of its draws and counts them */
+		struct ClusterBatch {
+			AllocBuffer buffer{};
+			VkDescriptorSet object_set = VK_NULL_HANDLE;
+			VkDescriptorSet late_set = VK_NULL_HANDLE;
+			std::vector<ClusterDraw> draws;
+			u32 clusters = 0;
+			// -- byte offsets into buffer, the counts are at 0. early (or all) counts first, then the late ones
+			VkDeviceSize handles = 0;
+			VkDeviceSize late_handles = 0;
+			VkDeviceSize commands = 0;
+			VkDeviceSize late_commands = 0;
+		};
+
+		struct ClusterFrame {
+			AllocBuffer buffer{};
+			VkDeviceSize size = 0;
+			// what the counts in the buffer were written for
+			u32 instances = 0;
+			u32 clusters = 0;
+		};
+
+		struct ClusterSlots {
+			u64 mesh_fk;
+			u32 first;
+			u32 count;
+		};
+
+		/* meshes with clusters are drawn cluster by cluster at their finest lod. every cluster is tested
+		* against the frustum, for facing away and, with occlusion culling, against the pyramid */
+		struct ClusterCulling {
+			// cluster_cull.comp, clustered meshes are drawn whole without it
+			ComputeProgram cull;
+			// u32 per cluster of every clustered renderable, 1 if it was drawn last frame. only the gpu writes it
+			AllocBuffer visibility{};
+			u32 capacity = 0;
+			// over the slots of visibility, runs ahead of capacity until build_clusters grows the buffer
+			RangeAllocator ranges;
+			// visibility ranges by slot. removing the renderable hands its range back, so does coming back with another mesh
+			std::unordered_map<u32, ClusterSlots> slots;
+			// handed out since the last build_clusters, cleared to hidden before anything reads them
+			std::vector<ClusterSlots> fresh;
+			std::vector<ClusterFrame> frames;
+			ClusterBatch batch;
+			// read back once the slot came around
+			u32 drawn = 0;
+			u32 total = 0;
+		};
+
+		/* occlusion culling without the gpu. the occluders are rasterized into a small depth buffer on the workers
+		* and the visible renderables are tested against it before batches are built, all within the frame */
+		struct SoftwareOcclusion {
+			SoftDepth depth;
+			std::vector<OccluderDraw> draws;
+			// of the last finish_collect, culled by the software depth
+			u32 occluded = 0;
+		};
+
+		struct UsedBuffer {
 			AllocBuffer buffer;
 		};
 
-		struct StaticDrawInfo {
-			Material material;
-			Mesh* mesh;
-			VkDeviceSize indirect_offset;
+		struct DangerBuffer {
+			// free again once the timeline reaches this
+			u64 timeline_value;
+			AllocBuffer buffer;
 		};
 
 		struct Renderer {
-			std::vector<RenderObject> t_objects;
+			RenderableRegistry registry;
 			// refactor this into one big buffer uwu
 			std::deque<AllocBuffer> available_buffers;
 			std::deque<UsedBuffer> used_buffers;
 			std::deque<DangerBuffer> danger_buffers;
 
-			std::vector<RenderObject> t_statics;
-			std::vector<AllocBuffer> static_buffers;
-			std::vector<StaticDrawInfo> static_draws;
+			// filled by finish_collect, in draw order
+			std::vector<DrawItem> visible_objects;
+			// this frame's, from build_batches
+			std::vector<DrawBatch> batches;
+			OcclusionCulling occlusion;
+			ClusterCulling clusters;
+			SoftwareOcclusion software;
 
 			UploadContext* up;
-			bool b_statics_sorted = false;
 		};
 
 		struct Assets {
@@ -73,7 +287,14 @@ namespace zebra {
 			std::unordered_map<u64, Material> t_materials;
 			std::unordered_map<u64, Mesh> t_meshes;
 			std::unordered_map<u64, Texture> t_textures;
+			// by mesh_fk, cpu triangles for meshes that can occlude
+			std::unordered_map<u64, OccluderMesh> t_occluders;
 			std::unordered_map<std::string, u64> t_names;
+			// always has its pipelines, stands in for materials that are still compiling
+			u64 fallback_material = 0;
+			// slots handed out in insert order, the gpu side names materials and textures by these
+			u32 material_slots = 0;
+			u32 texture_slots = 0;
 		};
 
 		struct SceneParameters {
@@ -83,13 +304,47 @@ namespace zebra {
 		u64 insert_mesh(Assets& assets, Mesh mesh);
 		u64 insert_material(Assets& assets, Material material);
 		u64 insert_texture(Assets& assets, Texture material);
+		/// @brief renderables of the mesh marked is_occluder hide things with this from now on
+		void insert_occluder(Assets& assets, u64 mesh_fk, OccluderMesh occluder);
 		void name_handle(Assets& assets, std::string name, u64 handle);
+		/// @brief gone for everything recorded from now on, the gpu copy goes once the timeline reaches value
+		void unload_mesh(Assets& assets, u64 mesh_fk, FrameDeletionQueue& deferred, u64 value);
+		void unload_texture(Assets& assets, u64 texture_fk, FrameDeletionQueue& deferred, u64 value);
 
 		void begin_collect(Renderer& renderer, UploadContext& up);
-		void add_renderable(Renderer& renderer, RenderObject object, bool bStatic = false);
-		void finish_collect(Renderer& renderer);
+		/// @return stays valid until remove_renderable, the object is drawn every frame until then. update and remove ignore it after that
+		RenderableHandle add_renderable(Renderer& renderer, RenderObject object);
+		void update_renderable(Renderer& renderer, RenderableHandle handle, const ObjectData& obj);
+		/* a frame's worth of update_renderable. they stay dirty until the next sync, so a frame
+		* that applied its updates but was never drawn still reaches the gpu with the one after it */
+		void apply_updates(Renderer& renderer, std::span<const RenderableUpdate> updates);
+		void remove_renderable(Renderer& renderer, RenderableHandle handle);
+		/// @param software_occlusion also drops what the occluders hide on the cpu
+		void finish_collect(Renderer& renderer, Assets& assets, JobSystem& jobs, const glm::mat4& viewproj, const LodSelection& lod, bool software_occlusion);
+		/* nearest static whose cull sphere the ray goes through, as of the last finish_collect.
+		* max_t is moved to where it was hit */
+		/// @return NO_RENDERABLE on a miss
+		RenderableHandle pick_renderable(Renderer& renderer, const glm::vec3& origin, const glm::vec3& dir, float& max_t);
+		/// @brief appends every static whose cull sphere touches sphere
+		void renderables_near(Renderer& renderer, const glm::vec4& sphere, std::vector<RenderableHandle>& out);
+		/// @brief copies the dirty instance ranges into the instance buffer. after finish_collect, outside of a render pass
+		void sync_renderables(Renderer& renderer, Assets& assets, UploadContext& up, VkCommandBuffer cmd, FrameDeletionQueue& deferred);
+		/// @brief records renderer.batches for rdata.phase
 		void render(Renderer& renderer, Assets& assets, PerFrameData& frame, UploadContext& up, GPUSceneData& params, RenderData& rdata);
-		void draw_batches(zebra::render::Renderer& renderer, zebra::UploadContext& up, zebra::PerFrameData& frame, zebra::DescriptorLayoutCache& dcache, std::vector<zebra::render::RenderObject>& object_vector, zebra::render::Assets& assets, VkDescriptorSet& scene_set);
+		/// @param occlusion leaves the instance counts to cull_occlusion
+		std::vector<DrawBatch> build_batches(zebra::render::Renderer& renderer, zebra::UploadContext& up, zebra::PerFrameData& frame, zebra::DescriptorLayoutCache& dcache, std::vector<DrawItem>& object_vector, zebra::render::Assets& assets, zebra::JobSystem& jobs, bool occlusion);
+		void record_batches(VkCommandBuffer cmd, zebra::render::Assets& assets, std::span<const DrawBatch> batches, VkDescriptorSet scene_set, DrawPass draw_pass, const RenderData& rdata, std::span<const GeometryBinding> geometry);
+		/* fills the draws of one phase of occlusion culled batches, outside of a render pass.
+		* the late phase tests against the pyramid, which has to be built from this frame's early depth by then */
+		void cull_occlusion(Renderer& renderer, VkCommandBuffer cmd, DrawPhase phase, const glm::mat4& viewproj, u32 frame_slot, UploadContext& up, PerFrameData& frame, DescriptorLayoutCache& dcache, VkSampler sampler);
+		/// @brief takes the counts of the last submission from frame_slot, which has to be complete
+		void read_occlusion_counters(Renderer& renderer, UploadContext& up, u32 frame_slot);
+		/* moves the visible instances of clustered meshes at their finest lod out of renderer.visible_objects
+		* and into renderer.clusters.batch. before build_batches, outside of a render pass. frame_slot has to be complete */
+		void build_clusters(Renderer& renderer, Assets& assets, UploadContext& up, VkCommandBuffer cmd, u32 frame_slot, PerFrameData& frame, DescriptorLayoutCache& dcache, FrameDeletionQueue& deferred, bool enabled);
+		/// @brief fills the cluster draws of one phase, like cull_occlusion
+		void cull_clusters(Renderer& renderer, VkCommandBuffer cmd, DrawPhase phase, const glm::mat4& viewproj, const glm::vec3& eye, Assets& assets, UploadContext& up, PerFrameData& frame, DescriptorLayoutCache& dcache, VkSampler sampler);
+		void record_clusters(VkCommandBuffer cmd, zebra::render::Assets& assets, const ClusterBatch& batch, VkDescriptorSet scene_set, DrawPass draw_pass, const RenderData& rdata, std::span<const GeometryBinding> geometry);
 		void clear_buffers(zebra::render::Renderer& renderer, zebra::UploadContext& up);
 
 		struct DependencyInfo {
@@ -102,33 +357,59 @@ namespace zebra {
 		};
 		
 
-		struct DependencyInfoHash {
-			std::size_t operator()(std::span<DependencyInfo> const& sdi) const noexcept {
-				size_t seed = 0;
-				for (auto& di : sdi) {
+		constexpr u32 MAX_ATTACHMENTS = 8;
+		constexpr u32 MAX_SUBPASSES = 4;
+
+		/* bit i refers to attachment i of the render pass.
+		* layouts follow from the role: color/depth attachment optimal, inputs are read only */
+		struct SubpassInfo {
+			u8 color = 0;
+			u8 depth = 0;
+			u8 input = 0;
+		};
+
+		/// @brief owns its attachments inline, so keys never point back into the caller
+		struct RenderPassKey {
+			std::array<DependencyInfo, MAX_ATTACHMENTS> attachments{};
+			std::array<SubpassInfo, MAX_SUBPASSES> subpasses{};
+			u32 count = 0;
+			u32 subpass_count = 0;
+
+			/// @param subpasses empty for a single subpass that uses every attachment in its attachment_layout
+			RenderPassKey(std::span<const DependencyInfo> info, std::span<const SubpassInfo> subpasses = {});
+			bool operator==(const RenderPassKey& other) const {
+				return count == other.count && subpass_count == other.subpass_count
+					&& memcmp(attachments.data(), other.attachments.data(), count * sizeof(DependencyInfo)) == 0
+					&& memcmp(subpasses.data(), other.subpasses.data(), subpass_count * sizeof(SubpassInfo)) == 0;
+			}
+		};
+
+		struct RenderPassKeyHash {
+			std::size_t operator()(const RenderPassKey& key) const noexcept {
+				size_t seed = key.count;
+				for (auto i = 0u; i < key.count; i++) {
+					auto& di = key.attachments[i];
 					boost::hash_combine(seed, di.format);
+					boost::hash_combine(seed, di.initial_layout);
 					boost::hash_combine(seed, di.attachment_layout);
 					boost::hash_combine(seed, di.final_layout);
 					boost::hash_combine(seed, di.on_load);
 					boost::hash_combine(seed, di.on_store);
 				}
-				return seed;
-			}
-		};
-		
-		struct DependencyInfoEq {
-			constexpr bool operator()(const std::span<DependencyInfo>& lhs, const std::span<DependencyInfo>& rhs) const {
-				if (lhs.size() != rhs.size()) return false;
-				else {
-					return memcmp(lhs.data(), rhs.data(), lhs.size_bytes()) == 0;
+				for (auto i = 0u; i < key.subpass_count; i++) {
+					auto& sp = key.subpasses[i];
+					boost::hash_combine(seed, sp.color | sp.depth << 8 | sp.input << 16);
 				}
+				return seed;
 			}
 		};
 		
+		/* render passes only depend on formats and ops, so they survive swapchain recreation.
+		* handles stay valid until clear, hold on to them instead of looking them up per frame */
 		struct RenderPassCache {
 			VkDevice device;
-			std::unordered_map<std::span<DependencyInfo>, VkRenderPass, DependencyInfoHash, DependencyInfoEq> cache;
-			VkRenderPass get_or_create(std::span<DependencyInfo> info);
+			std::unordered_map<RenderPassKey, VkRenderPass, RenderPassKeyHash> cache;
+			VkRenderPass get_or_create(std::span<const DependencyInfo> info, std::span<const SubpassInfo> subpasses = {});
 			void clear();
 			
 			
@@ -137,7 +418,43 @@ namespace zebra {
 			}
 		};
 
+		struct FramebufferKey {
+			VkRenderPass pass = VK_NULL_HANDLE;
+			VkExtent2D extent{};
+			std::array<VkImageView, MAX_ATTACHMENTS> views{};
+			u32 count = 0;
+
+			bool operator==(const FramebufferKey& other) const {
+				return pass == other.pass && extent.width == other.extent.width && extent.height == other.extent.height
+					&& count == other.count && std::equal(views.begin(), views.begin() + count, other.views.begin());
+			}
+		};
+
+		struct FramebufferKeyHash {
+			std::size_t operator()(const FramebufferKey& key) const noexcept {
+				size_t seed = 0;
+				boost::hash_combine(seed, key.pass);
+				boost::hash_combine(seed, key.extent.width);
+				boost::hash_combine(seed, key.extent.height);
+				for (auto i = 0u; i < key.count; i++) {
+					boost::hash_combine(seed, key.views[i]);
+				}
+				return seed;
+			}
+		};
+
+		/* framebuffers die with their views. whoever destroys an image view evicts it first,
+		* which also covers swapchain recreation */
+		struct FramebufferCache {
+			VkDevice device = VK_NULL_HANDLE;
+			std::unordered_map<FramebufferKey, VkFramebuffer, FramebufferKeyHash> cache;
+			VkFramebuffer get_or_create(VkRenderPass pass, VkExtent2D extent, std::span<const VkImageView> views);
+			/// @brief destroys every framebuffer that uses view
+			void evict(VkImageView view);
+			void clear();
+		};
+
 		AllocBuffer pop_buffer(Renderer& renderer, bool bJustTake = false);
-		AllocBuffer pop_hot_buffer(Renderer& renderer, VkFence render_fence);
+		AllocBuffer pop_hot_buffer(Renderer& renderer, u64 timeline_value);
 	}
 }
@@ -0,0 +1,172 @@
+#include "z_ecs.h"
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <mutex>
+#include "z_debug.h"
+
+namespace zebra {
+	// fixed size, so lookups never race with a registration moving the table
+	static std::array<ComponentInfo, MAX_COMPONENTS> component_table;
+	static std::atomic<u32> component_count{ 0 };
+	static std::mutex component_lock;
+
+	u32 register_component(u32 size, u32 align) {
+		std::lock_guard guard(component_lock);
+		auto id = component_count.load(std::memory_order_relaxed);
+		assert(id < MAX_COMPONENTS);
+		component_table[id] = { size, align };
+		component_count.store(id + 1, std::memory_order_release);
+		return id;
+	}
+
+	const ComponentInfo& component_info(u32 id) {
+		return component_table[id];
+	}
+
+	static u32 align_up(u32 value, u32 align) {
+		return (value + align - 1) / align * align;
+	}
+
+	static u32 find_archetype(World& world, ComponentMask mask) {
+		for (auto i = 0u; i < world.archetypes.size(); i++) {
+			if (world.archetypes[i].mask == mask) return i;
+		}
+
+		auto& archetype = world.archetypes.emplace_back();
+		archetype.mask = mask;
+		// every array may lose up to a cache line to alignment
+		u32 row_size = sizeof(Entity);
+		for (auto bits = mask; bits != 0; bits &= bits - 1) {
+			row_size += component_info(std::countr_zero(bits)).size;
+		}
+		archetype.chunk_capacity = (CHUNK_SIZE - CACHE_LINE * std::popcount(mask)) / row_size;
+		assert(archetype.chunk_capacity > 0);
+
+		u32 offset = archetype.chunk_capacity * sizeof(Entity);
+		for (auto bits = mask; bits != 0; bits &= bits - 1) {
+			auto id = (u32)std::countr_zero(bits);
+			offset = align_up(offset, CACHE_LINE);
+			archetype.offsets[id] = offset;
+			offset += archetype.chunk_capacity * component_info(id).size;
+		}
+		assert(offset <= CHUNK_SIZE);
+		DBG("archetype " << world.archetypes.size() - 1 << ": mask " << mask << ", " << archetype.chunk_capacity << " per chunk");
+		return (u32)world.archetypes.size() - 1;
+	}
+
+	static std::byte* component_at(Archetype& archetype, u32 id, u32 row) {
+		auto* chunk = archetype.chunks[row / archetype.chunk_capacity].get();
+		return chunk->data + archetype.offsets[id] + (u64)(row % archetype.chunk_capacity) * component_info(id).size;
+	}
+
+	static Entity& entity_row(Archetype& archetype, u32 row) {
+		auto* chunk = archetype.chunks[row / archetype.chunk_capacity].get();
+		return reinterpret_cast<Entity*>(chunk->data)[row % archetype.chunk_capacity];
+	}
+
+	static u32 push_row(Archetype& archetype, Entity entity) {
+		auto row = archetype.count++;
+		if (row / archetype.chunk_capacity >= archetype.chunks.size()) {
+			archetype.chunks.push_back(std::make_unique<Chunk>());
+		}
+		entity_row(archetype, row) = entity;
+		return row;
+	}
+
+	// the last row fills the hole, so the rows stay dense
+	static void remove_row(World& world, Archetype& archetype, u32 row) {
+		auto last = archetype.count - 1;
+		if (row != last) {
+			auto moved = entity_row(archetype, last);
+			entity_row(archetype, row) = moved;
+			for (auto bits = archetype.mask; bits != 0; bits &= bits - 1) {
+				auto id = (u32)std::countr_zero(bits);
+				std::memcpy(component_at(archetype, id, row), component_at(archetype, id, last), component_info(id).size);
+			}
+			world.records[moved.index].row = row;
+		}
+		archetype.count--;
+		if (archetype.count <= (archetype.chunks.size() - 1) * archetype.chunk_capacity) {
+			archetype.chunks.pop_back();
+		}
+	}
+
+	Entity create_entity(World& world, ComponentMask mask) {
+		u32 index;
+		if (!world.free_indices.empty()) {
+			index = world.free_indices.back();
+			world.free_indices.pop_back();
+		} else {
+			index = (u32)world.records.size();
+			world.records.push_back({ NO_ARCHETYPE, 0, 0 });
+		}
+		auto& record = world.records[index];
+		Entity entity = { index, record.generation };
+		record.archetype = find_archetype(world, mask);
+		record.row = push_row(world.archetypes[record.archetype], entity);
+		world.alive++;
+		return entity;
+	}
+
+	void destroy_entity(World& world, Entity entity) {
+		if (!alive(world, entity)) return;
+		auto& record = world.records[entity.index];
+		remove_row(world, world.archetypes[record.archetype], record.row);
+		record.archetype = NO_ARCHETYPE;
+		// handles still pointing here are stale from now on
+		record.generation++;
+		world.free_indices.push_back(entity.index);
+		world.alive--;
+	}
+
+	void change_components(World& world, Entity entity, ComponentMask mask) {
+		if (!alive(world, entity)) return;
+		auto from_index = world.records[entity.index].archetype;
+		if (world.archetypes[from_index].mask == mask) return;
+
+		// may grow the archetype list, no references into it before this
+		auto to_index = find_archetype(world, mask);
+		auto& from = world.archetypes[from_index];
+		auto& to = world.archetypes[to_index];
+		auto from_row = world.records[entity.index].row;
+		auto to_row = push_row(to, entity);
+		for (auto bits = from.mask & to.mask; bits != 0; bits &= bits - 1) {
+			auto id = (u32)std::countr_zero(bits);
+			std::memcpy(component_at(to, id, to_row), component_at(from, id, from_row), component_info(id).size);
+		}
+		remove_row(world, from, from_row);
+		world.records[entity.index].archetype = to_index;
+		world.records[entity.index].row = to_row;
+	}
+
+	bool alive(const World& world, Entity entity) {
+		if (entity.index >= world.records.size()) return false;
+		auto& record = world.records[entity.index];
+		return record.archetype != NO_ARCHETYPE && record.generation == entity.generation;
+	}
+
+	Entity entity_at(const World& world, u32 index) {
+		if (index >= world.records.size() || world.records[index].archetype == NO_ARCHETYPE) return NO_ENTITY;
+		return { index, world.records[index].generation };
+	}
+
+	void query_chunks(World& world, ComponentMask mask, std::vector<ChunkView>& out) {
+		for (auto& archetype : world.archetypes) {
+			if ((archetype.mask & mask) != mask) continue;
+			for (auto c = 0u; c < archetype.chunks.size(); c++) {
+				auto rows = std::min(archetype.chunk_capacity, archetype.count - c * archetype.chunk_capacity);
+				if (rows == 0) continue;
+				out.push_back({ &archetype, archetype.chunks[c].get(), rows });
+			}
+		}
+	}
+
+	void clear_world(World& world) {
+		world.archetypes.clear();
+		world.records.clear();
+		world.free_indices.clear();
+		world.alive = 0;
+	}
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "zebratypes.h"
+#include "z_jobs.h"
+
+namespace zebra {
+	/* archetype storage. every distinct set of component types is an archetype, its entities live
+	* in fixed size chunks with one packed array per component, each array on its own cache line.
+	* queries walk the chunks of the archetypes that have what they ask for and only touch those arrays.
+	* components are plain data, they get moved around with memcpy */
+	struct Entity {
+		u32 index = ~0u;
+		u32 generation = 0;
+		bool operator==(const Entity& other) const = default;
+	};
+
+	constexpr Entity NO_ENTITY{};
+	constexpr u32 MAX_COMPONENTS = 64;
+	constexpr u32 CHUNK_SIZE = 16 * 1024;
+	constexpr u32 CACHE_LINE = 64;
+	using ComponentMask = u64;
+
+	struct ComponentInfo {
+		u32 size;
+		u32 align;
+	};
+
+	/// @brief ids are handed out on first use, shared by every world
+	u32 register_component(u32 size, u32 align);
+	const ComponentInfo& component_info(u32 id);
+
+	template<class T>
+	u32 component_id() {
+		if constexpr (std::is_const_v<T>) {
+			// queries name read only components const, they are still the same component
+			return component_id<std::remove_const_t<T>>();
+		} else {
+			static_assert(std::is_trivially_copyable_v<T>, "components are moved with memcpy");
+			static_assert(alignof(T) <= CACHE_LINE);
+			static const u32 id = register_component(sizeof(T), alignof(T));
+			return id;
+		}
+	}
+
+	template<class... Cs>
+	ComponentMask component_mask() {
+		return (ComponentMask{ 0 } | ... | (ComponentMask{ 1 } << component_id<Cs>()));
+	}
+
+	struct alignas(CACHE_LINE) Chunk {
+		std::byte data[CHUNK_SIZE];
+	};
+
+	/* rows are dense over the chunks, every chunk but the last is full.
+	* the entity array sits at offset 0, components follow in id order */
+	struct Archetype {
+		ComponentMask mask = 0;
+		// by component id, only valid for ids in mask
+		std::array<u32, MAX_COMPONENTS> offsets{};
+		u32 chunk_capacity = 0;
+		u32 count = 0;
+		std::vector<std::unique_ptr<Chunk>> chunks;
+	};
+
+	struct EntityRecord {
+		u32 archetype;
+		u32 row;
+		u32 generation = 0;
+	};
+
+	constexpr u32 NO_ARCHETYPE = ~0u;
+
+	struct World {
+		std::vector<Archetype> archetypes;
+		// by entity index
+		std::vector<EntityRecord> records;
+		std::vector<u32> free_indices;
+		u32 alive = 0;
+	};
+
+	/// @brief the rows of one chunk, what queries hand out
+	struct ChunkView {
+		Archetype* archetype;
+		Chunk* chunk;
+		u32 rows;
+	};
+
+	/// @brief an empty entity, the row is uninitialized for every component in mask
+	Entity create_entity(World& world, ComponentMask mask);
+	/// @brief the last row of its archetype moves into its place
+	void destroy_entity(World& world, Entity entity);
+	/// @brief moves the entity to the archetype of mask, components in both keep their values
+	void change_components(World& world, Entity entity, ComponentMask mask);
+	bool alive(const World& world, Entity entity);
+	/// @return the live entity with this index, or NO_ENTITY
+	Entity entity_at(const World& world, u32 index);
+	/// @brief appends a view of every non empty chunk whose archetype has all of mask
+	void query_chunks(World& world, ComponentMask mask, std::vector<ChunkView>& out);
+	/// @brief every live entity and every chunk, the world is empty afterwards
+	void clear_world(World& world);
+
+	template<class T>
+	T* column(const ChunkView& view) {
+		return reinterpret_cast<T*>(view.chunk->data + view.archetype->offsets[component_id<T>()]);
+	}
+
+	inline const Entity* entities(const ChunkView& view) {
+		return reinterpret_cast<const Entity*>(view.chunk->data);
+	}
+
+	/// @return nullptr if the entity is dead or does not have T
+	template<class T>
+	T* get(World& world, Entity entity) {
+		if (!alive(world, entity)) return nullptr;
+		auto& record = world.records[entity.index];
+		auto& archetype = world.archetypes[record.archetype];
+		auto id = component_id<T>();
+		if ((archetype.mask & (ComponentMask{ 1 } << id)) == 0) return nullptr;
+		auto* chunk = archetype.chunks[record.row / archetype.chunk_capacity].get();
+		return reinterpret_cast<T*>(chunk->data + archetype.offsets[id]) + record.row % archetype.chunk_capacity;
+	}
+
+	template<class... Cs>
+	Entity create_entity(World& world, const Cs&... components) {
+		auto entity = create_entity(world, component_mask<Cs...>());
+		((*get<Cs>(world, entity) = components), ...);
+		return entity;
+	}
+
+	template<class T>
+	void add_component(World& world, Entity entity, const T& component) {
+		auto& record = world.records[entity.index];
+		change_components(world, entity, world.archetypes[record.archetype].mask | component_mask<T>());
+		*get<T>(world, entity) = component;
+	}
+
+	template<class T>
+	void remove_component(World& world, Entity entity) {
+		auto& record = world.records[entity.index];
+		change_components(world, entity, world.archetypes[record.archetype].mask & ~component_mask<T>());
+	}
+
+	/// @brief fn(entity, Cs&...) for every entity that has all of Cs
+	template<class... Cs, class F>
+	void for_each(World& world, F&& fn) {
+		std::vector<ChunkView> views;
+		query_chunks(world, component_mask<Cs...>(), views);
+		for (auto& view : views) {
+			auto* ids = entities(view);
+			auto columns = std::make_tuple(column<Cs>(view)...);
+			for (u32 row = 0; row < view.rows; row++) {
+				std::apply([&](auto*... arrays) { fn(ids[row], arrays[row]...); }, columns);
+			}
+		}
+	}
+
+	/* fn(view) for the chunks of every entity that has all of Cs, a few chunks per job.
+	* no structural changes from inside, chunks may be written by the job that holds them */
+	template<class... Cs, class F>
+	void parallel_for_chunks(World& world, JobSystem& jobs, F&& fn) {
+		std::vector<ChunkView> views;
+		query_chunks(world, component_mask<Cs...>(), views);
+		jobs.parallel_for(0, views.size(), jobs.grain_for(views.size(), 4), [&](u64 lo, u64 hi) {
+			for (auto i = lo; i < hi; i++) {
+				fn(views[i]);
+			}
+			});
+	}
+}
@@ -0,0 +1,192 @@
+#include "z_jobs.h"
+#include "z_debug.h"
+
+namespace zebra {
+	static thread_local i32 tl_worker_index = -1;
+
+	void CounterAwaiter::await_suspend(std::coroutine_handle<> handle) {
+		jobs->run_after(*counter, [handle]() { handle.resume(); });
+	}
+
+	JobSystem::~JobSystem() {
+		shutdown();
+	}
+
+	void JobSystem::init(u32 worker_count) {
+		if (worker_count == 0) {
+			worker_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+		}
+
+		// slot 0 is the main thread
+		for (auto i = 0u; i < worker_count + 1; i++) {
+			queues.push_back(std::make_unique<WorkerQueue>());
+		}
+		tl_worker_index = 0;
+		window_start = std::chrono::steady_clock::now();
+
+		running.store(true, std::memory_order_release);
+		for (auto i = 1u; i < worker_count + 1; i++) {
+			workers.emplace_back(&JobSystem::worker_loop, this, i);
+		}
+		DBG("started " << worker_count << " workers");
+	}
+
+	void JobSystem::shutdown() {
+		if (!running.exchange(false)) return;
+		{
+			std::lock_guard guard(sleep_lock);
+			sleep_cv.notify_all();
+		}
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+		queues.clear();
+	}
+
+	u32 JobSystem::local_index() const {
+		return tl_worker_index < 0 ? 0u : (u32)tl_worker_index;
+	}
+
+	void JobSystem::run(std::function<void()>&& fn, JobCounter* counter) {
+		if (counter) {
+			counter->pending.fetch_add(1, std::memory_order_relaxed);
+		}
+		push(Job{ std::move(fn), counter });
+	}
+
+	void JobSystem::run_after(JobCounter& dependency, std::function<void()>&& fn, JobCounter* counter) {
+		if (counter) {
+			counter->pending.fetch_add(1, std::memory_order_relaxed);
+		}
+		Job job{ std::move(fn), counter };
+		{
+			std::lock_guard guard(dependency.continuation_lock);
+			if ((dependency.pending.load(std::memory_order_acquire) & ~JobCounter::RELEASING) != 0) {
+				dependency.continuations.push_back(std::move(job));
+				return;
+			}
+		}
+		push(std::move(job));
+	}
+
+	void JobSystem::push(Job&& job) {
+		if (queues.empty()) [[unlikely]] {
+			// not initialized (or already shut down), just run inline
+			execute(0, job);
+			return;
+		}
+		auto& queue = *queues[local_index()];
+		queued.fetch_add(1, std::memory_order_release);
+		{
+			std::lock_guard guard(queue.lock);
+			queue.jobs.push_back(std::move(job));
+		}
+		sleep_cv.notify_one();
+	}
+
+	bool JobSystem::try_execute(u32 index) {
+		Job job;
+		bool found = false;
+		{
+			auto& own = *queues[index];
+			std::lock_guard guard(own.lock);
+			if (!own.jobs.empty()) {
+				job = std::move(own.jobs.back());
+				own.jobs.pop_back();
+				found = true;
+			}
+		}
+
+		// steal the oldest job from someone else, starting next to us so thieves spread out
+		for (auto i = 1u; !found && i < queues.size(); i++) {
+			auto& victim = *queues[(index + i) % queues.size()];
+			std::lock_guard guard(victim.lock);
+			if (!victim.jobs.empty()) {
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+				queues[index]->steals.fetch_add(1, std::memory_order_relaxed);
+				found = true;
+			}
+		}
+
+		if (!found) return false;
+		queued.fetch_sub(1, std::memory_order_relaxed);
+		execute(index, job);
+		return true;
+	}
+
+	void JobSystem::execute(u32 index, Job& job) {
+		auto start = std::chrono::steady_clock::now();
+		job.fn();
+		auto end = std::chrono::steady_clock::now();
+
+		if (index < queues.size()) {
+			auto& queue = *queues[index];
+			queue.busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), std::memory_order_relaxed);
+			queue.executed.fetch_add(1, std::memory_order_relaxed);
+		}
+		finish(job.counter);
+	}
+
+	void JobSystem::finish(JobCounter* counter) {
+		if (counter == nullptr) return;
+		u32 current = counter->pending.load(std::memory_order_relaxed);
+		u32 next;
+		do {
+			next = current == 1 ? JobCounter::RELEASING : current - 1;
+		} while (!counter->pending.compare_exchange_weak(current, next, std::memory_order_acq_rel));
+		if (next != JobCounter::RELEASING) return;
+
+		// last job out releases everything that waited on this counter
+		std::vector<Job> released;
+		{
+			std::lock_guard guard(counter->continuation_lock);
+			released.swap(counter->continuations);
+		}
+		// counter may be gone after this
+		counter->pending.fetch_sub(JobCounter::RELEASING, std::memory_order_acq_rel);
+		for (auto& job : released) {
+			push(std::move(job));
+		}
+	}
+
+	void JobSystem::wait(JobCounter& counter) {
+		auto index = local_index();
+		while (!counter.done()) {
+			if (queues.empty() || !try_execute(index)) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	void JobSystem::worker_loop(u32 index) {
+		tl_worker_index = (i32)index;
+		while (running.load(std::memory_order_acquire)) {
+			if (try_execute(index)) continue;
+
+			std::unique_lock guard(sleep_lock);
+			sleep_cv.wait_for(guard, std::chrono::milliseconds(1), [this]() {
+				return queued.load(std::memory_order_acquire) > 0 || !running.load(std::memory_order_acquire);
+			});
+		}
+	}
+
+	std::vector<WorkerUtilization> JobSystem::utilization() {
+		auto now = std::chrono::steady_clock::now();
+		auto window_ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(now - window_start).count();
+		window_start = now;
+
+		std::vector<WorkerUtilization> result;
+		result.reserve(queues.size());
+		for (auto& queue : queues) {
+			auto busy = (double)queue->busy_ns.exchange(0, std::memory_order_relaxed);
+			result.push_back({
+				.busy = window_ns > 0.0 ? (float)(busy / window_ns) : 0.f,
+				.jobs = queue->executed.exchange(0, std::memory_order_relaxed),
+				.steals = queue->steals.exchange(0, std::memory_order_relaxed),
+			});
+		}
+		return result;
+	}
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "zebratypes.h"
+
+namespace zebra {
+
+	struct JobCounter;
+
+	struct Job {
+		std::function<void()> fn;
+		JobCounter* counter = nullptr;
+	};
+
+	/* counts outstanding jobs. jobs registered with run_after are held back
+	* in here until the counter drops to zero. */
+	struct JobCounter {
+		// set by the last job while it hands out continuations, so waiters
+		// cannot return (and free the counter) before it is done touching it
+		static constexpr u32 RELEASING = 1u << 31;
+
+		std::atomic<u32> pending{ 0 };
+		std::mutex continuation_lock;
+		std::vector<Job> continuations;
+
+		bool done() const {
+			return pending.load(std::memory_order_acquire) == 0;
+		}
+	};
+
+	struct WorkerUtilization {
+		float busy; // 0..1 of the measured window
+		u64 jobs;
+		u64 steals;
+	};
+
+	struct alignas(64) WorkerQueue {
+		// owner pushes and pops at the back, thieves take from the front
+		std::mutex lock;
+		std::deque<Job> jobs;
+
+		// -- metrics, reset on JobSystem::utilization
+		std::atomic<u64> busy_ns{ 0 };
+		std::atomic<u64> executed{ 0 };
+		std::atomic<u64> steals{ 0 };
+	};
+
+	class JobSystem;
+
+	/// @brief co_await jobs.wait_async(counter) resumes the coroutine on a worker once counter is done
+	struct CounterAwaiter {
+		JobSystem* jobs;
+		JobCounter* counter;
+
+		bool await_ready() const noexcept {
+			return counter->done();
+		}
+		void await_suspend(std::coroutine_handle<> handle);
+		void await_resume() const noexcept {}
+	};
+
+	/* work stealing scheduler. queue 0 belongs to the main thread (and any other thread that
+	* is not a worker), which only executes jobs while it waits on a counter. */
+	class JobSystem {
+	public:
+		JobSystem() = default;
+		~JobSystem();
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator=(JobSystem const&) = delete;
+
+		/// @param worker_count 0 picks hardware_concurrency - 1
+		void init(u32 worker_count = 0);
+		void shutdown();
+
+		void run(std::function<void()>&& fn, JobCounter* counter = nullptr);
+		/// @brief fn is queued once dependency is done, counter is held from now on
+		void run_after(JobCounter& dependency, std::function<void()>&& fn, JobCounter* counter = nullptr);
+		/// @brief executes other jobs until counter is done
+		void wait(JobCounter& counter);
+		CounterAwaiter wait_async(JobCounter& counter) {
+			return CounterAwaiter{ this, &counter };
+		}
+
+		/// @brief splits [begin, end) into chunks of grain and calls fn(lo, hi) for each, blocks until all are done
+		template<class F>
+		void parallel_for(u64 begin, u64 end, u64 grain, F&& fn) {
+			if (end <= begin) return;
+			grain = std::max(grain, (u64)1);
+			if (end - begin <= grain || queues.size() <= 1) {
+				fn(begin, end);
+				return;
+			}
+
+			JobCounter counter;
+			for (u64 lo = begin; lo < end; lo += grain) {
+				u64 hi = std::min(lo + grain, end);
+				run([&fn, lo, hi]() { fn(lo, hi); }, &counter);
+			}
+			wait(counter);
+		}
+
+		/// @brief chunk size so every thread gets a few chunks to balance with
+		u64 grain_for(u64 count, u64 min_grain = 64) const {
+			return std::max(min_grain, count / ((u64)thread_count() * 4) + 1);
+		}
+
+		u32 thread_count() const {
+			return (u32)queues.size();
+		}
+
+		/// @brief busy fraction per thread since the last call, index 0 is the main thread
+		std::vector<WorkerUtilization> utilization();
+
+	protected:
+		void worker_loop(u32 index);
+		void push(Job&& job);
+		bool try_execute(u32 index);
+		void execute(u32 index, Job& job);
+		void finish(JobCounter* counter);
+		u32 local_index() const;
+
+		std::vector<std::unique_ptr<WorkerQueue>> queues;
+		std::vector<std::thread> workers;
+		std::atomic<bool> running = false;
+		std::atomic<u32> queued{ 0 };
+		std::mutex sleep_lock;
+		std::condition_variable sleep_cv;
+		std::chrono::steady_clock::time_point window_start;
+	};
+
+	/// @brief sorts chunks in parallel, then merges neighbouring runs pairwise until one is left
+	template<class It, class Cmp>
+	void parallel_sort(JobSystem& jobs, It begin, It end, Cmp cmp) {
+		const u64 count = (u64)(end - begin);
+		const u64 grain = jobs.grain_for(count, 2048);
+		if (count <= grain) {
+			std::sort(begin, end, cmp);
+			return;
+		}
+
+		jobs.parallel_for(0, count, grain, [&](u64 lo, u64 hi) {
+			std::sort(begin + lo, begin + hi, cmp);
+			});
+
+		for (u64 width = grain; width < count; width *= 2) {
+			const u64 pairs = (count + 2 * width - 1) / (2 * width);
+			jobs.parallel_for(0, pairs, 1, [&](u64 lo, u64 hi) {
+				for (auto pair = lo; pair < hi; pair++) {
+					u64 first = pair * 2 * width;
+					u64 middle = std::min(first + width, count);
+					u64 last = std::min(first + 2 * width, count);
+					if (middle < last) {
+						std::inplace_merge(begin + first, begin + middle, begin + last, cmp);
+					}
+				}
+				});
+		}
+	}
+}
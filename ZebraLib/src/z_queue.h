@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include "zebratypes.h"
+
+namespace zebra {
+
+	/* bounded lock-free queue between one producer and one consumer thread. slots are written
+	* and read in place, so whatever they hold keeps its capacity from one round to the next.
+	* a slot stays with the consumer from read_slot until release, so it can be used while it is processed */
+	template<class T, u32 N>
+	struct SpscQueue {
+		std::array<T, N> slots{};
+		// both only ever grow, the slot is the value mod N
+		std::atomic<u32> head{ 0 };
+		std::atomic<u32> tail{ 0 };
+
+		// -- producer side
+		/// @return nullptr while all N slots are queued or being processed
+		T* write_slot() {
+			auto t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) >= N) return nullptr;
+			return &slots[t % N];
+		}
+
+		void publish() {
+			tail.fetch_add(1, std::memory_order_release);
+			tail.notify_one();
+		}
+
+		// -- consumer side
+		/// @return nullptr if nothing was published
+		T* read_slot() {
+			auto h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire)) return nullptr;
+			return &slots[h % N];
+		}
+
+		/// @brief blocks until the producer publishes something
+		T& wait_read_slot() {
+			auto h = head.load(std::memory_order_relaxed);
+			auto t = tail.load(std::memory_order_acquire);
+			while (h == t) {
+				tail.wait(t, std::memory_order_acquire);
+				t = tail.load(std::memory_order_acquire);
+			}
+			return slots[h % N];
+		}
+
+		void release() {
+			head.fetch_add(1, std::memory_order_release);
+		}
+	};
+}
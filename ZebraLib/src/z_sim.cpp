@@ -0,0 +1,37 @@
+#include "z_sim.h"
+#include <algorithm>
+#include <cstring>
+
+namespace zebra {
+	void interpolate_snapshots(const SimSnapshot& previous, const SimSnapshot& current, float alpha, FirstPersonPerspectiveCamera& out_camera, std::vector<u8>& moving, std::vector<render::RenderableUpdate>& out_updates) {
+		alpha = glm::clamp(alpha, 0.f, 1.f);
+		out_camera = FirstPersonPerspectiveCamera::interpolate(previous.camera, current.camera, alpha);
+
+		// objects are matched by index, anything that was spawned this tick snaps into place
+		out_updates.clear();
+		moving.resize(current.objects.size(), 1);
+		auto blend_count = std::min(previous.objects.size(), current.objects.size());
+		for (auto i = 0ull; i < current.objects.size(); i++) {
+			auto& object = current.objects[i];
+			bool blends = i < blend_count && std::memcmp(&previous.objects[i].obj, &object.obj, sizeof(ObjectData)) != 0;
+			// at rest and already sent at rest, the renderer still has it
+			if (!blends && !moving[i]) continue;
+			moving[i] = blends;
+
+			auto& update = out_updates.emplace_back(object);
+			if (blends) {
+				auto& a = previous.objects[i].obj;
+				for (auto c = 0; c < 4; c++) {
+					update.obj.model_matrix[c] = glm::mix(a.model_matrix[c], object.obj.model_matrix[c], alpha);
+				}
+				update.obj.color = glm::mix(a.color, object.obj.color, alpha);
+			}
+		}
+	}
+
+	float snapshot_alpha(const SimSnapshot& previous, const SimSnapshot& current, float since, float tick_dt) {
+		if (current.tick <= previous.tick) return 1.f;
+		float span = (current.tick - previous.tick) * tick_dt;
+		return (since + span - tick_dt) / span;
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <vector>
+#include <glm/glm.hpp>
+#include "zebratypes.h"
+#include "g_camera.h"
+#include "renderer.h"
+
+namespace zebra {
+
+	/* lock-free handoff between one writer (sim thread) and one reader (render thread).
+	* four slots: the writer owns one, the reader owns two (previous and current, for interpolation)
+	* and the last one sits in the middle. publishing and consuming is a single atomic exchange each.
+	* if the reader is slow, the writer just overwrites the unconsumed middle slot. */
+	template<class T>
+	struct SnapshotExchange {
+		static constexpr u8 FRESH = 0x80;
+
+		std::array<T, 4> slots{};
+		std::atomic<u8> middle{ 1 };
+		u8 back = 0;
+		u8 previous = 2;
+		u8 current = 3;
+
+		// -- writer side
+		T& write_slot() {
+			return slots[back];
+		}
+
+		void publish() {
+			back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+		}
+
+		// -- reader side
+		/// @brief swaps in the newest snapshot, if there is one
+		/// @return true if current changed
+		bool consume() {
+			if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+			auto got = middle.exchange(previous, std::memory_order_acq_rel);
+			previous = current;
+			current = got & ~FRESH;
+			return true;
+		}
+
+		const T& read_previous() const {
+			return slots[previous];
+		}
+
+		const T& read_current() const {
+			return slots[current];
+		}
+	};
+
+	struct SimSnapshot {
+		u64 tick = 0;
+		std::chrono::steady_clock::time_point published;
+		FirstPersonPerspectiveCamera camera;
+		// renderables owned by the simulation, statics stay in the renderer
+		std::vector<render::RenderableUpdate> objects;
+	};
+
+	/// @brief sim world component, the renderable that shows the entity
+	struct SimRenderable {
+		render::RenderableHandle handle;
+	};
+
+	/* written by the main thread (glfw has to be polled there),
+	* read by the sim thread once per tick */
+	struct SimInput {
+		std::atomic<u32> held_actions{ 0 };
+		std::atomic<glm::vec2> mouse_delta{ glm::vec2(0.f) };
+		std::atomic<float> speed{ 12.f };
+		std::atomic<float> fly_speed{ 12.f };
+		std::atomic<bool> invert_camera{ false };
+		std::atomic<glm::vec2> mouse_sensitivity{ glm::vec2(0.01f) };
+
+		void add_mouse_delta(glm::vec2 delta) {
+			auto old = mouse_delta.load(std::memory_order_relaxed);
+			while (!mouse_delta.compare_exchange_weak(old, old + delta, std::memory_order_acq_rel));
+		}
+
+		glm::vec2 take_mouse_delta() {
+			return mouse_delta.exchange(glm::vec2(0.f), std::memory_order_acq_rel);
+		}
+	};
+
+	/* blends two snapshots, alpha 0 is previous and 1 is current. only objects that differ between
+	* the two, or came to rest since the last call, end up in out_updates. moving is by object index
+	* and carries over between calls */
+	void interpolate_snapshots(const SimSnapshot& previous, const SimSnapshot& current, float alpha, FirstPersonPerspectiveCamera& out_camera, std::vector<u8>& moving, std::vector<render::RenderableUpdate>& out_updates);
+
+	/* where between the two snapshots to draw, since is the time passed since current was published.
+	* a slow reader misses ticks, so previous can be several ticks behind current. the blend is spread over
+	* the ticks in between and always shows the state one tick ago, the speed stays the same either way */
+	float snapshot_alpha(const SimSnapshot& previous, const SimSnapshot& current, float since, float tick_dt);
+}
@@ -0,0 +1,233 @@
+#include "z_transform.h"
+#include <algorithm>
+#include <type_traits>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace zebra {
+	static constexpr u32 NO_PARENT = ~0u;
+
+	glm::mat4 to_matrix(const Transform& transform) {
+		glm::mat4 matrix = glm::mat4_cast(transform.rotation);
+		matrix[0] *= transform.scale.x;
+		matrix[1] *= transform.scale.y;
+		matrix[2] *= transform.scale.z;
+		matrix[3] = glm::vec4(transform.position, 1.f);
+		return matrix;
+	}
+
+	static void mark_dirty(TransformHierarchy& hierarchy, u32 slot) {
+		if (hierarchy.dirty[slot]) return;
+		hierarchy.dirty[slot] = 1;
+		hierarchy.dirty_handles.push_back(hierarchy.handle_of[slot]);
+	}
+
+	TransformHandle add_transform(TransformHierarchy& hierarchy, const Transform& local, TransformHandle parent) {
+		TransformHandle handle;
+		if (!hierarchy.free_handles.empty()) {
+			handle = hierarchy.free_handles.back();
+			hierarchy.free_handles.pop_back();
+		} else {
+			handle = (TransformHandle)hierarchy.slot_of.size();
+			hierarchy.slot_of.push_back(0);
+		}
+
+		// parents always exist before their children, so appending keeps parents first
+		auto parent_slot = parent == NO_TRANSFORM ? NO_PARENT : hierarchy.slot_of[parent];
+		auto slot = (u32)hierarchy.local.size();
+		hierarchy.slot_of[handle] = slot;
+		hierarchy.local.push_back(local);
+		hierarchy.parent.push_back(parent_slot);
+		hierarchy.world.push_back(glm::mat4(1.f));
+		hierarchy.dirty.push_back(0);
+		hierarchy.depth.push_back(parent_slot == NO_PARENT ? 0 : hierarchy.depth[parent_slot] + 1);
+		hierarchy.handle_of.push_back(handle);
+		hierarchy.unsorted = true;
+		mark_dirty(hierarchy, slot);
+		return handle;
+	}
+
+	// drops the slots that have no new slot, keeps the order of the rest
+	template<class T>
+	static void compact(std::vector<T>& values, const std::vector<u32>& new_slot) {
+		u32 count = 0;
+		for (auto i = 0u; i < values.size(); i++) {
+			if (new_slot[i] == NO_PARENT) continue;
+			values[count++] = values[i];
+		}
+		values.resize(count);
+	}
+
+	void remove_transform(TransformHierarchy& hierarchy, TransformHandle handle) {
+		const auto count = (u32)hierarchy.local.size();
+		const auto root = hierarchy.slot_of[handle];
+
+		// children come after their parents, one pass finds the whole subtree
+		std::vector<u8> removed(count, 0);
+		removed[root] = 1;
+		for (auto i = root + 1; i < count; i++) {
+			removed[i] = hierarchy.parent[i] != NO_PARENT && removed[hierarchy.parent[i]];
+		}
+
+		std::vector<u32> new_slot(count, NO_PARENT);
+		u32 kept = 0;
+		for (auto i = 0u; i < count; i++) {
+			if (removed[i]) {
+				hierarchy.free_handles.push_back(hierarchy.handle_of[i]);
+				hierarchy.slot_of[hierarchy.handle_of[i]] = NO_PARENT;
+			} else {
+				new_slot[i] = kept++;
+			}
+		}
+
+		compact(hierarchy.local, new_slot);
+		compact(hierarchy.parent, new_slot);
+		compact(hierarchy.world, new_slot);
+		compact(hierarchy.dirty, new_slot);
+		compact(hierarchy.depth, new_slot);
+		compact(hierarchy.handle_of, new_slot);
+		for (auto i = 0u; i < kept; i++) {
+			if (hierarchy.parent[i] != NO_PARENT) hierarchy.parent[i] = new_slot[hierarchy.parent[i]];
+			hierarchy.slot_of[hierarchy.handle_of[i]] = i;
+		}
+		hierarchy.unsorted = true;
+	}
+
+	void set_local(TransformHierarchy& hierarchy, TransformHandle handle, const Transform& local) {
+		auto slot = hierarchy.slot_of[handle];
+		hierarchy.local[slot] = local;
+		mark_dirty(hierarchy, slot);
+	}
+
+	const Transform& local_transform(const TransformHierarchy& hierarchy, TransformHandle handle) {
+		return hierarchy.local[hierarchy.slot_of[handle]];
+	}
+
+	const glm::mat4& world_matrix(const TransformHierarchy& hierarchy, TransformHandle handle) {
+		return hierarchy.world[hierarchy.slot_of[handle]];
+	}
+
+	/* breadth first from the roots, which keeps the depth order and puts the children of a node next to each other,
+	* in the order of their parents. rebuilds level_begin and the child ranges on the way */
+	static void sort_breadth_first(TransformHierarchy& hierarchy) {
+		const auto count = (u32)hierarchy.local.size();
+
+		// children by old slot, counting sort on the parent
+		std::vector<u32> children_begin(count + 1, 0);
+		for (auto p : hierarchy.parent) {
+			if (p != NO_PARENT) children_begin[p + 1]++;
+		}
+		for (auto i = 0u; i < count; i++) children_begin[i + 1] += children_begin[i];
+		std::vector<u32> children(children_begin[count]);
+		std::vector<u32> cursor(children_begin.begin(), children_begin.end() - 1);
+		for (auto i = 0u; i < count; i++) {
+			if (hierarchy.parent[i] != NO_PARENT) children[cursor[hierarchy.parent[i]]++] = i;
+		}
+
+		// order[new slot] = old slot
+		std::vector<u32> order;
+		order.reserve(count);
+		for (auto i = 0u; i < count; i++) {
+			if (hierarchy.parent[i] == NO_PARENT) order.push_back(i);
+		}
+		hierarchy.first_child.resize(count);
+		hierarchy.child_count.resize(count);
+		for (auto i = 0u; i < count; i++) {
+			auto old = order[i];
+			hierarchy.first_child[i] = (u32)order.size();
+			hierarchy.child_count[i] = children_begin[old + 1] - children_begin[old];
+			order.insert(order.end(), children.begin() + children_begin[old], children.begin() + children_begin[old + 1]);
+		}
+
+		std::vector<u32> new_slot(count);
+		for (auto i = 0u; i < count; i++) new_slot[order[i]] = i;
+
+		auto permute = [&](auto& values) {
+			std::remove_reference_t<decltype(values)> sorted(values.size());
+			for (auto i = 0u; i < count; i++) sorted[i] = values[order[i]];
+			values.swap(sorted);
+		};
+		permute(hierarchy.local);
+		permute(hierarchy.world);
+		permute(hierarchy.dirty);
+		permute(hierarchy.depth);
+		permute(hierarchy.handle_of);
+		permute(hierarchy.parent);
+		for (auto i = 0u; i < count; i++) {
+			if (hierarchy.parent[i] != NO_PARENT) hierarchy.parent[i] = new_slot[hierarchy.parent[i]];
+			hierarchy.slot_of[hierarchy.handle_of[i]] = i;
+		}
+
+		u16 max_depth = 0;
+		for (auto d : hierarchy.depth) max_depth = std::max(max_depth, d);
+		hierarchy.level_begin.assign(max_depth + 2u, count);
+		for (auto i = count; i-- > 0;) hierarchy.level_begin[hierarchy.depth[i]] = i;
+		if (count == 0) hierarchy.level_begin.assign(1, 0);
+		hierarchy.unsorted = false;
+	}
+
+	void update_transforms(TransformHierarchy& hierarchy, JobSystem& jobs) {
+		if (hierarchy.unsorted) {
+			sort_breadth_first(hierarchy);
+		}
+		hierarchy.changed.clear();
+		if (hierarchy.dirty_handles.empty()) return;
+
+		// every dirty node starts a range on its level
+		const auto levels = (u32)hierarchy.level_begin.size() - 1;
+		auto& ranges = hierarchy.dirty_ranges;
+		if (ranges.size() < levels) ranges.resize(levels);
+		u32 first_level = levels;
+		for (auto handle : hierarchy.dirty_handles) {
+			auto slot = hierarchy.slot_of[handle];
+			// removed since it was set
+			if (slot == NO_PARENT || !hierarchy.dirty[slot]) continue;
+			hierarchy.dirty[slot] = 0;
+			ranges[hierarchy.depth[slot]].push_back({ slot, slot + 1 });
+			first_level = std::min(first_level, (u32)hierarchy.depth[slot]);
+		}
+		hierarchy.dirty_handles.clear();
+
+		// a level only reads the one above it, which is done by the time it starts
+		for (u32 level = first_level; level < levels; level++) {
+			auto& current = ranges[level];
+			if (current.empty()) continue;
+
+			// dirty nodes can sit inside the subtree of another one
+			std::sort(current.begin(), current.end(), [](const SlotRange& a, const SlotRange& b) { return a.begin < b.begin; });
+			u32 merged = 0;
+			for (auto& range : current) {
+				if (merged > 0 && range.begin <= current[merged - 1].end) {
+					current[merged - 1].end = std::max(current[merged - 1].end, range.end);
+				} else {
+					current[merged++] = range;
+				}
+			}
+			current.resize(merged);
+
+			u64 total = 0;
+			for (auto& range : current) total += range.end - range.begin;
+			const u64 grain = jobs.grain_for(total, 512);
+			for (auto& range : current) {
+				jobs.parallel_for(range.begin, range.end, grain, [&](u64 lo, u64 hi) {
+					for (auto i = lo; i < hi; i++) {
+						auto parent = hierarchy.parent[i];
+						auto local = to_matrix(hierarchy.local[i]);
+						hierarchy.world[i] = parent == NO_PARENT ? local : hierarchy.world[parent] * local;
+					}
+					});
+			}
+
+			// the children of a range are one range on the next level
+			for (auto& range : current) {
+				for (auto i = range.begin; i < range.end; i++) {
+					hierarchy.changed.push_back(hierarchy.handle_of[i]);
+				}
+				if (level + 1 == levels) continue;
+				auto last = range.end - 1;
+				SlotRange below{ hierarchy.first_child[range.begin], hierarchy.first_child[last] + hierarchy.child_count[last] };
+				if (below.begin < below.end) ranges[level + 1].push_back(below);
+			}
+			current.clear();
+		}
+	}
+}
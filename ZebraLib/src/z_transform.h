@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "zebratypes.h"
+#include "z_jobs.h"
+
+namespace zebra {
+	using TransformHandle = u32;
+	constexpr TransformHandle NO_TRANSFORM = ~0u;
+
+	struct Transform {
+		glm::vec3 position{ 0.f };
+		glm::quat rotation{ 1.f, 0.f, 0.f, 0.f };
+		glm::vec3 scale{ 1.f };
+	};
+
+	glm::mat4 to_matrix(const Transform& transform);
+
+	// slots [begin, end) of one level
+	struct SlotRange {
+		u32 begin;
+		u32 end;
+	};
+
+	/* parent relative transforms, stored breadth first so every parent comes before its children
+	* and the children of a node sit next to each other. a subtree is then one contiguous range per level,
+	* so update walks only the ranges under dirty nodes, level by level with each level in parallel.
+	* handles stay valid while nodes move around inside the arrays */
+	struct TransformHierarchy {
+		// -- by slot, in depth order
+		std::vector<Transform> local;
+		std::vector<u32> parent;
+		std::vector<glm::mat4> world;
+		// set by set_local and add_transform, so a node is listed in dirty_handles once
+		std::vector<u8> dirty;
+		std::vector<u16> depth;
+		std::vector<TransformHandle> handle_of;
+		// children of a slot are [first_child, first_child + child_count), leaves point where theirs would go
+		std::vector<u32> first_child;
+		std::vector<u32> child_count;
+		// first slot of every depth, plus the end
+		std::vector<u32> level_begin;
+
+		// -- by handle
+		std::vector<u32> slot_of;
+		std::vector<TransformHandle> free_handles;
+
+		// handles whose world matrix changed in the last update
+		std::vector<TransformHandle> changed;
+		// set since the last update, may hold handles removed since
+		std::vector<TransformHandle> dirty_handles;
+		// update scratch, by depth the ranges left to recompute
+		std::vector<std::vector<SlotRange>> dirty_ranges;
+		// nodes were added or removed, the arrays need to be put back in breadth first order
+		bool unsorted = false;
+	};
+
+	TransformHandle add_transform(TransformHierarchy& hierarchy, const Transform& local, TransformHandle parent = NO_TRANSFORM);
+	/// @brief removes the node and everything below it
+	void remove_transform(TransformHierarchy& hierarchy, TransformHandle handle);
+	void set_local(TransformHierarchy& hierarchy, TransformHandle handle, const Transform& local);
+	const Transform& local_transform(const TransformHierarchy& hierarchy, TransformHandle handle);
+	/// @brief as of the last update
+	const glm::mat4& world_matrix(const TransformHierarchy& hierarchy, TransformHandle handle);
+	/// @brief recomputes the world matrices of dirty subtrees and lists them in changed
+	void update_transforms(TransformHierarchy& hierarchy, JobSystem& jobs);
+}
@@ -10,6 +10,8 @@
 #include <random>
 #include <magic_enum.h>
 #include <numeric>
+#include <cstring>
+#include <algorithm>
 
 #include "vk_mem_alloc.h"
 #define VMA_IMPLEMENTATION
@@ -136,6 +138,7 @@ namespace zebra {
 
 	bool zCore::init_gfx() {
 		DBG("start");
+		jobs.init();
 
 		if (glfwInit()) {
 			DBG("glfw success");
@@ -146,30 +149,42 @@ namespace zebra {
 
 		DBG("vulkan");
 		if (!this->init_vulkan()) return false;
-
+		// upscaling has to filter, an input attachment only reads its own pixel. only matters if the scale can drop
+		if (dynamic_resolution && resolution.min_scale < 1.f) fused_composite = false;
+		/* hi-z splits the forward pass in two around the pyramid build, and the late one has to stay compatible with
+		* the early one, so the composite cannot be a subpass of either. it runs as its own render pass with blit.frag
+		* sampling scene_color. tilers never get here, init_vulkan turned occlusion culling off for them */
+		if (occlusion_culling) fused_composite = false;
+		resolution.enabled = dynamic_resolution;
+		resolution.target_ms = settings.target_ms;
 
 		auto sampler_info = vki::sampler_create_info(VK_FILTER_NEAREST);
 		vkCreateSampler(_up.device, &sampler_info, nullptr, &_vk.default_sampler);
+		auto linear_sampler_info = vki::sampler_create_info(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+		vkCreateSampler(_up.device, &linear_sampler_info, nullptr, &_vk.linear_sampler);
 		main_delq.push_function([this] {
 			vkDestroySampler(_up.device, _vk.default_sampler, nullptr);
+			vkDestroySampler(_up.device, _vk.linear_sampler, nullptr);
 			});
 
 		DBG("swapchain");
 		if (!this->init_swapchain()) return false;
 
 		DBG("per frame data");
-		if (!this->init_swapchain_per_frame_data()) return false; 
+		if (!this->init_frame_sync()) return false;
 
 		DBG("render pass");
 		if (!this->init_default_renderpass()) return false; // ???
 
-		DBG("framebuffers");
-		if (!this->init_framebuffers()) return false;
+		DBG("render graph");
+		if (!this->init_render_graph()) return false;
 
 		DBG("pipelines/shaders");
 		init_descriptor_set_layouts();
 
 		init_per_frame_data();
+		// turned off above if the queue cannot time
+		settings.dynamic_resolution = resolution.enabled;
 		if (!this->init_pipelines()) return false;
 
 		init_renderer();
@@ -195,33 +210,59 @@ namespace zebra {
 	void zCore::init_renderer() {
 		main_delq.push_function([this] {
 			render::clear_buffers(renderer, _up);
-			for (auto& buf : assets.t_meshes) {
-				vmaDestroyBuffer(_up.allocator, buf.second.vertices.buffer, buf.second.vertices.allocation);
+			destroy_pool(_vk.geometry);
+			for (auto& mesh : assets.t_meshes) {
+				if (mesh.second.clusters.buffer == VK_NULL_HANDLE) continue;
+				vmaDestroyBuffer(_vk.allocator, mesh.second.clusters.buffer, mesh.second.clusters.allocation);
 			}
 			for (auto& tex : assets.t_textures) {
 				destroy_texture(_up, tex.second);
 			}
-			for (auto& mat : assets.t_materials) {
-				vkDestroyPipelineLayout(_up.device, mat.second.pipeline_layout, nullptr);
-				vkDestroyPipeline(_up.device, mat.second.pipeline, nullptr);
-			}
+			// pipelines and their layouts belong to the caches, several materials may share one
+			_vk.pipeline_layouts.destroy();
+			_vk.pipeline_cache.destroy();
 
 			});
 	}
 
 	bool zCore::init_per_frame_data() {
 		init_descriptor_sets();
-		return true;
-	}
 
-	bool zCore::init_swapchain_per_frame_data() {
-		VkFenceCreateInfo fence_info = {
-			.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-			.pNext = nullptr,
-			.flags = VK_FENCE_CREATE_SIGNALED_BIT,
-		};
+		// gpu frame times for the resolution controller
+		if (!_vk.gpu_properties.limits.timestampComputeAndGraphics) {
+			DBG("no timestamps on the graphics queue, dynamic resolution stays at " << resolution.scale);
+			resolution.enabled = false;
+			return true;
+		}
+		u32 family_count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(_vk.vkb_device.physical_device.physical_device, &family_count, nullptr);
+		std::vector<VkQueueFamilyProperties> families(family_count);
+		vkGetPhysicalDeviceQueueFamilyProperties(_vk.vkb_device.physical_device.physical_device, &family_count, families.data());
+		u32 valid_bits = families[_vk.vkb_device.get_queue_index(vkb::QueueType::graphics).value()].timestampValidBits;
+		if (valid_bits == 0) {
+			DBG("graphics queue cannot time, dynamic resolution stays at " << resolution.scale);
+			resolution.enabled = false;
+			return true;
+		}
+		_vk.timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
 
+		VkQueryPoolCreateInfo query_info = {
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = 2,
+		};
+		for (auto i = 0u; i < frames.size(); i++) {
+			VK_CHECK(vkCreateQueryPool(_up.device, &query_info, nullptr, &frames[i].timestamps));
+			main_delq.push_function([this, i]() {
+				vkDestroyQueryPool(_up.device, frames[i].timestamps, nullptr);
+				});
+		}
+		return true;
+	}
 
+	// none of this depends on the swapchain, it lives as long as the device
+	// frames are waited on through the upload context timeline, only the swapchain needs binary semaphores
+	bool zCore::init_frame_sync() {
 		VkSemaphoreCreateInfo semaphore_info = {
 			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
 			.pNext = nullptr,
@@ -238,13 +279,11 @@ namespace zebra {
 				frames[i].pool);
 
 			VK_CHECK(vkAllocateCommandBuffers(_up.device, &cmd_info, &frames[i].buf));
-			VK_CHECK(vkCreateFence(_up.device, &fence_info, nullptr, &frames[i].renderF));
 			VK_CHECK(vkCreateSemaphore(_up.device, &semaphore_info, nullptr, &frames[i].presentS));
 			VK_CHECK(vkCreateSemaphore(_up.device, &semaphore_info, nullptr, &frames[i].renderS));
 
-			swapchain_delq.push_function([this, i]() {
+			main_delq.push_function([this, i]() {
 				vkDestroyCommandPool(_up.device, frames[i].pool, nullptr);
-				vkDestroyFence(_up.device, frames[i].renderF, nullptr);
 				vkDestroySemaphore(_up.device, frames[i].renderS, nullptr);
 				vkDestroySemaphore(_up.device, frames[i].presentS, nullptr);
 				});
@@ -253,112 +292,147 @@ namespace zebra {
 		return true;
 	}
 
-	render::DependencyInfo color_dependency(const VulkanNative& _vk) {
-		return 	render::DependencyInfo {
-				.format = _vk.screen_texture.format,
-				.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED,
-				.final_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-				.on_load = VK_ATTACHMENT_LOAD_OP_CLEAR,
-				.on_store = VK_ATTACHMENT_STORE_OP_STORE,
-				.attachment_layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-			};
-	}
-	
-	
-	render::DependencyInfo depth_dependency(const VulkanNative& _vk) {
-		return 	render::DependencyInfo {
-				.format = _vk.depth_texture.format,
-				.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED,
-				.final_layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-				.on_load = VK_ATTACHMENT_LOAD_OP_CLEAR,
-				.on_store = VK_ATTACHMENT_STORE_OP_STORE,
-				.attachment_layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-			};
-	}
-	
-	
-	render::DependencyInfo blit_dependency(const Window& _window) {
-		return 	render::DependencyInfo {
-				.format = _window.vkb_swapchain.image_format,
-				.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED,
-				.final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-				.on_load = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-				.on_store = VK_ATTACHMENT_STORE_OP_STORE,
-				.attachment_layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-			};
-	}
-
-
 	bool zCore::init_default_renderpass() {
 		// lol jk this just destructs them at the end
 		// and doesnt even create render passes anymore
 		main_delq.push_function([this]() {
 			_vk.renderpass_cache.clear();
 		});
+		main_delq.push_function([this]() {
+			_vk.framebuffer_cache.clear();
+		});
 		return true;
 	}
 
 
-	// TODO: remove this
-	// as render pass becomes more generic, so does this
-	bool zCore::init_framebuffers() {
+	bool zCore::init_render_graph() {
+		auto& graph = _vk.graph;
+		graph.device = _up.device;
+		graph.allocator = _vk.allocator;
+		graph.pass_cache = &_vk.renderpass_cache;
+		graph.framebuffer_cache = &_vk.framebuffer_cache;
 
-		std::array<render::DependencyInfo, 2> deps_1 = { color_dependency(_vk), depth_dependency(_vk) };
-		auto forward_renderpass = _vk.renderpass_cache.get_or_create(deps_1);
+		auto extent = _window.extent();
+		auto scene_color = render::create_texture(graph, "scene_color", { VK_FORMAT_R16G16B16A16_SFLOAT, extent });
+		auto scene_depth = render::create_texture(graph, "scene_depth", { VK_FORMAT_D32_SFLOAT, extent, VK_IMAGE_ASPECT_DEPTH_BIT });
+		_vk.backbuffer = render::import_texture(graph, "backbuffer", { _window.vkb_swapchain.image_format, extent }, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 
-		// forward pass
-		{
+		const VkClearValue clear_color = { .color = {0.6f, 0.4f, 0.4f, 1.f} };
+		const VkClearValue clear_depth = { .depthStencil = {1.f, 0 } };
 
-			
-			auto forward_info = vki::framebuffer_info(forward_renderpass, _window.extent());
-			auto attachments = { _vk.screen_texture.view, _vk.depth_texture.view };
-			forward_info.attachmentCount = attachments.size();
-			forward_info.pAttachments = attachments.begin();
-			VK_CHECK(vkCreateFramebuffer(_up.device, &forward_info, nullptr, &_vk.forward_framebuffer));
-			swapchain_delq.push_function([this]() {
-				vkDestroyFramebuffer(_up.device, _vk.forward_framebuffer, nullptr);
-				});
+		auto forward = [this](render::DrawPhase phase) {
+			return [this, phase](render::RGPassContext& ctx) {
+				if (phase == render::DrawPhase::Late && !_df.occlusion) return;
+				render::RenderData rdata = {
+					.forward_pass = ctx.pass,
+					.forward_framebuffer = ctx.framebuffer,
+					.forward_extent = ctx.extent,
+					.dcache = &_vk.layout_cache,
+					.jobs = &jobs,
+					.depth_prepass = drawing->settings.depth_prepass,
+					.dynamic_state = &_vk.dynamic_state,
+					.geometry = &_vk.geometry,
+					.multi_draw_indirect = _vk.vkb_device.physical_device.features.multiDrawIndirect == VK_TRUE,
+					.phase = _df.occlusion ? phase : render::DrawPhase::All,
+					.draw_indexed_indirect_count = _vk.draw_indexed_indirect_count,
+				};
+				render::render(this->renderer, this->assets, current_frame(), this->_up, _df.scene_data, rdata);
+			};
+		};
 
+		// without occlusion culling this is the whole scene
+		_vk.forward_pass = render::add_pass(graph, "forward")
+			.write_color(scene_color, clear_color)
+			.write_depth(scene_depth, clear_depth)
+			.execute(forward(render::DrawPhase::Early));
+
+		// cluster culling binds the pyramid even where occlusion culling never builds it
+		render::destroy_pyramid(renderer.occlusion.pyramid, deferred, _up.timeline.submitted);
+		renderer.occlusion.pyramid = render::create_pyramid(_up.device, _vk.allocator, extent);
+
+		_vk.late_pass = render::RG_NONE;
+		if (occlusion_culling) {
+			// the pyramid lives outside the graph, the pass only has to see scene_depth sampled
+			render::add_pass(graph, "occlusion")
+				.read(scene_depth)
+				.side_effect()
+				.execute([this, scene_depth](render::RGPassContext& ctx) {
+					if (!_df.occlusion) return;
+					auto& frame = current_frame();
+					auto area = render::render_area(*ctx.graph, _vk.forward_pass);
+					render::build_pyramid(renderer.occlusion.pyramid, ctx.cmd, renderer.occlusion.reduce, render::texture_view(*ctx.graph, scene_depth), _vk.default_sampler, area,
+						_up.device, frame.descriptor_pool, _vk.layout_cache);
+					render::cull_occlusion(renderer, ctx.cmd, render::DrawPhase::Late, _df.viewproj, current_frame_idx(), _up, frame, _vk.layout_cache, _vk.default_sampler);
+					render::cull_clusters(renderer, ctx.cmd, render::DrawPhase::Late, _df.viewproj, _df.eye, assets, _up, frame, _vk.layout_cache, _vk.default_sampler);
+					});
+
+			// loads what the early pass drew, so it is a render pass compatible with it
+			_vk.late_pass = render::add_pass(graph, "forward_late")
+				.write_color(scene_color)
+				.write_depth(scene_depth, clear_depth)
+				.execute(forward(render::DrawPhase::Late));
 		}
-		
-		std::array<render::DependencyInfo, 2> deps_2 = { color_dependency(_vk), depth_dependency(_vk) };
-		auto overlay_renderpass = _vk.renderpass_cache.get_or_create(deps_2);
-			
-		
-		// overlay pass
-		{
-
-			auto overlay_info = vki::framebuffer_info(overlay_renderpass, _window.extent());
-			auto attachments = { _vk.overlay_texture.view, _vk.overlay_depth_texture.view };
-			overlay_info.attachmentCount = attachments.size();
-			overlay_info.pAttachments = attachments.begin();
-			VK_CHECK(vkCreateFramebuffer(_up.device, &overlay_info, nullptr, &_vk.overlay_framebuffer));
-			swapchain_delq.push_function([this]() {
-				vkDestroyFramebuffer(_up.device, _vk.overlay_framebuffer, nullptr);
-				});
 
+		// final pass to copy to screen. fused, it runs as a second subpass and scene_color never leaves tile memory
+		auto blit = render::add_pass(graph, "blit");
+		if (fused_composite) {
+			blit.read_attachment(scene_color);
+		} else {
+			blit.read(scene_color);
 		}
-		
-		
-		// final pass to copy to screen
-		const u32 swapchain_imagecount = (u32)_vk.image_views.size();
-		auto swapchain_imageviews = _vk.image_views;
-		_vk.framebuffers = std::vector<VkFramebuffer>(_vk.image_views.size());
-
-		std::array<render::DependencyInfo, 1> deps_3 = { blit_dependency(_window) };
-		auto blit_pass = _vk.renderpass_cache.get_or_create(deps_3);
-
-		auto final_framebuffer_info = vki::framebuffer_info(blit_pass, _window.extent());
-		for (auto i = 0u; i < swapchain_imagecount; i++) {
-			final_framebuffer_info.attachmentCount = 1;
-			final_framebuffer_info.pAttachments = &swapchain_imageviews[i];
-			VK_CHECK(vkCreateFramebuffer(_up.device, &final_framebuffer_info, nullptr, &_vk.framebuffers[i]));
-			swapchain_delq.push_function([this, i]() {
-				vkDestroyFramebuffer(_up.device, _vk.framebuffers[i], nullptr);
+		_vk.blit_pass = blit
+			.write_color(_vk.backbuffer)
+			.execute([this, scene_color](render::RGPassContext& ctx) {
+				VkDescriptorImageInfo image_buffer_info = {
+					.sampler = fused_composite ? VK_NULL_HANDLE : _vk.linear_sampler,
+					.imageView = render::texture_view(*ctx.graph, scene_color),
+					.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				};
+				auto descriptor_type = fused_composite ? VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+				VkDescriptorSet scene_set;
+				DescriptorBuilder::begin(_up.device, current_frame().descriptor_pool, _vk.layout_cache)
+					.bind_image(0, image_buffer_info, descriptor_type, VK_SHADER_STAGE_FRAGMENT_BIT)
+					.build(scene_set);
+
+				VkViewport viewport = vki::viewport_info(ctx.extent);
+				VkRect2D scissor = {
+					.offset = { 0, 0 },
+					.extent = ctx.extent,
+				};
+				vkCmdSetViewport(ctx.cmd, 0, 1, &viewport);
+				vkCmdSetScissor(ctx.cmd, 0, 1, &scissor);
+
+				auto& blit_material = assets.t_materials[assets.t_names["blit"]];
+				vkCmdBindPipeline(ctx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, blit_material.pipeline);
+				set_raster_state(ctx.cmd, _vk.dynamic_state, blit_material.state);
+				vkCmdBindDescriptorSets(ctx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, blit_material.pipeline_layout, 0, 1, &scene_set, 0, nullptr);
+				if (!fused_composite) {
+					// upscale whatever part of scene_color the forward pass rendered this frame
+					auto area = render::render_area(*ctx.graph, _vk.forward_pass);
+					auto full = ctx.graph->resources[scene_color].desc.extent;
+					CompositePushConstants composite = {
+						.uv_scale = { (float)area.width / full.width, (float)area.height / full.height },
+						.sharpness = area.width < full.width ? drawing->settings.composite_sharpness : 0.f,
+					};
+					vkCmdPushConstants(ctx.cmd, blit_material.pipeline_layout, blit_material.push_stages, 0, sizeof(CompositePushConstants), &composite);
+				}
+				vkCmdDraw(ctx.cmd, 3, 1, 0, 0);
 				});
-		}
 
+		// ui goes straight on the backbuffer. this imgui version only builds its pipeline against a render pass,
+		// so it keeps one under dynamic rendering, otherwise it is just another subpass after the blit
+		_vk.ui_pass = render::add_pass(graph, "ui")
+			.write_color(_vk.backbuffer)
+			.needs_render_pass()
+			.execute([this](render::RGPassContext& ctx) {
+				// a copy, imgui itself is already building the next frame
+				if (drawing->ui.data.Valid) {
+					ImGui_ImplVulkan_RenderDrawData(const_cast<ImDrawData*>(&drawing->ui.data), ctx.cmd);
+				}
+				});
 
+		render::compile(graph);
 		return true;
 	}
 
@@ -383,11 +457,11 @@ namespace zebra {
 
 	// ok 02.09.2021 -> touches renderpass
 	bool zCore::init_swapchain() {
-		vkDeviceWaitIdle(_up.device);
-
+		// handing over the old swapchain lets the driver reuse its resources, and frames in flight keep presenting from it
 		vkb::SwapchainBuilder swapchain_builder{ _vk.vkb_device };
 		auto swap_ret = swapchain_builder
 			.use_default_present_mode_selection()
+			.set_old_swapchain(_window.vkb_swapchain)
 			.build();
 		if (!swap_ret) {
 			DBG("creation failed. " << swap_ret.error().message());
@@ -400,85 +474,40 @@ namespace zebra {
 		{
 			_vk.images = _window.vkb_swapchain.get_images().value();
 			_vk.image_views = _window.vkb_swapchain.get_image_views().value();
-			swapchain_delq.push_function([this]() {
-				for (auto i = 0u; i < _vk.image_views.size(); i++) {
-					vkDestroyImageView(_up.device, _vk.image_views[i], nullptr);
-				}
-				vkb::destroy_swapchain(_window.vkb_swapchain);
-				});
-		}
-		// depth texture
-		{
-			VkExtent3D depth_image_extent = {
-				.width = _window.extent().width,
-				.height = _window.extent().height,
-				.depth = 1,
-			};
-			VkImageCreateInfo depth_image_info = vki::image_create_info(VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, depth_image_extent);
-			create_gpu_texture(_up, depth_image_info, VK_IMAGE_ASPECT_DEPTH_BIT, _vk.depth_texture);
-			VkImageCreateInfo odepth_image_info = vki::image_create_info(VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, depth_image_extent);
-			create_gpu_texture(_up, odepth_image_info, VK_IMAGE_ASPECT_DEPTH_BIT, _vk.overlay_depth_texture);
-
-			swapchain_delq.push_function([this]() {
-				destroy_texture(_up, _vk.depth_texture);
-				destroy_texture(_up, _vk.overlay_depth_texture);
-				});
-		}
-		// screen textures
-		{
-			VkExtent3D render_image_extent = {
-				.width = _window.extent().width,
-				.height = _window.extent().height,
-				.depth = 1,
-			};
-
-			auto screen_texture_info = vki::image_create_info(VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, render_image_extent);
-			create_gpu_texture(_up, screen_texture_info, VK_IMAGE_ASPECT_COLOR_BIT, _vk.screen_texture);
-			create_gpu_texture(_up, screen_texture_info, VK_IMAGE_ASPECT_COLOR_BIT, _vk.overlay_texture);
-
-			swapchain_delq.push_function([this]() {
-				destroy_texture(_up, _vk.screen_texture);
-				destroy_texture(_up, _vk.overlay_texture);
-				});
-
 		}
 
-
 		return true;
 	}
 
-	// ok 02.09.2021 -> touches renderpass
+	/* no device wait, the old swapchain is retired and the frames in flight finish with it.
+	* runs on whichever thread records, so no glfw in here. the main thread holds back
+	* frames while the window is minimized */
 	bool zCore::recreate_swapchain() {
-
-		vkDeviceWaitIdle(_up.device);
-		// go into begin_collect state to ensure that scratch buffers are correctly unused
-		render::begin_collect(renderer, _up);
-		assert(renderer.danger_buffers.size() == 0);
-		
-		swapchain_delq.flush();
-		int w, h;
-		do {
-			glfwGetWindowSize(this->_window.handle, &w, &h);
-			if (w == 0 && h == 0) {
-				DBG("window is currently 0-sized");
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-				glfwPollEvents();
-			}
-		} while (w == 0 && h == 0);
+		auto old_swapchain = _window.swapchain();
+		auto old_views = _vk.image_views;
 
 		DBG("recreate swapchain");
+		// minimized since the packet was built, keep the old one and try again next frame
 		if (!this->init_swapchain()) return false;
+		retire_swapchain(old_swapchain, old_views);
 
-		DBG("per frame data");
-		if (!this->init_swapchain_per_frame_data()) return false;
+		// render passes only depend on formats, the cache stays warm across resizes
 
-		_vk.renderpass_cache.clear();
-
-		DBG("framebuffers");
-		if (!this->init_framebuffers()) return false;
+		DBG("render graph");
+		if (!this->init_render_graph()) return false;
 		return true;
 	}
 
+	// the views, the swapchain and the render graph transients, tagged with the last submission that used them
+	void zCore::retire_swapchain(VkSwapchainKHR swapchain, const std::vector<VkImageView>& views) {
+		for (auto view : views) {
+			defer_destroy(deferred, _up.timeline.submitted, view);
+		}
+		defer_destroy(deferred, _up.timeline.submitted, swapchain);
+		render::destroy(_vk.graph, deferred, _up.timeline.submitted);
+		render::destroy_pyramid(renderer.occlusion.pyramid, deferred, _up.timeline.submitted);
+	}
+
 	// OK 01.09.2021
 	bool zCore::init_vulkan() {
 		if (!glfwVulkanSupported()) {
@@ -517,6 +546,13 @@ namespace zebra {
 			.set_surface(_window.surface)
 			.set_minimum_version(1, 2)
 			.add_desired_extension("VK_KHR_shader_draw_parameters")
+			.add_desired_extension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)
+			.add_desired_extension(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)
+			.add_desired_extension(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME)
+			.add_desired_extension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)
+#ifdef VK_EXT_extended_dynamic_state3
+			.add_desired_extension(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)
+#endif
 			.prefer_gpu_device_type(vkb::PreferredDeviceType::discrete)
 			.select();
 		if (!phys_ret) {
@@ -527,7 +563,112 @@ namespace zebra {
 		auto physical_device = phys_ret.value();
 		vkGetPhysicalDeviceFeatures(physical_device.physical_device, &physical_device.features);
 
+		// dynamic rendering drops render pass and framebuffer objects entirely. tilers (anything with lazily
+		// allocated memory) stay on render passes, the fused composite subpass is worth more there
+		u32 extension_count = 0;
+		vkEnumerateDeviceExtensionProperties(physical_device.physical_device, nullptr, &extension_count, nullptr);
+		std::vector<VkExtensionProperties> device_extensions(extension_count);
+		vkEnumerateDeviceExtensionProperties(physical_device.physical_device, nullptr, &extension_count, device_extensions.data());
+		auto has_extension = [&](const char* name) {
+			return std::any_of(device_extensions.begin(), device_extensions.end(), [name](const VkExtensionProperties& ext) {
+				return strcmp(ext.extensionName, name) == 0;
+				});
+		};
+		bool has_dynamic_rendering = has_extension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+
+		VkPhysicalDeviceMemoryProperties memory_properties;
+		vkGetPhysicalDeviceMemoryProperties(physical_device.physical_device, &memory_properties);
+		bool is_tiler = false;
+		for (auto i = 0u; i < memory_properties.memoryTypeCount; i++) {
+			is_tiler |= (memory_properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+		}
+		bool use_dynamic_rendering = has_dynamic_rendering && !is_tiler;
+		// tilers keep the composite in the tile. a scaled scene would have to be sampled, and a split forward pass
+		// would have to store scene_depth, so both stay off there
+		if (is_tiler) {
+			dynamic_resolution = false;
+			occlusion_culling = false;
+		}
+
+		VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+			.pNext = nullptr,
+			.dynamicRendering = VK_TRUE,
+		};
+
+		// core in 1.2 and required there, frames and uploads all wait on one timeline
+		VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+			.pNext = nullptr,
+			.timelineSemaphore = VK_TRUE,
+		};
+
+		// fixed function state on the command buffer, so pipelines only differ in what really has to be compiled
+		VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamic_state_features = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
+		};
+		VkPhysicalDeviceExtendedDynamicState2FeaturesEXT dynamic_state2_features = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT,
+		};
+		VkPhysicalDeviceFeatures2 features2 = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+			.pNext = nullptr,
+		};
+		if (has_extension(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)) {
+			dynamic_state_features.pNext = features2.pNext;
+			features2.pNext = &dynamic_state_features;
+		}
+		if (has_extension(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME)) {
+			dynamic_state2_features.pNext = features2.pNext;
+			features2.pNext = &dynamic_state2_features;
+		}
+#ifdef VK_EXT_extended_dynamic_state3
+		VkPhysicalDeviceExtendedDynamicState3FeaturesEXT dynamic_state3_features = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT,
+		};
+		if (has_extension(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+			dynamic_state3_features.pNext = features2.pNext;
+			features2.pNext = &dynamic_state3_features;
+		}
+#endif
+		vkGetPhysicalDeviceFeatures2(physical_device.physical_device, &features2);
+
+		auto& dynamic_state = _vk.dynamic_state;
+		dynamic_state.extended = dynamic_state_features.extendedDynamicState;
+		dynamic_state.extended2 = dynamic_state2_features.extendedDynamicState2;
+		dynamic_state_features = { .sType = dynamic_state_features.sType, .pNext = nullptr, .extendedDynamicState = dynamic_state.extended };
+		dynamic_state2_features = { .sType = dynamic_state2_features.sType, .pNext = nullptr, .extendedDynamicState2 = dynamic_state.extended2 };
+#ifdef VK_EXT_extended_dynamic_state3
+		dynamic_state.extended3_polygon = dynamic_state3_features.extendedDynamicState3PolygonMode;
+		dynamic_state.extended3_blend = dynamic_state3_features.extendedDynamicState3ColorBlendEnable
+			&& dynamic_state3_features.extendedDynamicState3ColorBlendEquation
+			&& dynamic_state3_features.extendedDynamicState3ColorWriteMask;
+		dynamic_state3_features = {
+			.sType = dynamic_state3_features.sType,
+			.pNext = nullptr,
+			.extendedDynamicState3PolygonMode = dynamic_state.extended3_polygon,
+			.extendedDynamicState3ColorBlendEnable = dynamic_state.extended3_blend,
+			.extendedDynamicState3ColorBlendEquation = dynamic_state.extended3_blend,
+			.extendedDynamicState3ColorWriteMask = dynamic_state.extended3_blend,
+		};
+#endif
+
 		vkb::DeviceBuilder device_builder{ physical_device };
+		device_builder.add_pNext(&timeline_features);
+		if (dynamic_state.extended) {
+			device_builder.add_pNext(&dynamic_state_features);
+		}
+		if (dynamic_state.extended2) {
+			device_builder.add_pNext(&dynamic_state2_features);
+		}
+#ifdef VK_EXT_extended_dynamic_state3
+		if (dynamic_state.extended3_polygon || dynamic_state.extended3_blend) {
+			device_builder.add_pNext(&dynamic_state3_features);
+		}
+#endif
+		if (use_dynamic_rendering) {
+			device_builder.add_pNext(&dynamic_rendering_features);
+		}
 		auto dev_ret = device_builder
 			.build();
 		if (!dev_ret) {
@@ -537,6 +678,21 @@ namespace zebra {
 		_vk.vkb_device = dev_ret.value();
 		DBG("multidrawindirect: " << _vk.vkb_device.physical_device.features.multiDrawIndirect);
 
+		if (use_dynamic_rendering) {
+			_vk.graph.dynamic_rendering = true;
+			_vk.graph.begin_rendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(_vk.vkb_device.device, "vkCmdBeginRenderingKHR");
+			_vk.graph.end_rendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(_vk.vkb_device.device, "vkCmdEndRenderingKHR");
+			// input attachments need subpasses, so the composite samples scene_color instead
+			fused_composite = false;
+		}
+		// cluster draws stop at the count the cull shader wrote instead of running through empty ones
+		if (has_extension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+			_vk.draw_indexed_indirect_count = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(_vk.vkb_device.device, "vkCmdDrawIndexedIndirectCountKHR");
+		}
+		DBG("dynamic rendering: " << use_dynamic_rendering << (is_tiler ? " (tiler, keeping render passes)" : ""));
+		load_dynamic_state(dynamic_state, _vk.vkb_device.device);
+		DBG("extended dynamic state: " << dynamic_state.extended << dynamic_state.extended2 << dynamic_state.extended3_polygon << dynamic_state.extended3_blend);
+
 		auto graphics_queue_ret = _vk.vkb_device.get_queue(vkb::QueueType::graphics);
 		if (!graphics_queue_ret) {
 			DBG("no graphics queue: " << graphics_queue_ret.error().message());
@@ -550,6 +706,11 @@ namespace zebra {
 			.instance = _vk.vkb_instance.instance,
 		};
 		vmaCreateAllocator(&allocate_info, &_vk.allocator);
+		deferred.device = _vk.vkb_device.device;
+		deferred.allocator = _vk.allocator;
+		deferred.framebuffer_cache = &_vk.framebuffer_cache;
+		deferred.geometry_pool = &_vk.geometry;
+		init_pool(_vk.geometry, _vk.allocator, sizeof(P3N3C3U2));
 		main_delq.push_function([this]() {
 			vmaDestroyAllocator(_vk.allocator);
 			});
@@ -558,6 +719,10 @@ namespace zebra {
 		DBG("gpu minimum buffer alignment: " << _vk.gpu_properties.limits.minUniformBufferOffsetAlignment);
 		init_upload_context();
 		_vk.renderpass_cache.device = _vk.vkb_device.device;
+		_vk.framebuffer_cache.device = _vk.vkb_device.device;
+		_vk.pipeline_cache.init(_vk.vkb_device.device);
+		_vk.pipeline_layouts.device = _vk.vkb_device.device;
+		start_service(pipelines, _vk.vkb_device.device);
 
 		DBG("complete and ready to use.");
 		return true;
@@ -571,45 +736,32 @@ namespace zebra {
 		VkShaderModule mesh_triangle_vertex;
 		VkShaderModule blit_fragment;
 		VkShaderModule fullscreen_vertex;
-
-		load_shader_module("../shaders/default_lit.frag.spv", &default_lit_frag);
-		load_shader_module("../shaders/tri_mesh.vert.spv", &mesh_triangle_vertex);
-		load_shader_module("../shaders/textured_lit.frag.spv", &textured_mesh_shader);
-		load_shader_module("../shaders/blit.frag.spv", &blit_fragment);
-		load_shader_module("../shaders/fullscreen.vert.spv", &fullscreen_vertex);
-
+		VkShaderModule depth_only_vertex;
+		VkShaderModule depth_alpha_frag;
+
+		// layouts come from the shaders themselves. everything drawn in the forward pass shares one,
+		// so switching materials keeps the frame and batch sets bound
+		ReflectedLayout mesh_reflection;
+		ReflectedLayout blit_reflection;
+		bool loaded = true;
+		loaded &= load_shader_module("../shaders/default_lit.frag.spv", &default_lit_frag, &mesh_reflection);
+		loaded &= load_shader_module("../shaders/tri_mesh.vert.spv", &mesh_triangle_vertex, &mesh_reflection);
+		loaded &= load_shader_module("../shaders/textured_lit.frag.spv", &textured_mesh_shader, &mesh_reflection);
+		loaded &= load_shader_module(fused_composite ? "../shaders/composite.frag.spv" : "../shaders/blit.frag.spv", &blit_fragment, &blit_reflection);
+		loaded &= load_shader_module("../shaders/fullscreen.vert.spv", &fullscreen_vertex, &blit_reflection);
+		loaded &= load_shader_module("../shaders/depth_only.vert.spv", &depth_only_vertex, &mesh_reflection);
+		loaded &= load_shader_module("../shaders/depth_alpha.frag.spv", &depth_alpha_frag, &mesh_reflection);
+		if (!loaded) return false;
+
+		// variants that only differ in dynamic state come back as the same pipeline
 		PipelineBuilder pipeline_builder;
+		pipeline_builder
+			.use_cache(_vk.pipeline_cache)
+			.use_dynamic_state(_vk.dynamic_state);
 
+		auto mesh_layout = _vk.pipeline_layouts.create(_vk.layout_cache, mesh_reflection);
 
-		std::array push_constants = { 
-			VkPushConstantRange{ VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants)}
-		};
-
-		// these layouts could come from reflection
-		// GLOBAL
-		FatSetLayout scene_set;
-		scene_set
-			.add_binding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-
-		FatSetLayout object_set;
-		object_set
-			.add_binding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
-
-		// TEXTURE
-		FatSetLayout texture_set;
-		texture_set
-			.add_binding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT );
-		std::array mesh_fat_sets = {
-			scene_set,
-			object_set,
-			texture_set,
-		};
-
-		std::cout << mesh_fat_sets[1].bindings[0].descriptorType;
-		auto mesh_layout = create_pipeline_layout<DefaultFatSize>(_up.device, _vk.layout_cache, std::span(mesh_fat_sets), std::span(push_constants));
-
-		std::array<render::DependencyInfo, 2> deps_1 = { color_dependency(_vk), depth_dependency(_vk) };
-		auto forward_renderpass = _vk.renderpass_cache.get_or_create(deps_1);
+		auto forward_target = render::pipeline_target(_vk.graph, _vk.forward_pass);
 
 		// mesh color shader
 		auto vertex_description = P3N3C3U2::get_vertex_description();
@@ -621,42 +773,97 @@ namespace zebra {
 			.clear_shaders()
 			.add_shader(VK_SHADER_STAGE_VERTEX_BIT, mesh_triangle_vertex)
 			.add_shader(VK_SHADER_STAGE_FRAGMENT_BIT, default_lit_frag)
-			.build_pipeline(_up.device, forward_renderpass);
+			.build_pipeline(_up.device, forward_target);
+		auto mesh_state = pipeline_builder.raster_state();
+
+		// depth prepass variants. position only depth without color writes, then shading with EQUAL on top of it
+		auto position_description = P3N3C3U2::get_position_description();
+		pipeline_builder._color_blend_attachment.colorWriteMask = 0;
+		auto mesh_depth_pipeline = pipeline_builder
+			.set_vertex_format(position_description)
+			.clear_shaders()
+			.add_shader(VK_SHADER_STAGE_VERTEX_BIT, depth_only_vertex)
+			.build_pipeline(_up.device, forward_target);
+		auto depth_state = pipeline_builder.raster_state();
+		pipeline_builder._color_blend_attachment = vki::color_blend_attachment_state();
+
+		auto mesh_equal_pipeline = pipeline_builder
+			.set_vertex_format(vertex_description)
+			.depth(true, false, VK_COMPARE_OP_EQUAL)
+			.clear_shaders()
+			.add_shader(VK_SHADER_STAGE_VERTEX_BIT, mesh_triangle_vertex)
+			.add_shader(VK_SHADER_STAGE_FRAGMENT_BIT, default_lit_frag)
+			.build_pipeline(_up.device, forward_target);
+		auto equal_state = pipeline_builder.raster_state();
+		pipeline_builder.depth(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
 
 		auto defaultmesh_fk = render::insert_material(assets, {
 			.texture_set = VK_NULL_HANDLE,
 			.pipeline = mesh_pipeline,
 			.pipeline_layout = mesh_layout,
+			.depth_pipeline = mesh_depth_pipeline,
+			.equal_pipeline = mesh_equal_pipeline,
+			.state = mesh_state,
+			.depth_state = depth_state,
+			.equal_state = equal_state,
 			});
 
 		render::name_handle(assets, "defaultmesh", defaultmesh_fk);
+		assets.fallback_material = defaultmesh_fk;
 
-		// single texture mesh shader
-		std::array tex_fat_sets = {
-			scene_set,
-			object_set,
-			texture_set,
-		};
+		// the textured variants compile on the pipeline service thread, until they arrive it draws as defaultmesh.
+		// the modules they use go away with the last of them
+		auto async_modules = std::make_shared<ShaderModuleSet>(_up.device);
+		async_modules->modules = { mesh_triangle_vertex, textured_mesh_shader, depth_alpha_frag };
 
-		std::array<VkPushConstantRange, 0> empty_range = {};
-		auto stex_pipe_layout = create_pipeline_layout<DefaultFatSize>(_up.device, _vk.layout_cache, std::span(tex_fat_sets), std::span(empty_range));
+		// same fixed function state as the untextured variants
+		auto tmesh_fk = render::insert_material(assets, {
+			.texture_set = VK_NULL_HANDLE,
+			.pipeline = VK_NULL_HANDLE,
+			.pipeline_layout = mesh_layout,
+			.state = mesh_state,
+			.depth_state = depth_state,
+			.equal_state = equal_state,
+			.pending_pipelines = 3,
+			});
 
 		// mesh texture shader
-		auto tex_pipeline = pipeline_builder
-			.set_layout(stex_pipe_layout)
+		pipeline_builder
+			.set_layout(mesh_layout)
 			.clear_shaders()
 			.add_shader(VK_SHADER_STAGE_VERTEX_BIT, mesh_triangle_vertex)
-			.add_shader(VK_SHADER_STAGE_FRAGMENT_BIT, textured_mesh_shader)
-			.build_pipeline(_up.device, forward_renderpass);
-
-		auto tmesh_fk = render::insert_material(assets, { VK_NULL_HANDLE, tex_pipeline, stex_pipe_layout });
-		render::name_handle(assets, "texturedmesh", tmesh_fk);
+			.add_shader(VK_SHADER_STAGE_FRAGMENT_BIT, textured_mesh_shader);
+		compile_async(pipelines, pipeline_builder, forward_target, async_modules, tmesh_fk, MaterialVariant::Shade);
 
-		std::array blit_fat_sets = {
-			texture_set,
+		// the alpha test moves into the prepass, so the shading pass can turn it off and keep early-z
+		pipeline_builder._color_blend_attachment.colorWriteMask = 0;
+		pipeline_builder
+			.clear_shaders()
+			.add_shader(VK_SHADER_STAGE_VERTEX_BIT, mesh_triangle_vertex)
+			.add_shader(VK_SHADER_STAGE_FRAGMENT_BIT, depth_alpha_frag);
+		compile_async(pipelines, pipeline_builder, forward_target, async_modules, tmesh_fk, MaterialVariant::Depth);
+		pipeline_builder._color_blend_attachment = vki::color_blend_attachment_state();
+
+		const VkBool32 alpha_test = VK_FALSE;
+		VkSpecializationMapEntry alpha_test_entry = { .constantID = 0, .offset = 0, .size = sizeof(VkBool32) };
+		VkSpecializationInfo no_alpha_test = {
+			.mapEntryCount = 1,
+			.pMapEntries = &alpha_test_entry,
+			.dataSize = sizeof(VkBool32),
+			.pData = &alpha_test,
 		};
+		pipeline_builder
+			.depth(true, false, VK_COMPARE_OP_EQUAL)
+			.clear_shaders()
+			.add_shader(VK_SHADER_STAGE_VERTEX_BIT, mesh_triangle_vertex)
+			.add_shader(VK_SHADER_STAGE_FRAGMENT_BIT, textured_mesh_shader, &no_alpha_test);
+		compile_async(pipelines, pipeline_builder, forward_target, async_modules, tmesh_fk, MaterialVariant::Equal);
+		async_modules.reset();
 
-		VkPipelineLayout blit_pipe_layout = create_pipeline_layout<DefaultFatSize>(_up.device, _vk.layout_cache, std::span(blit_fat_sets), std::span(empty_range));
+		render::name_handle(assets, "texturedmesh", tmesh_fk);
+
+		// the input attachment or sampled scene color, with the upscale parameters in the sampled case
+		VkPipelineLayout blit_pipe_layout = _vk.pipeline_layouts.create(_vk.layout_cache, blit_reflection);
 		
 		// fullscreen blit
 		pipeline_builder
@@ -675,20 +882,60 @@ namespace zebra {
 		pipeline_builder._color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
 		pipeline_builder._color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
 		
-		std::array<render::DependencyInfo, 1> deps_3 = { blit_dependency(_window) };
-		auto blit_pass = _vk.renderpass_cache.get_or_create(deps_3);
-		
-		auto blit_pipeline = pipeline_builder.build_pipeline(_up.device, blit_pass);
+		auto blit_pipeline = pipeline_builder.build_pipeline(_up.device, render::pipeline_target(_vk.graph, _vk.blit_pass));
 
-		auto blit_fk = render::insert_material(assets, { VK_NULL_HANDLE, blit_pipeline, blit_pipe_layout });
+		auto blit_fk = render::insert_material(assets, {
+			.texture_set = VK_NULL_HANDLE,
+			.pipeline = blit_pipeline,
+			.pipeline_layout = blit_pipe_layout,
+			.state = pipeline_builder.raster_state(),
+			.push_stages = blit_reflection.push_constants.empty() ? 0 : blit_reflection.push_constants.front().stageFlags,
+			});
+		DBG(_vk.pipeline_cache.size() << " pipelines for " << _vk.pipeline_cache.requests << " requested, " << pipelines.in_flight.load() << " compiling");
 		render::name_handle(assets, "blit", blit_fk);
 
+		// occlusion culling, the graph passes skip it if these did not build
+		if (occlusion_culling) {
+			VkShaderModule reduce_shader;
+			VkShaderModule cull_shader;
+			ReflectedLayout reduce_reflection;
+			ReflectedLayout cull_reflection;
+			if (!load_shader_module("../shaders/hiz_reduce.comp.spv", &reduce_shader, &reduce_reflection)) return false;
+			if (!load_shader_module("../shaders/occlusion_cull.comp.spv", &cull_shader, &cull_reflection)) return false;
+
+			auto& occlusion = renderer.occlusion;
+			occlusion.reduce.layout = _vk.pipeline_layouts.create(_vk.layout_cache, reduce_reflection);
+			occlusion.reduce.pipeline = build_compute_pipeline(_up.device, _vk.pipeline_cache, occlusion.reduce.layout, reduce_shader);
+			occlusion.cull.layout = _vk.pipeline_layouts.create(_vk.layout_cache, cull_reflection);
+			occlusion.cull.pipeline = build_compute_pipeline(_up.device, _vk.pipeline_cache, occlusion.cull.layout, cull_shader);
+			vkDestroyShaderModule(_up.device, reduce_shader, nullptr);
+			vkDestroyShaderModule(_up.device, cull_shader, nullptr);
+
+			occlusion.counters = create_buffer(_vk.allocator, FRAME_OVERLAP * 2 * sizeof(u32), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			MappedBuffer<u32> counts{ _vk.allocator, occlusion.counters };
+			std::fill(counts.data, counts.data + FRAME_OVERLAP * 2, 0u);
+		}
+
+		// cluster culling, clustered meshes are drawn whole if it did not build
+		{
+			VkShaderModule cluster_shader;
+			ReflectedLayout cluster_reflection;
+			if (load_shader_module("../shaders/cluster_cull.comp.spv", &cluster_shader, &cluster_reflection)) {
+				auto& clusters = renderer.clusters;
+				clusters.cull.layout = _vk.pipeline_layouts.create(_vk.layout_cache, cluster_reflection);
+				clusters.cull.pipeline = build_compute_pipeline(_up.device, _vk.pipeline_cache, clusters.cull.layout, cluster_shader);
+				vkDestroyShaderModule(_up.device, cluster_shader, nullptr);
+			} else {
+				// the pipeline stays null, draw builds no cluster batch without it
+				DBG("no cluster culling, clustered meshes are drawn whole");
+			}
+		}
+
 		//cleanup
 		vkDestroyShaderModule(_up.device, default_lit_frag, nullptr);
-		vkDestroyShaderModule(_up.device, textured_mesh_shader, nullptr);
-		vkDestroyShaderModule(_up.device, mesh_triangle_vertex, nullptr);
 		vkDestroyShaderModule(_up.device, fullscreen_vertex, nullptr);
 		vkDestroyShaderModule(_up.device, blit_fragment, nullptr);
+		vkDestroyShaderModule(_up.device, depth_only_vertex, nullptr);
 
 
 		return true;
@@ -702,45 +949,81 @@ namespace zebra {
 		monkey.obj.model_matrix = glm::mat4{ 1.0f };
 		monkey.obj.color = glm::vec4(1.f);
 
+		// a spinning monkey with two smaller ones attached, they follow without ever being touched
+		spin_root = add_transform(sim_transforms, {});
+		add_sim_object(monkey, spin_root);
+		for (float side : { -3.f, 3.f }) {
+			auto moon = add_transform(sim_transforms, { .position = { side, 0.f, 0.f }, .scale = glm::vec3(0.35f) }, spin_root);
+			add_sim_object(monkey, moon);
+		}
+		update_transforms(sim_transforms, jobs);
+		apply_transforms();
+
 		std::random_device r;
-		std::default_random_engine e1(r());
-		std::uniform_real_distribution<float> frandom(0, 1);
-
-		add_renderable(renderer, monkey, true);
-		for (float x = -20; x <= 20; x+=1.00001f) {
-			for (float y = -12; y <= 12; y+=1.00001f) {
-				for (float z = -20; z <= 20; z+=1.00001f) {
-					render::RenderObject tri;
-					tri.mesh_fk = assets.t_names["triangle"];
-					tri.material_fk = assets.t_names["defaultmesh"];
-
-					float ox = frandom(e1) * 0.5f - 0.25f;
-					float oy = frandom(e1) * 0.5f - 0.25f;
-					float oz = frandom(e1) * 0.5f - 0.25f;
-					glm::mat4 translation = glm::translate(glm::mat4{ 1.0 }, glm::vec3(2.0f*x + ox, 2.0f*z + oz, 2.0f*y + oy));
-					glm::mat4 scale = glm::scale(glm::mat4{ 1.0 }, glm::vec3(0.5f, 0.5f, 0.5f));
-					tri.obj.model_matrix = translation * scale;
-					float hue = frandom(e1) * 6;
-					float x = (1.f - glm::abs(glm::mod(hue, 2.f)) - 1.f);
-					glm::vec3 color{};
-					if (hue > 5.f) {
-						color = glm::vec3(1, 0, x);
-					} else if (hue > 4.f) {
-						color = glm::vec3(x, 0, 1);
-					} else if (hue > 3.f) {
-						color = glm::vec3(0, x, 1);
-					} else if (hue > 2.f) {
-						color = glm::vec3(0, 1, x);
-					} else if (hue > 1.f) {
-						color = glm::vec3(x, 1, 0);
-					} else {
-						color = glm::vec3(1, x, 0);
-					}
-					tri.obj.color = glm::vec4(color, 1.f);
 
-					add_renderable(renderer, tri, true);
+		std::vector<float> xs, ys, zs;
+		for (float x = -20; x <= 20; x += 1.00001f) xs.push_back(x);
+		for (float y = -12; y <= 12; y += 1.00001f) ys.push_back(y);
+		for (float z = -20; z <= 20; z += 1.00001f) zs.push_back(z);
+
+		// one slice per x, each with its own engine so the jobs dont share state
+		std::vector<std::vector<render::RenderObject>> slices(xs.size());
+		std::vector<u32> seeds(xs.size());
+		for (auto& seed : seeds) {
+			seed = r();
+		}
+
+		const auto triangle_fk = assets.t_names["triangle"];
+		const auto defaultmesh_fk = assets.t_names["defaultmesh"];
+		jobs.parallel_for(0, xs.size(), 1, [&](u64 lo, u64 hi) {
+			for (auto xi = lo; xi < hi; xi++) {
+				std::default_random_engine e1(seeds[xi]);
+				std::uniform_real_distribution<float> frandom(0, 1);
+				float x = xs[xi];
+				auto& slice = slices[xi];
+				slice.reserve(ys.size() * zs.size());
+				for (float y : ys) {
+					for (float z : zs) {
+						render::RenderObject tri;
+						tri.mesh_fk = triangle_fk;
+						tri.material_fk = defaultmesh_fk;
+						tri.is_static = true;
+
+						float ox = frandom(e1) * 0.5f - 0.25f;
+						float oy = frandom(e1) * 0.5f - 0.25f;
+						float oz = frandom(e1) * 0.5f - 0.25f;
+						tri.obj.model_matrix = to_matrix({
+							.position = glm::vec3(2.0f * x + ox, 2.0f * z + oz, 2.0f * y + oy),
+							.scale = glm::vec3(0.5f),
+							});
+						float hue = frandom(e1) * 6;
+						float x = (1.f - glm::abs(glm::mod(hue, 2.f)) - 1.f);
+						glm::vec3 color{};
+						if (hue > 5.f) {
+							color = glm::vec3(1, 0, x);
+						} else if (hue > 4.f) {
+							color = glm::vec3(x, 0, 1);
+						} else if (hue > 3.f) {
+							color = glm::vec3(0, x, 1);
+						} else if (hue > 2.f) {
+							color = glm::vec3(0, 1, x);
+						} else if (hue > 1.f) {
+							color = glm::vec3(x, 1, 0);
+						} else {
+							color = glm::vec3(1, x, 0);
+						}
+						tri.obj.color = glm::vec4(color, 1.f);
+
+						slice.push_back(tri);
+					}
 				}
 			}
+			});
+
+		for (auto& slice : slices) {
+			for (auto& tri : slice) {
+				add_renderable(renderer, tri);
+			}
 		}
 
 
@@ -757,19 +1040,28 @@ namespace zebra {
 			.bind_image(0, image_buffer_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
 			.build(texture_set, texture_set_layout);
 		assets.t_materials[textured_mat].texture_set = texture_set;
+		assets.t_materials[textured_mat].texture_index = assets.t_textures[assets.t_names["empire_diffuse"]].table_index;
 
 		render::RenderObject map;
 		map.mesh_fk = assets.t_names["empire_mesh"];
 		map.material_fk = assets.t_names["texturedmesh"];
 		map.obj.color = glm::vec4(1.f);
-		map.obj.model_matrix = glm::translate(glm::mat4{ 1.0f }, glm::vec3{ 5, -10, 0 });
-		add_renderable(renderer, map, true);
+		map.obj.model_matrix = to_matrix({ .position = { 5, -10, 0 } });
+		map.is_static = true;
+		map.is_occluder = true;
+		add_renderable(renderer, map);
 	}
 
 	// ok 02.09.2021
 	bool zCore::cleanup() {
+		stop_simulation();
+		stop_render_thread();
+		// compiles still running use the pipeline cache and the shader modules
+		stop_service(pipelines);
+		jobs.shutdown();
 		vkQueueWaitIdle(_vk.graphics_queue);
-		swapchain_delq.flush();
+		retire_swapchain(_window.swapchain(), _vk.image_views);
+		collect_all(deferred);
 		main_delq.flush();
 		
 		vkb::destroy_surface(_vk.vkb_instance, _window.surface);
@@ -782,13 +1074,8 @@ namespace zebra {
 
 	// ok for now 02.09.2021, for multithread loading, one uploadcontext per thread
 	void zCore::init_upload_context() {
-		VkFenceCreateInfo fence_create_info = {
-			.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-			.pNext = nullptr,
-			.flags = 0,
-		};
 		_up.device = _vk.vkb_device.device;
-		vkCreateFence(_up.device, &fence_create_info, nullptr, &_up.uploadF);
+		init_timeline(_up.timeline, _up.device);
 		auto command_pool_info = vki::command_pool_create_info(
 			_vk.vkb_device.get_queue_index(vkb::QueueType::graphics).value());
 		vkCreateCommandPool(_up.device, &command_pool_info, nullptr, &_up.pool);
@@ -797,7 +1084,7 @@ namespace zebra {
 		_up.graphics_queue = _vk.graphics_queue;
 
 		main_delq.push_function([this]() {
-			vkDestroyFence(_up.device, _up.uploadF, nullptr);
+			destroy_timeline(_up.timeline);
 			vkDestroyCommandPool(_up.device, _up.pool, nullptr);
 			});
 
@@ -840,6 +1127,8 @@ namespace zebra {
 				{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2500},
 				{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2500},
 				{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000},
+				{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 16},
+				{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 64},
 			};
 			VkDescriptorPoolCreateInfo pool_info = {
 				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
@@ -900,10 +1189,8 @@ namespace zebra {
 				},
 		};
 
-		std::array<render::DependencyInfo, 2> deps_1 = { color_dependency(_vk), depth_dependency(_vk) };
-		auto forward_renderpass = _vk.renderpass_cache.get_or_create(deps_1);
-
-		ImGui_ImplVulkan_Init(&init_info, forward_renderpass);
+		init_info.Subpass = render::render_subpass(_vk.graph, _vk.ui_pass);
+		ImGui_ImplVulkan_Init(&init_info, render::render_pass(_vk.graph, _vk.ui_pass));
 		vku::vk_immediate(_up, [this](VkCommandBuffer cmd) {
 			ImGui_ImplVulkan_CreateFontsTexture(cmd);
 			});
@@ -987,31 +1274,47 @@ namespace zebra {
 			// schedule UI to update, but I dont have UI yet..
 		} else {
 			glm::vec2 mouse_nowpos = { x, y };
-			mouse_delta += mouse_nowpos - _mouse_old_pos;
+			sim_input.add_mouse_delta(mouse_nowpos - _mouse_old_pos);
 		}
 
 		_mouse_old_pos = { x, y };
 	}
 
-	void zCore::process_key_inputs() {
-		std::set<InputAction> held_actions;
+	// main thread, glfw may only be asked from here
+	void zCore::sample_key_inputs() {
+		u32 held_actions = 0;
 		for (auto keyi : key_inputs) {
 			if (keyi.condition == HOLD && is_key_held(keyi.key)) {
-				held_actions.insert(keyi.action);
+				held_actions |= 1u << keyi.action;
 			}
 		}
+		sim_input.held_actions.store(held_actions, std::memory_order_release);
+		sim_input.speed.store(speed, std::memory_order_relaxed);
+		sim_input.fly_speed.store(fly_speed, std::memory_order_relaxed);
+		sim_input.invert_camera.store(invert_camera, std::memory_order_relaxed);
+		sim_input.mouse_sensitivity.store(mouse_delta_sens, std::memory_order_relaxed);
+	}
+
+	// sim thread
+	void zCore::process_key_inputs() {
+		const u32 held_mask = sim_input.held_actions.load(std::memory_order_acquire);
+		auto held = [held_mask](InputAction action) {
+			return (held_mask & (1u << action)) != 0;
+		};
+		const float speed = sim_input.speed.load(std::memory_order_relaxed);
+		const float fly_speed = sim_input.fly_speed.load(std::memory_order_relaxed);
 
 		glm::vec2 movement_dir{ 0.f,0.f };
-		if (held_actions.contains(InputAction::MOVE_FORWARD)) {
+		if (held(InputAction::MOVE_FORWARD)) {
 			movement_dir += glm::vec2{ 0.f, 1.f };
 		}
-		if (held_actions.contains(InputAction::MOVE_BACK)) {
+		if (held(InputAction::MOVE_BACK)) {
 			movement_dir += glm::vec2{ 0.f, -1.f };
 		}
-		if (held_actions.contains(InputAction::MOVE_STRAFE_LEFT)) {
+		if (held(InputAction::MOVE_STRAFE_LEFT)) {
 			movement_dir += glm::vec2{ -1.f, 0.f };
 		}
-		if (held_actions.contains(InputAction::MOVE_STRAFE_RIGHT)) {
+		if (held(InputAction::MOVE_STRAFE_RIGHT)) {
 			movement_dir += glm::vec2{ 1.f, 0.f };
 		}
 
@@ -1024,10 +1327,10 @@ namespace zebra {
 		}
 
 		float fly_dir = 0.f;
-		if (held_actions.contains(InputAction::MOVE_FLY_UP)) {
+		if (held(InputAction::MOVE_FLY_UP)) {
 			fly_dir -= 1.f;
 		} 
-		if (held_actions.contains(InputAction::MOVE_FLY_DOWN)) {
+		if (held(InputAction::MOVE_FLY_DOWN)) {
 			fly_dir += 1.f;
 		}
 		if (fly_dir != 0.f) {
@@ -1042,14 +1345,14 @@ namespace zebra {
 		//DBG(" x " << _camera._pos.x << "  y " << _camera._pos.y << "  z " << _camera._pos.z);
 		//DBG("phi " << _camera.phi << " theta " << _camera.theta);
 
-		auto invert_cam_factor = invert_camera ? -1.f : 1.f;
-		auto sensitivity_delta = mouse_delta_sens * mouse_delta;
+		// main thread settings, they come over with the rest of the input
+		auto invert_cam_factor = sim_input.invert_camera.load(std::memory_order_relaxed) ? -1.f : 1.f;
+		auto sensitivity_delta = sim_input.mouse_sensitivity.load(std::memory_order_relaxed) * sim_input.take_mouse_delta();
 		_camera.apply_rotation(sensitivity_delta.y * invert_cam_factor, sensitivity_delta.x);
-		mouse_delta = glm::vec2(0.f);
 	}
 
 	// move outside
-	bool zCore::load_shader_module(const char* file_path, VkShaderModule* out_shader) {
+	bool zCore::load_shader_module(const char* file_path, VkShaderModule* out_shader, ReflectedLayout* layout) {
 		std::filesystem::path file_path_std{ file_path };
 
 		std::ifstream file(file_path, std::ios::ate | std::ios::binary);
@@ -1067,6 +1370,14 @@ namespace zebra {
 		file.read((char*)buffer.data(), filesize);
 		file.close();
 
+		if (layout) {
+			ShaderReflection reflection;
+			if (!reflect_spirv(buffer, reflection) || !merge_reflection(*layout, reflection)) {
+				DBG("layout of " << file_path << " does not fit the other stages");
+				return false;
+			}
+		}
+
 		VkShaderModuleCreateInfo create_info{
 			.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
 			.pNext = nullptr,
@@ -1079,6 +1390,8 @@ namespace zebra {
 			DBG("Error loading shader: " << file_path);
 			return false;
 		}
+		// the handle may be one a destroyed module had, pipelines are cached by the code
+		_vk.pipeline_cache.add_module(shader_module, buffer);
 
 		*out_shader = shader_module;
 		return true;
@@ -1111,63 +1424,87 @@ namespace zebra {
 		triangle._vertices[1].color = { 0.f, 1.f, 0.0f }; //pure green
 		triangle._vertices[2].color = { 0.f, 1.f, 0.0f }; //pure green
 
-		auto gpu_triangle = upload_mesh(triangle);
-
+		// parsing is the slow part, uploads share one upload context and stay on this thread
 		LocalMesh monkey_mesh;
-		monkey_mesh.load_from_obj("../assets/monkey_smooth.obj");
-		auto gpu_monkey = upload_mesh(monkey_mesh);
-
-
-
 		LocalMesh lost_empire;
-		lost_empire.load_from_obj("../assets/lost_empire.obj");
+		JobCounter parsing;
+		jobs.run([&monkey_mesh]() {
+			monkey_mesh.load_from_obj("../assets/monkey_smooth.obj");
+			monkey_mesh.generate_lods();
+			}, &parsing);
+		jobs.run([&lost_empire]() {
+			lost_empire.load_from_obj("../assets/lost_empire.obj");
+			lost_empire.generate_lods();
+			// one mesh for the whole level, mostly off screen or behind itself
+			lost_empire.generate_meshlets();
+			}, &parsing);
+		jobs.wait(parsing);
+
+		auto gpu_triangle = upload_mesh(triangle);
+		auto gpu_monkey = upload_mesh(monkey_mesh);
 		auto gpu_empire = upload_mesh(lost_empire);
 
 		auto monkey_fkey = render::insert_mesh(assets, gpu_monkey);
 		auto triangle_fkey = render::insert_mesh(assets, gpu_triangle);
 		auto empire_fkey = render::insert_mesh(assets, gpu_empire);
 		render::name_handle(assets, "empire_mesh", empire_fkey);
+		// the level hides most of itself, a coarse copy of it is enough to find what
+		render::insert_occluder(assets, empire_fkey, make_occluder(lost_empire, 1 << 15));
 		render::name_handle(assets, "triangle", triangle_fkey);
 		render::name_handle(assets, "monkey", monkey_fkey);
 	}
 
-	// NOT OK
 	Mesh zCore::upload_mesh(LocalMesh& lmesh) {
-		Mesh mesh;
-		const size_t buffer_size = lmesh._vertices.size() * sizeof(lmesh._vertices[0]);
-		mesh.size = lmesh._vertices.size();
+		assert(!lmesh._vertices.empty()); // you are trying to upload an empty mesh.
 
-		assert(buffer_size != 0); // you are trying to upload an empty mesh.
+		// everything draws indexed, plain triangle lists get the trivial index buffer
+		if (lmesh._indices.empty()) {
+			lmesh._indices.resize(lmesh._vertices.size());
+			std::iota(lmesh._indices.begin(), lmesh._indices.end(), 0u);
+		}
 
-		auto staging_buffer = create_buffer(_vk.allocator, buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+		Mesh mesh;
+		mesh.bounds = lmesh.bounding_sphere();
+		// without generated lods the full mesh is drawn at every distance
+		mesh.lods[0] = { 0, (u32)lmesh._indices.size(), 0.f };
+		if (!lmesh._lods.empty()) {
+			mesh.lod_count = (u32)lmesh._lods.size();
+			std::copy(lmesh._lods.begin(), lmesh._lods.end(), mesh.lods.begin());
+		}
+		mesh.geometry = allocate_geometry(_vk.geometry, (u32)lmesh._vertices.size(), (u32)lmesh._indices.size());
 
+		const size_t vertex_size = lmesh._vertices.size() * sizeof(lmesh._vertices[0]);
+		const size_t index_size = lmesh._indices.size() * sizeof(u32);
+		const size_t cluster_size = lmesh._meshlets.size() * sizeof(Meshlet);
+		auto staging_buffer = create_buffer(_vk.allocator, vertex_size + index_size + cluster_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
 		{
 			MappedBuffer<char> staging_map{ _vk.allocator, staging_buffer };
-			memcpy(staging_map.data, lmesh._vertices.data(), buffer_size);
+			memcpy(staging_map.data, lmesh._vertices.data(), vertex_size);
+			memcpy(staging_map.data + vertex_size, lmesh._indices.data(), index_size);
+			memcpy(staging_map.data + vertex_size + index_size, lmesh._meshlets.data(), cluster_size);
+		}
+		// only the cluster cull shader reads these
+		if (cluster_size > 0) {
+			mesh.clusters = create_buffer(_vk.allocator, cluster_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			mesh.cluster_count = (u32)lmesh._meshlets.size();
 		}
 
-		if (_vk.allocator->IsIntegratedGpu()) {
-			// we dont need to copy, as cpu and gpu visible memory are usually the same
-			mesh.vertices = staging_buffer;
-		} else {
-			// need to copy from cpu to gpu
-			mesh.vertices = create_buffer(_vk.allocator, 
-				buffer_size, 
-				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-				VMA_MEMORY_USAGE_GPU_ONLY);
-
-
-			// copy from staging to vertex
-			vku::vk_immediate(_up, [=](VkCommandBuffer cmd) {
-				VkBufferCopy copy;
-				copy.dstOffset = 0;
-				copy.srcOffset = 0;
-				copy.size = buffer_size;
-				vkCmdCopyBuffer(cmd, staging_buffer.buffer, mesh.vertices.buffer, 1, &copy);
-				});
+		// the pool is device local on every gpu, integrated ones included
+		auto target = geometry_binding(_vk.geometry, mesh.geometry.block);
+		std::array copies = {
+			VkBufferCopy{ .srcOffset = 0, .dstOffset = vertex_offset(_vk.geometry, mesh.geometry), .size = vertex_size },
+			VkBufferCopy{ .srcOffset = vertex_size, .dstOffset = index_offset(mesh.geometry), .size = index_size },
+		};
+		vku::vk_immediate(_up, [&](VkCommandBuffer cmd) {
+			vkCmdCopyBuffer(cmd, staging_buffer.buffer, target.vertices, 1, &copies[0]);
+			vkCmdCopyBuffer(cmd, staging_buffer.buffer, target.indices, 1, &copies[1]);
+			if (cluster_size > 0) {
+				VkBufferCopy cluster_copy = { .srcOffset = vertex_size + index_size, .dstOffset = 0, .size = cluster_size };
+				vkCmdCopyBuffer(cmd, staging_buffer.buffer, mesh.clusters.buffer, 1, &cluster_copy);
+			}
+			});
 
-			vmaDestroyBuffer(_vk.allocator, staging_buffer.buffer, staging_buffer.allocation);
-		}
+		vmaDestroyBuffer(_vk.allocator, staging_buffer.buffer, staging_buffer.allocation);
 		return mesh;
 	}
 
@@ -1176,10 +1513,45 @@ namespace zebra {
 		_df.global_current_time = 0.0;
 	}
 
-	void zCore::draw() {
+	// main thread side of a frame, everything draw needs that is not owned by the recording thread
+	void zCore::build_frame_packet(FramePacket& packet) {
+		int w, h;
+		glfwGetFramebufferSize(_window.handle, &w, &h);
+		render_camera.aspect = (float)w / (float)h;
+
+		glm::mat4 view = render_camera.view();
+		glm::mat4 projection = render_camera.projection();
+		GPUCameraData camera_data = {
+			.view = view,
+			.proj = projection,
+			.viewproj = projection * view,
+		};
+
+		packet.stop = false;
+		packet.scene_data = {
+			.camera = camera_data,
+		};
+		packet.viewproj = camera_data.viewproj;
+		// pixels a unit covers at distance 1, the same angle the projection uses
+		packet.lod = {
+			.eye = render_camera._pos,
+			.pixel_scale = (float)h / (2.f * std::abs(std::tan(render_camera.povy * 0.5f))),
+			.error_pixels = settings.lod_error_pixels,
+		};
+		packet.updates.assign(render_updates.begin(), render_updates.end());
+		packet.settings = settings;
+		capture_ui(packet.ui, ImGui::GetDrawData());
+	}
+
+	void zCore::draw(const FramePacket& packet) {
+		drawing = &packet;
+		resolution.enabled = packet.settings.dynamic_resolution;
+		resolution.target_ms = packet.settings.target_ms;
 
 		uint32_t swapchain_image_idx;
-		auto acquire_result = vkAcquireNextImageKHR(_up.device, _window.swapchain(), 0, current_frame().presentS, nullptr, &swapchain_image_idx);
+		// the render thread has nothing better to do than wait for an image
+		u64 acquire_timeout = pipelined_rendering ? UINT64_MAX : 0;
+		auto acquire_result = vkAcquireNextImageKHR(_up.device, _window.swapchain(), acquire_timeout, current_frame().presentS, nullptr, &swapchain_image_idx);
 
 
 		//for (auto& static_obj : static_renderables) {
@@ -1187,7 +1559,14 @@ namespace zebra {
 		//}
 
 
-		if (acquire_result == VK_SUCCESS) {
+		collect(deferred, completed_value(_up.timeline));
+		// pipelines that finished compiling take over from the fallback starting with this frame
+		apply_compiled(pipelines, assets);
+		// the sim moved on whether or not there is an image, a dropped frame's updates go up with the next one
+		render::apply_updates(renderer, packet.updates);
+
+		// suboptimal still signals the semaphore, so that frame is rendered and presented before recreating
+		if (acquire_result == VK_SUCCESS || acquire_result == VK_SUBOPTIMAL_KHR) {
 			// we have an image to render to
 
 			// ------ acquire frame
@@ -1196,149 +1575,100 @@ namespace zebra {
 			VkCommandBufferBeginInfo cmd_begin_info = vki::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 			VK_CHECK(vkResetDescriptorPool(_up.device, frame.descriptor_pool, 0));
 			VK_CHECK(vkBeginCommandBuffer(frame.buf, &cmd_begin_info));
-			// ------ acquire frame end
-
-
-			// forward pass
-			{
-				// -- pushing around data into buffers
-
-				glm::mat4 view = _camera.view();
-				glm::mat4 projection = _camera.projection();
-				GPUCameraData camera_data = {
-					.view = view,
-					.proj = projection,
-					.viewproj = projection * view,
-				};
-
-				GPUSceneData scene_data = {
-					.camera = camera_data,
-				};
-
-				
-				std::array<render::DependencyInfo, 2> deps_1 = { color_dependency(_vk), depth_dependency(_vk) };
-				auto forward_renderpass = _vk.renderpass_cache.get_or_create(deps_1);
-				
-				std::array<render::DependencyInfo, 2> deps_2 = { color_dependency(_vk), depth_dependency(_vk) };
-				auto overlay_renderpass = _vk.renderpass_cache.get_or_create(deps_2);
-				
-				
-				render::RenderData rdata = {
-					.forward_pass = forward_renderpass,
-					.forward_framebuffer = _vk.forward_framebuffer,
-					.forward_extent = _window.extent(),
-					.dcache = &_vk.layout_cache,
-				};
-				VkViewport viewport = vki::viewport_info(_window.extent());
-				_camera.aspect = viewport.width / viewport.height;
-
-				render::begin_collect(renderer, _up);
-				render::finish_collect(this->renderer);
 
-				// This doesnt look pretty at all
-				const VkClearValue clear_color = { .color = {0.6f, 0.4f, 0.4f, 1.f} };
-				const VkClearValue clear_depth = { .depthStencil = {1.f, 0 }};
-				auto clear_values = { clear_color, clear_depth };
-				
-				// TODO: Get the framebuffer dynamically from a cache as well!
-				// It is possible to create the textures backing the framebuffers dynamically too
-				// That way, we can build complex rendering pipelines with multiple passes without
-				// bloating the _vk struct.
-				// Swapchain images still have to be a special case I think.
-				auto overlay_pass_info = vki::renderpass_begin_info(overlay_renderpass, _vk.overlay_framebuffer, _window.extent());
-				overlay_pass_info.clearValueCount = 2;
-				overlay_pass_info.pClearValues = clear_values.begin();
-
-				vkCmdBeginRenderPass(frame.buf, &overlay_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-
-				//auto proper_pass_info = vki::renderpass_begin_info(forward_renderpass, _vk.forward_framebuffer, _window.extent());
-				//proper_pass_info.clearValueCount = 2;
-				//proper_pass_info.pClearValues = clear_values.begin();
-				//vkCmdBeginRenderPass(frame.buf, &proper_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-				render::render(this->renderer, this->assets, frame, this->_up, scene_data, rdata);
-				
-				auto imgui_draw_data = ImGui::GetDrawData();
-				if (imgui_draw_data != nullptr) {
-					ImGui_ImplVulkan_RenderDrawData(imgui_draw_data, current_frame().buf);
+			// the timeline passed this slot's last value, so its timestamps are in
+			if (frame.timestamps_written) {
+				u64 stamps[2];
+				if (vkGetQueryPoolResults(_up.device, frame.timestamps, 0, 2, sizeof(stamps), stamps, sizeof(u64), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+					// masked again after subtracting, a counter narrower than 64 bits may have wrapped in between
+					u64 mask = _vk.timestamp_mask;
+					u64 ticks = ((stamps[1] & mask) - (stamps[0] & mask)) & mask;
+					float gpu_ms = (float)ticks * _vk.gpu_properties.limits.timestampPeriod / 1e6f;
+					render::update_resolution(resolution, gpu_ms);
 				}
-				//vkCmdEndRenderPass(frame.buf);
-				
-				vkCmdEndRenderPass(frame.buf);
-				
-				
-
-				// --
-
 			}
+			render::read_occlusion_counters(renderer, _up, current_frame_idx());
+			if (frame.timestamps != VK_NULL_HANDLE) {
+				vkCmdResetQueryPool(frame.buf, frame.timestamps, 0, 2);
+				vkCmdWriteTimestamp(frame.buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestamps, 0);
+			}
+			// ------ acquire frame end
 
-			// copy pass here
-			{
-
-				// -- immediate
-				VkDescriptorImageInfo image_buffer_info;
-				image_buffer_info.sampler = _vk.default_sampler;
-				image_buffer_info.imageView = _vk.screen_texture.view;
-				image_buffer_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-				VkDescriptorSet copy_set;
-				DescriptorBuilder::begin(_up.device, frame.descriptor_pool, _vk.layout_cache)
-					.bind_image(0, image_buffer_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-					.build(copy_set);
-					
-				VkDescriptorSet overlay_set;
-				
-				image_buffer_info.imageView = _vk.overlay_texture.view;
-				DescriptorBuilder::begin(_up.device, frame.descriptor_pool, _vk.layout_cache)
-					.bind_image(0, image_buffer_info, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-					.build(overlay_set);
-
-				// -- immediate
-
-				std::array<render::DependencyInfo, 1> deps_3 = { blit_dependency(_window) };
-				auto blit_pass = _vk.renderpass_cache.get_or_create(deps_3);
-
-				VkExtent2D copy_pass_extent = _window.vkb_swapchain.extent;
-				VkRenderPassBeginInfo copy_rp_info = vki::renderpass_begin_info(blit_pass, _vk.framebuffers[swapchain_image_idx], copy_pass_extent);
-
-				VkViewport viewport = vki::viewport_info(_window.extent());
-
-				VkRect2D scissor = {
-					.offset = { 0, 0 },
-					.extent = _window.extent(),
-				};
-
-				vkCmdSetViewport(frame.buf, 0, 1, &viewport);
-				vkCmdSetScissor(frame.buf, 0, 1, &scissor);
 
-				vkCmdBeginRenderPass(frame.buf, &copy_rp_info, VK_SUBPASS_CONTENTS_INLINE);
-				auto blit_material = assets.t_materials[assets.t_names["blit"]];
+			// -- pushing around data into buffers
+			_df.scene_data = packet.scene_data;
+			_df.viewproj = packet.viewproj;
+			_df.eye = packet.lod.eye;
+			auto& occlusion = renderer.occlusion;
+			_df.occlusion = _vk.late_pass != render::RG_NONE && packet.settings.occlusion_culling
+				&& occlusion.cull.pipeline != VK_NULL_HANDLE && occlusion.reduce.pipeline != VK_NULL_HANDLE;
 
-				vkCmdBindPipeline(frame.buf, VK_PIPELINE_BIND_POINT_GRAPHICS, blit_material.pipeline);
-				
-				vkCmdBindDescriptorSets(frame.buf, VK_PIPELINE_BIND_POINT_GRAPHICS, blit_material.pipeline_layout, 0, 1, &overlay_set, 0, nullptr);
-				vkCmdDraw(frame.buf, 3, 1, 0, 0);
-				vkCmdEndRenderPass(frame.buf);
+			render::begin_collect(renderer, _up);
+			render::finish_collect(this->renderer, this->assets, this->jobs, packet.viewproj, packet.lod, packet.settings.software_occlusion);
+			render::sync_renderables(renderer, assets, _up, frame.buf, deferred);
+			{
+				// what the middle of the screen looks at
+				auto inverse = glm::inverse(packet.viewproj);
+				glm::vec4 near = inverse * glm::vec4(0.f, 0.f, 0.f, 1.f);
+				glm::vec4 far = inverse * glm::vec4(0.f, 0.f, 1.f, 1.f);
+				float reach = std::numeric_limits<float>::infinity();
+				picked = render::pick_renderable(renderer, packet.lod.eye, glm::vec3(far) / far.w - glm::vec3(near) / near.w, reach);
 			}
+			// clusters are drawn with indirect counts or runs of mostly empty draws, one at a time would be worse than the whole mesh
+			bool clusters = packet.settings.cluster_culling && renderer.clusters.cull.pipeline != VK_NULL_HANDLE
+				&& occlusion.pyramid.view != VK_NULL_HANDLE && _vk.vkb_device.physical_device.features.multiDrawIndirect == VK_TRUE;
+			render::build_clusters(renderer, assets, _up, frame.buf, current_frame_idx(), frame, _vk.layout_cache, deferred, clusters);
+			// instance handles go up once for every pass. with occlusion culling the early draws are filled in
+			// now, the late ones between the two forward passes
+			renderer.batches = render::build_batches(renderer, _up, frame, _vk.layout_cache, renderer.visible_objects, assets, jobs, _df.occlusion);
+			if (_df.occlusion) {
+				render::cull_occlusion(renderer, frame.buf, render::DrawPhase::Early, packet.viewproj, current_frame_idx(), _up, frame, _vk.layout_cache, _vk.default_sampler);
+			}
+			render::cull_clusters(renderer, frame.buf, _df.occlusion ? render::DrawPhase::Early : render::DrawPhase::All, packet.viewproj, _df.eye, assets, _up, frame, _vk.layout_cache, _vk.default_sampler);
+
+			render::bind_imported(_vk.graph, _vk.backbuffer, _vk.images[swapchain_image_idx], _vk.image_views[swapchain_image_idx]);
+			// the targets stay at full size, only the rendered part of them shrinks
+			auto scene_area = render::scaled_extent(resolution, _window.extent());
+			render::set_render_area(_vk.graph, _vk.forward_pass, scene_area);
+			if (_vk.late_pass != render::RG_NONE) {
+				render::set_render_area(_vk.graph, _vk.late_pass, scene_area);
+			}
+			render::execute(_vk.graph, frame.buf);
 
-
+			if (frame.timestamps != VK_NULL_HANDLE) {
+				vkCmdWriteTimestamp(frame.buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestamps, 1);
+				frame.timestamps_written = true;
+			}
 
 			VK_CHECK(vkEndCommandBuffer(current_frame().buf));
 
 			VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			// binary semaphores for the swapchain, their values are ignored
+			frame.timeline_value = next_value(_up.timeline);
+			VkSemaphore signal_semaphores[2] = { frame.renderS, _up.timeline.semaphore };
+			uint64_t wait_values[1] = { 0 };
+			uint64_t signal_values[2] = { 0, frame.timeline_value };
+			VkTimelineSemaphoreSubmitInfo timeline_info = {
+				.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+				.pNext = nullptr,
+				.waitSemaphoreValueCount = 1,
+				.pWaitSemaphoreValues = wait_values,
+				.signalSemaphoreValueCount = 2,
+				.pSignalSemaphoreValues = signal_values,
+			};
 			VkSubmitInfo submit_info = {
 				.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-				.pNext = nullptr,
+				.pNext = &timeline_info,
 				.waitSemaphoreCount = 1,
 				.pWaitSemaphores = &frame.presentS,
 				.pWaitDstStageMask = &wait_stage,
 				.commandBufferCount = 1,
 				.pCommandBuffers = &frame.buf,
-				.signalSemaphoreCount = 1,
-				.pSignalSemaphores = &frame.renderS,
+				.signalSemaphoreCount = 2,
+				.pSignalSemaphores = signal_semaphores,
 			};
 
-			vkResetFences(_up.device, 1, &current_frame().renderF);
-			VK_CHECK(vkQueueSubmit(_vk.graphics_queue, 1, &submit_info, frame.renderF));
+			VK_CHECK(vkQueueSubmit(_vk.graphics_queue, 1, &submit_info, VK_NULL_HANDLE));
 			VkPresentInfoKHR present_info = {
 				.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
 				.pNext = nullptr,
@@ -1349,44 +1679,214 @@ namespace zebra {
 				.pImageIndices = &swapchain_image_idx,
 			};
 
-			vkQueuePresentKHR(_vk.graphics_queue, &present_info);
+			auto present_result = vkQueuePresentKHR(_vk.graphics_queue, &present_info);
+			publish_render_stats();
 			advance_frame();
-		} else if (acquire_result == VK_ERROR_OUT_OF_DATE_KHR || acquire_result == VK_SUBOPTIMAL_KHR) {
+			if (acquire_result == VK_SUBOPTIMAL_KHR || present_result == VK_SUBOPTIMAL_KHR || present_result == VK_ERROR_OUT_OF_DATE_KHR) {
+				this->recreate_swapchain();
+			}
+		} else if (acquire_result == VK_ERROR_OUT_OF_DATE_KHR) {
 			this->recreate_swapchain();
 		}
+		drawing = nullptr;
+	}
+
+	void zCore::publish_render_stats() {
+		auto& stats = render_stats.write_slot();
+		stats = {
+			.frame = frame_counter,
+			.objects = renderer.registry.world.alive,
+			.visible = renderer.visible_objects.size(),
+			.drawn_early = renderer.occlusion.drawn_early,
+			.drawn_late = renderer.occlusion.drawn_late,
+			.clusters = renderer.clusters.total,
+			.clusters_drawn = renderer.clusters.drawn,
+			.picked = picked,
+			.statics_refit = renderer.registry.statics_refit,
+			.statics_rebuilt = renderer.registry.statics_rebuilt,
+			.software_occluded = renderer.software.occluded,
+			.occluder_triangles = renderer.software.depth.triangles,
+			.uploaded = renderer.registry.uploaded,
+			.upload_ranges = renderer.registry.upload_ranges,
+			.renderpasses = _vk.renderpass_cache.cache.size(),
+			.framebuffers = _vk.framebuffer_cache.cache.size(),
+			.pipelines = _vk.pipeline_cache.size(),
+			.pipeline_requests = _vk.pipeline_cache.requests.load(std::memory_order_relaxed),
+			.pipelines_compiling = pipelines.in_flight.load(std::memory_order_relaxed),
+			.deferred = pending(deferred),
+			.timeline_completed = completed_value(_up.timeline),
+			.timeline_submitted = _up.timeline.submitted,
+			.buffers_in_use = renderer.danger_buffers.size(),
+			.available_buffers = renderer.available_buffers.size(),
+			.graph = _vk.graph.stats,
+			.gpu_ms = resolution.gpu_ms,
+			.resolution_scale = resolution.scale,
+			.scene_extent = render::render_area(_vk.graph, _vk.forward_pass),
+		};
+		render_stats.publish();
+	}
+
+	// RENDER THREAD
+	void zCore::start_render_thread() {
+		if (!pipelined_rendering) return;
+		render_thread = std::thread(&zCore::render_loop, this);
+	}
+
+	void zCore::stop_render_thread() {
+		if (!render_thread.joinable()) return;
+		FramePacket* packet;
+		while ((packet = frame_queue.write_slot()) == nullptr) {
+			std::this_thread::yield();
+		}
+		packet->stop = true;
+		frame_queue.publish();
+		render_thread.join();
+	}
+
+	/* records, submits and presents the packets the main thread publishes, in order.
+	* jobs it waits on (culling, batching) go through queue 0 like the main thread's */
+	void zCore::render_loop() {
+		while (true) {
+			auto& packet = frame_queue.wait_read_slot();
+			if (packet.stop) {
+				frame_queue.release();
+				return;
+			}
+			// the slot about to be recorded has to be off the gpu
+			wait(_up.timeline, current_frame().timeline_value);
+			draw(packet);
+			frame_queue.release();
+		}
+	}
+
+	// SIMULATION
+	void zCore::start_simulation() {
+		// seed every slot, so the first frames interpolate between valid cameras
+		auto now = std::chrono::steady_clock::now();
+		for (auto& slot : sim_exchange.slots) {
+			slot.camera = _camera;
+			slot.published = now;
+		}
+		render_camera = _camera;
+
+		sim_running.store(true, std::memory_order_release);
+		sim_thread = std::thread(&zCore::sim_loop, this);
+	}
+
+	void zCore::stop_simulation() {
+		sim_running.store(false, std::memory_order_release);
+		if (sim_thread.joinable()) {
+			sim_thread.join();
+		}
+	}
+
+	void zCore::sim_loop() {
+		using clock = std::chrono::steady_clock;
+		const auto tick_duration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(TICK_DT));
+		// a hitch on this thread should not turn into a burst of catch-up ticks
+		const auto max_behind = 4 * tick_duration;
+
+		auto next_tick = clock::now();
+		while (sim_running.load(std::memory_order_acquire)) {
+			process_key_inputs();
+			process_mouse_inputs();
+			_camera.tick();
+			animate_scene(TICK_DT);
+			update_transforms(sim_transforms, jobs);
+			apply_transforms();
+
+			auto& snapshot = sim_exchange.write_slot();
+			snapshot.tick = ++sim_tick;
+			snapshot.camera = _camera;
+			// chunk order, which only changes when entities come or go
+			snapshot.objects.clear();
+			for_each<const SimRenderable, const ObjectData>(sim_world, [&](Entity, const SimRenderable& renderable, const ObjectData& obj) {
+				snapshot.objects.push_back({ renderable.handle, obj });
+				});
+			snapshot.published = clock::now();
+			sim_exchange.publish();
+
+			next_tick += tick_duration;
+			auto now = clock::now();
+			if (now - next_tick > max_behind) {
+				next_tick = now;
+			}
+			std::this_thread::sleep_until(next_tick);
+		}
+	}
+
+	Entity zCore::add_sim_object(render::RenderObject object, TransformHandle transform) {
+		// registered before the render thread starts, from then on it only hears about movement
+		auto handle = render::add_renderable(renderer, object);
+		auto entity = create_entity(sim_world, object.obj, SimRenderable{ handle });
+		if (transform_entities.size() <= transform) {
+			transform_entities.resize(transform + 1, NO_ENTITY);
+		}
+		transform_entities[transform] = entity;
+		return entity;
+	}
+
+	void zCore::animate_scene(float dt) {
+		if (spin_root == NO_TRANSFORM) return;
+		auto spin = local_transform(sim_transforms, spin_root);
+		spin.rotation = glm::normalize(glm::angleAxis(0.5f * dt, glm::vec3(0.f, 1.f, 0.f)) * spin.rotation);
+		set_local(sim_transforms, spin_root, spin);
+	}
+
+	void zCore::apply_transforms() {
+		// only what moved, the rest of the objects keep last tick's matrix
+		for (auto handle : sim_transforms.changed) {
+			if (handle >= transform_entities.size()) continue;
+			if (auto* obj = get<ObjectData>(sim_world, transform_entities[handle])) {
+				obj->model_matrix = world_matrix(sim_transforms, handle);
+			}
+		}
+	}
+
+	// render thread, renders one tick behind the simulation
+	void zCore::interpolate_render_state() {
+		sim_exchange.consume();
+		auto& previous = sim_exchange.read_previous();
+		auto& current = sim_exchange.read_current();
+		std::chrono::duration<float> since_tick = std::chrono::steady_clock::now() - current.published;
+		interpolate_snapshots(previous, current, snapshot_alpha(previous, current, since_tick.count(), TICK_DT), render_camera, render_moving, render_updates);
 	}
 
 	// APP
 	void zCore::app_loop() {
-
-		auto old_tick = std::chrono::steady_clock::now();
-		auto tick_acc = 0.f;
-		auto dt = TICK_DT;
-		
 		boost::circular_buffer<float> frame_times(250);
-		
+		start_simulation();
+		start_render_thread();
 
 		while (!glfwWindowShouldClose(_window.handle)) {
 			glfwPollEvents();
 			if (die) {
 				DBG("time to die");
+				stop_render_thread();
+				stop_simulation();
 				return;
 			}
-			auto now_tick = std::chrono::steady_clock::now();
-			std::chrono::duration<float> tick_fdiff = now_tick - old_tick;
-			tick_acc += tick_fdiff.count();
-
-			while (tick_acc > dt) {
-				// tick loop
-				tick_acc -= dt;
-				process_key_inputs();
-				process_mouse_inputs();
-				_camera.tick();
+			sample_key_inputs();
+
+			int w, h;
+			glfwGetFramebufferSize(_window.handle, &w, &h);
+			if (w == 0 || h == 0) {
+				// minimized, nothing to present to. sleep until something happens to the window
+				glfwWaitEvents();
+				continue;
 			}
 
 			// -- drawing and animation
 
-			if (vkGetFenceStatus(_up.device, current_frame().renderF) == VK_SUCCESS) 	{ // actual rendering
+			// pipelined, a free packet is the go. otherwise the slot that is about to be recorded has to be done
+			FramePacket* packet = nullptr;
+			if (pipelined_rendering || reached(_up.timeline, current_frame().timeline_value)) {
+				packet = frame_queue.write_slot();
+			}
+			if (packet != nullptr) 	{ // actual rendering
+				render_stats.consume();
+				auto& stats = render_stats.read_current();
+
 				auto start_frame = std::chrono::steady_clock::now();
 				auto anim_dt = start_frame - _df.old_frame_start;
 				auto anim_dt_float = std::chrono::duration<float>(anim_dt).count();
@@ -1402,15 +1902,61 @@ namespace zebra {
 				auto avg_ft = std::accumulate(frame_times.begin(), frame_times.end(), 0.f)/frame_times.size();
 				
 				ImGui::Text("_gt %f", (float)_df.global_current_time);
-				ImGui::Text("_frameidx %u", current_frame_idx());
+				ImGui::Text("_frameidx %u", (u32)(stats.frame % FRAME_OVERLAP));
+				ImGui::Text("_simtick %llu", (unsigned long long)sim_exchange.read_current().tick);
 				ImGui::Text("avg frametime %f", avg_ft);
 				ImGui::Separator();
 				
-				ImGui::Text("Number of objects: %u", renderer.t_statics.size() + renderer.t_objects.size());
-				ImGui::Text("Renderpasses in cache: %u", _vk.renderpass_cache.cache.size());
-				ImGui::Text("Buffers in use: %u", renderer.danger_buffers.size());
-				ImGui::Text("Available scratch buffers: %u", renderer.available_buffers.size());
+				ImGui::Text("Number of objects: %u", (u32)stats.objects);
+				ImGui::Text("Visible objects: %u", (u32)stats.visible);
+				ImGui::Text("Instances uploaded: %u in %u ranges", stats.uploaded, stats.upload_ranges);
+				ImGui::Checkbox("Depth prepass", &settings.depth_prepass);
+				ImGui::SliderFloat("LOD error px", &settings.lod_error_pixels, 0.f, 8.f);
+				if (_vk.late_pass != render::RG_NONE) {
+					ImGui::Checkbox("Occlusion culling", &settings.occlusion_culling);
+					if (settings.occlusion_culling) {
+						u32 drawn = stats.drawn_early + stats.drawn_late;
+						ImGui::Text("Drawn %u early, %u late, %u occluded", stats.drawn_early, stats.drawn_late, (u32)stats.visible > drawn ? (u32)stats.visible - drawn : 0u);
+					}
+				}
+				ImGui::Checkbox("Software occlusion", &settings.software_occlusion);
+				if (settings.software_occlusion) {
+					ImGui::Text("Occluded on the cpu %u, %u occluder triangles", stats.software_occluded, stats.occluder_triangles);
+				}
+				ImGui::Checkbox("Cluster culling", &settings.cluster_culling);
+				if (settings.cluster_culling) {
+					ImGui::Text("Clusters drawn %u of %u", stats.clusters_drawn, stats.clusters);
+				}
+				if (stats.picked != render::NO_RENDERABLE) {
+					ImGui::Text("Picked: %u", stats.picked.index);
+				} else {
+					ImGui::Text("Picked: nothing");
+				}
+				ImGui::Text("Statics refit: %u%s", stats.statics_refit, stats.statics_rebuilt ? ", rebuilt" : "");
+				if (dynamic_resolution) {
+					ImGui::Text("GPU %.2f ms, scene at %ux%u (%.0f%%)", stats.gpu_ms, stats.scene_extent.width, stats.scene_extent.height, stats.resolution_scale * 100.f);
+					ImGui::Checkbox("Dynamic resolution", &settings.dynamic_resolution);
+					ImGui::SliderFloat("Target ms", &settings.target_ms, 4.f, 33.f);
+					ImGui::SliderFloat("Sharpen", &settings.composite_sharpness, 0.f, 1.f);
+				}
+				ImGui::Text("Renderpasses in cache: %u", (u32)stats.renderpasses);
+				ImGui::Text("Framebuffers in cache: %u", (u32)stats.framebuffers);
+				ImGui::Text("Pipelines: %u for %u variants, %u compiling", (u32)stats.pipelines, (u32)stats.pipeline_requests, stats.pipelines_compiling);
+				ImGui::Text("Deferred deletions: %u", (u32)stats.deferred);
+				ImGui::Text("GPU timeline: %llu / %llu", (unsigned long long)stats.timeline_completed, (unsigned long long)stats.timeline_submitted);
+				ImGui::Text("Graph passes: %u (%u culled)%s", stats.graph.passes, stats.graph.culled_passes, _vk.graph.dynamic_rendering ? ", dynamic rendering" : "");
+				ImGui::Text("Transient memory: %llu / %llu kb, %llu kb lazy", (unsigned long long)stats.graph.allocated_bytes / 1024, (unsigned long long)stats.graph.requested_bytes / 1024, (unsigned long long)stats.graph.lazy_bytes / 1024);
+				ImGui::Text("Buffers in use: %u", (u32)stats.buffers_in_use);
+				ImGui::Text("Available scratch buffers: %u", (u32)stats.available_buffers);
 				
+				ImGui::Separator();
+				auto worker_utilization = jobs.utilization();
+				for (auto i = 0u; i < worker_utilization.size(); i++) {
+					auto& util = worker_utilization[i];
+					ImGui::Text("worker %u: %3.0f%% busy, %llu jobs, %llu steals", i, util.busy * 100.f, (unsigned long long)util.jobs, (unsigned long long)util.steals);
+				}
+				ImGui::Separator();
+
 				ImGui::SliderFloat("Horizontal speed", &speed, 1.f, 50.f);
 				ImGui::SliderFloat("Vertical speed", &fly_speed, 1.f, 50.f);
 
@@ -1418,16 +1964,22 @@ namespace zebra {
 				ImGui::Render();
 				
 				// -- vulkan
-				draw();
+				interpolate_render_state();
+				build_frame_packet(*packet);
+				frame_queue.publish();
+				if (!pipelined_rendering) {
+					draw(frame_queue.wait_read_slot());
+					frame_queue.release();
+				}
 
 
 				_df.old_frame_start = start_frame;
 			}
 
-
-			old_tick = now_tick;
 			std::this_thread::yield();
 		}
+		stop_render_thread();
+		stop_simulation();
 		this->cleanup();
 	}
 
@@ -1442,13 +1994,33 @@ namespace zebra {
 	}
 
 	void zCore::load_images() {
-		Texture lost_empire;
-		load_image_from_file(_up, "../assets/lost_empire-RGBA.png", lost_empire.image, lost_empire.allocation);
-		VkImageViewCreateInfo image_info = vki::imageview_create_info(VK_FORMAT_R8G8B8A8_SRGB, lost_empire.image,  VK_IMAGE_ASPECT_COLOR_BIT);
-		vkCreateImageView(_up.device, &image_info, nullptr, &lost_empire.view);
-		lost_empire.format = image_info.format;
-
-		auto empire_handle = render::insert_texture(assets, lost_empire);
-		render::name_handle(assets, "empire_diffuse", empire_handle);
+		struct ImageFile {
+			const char* name;
+			const char* path;
+			LocalImage image;
+		};
+
+		std::array image_files = {
+			ImageFile{ "empire_diffuse", "../assets/lost_empire-RGBA.png" },
+		};
+
+		// decode in parallel, upload one after another
+		jobs.parallel_for(0, image_files.size(), 1, [&image_files](u64 lo, u64 hi) {
+			for (auto i = lo; i < hi; i++) {
+				load_image_pixels(image_files[i].path, image_files[i].image);
+			}
+			});
+
+		for (auto& file : image_files) {
+			Texture texture;
+			if (!upload_image(_up, file.image, texture.image, texture.allocation)) continue;
+			VkImageViewCreateInfo image_info = vki::imageview_create_info(VK_FORMAT_R8G8B8A8_SRGB, texture.image, VK_IMAGE_ASPECT_COLOR_BIT);
+			vkCreateImageView(_up.device, &image_info, nullptr, &texture.view);
+			texture.format = image_info.format;
+
+			auto handle = render::insert_texture(assets, texture);
+			render::name_handle(assets, file.name, handle);
+			DBG("Texture loaded sucessfully: " << file.path);
+		}
 	}
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <thread>
 #include <chrono>
 #include <span>
+#include <atomic>
 
 #include "zebratypes.h"
 #include "g_types.h"
@@ -19,7 +20,17 @@
 #include "g_descriptorset.h"
 #include "g_mesh.h"
 #include "renderer.h"
+#include "g_rendergraph.h"
+#include "g_dynres.h"
 #include "z_debug.h"
+#include "z_sim.h"
+#include "z_transform.h"
+#include "z_ecs.h"
+#include "z_jobs.h"
+#include "z_queue.h"
+#include "g_frame.h"
+#include "g_pipeline_service.h"
+#include "g_reflect.h"
 
 
 namespace zebra { 
@@ -30,26 +41,38 @@ namespace zebra {
 		VkQueue graphics_queue;
 		
 		render::RenderPassCache renderpass_cache;
+		render::FramebufferCache framebuffer_cache;
+		PipelineCache pipeline_cache;
+		PipelineLayoutCache pipeline_layouts;
+		DynamicStateSupport dynamic_state;
 
 		
 		VmaAllocator allocator;
+		// every mesh lives in here
+		GeometryPool geometry;
 
-		VkFramebuffer forward_framebuffer;
-		VkFramebuffer overlay_framebuffer;
-		std::vector<VkFramebuffer> framebuffers;
 		std::vector<VkImageView> image_views;
 		std::vector<VkImage> images;
 
-		Texture overlay_texture;
-		Texture overlay_depth_texture;
-
-		Texture screen_texture;
-		Texture depth_texture;
+		// rebuilt with the swapchain, owns every attachment
+		render::RenderGraph graph;
+		render::RGResource backbuffer;
+		render::RGPass forward_pass;
+		// draws what occlusion culling found visible late, RG_NONE without it
+		render::RGPass late_pass = render::RG_NONE;
+		// VK_KHR_draw_indirect_count, null without it
+		PFN_vkCmdDrawIndexedIndirectCountKHR draw_indexed_indirect_count = nullptr;
+		render::RGPass blit_pass;
+		render::RGPass ui_pass;
 		VkSampler default_sampler;
+		// upscaling the scene
+		VkSampler linear_sampler;
 
 		DescriptorLayoutCache layout_cache;
 		VkDescriptorPool descriptor_pool;
 		VkPhysicalDeviceProperties gpu_properties;
+		// timestampValidBits of the graphics queue family, the rest of a query result is garbage
+		u64 timestamp_mask = ~0ull;
 
 		vkb::Instance vkb_instance;
 		vkb::Device vkb_device;
@@ -72,6 +95,12 @@ namespace zebra {
 	struct DrawFrameInfo {
 		std::chrono::steady_clock::time_point old_frame_start;
 		double global_current_time;
+		// read by the render graph passes while recording
+		GPUSceneData scene_data;
+		glm::mat4 viewproj;
+		glm::vec3 eye;
+		// this frame is drawn in an early and a late pass
+		bool occlusion = false;
 	};
 
 	struct IndirectBatch {
@@ -86,7 +115,7 @@ namespace zebra {
 		std::deque<std::function<void()>> deletors;
 
 		void push_function(std::function<void()>&& function) {
-			deletors.push_back(function);
+			deletors.push_back(std::move(function));
 		}
 
 		void flush() {
@@ -104,6 +133,9 @@ namespace zebra {
 		INPUT_ACTION_COUNT,
 	};
 
+	// held actions are handed to the sim thread as a bitmask
+	static_assert(INPUT_ACTION_COUNT <= 32);
+
 	struct Key {
 		i32 keycode;
 		bool operator<(const Key& k) const {
@@ -149,27 +181,6 @@ namespace zebra {
 	constexpr float TICK_DT = 1.f / 100.f;
 
 	
-	template< u32 BufferSize = DefaultFatSize >
-	VkPipelineLayout create_pipeline_layout(VkDevice device, DescriptorLayoutCache& cache, std::span<FatSetLayout<BufferSize>, std::dynamic_extent> sets, std::span<VkPushConstantRange, std::dynamic_extent> ranges) {
-		auto pipeline_layout_create_info = vki::pipeline_layout_create_info();
-		VkDescriptorSetLayout layouts[BufferSize];
-
-		for (auto i = 0u; i < sets.size(); i++) {
-			layouts[i] = cache.create(device, sets[i]);
-		}
-
-		pipeline_layout_create_info.pushConstantRangeCount = ranges.size();
-		pipeline_layout_create_info.pPushConstantRanges = ranges.data();
-
-		pipeline_layout_create_info.setLayoutCount = sets.size();
-		pipeline_layout_create_info.pSetLayouts = layouts;
-
-		VkPipelineLayout layout;
-		VK_CHECK(vkCreatePipelineLayout(device, &pipeline_layout_create_info, nullptr, &layout));
-
-		return layout;
-	};
-
 	void bind_mesh(VkCommandBuffer cmd, Mesh* mesh);
 
 
@@ -188,7 +199,8 @@ namespace zebra {
 
 		// epilogue, triggered by key event
 		// pressed, release events are processed immediately
-		// holds are deferred to the next tick
+		// holds are sampled on the main thread and deferred to the next tick
+		void sample_key_inputs();
 		void process_key_inputs();
 		void process_mouse_inputs();
 		void set_cursor_absolute(bool absolute);
@@ -197,10 +209,10 @@ namespace zebra {
 		bool init_vulkan();
 		bool init_gfx();
 		bool init_default_renderpass();
-		bool init_swapchain_per_frame_data();
+		bool init_frame_sync();
 		bool init_per_frame_data();
 		bool init_swapchain();
-		bool init_framebuffers();
+		bool init_render_graph();
 		bool init_pipelines();
 		void init_descriptor_set_layouts();
 		void init_descriptor_sets();
@@ -210,19 +222,40 @@ namespace zebra {
 		void init_renderer();
 		void load_images();
 		bool recreate_swapchain();
+		void retire_swapchain(VkSwapchainKHR swapchain, const std::vector<VkImageView>& views);
 		bool create_window();
 		
 		void app_loop();
+		void start_simulation();
+		void stop_simulation();
+		/// @brief the object is placed by transform from now on, sim thread (or before it runs)
+		Entity add_sim_object(render::RenderObject object, TransformHandle transform);
+		void animate_scene(float dt);
+		/// @brief copies the world matrices that changed in the last transform update into the sim objects
+		void apply_transforms();
+		void sim_loop();
+		void interpolate_render_state();
 		void setup_draw();
-		void draw();
+		void build_frame_packet(FramePacket& packet);
+		void draw(const FramePacket& packet);
+		void publish_render_stats();
+		void start_render_thread();
+		void stop_render_thread();
+		void render_loop();
 		void load_meshes();
 
 
 
 	public:
+		// -- scheduling
+		JobSystem jobs;
+		// builds pipelines on a thread of its own, materials use the fallback until theirs arrive
+		PipelineService pipelines;
+
 		// -- cleanup
 		DeletionQueue main_delq;
-		DeletionQueue swapchain_delq;
+		// gpu objects that submissions in flight may still use, collected as the timeline passes them
+		FrameDeletionQueue deferred;
 		bool die = false;
 
 		// -- rendering
@@ -232,13 +265,38 @@ namespace zebra {
 		Window _window;
 		render::Assets assets;
 		render::Renderer renderer;
+		// render thread, the static under the middle of the screen as of the last frame
+		render::RenderableHandle picked = render::NO_RENDERABLE;
+		// composite as a subpass of the forward pass instead of sampling scene_color in a second render pass.
+		// turned off when the device uses dynamic rendering
+		bool fused_composite = true;
+		// scene rendered into part of its targets and upscaled in the composite, needs the sampled composite.
+		// off on tilers, they keep the fused one
+		bool dynamic_resolution = true;
+		// hi-z occlusion culling, splits the forward pass around the pyramid build. forces the sampled composite
+		// (blit.frag in a render pass of its own), and scene_depth has to leave the tile. off on tilers, set in init_vulkan
+		bool occlusion_culling = true;
+		render::ResolutionController resolution;
+		// edited by the debug ui on the main thread, travels to the recording thread in the frame packet.
+		// depth_prepass: depth first, then shade with depth EQUAL so fragment cost follows visible pixels instead of overdraw
+		RenderSettings settings;
+
+		// record, submit and present on render_thread while the main thread builds the next frame. fixed once app_loop runs
+		bool pipelined_rendering = true;
+		std::thread render_thread;
+		// one packet being recorded, one being filled or waiting
+		SpscQueue<FramePacket, 2> frame_queue;
+		// the packet draw is recording, for the render graph passes
+		const FramePacket* drawing = nullptr;
+		SnapshotExchange<RenderStats> render_stats;
 
 		std::array<PerFrameData, FRAME_OVERLAP> frames;
 		size_t frame_counter = 0;
 
 
 		// -- rendering
-		bool load_shader_module(const char* file_path, VkShaderModule* out_shader);
+		/// @param layout if set, the descriptor sets and push constants the shader declares are merged into it
+		bool load_shader_module(const char* file_path, VkShaderModule* out_shader, ReflectedLayout* layout = nullptr);
 		Mesh upload_mesh(LocalMesh& mesh);
 
 		size_t pad_uniform_buffer_size(size_t original_size);
@@ -247,7 +305,29 @@ namespace zebra {
 		PerFrameData& current_frame();
 		u32 current_frame_idx();
 
+		// -- simulation
+		// _camera and sim_world belong to the sim thread once it is running,
+		// the render thread only ever sees them through sim_exchange
 		FirstPersonPerspectiveCamera _camera;
+		// entities with ObjectData and a SimRenderable
+		World sim_world;
+		// where the sim entities are, parent relative
+		TransformHierarchy sim_transforms;
+		// by transform handle, the entity placed by it or NO_ENTITY
+		std::vector<Entity> transform_entities;
+		TransformHandle spin_root = NO_TRANSFORM;
+		std::thread sim_thread;
+		std::atomic<bool> sim_running = false;
+		u64 sim_tick = 0;
+		SimInput sim_input;
+		SnapshotExchange<SimSnapshot> sim_exchange;
+
+		// interpolated between the last two snapshots each frame
+		FirstPersonPerspectiveCamera render_camera;
+		std::vector<render::RenderableUpdate> render_updates;
+		// by sim object, whether it moved in the last interpolation
+		std::vector<u8> render_moving;
+
 		float speed = 12.f;
 		float fly_speed = 12.f;
 
@@ -255,9 +335,9 @@ namespace zebra {
 		std::map<InputAction, std::function<void()>> action_map;
 		std::vector<KeyInput> key_inputs;
 		bool cursor_use_absolute_position = false;
+		// main thread, the sim thread reads them through sim_input
 		bool invert_camera = false;
 		glm::vec2 mouse_delta_sens = glm::vec2(0.01f, 0.01f);
-		glm::vec2 mouse_delta = glm::vec2(0.f);
 
 		zCore();
 		virtual ~zCore();
@@ -0,0 +1,10 @@
+#pragma once
+#include <cstdio>
+
+// ends the test on the first failed check
+#define CHECK(x) do {\
+if (!(x)) {\
+	std::fprintf(stderr, "%s:%d: failed %s\n", __FILE__, __LINE__, #x);\
+	return 1;\
+}\
+} while (0)
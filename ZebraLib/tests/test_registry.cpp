@@ -0,0 +1,81 @@
+#include "test.h"
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+#include "renderer.h"
+
+using namespace zebra;
+
+static ObjectData at(float x, float y) {
+	return ObjectData{ glm::translate(glm::mat4(1.f), glm::vec3(x, y, 0.f)), glm::vec4(1.f) };
+}
+
+// what sync_renderables leaves behind on the cpu, without the copies
+static void drain(render::RenderableRegistry& registry) {
+	for (auto handle : registry.dirty_handles) registry.dirty[handle] = 0;
+	registry.dirty_handles.clear();
+}
+
+/* a frame whose acquire failed still applied its updates. the next frame that gets drawn
+* has to upload both, with the newer data where they overlap */
+int main() {
+	JobSystem jobs;
+	jobs.init(2);
+	render::Renderer renderer;
+	render::Assets assets;
+	assets.t_meshes[1] = Mesh{ .bounds = glm::vec4(0.f, 0.f, 0.f, 0.5f) };
+
+	constexpr u32 COUNT = 8;
+	std::vector<render::RenderableHandle> handles;
+	for (auto i = 0u; i < COUNT; i++) {
+		handles.push_back(render::add_renderable(renderer, render::RenderObject{ .obj = at((float)i, 0.f), .material_fk = 1, .mesh_fk = 1, .is_static = i % 2 == 0 }));
+	}
+
+	auto viewproj = glm::perspective(glm::radians(70.f), 16.f / 9.f, 0.1f, 200.f) * glm::lookAt(glm::vec3(4.f, 4.f, 30.f), glm::vec3(4.f, 4.f, 0.f), glm::vec3(0.f, 1.f, 0.f));
+	render::LodSelection lod{ .eye = glm::vec3(4.f, 4.f, 30.f), .pixel_scale = 1000.f };
+	render::finish_collect(renderer, assets, jobs, viewproj, lod, false);
+	drain(renderer.registry);
+
+	// dropped, never collected or synced
+	std::vector<render::RenderableUpdate> dropped;
+	for (auto i = 0u; i < 4; i++) dropped.push_back({ handles[i], at((float)i, 5.f) });
+	render::apply_updates(renderer, dropped);
+
+	std::vector<render::RenderableUpdate> drawn;
+	for (auto i = 2u; i < 6; i++) drawn.push_back({ handles[i], at((float)i, 9.f) });
+	render::apply_updates(renderer, drawn);
+	render::finish_collect(renderer, assets, jobs, viewproj, lod, false);
+
+	auto& registry = renderer.registry;
+	auto dirty = registry.dirty_handles;
+	std::sort(dirty.begin(), dirty.end());
+	CHECK(dirty.size() == 6);
+	for (auto i = 0u; i < 6; i++) CHECK(dirty[i] == handles[i].index);
+
+	for (auto i = 0u; i < COUNT; i++) {
+		float y = i < 2 ? 5.f : i < 6 ? 9.f : 0.f;
+		auto entity = handles[i];
+		CHECK(get<ObjectData>(registry.world, entity)->model_matrix[3] == glm::vec4((float)i, y, 0.f, 1.f));
+		CHECK(glm::vec3(get<render::CullSphere>(registry.world, entity)->sphere) == glm::vec3((float)i, y, 0.f));
+	}
+
+	// every one of them in view where it is now
+	CHECK(renderer.visible_objects.size() == COUNT);
+
+	drain(registry);
+	render::finish_collect(renderer, assets, jobs, viewproj, lod, false);
+	CHECK(registry.dirty_handles.empty());
+
+	// a removed handle does nothing, even once its slot belongs to another renderable
+	auto gone = handles[3];
+	render::remove_renderable(renderer, gone);
+	auto reused = render::add_renderable(renderer, render::RenderObject{ .obj = at(3.f, 1.f), .material_fk = 1, .mesh_fk = 1 });
+	CHECK(reused.index == gone.index);
+	CHECK(reused != gone);
+	render::update_renderable(renderer, gone, at(3.f, 7.f));
+	render::remove_renderable(renderer, gone);
+	CHECK(alive(registry.world, reused));
+	CHECK(get<ObjectData>(registry.world, reused)->model_matrix[3] == glm::vec4(3.f, 1.f, 0.f, 1.f));
+
+	jobs.shutdown();
+	return 0;
+}
@@ -0,0 +1,40 @@
+#include "test.h"
+#include "g_simplify.h"
+
+using namespace zebra;
+
+/* a flat square cut into one cell wide strips, each with vertices of its own like a uv island. every vertex
+* off the outline sits on a seam, with seams locked nothing would go */
+int main() {
+	constexpr u32 CELLS = 16;
+	std::vector<glm::vec3> positions;
+	std::vector<u32> island;
+	std::vector<u32> indices;
+	for (auto x = 0u; x < CELLS; x++) {
+		const u32 first = (u32)positions.size();
+		for (auto y = 0u; y <= CELLS; y++) {
+			for (auto side = 0u; side < 2; side++) {
+				positions.push_back(glm::vec3((float)(x + side), (float)y, 0.f));
+				island.push_back(x);
+			}
+		}
+		for (auto y = 0u; y < CELLS; y++) {
+			u32 a = first + y * 2;
+			u32 c = a + 2;
+			indices.insert(indices.end(), { a, a + 1, c, c, a + 1, c + 1 });
+		}
+	}
+
+	float error;
+	auto simplified = simplify_mesh(indices, positions, indices.size() / 4, 0.01f, error);
+	CHECK(simplified.size() < indices.size() / 2);
+	CHECK(error <= 0.01f);
+
+	// every triangle stays inside its strip and keeps facing +z
+	for (u64 t = 0; t < simplified.size(); t += 3) {
+		auto i0 = simplified[t], i1 = simplified[t + 1], i2 = simplified[t + 2];
+		CHECK(island[i0] == island[i1] && island[i1] == island[i2]);
+		CHECK(glm::cross(positions[i1] - positions[i0], positions[i2] - positions[i0]).z > 0.f);
+	}
+	return 0;
+}